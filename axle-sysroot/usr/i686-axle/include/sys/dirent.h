@@ -13,3 +13,10 @@ struct dirent {
 	// 2.6.4); offset is (d_reclen - 1)
 	*/
 };
+
+/* Values of the d_type byte ending each getdents() record */
+#define DT_UNKNOWN	0
+#define DT_DIR		4
+#define DT_REG		8
+
+int getdents(unsigned int fd, struct dirent *dirp, unsigned int count);
@@ -11,6 +11,26 @@
 #define HEADERS_MAX 64
 #define HEADER_MAGIC 0xBF
 
+//indexed hierarchical format
+//layout: rd2_header | rd2_node[node_count] | string table | page-aligned file data
+//nodes are stored breadth-first, so every directory's children are contiguous,
+//and each run of children is sorted by name so the kernel can binary search it
+//these definitions must match kernel/util/vfs/initrd.h
+#define INITRD_V2_MAGIC		0x32445249 //"IRD2"
+#define INITRD_V2_VERSION	1
+#define INITRD_PAGE_SIZE	0x1000
+#define INITRD_NAME_MAX		127
+
+#define INITRD_NODE_FILE	0x1
+#define INITRD_NODE_DIR		0x2
+//file data is a table of (pages + 1) uint32 offsets followed by one LZ4 block per page
+//offsets are relative to the start of the table, and a block as long as its page is stored raw
+#define INITRD_NODE_LZ4		0x4
+
+#define LZ4_HASH_LOG		12
+#define LZ4_MIN_MATCH		4
+#define LZ4_MAX_OFFSET		65535
+
 typedef struct initrd_header {
 	unsigned char magic;	//magic number
 	char name[64];
@@ -18,6 +38,44 @@ typedef struct initrd_header {
 	unsigned int length;	//length of file
 } rd_header;
 
+typedef struct __attribute__((packed)) initrd_v2_header {
+	unsigned int magic;
+	unsigned short version;
+	unsigned short flags;
+	unsigned int node_count;
+	unsigned int node_table_offset;
+	unsigned int string_table_offset;
+	unsigned int string_table_size;
+	unsigned int data_offset;	//page aligned
+	unsigned int reserved;
+} rd2_header;
+
+typedef struct __attribute__((packed)) initrd_v2_node {
+	unsigned int parent;		//node index of containing directory, root is its own parent
+	unsigned int name_offset;	//offset of NUL-terminated name in string table
+	unsigned short name_len;
+	unsigned short flags;
+	unsigned int first_child;	//directories only
+	unsigned int child_count;	//directories only
+	unsigned long long offset;	//files only, page aligned offset from start of image
+	unsigned long long length;	//files only
+} rd2_node;
+
+//in-memory tree built from the host directory before it's flattened
+typedef struct tree_node {
+	char* name;
+	char* path;
+	int is_dir;
+	unsigned long long length;
+	struct tree_node* parent;
+	struct tree_node** children;
+	unsigned int child_count;
+	unsigned int index;
+	unsigned long long offset;
+	unsigned char* compressed;	//set if file is stored LZ4-compressed
+	unsigned long long stored_length;
+} tree_node;
+
 FILE* openfile(const char* dirname, struct dirent* dir, const char* mode) {
 	char pathname[1024]; //should be big enough
 	FILE *fp;
@@ -90,7 +148,9 @@ void write_dir(const char* dirname) {
 	//write actual file data to initrd
 	printf("writing %d headers to initrd\n", nheaders);
 	for (int i = 0; i < nheaders; i++) {
-		FILE* stream = fopen(headers[i].name, "r");
+		char pathname[1024];
+		snprintf(pathname, sizeof(pathname), "%s/%s", dirname, headers[i].name);
+		FILE* stream = fopen(pathname, "r");
 		if (!stream) {
 			printf("Couldn't find file %s!\n", headers[i].name);
 			continue;
@@ -107,9 +167,358 @@ void write_dir(const char* dirname) {
 	fclose(wstream);
 }
 
+static unsigned int lz4_read32(const unsigned char* p) {
+	unsigned int v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static unsigned char* lz4_write_length(unsigned char* op, int len) {
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+//greedy single-probe LZ4 block compressor
+//returns compressed size, or -1 if the output wouldn't fit in dst_cap
+static int lz4_compress_block(const unsigned char* src, int len, unsigned char* dst, int dst_cap) {
+	int table[1 << LZ4_HASH_LOG];
+	for (int i = 0; i < (1 << LZ4_HASH_LOG); i++) {
+		table[i] = -1;
+	}
+
+	unsigned char* op = dst;
+	unsigned char* oend = dst + dst_cap;
+	int anchor = 0;
+	int ip = 0;
+	//format requires the last match to start 12 bytes before the end, and the last 5 bytes to be literals
+	int mflimit = len - 12;
+	int matchlimit = len - 5;
+
+	while (ip < mflimit) {
+		unsigned int seq = lz4_read32(src + ip);
+		unsigned int h = (seq * 2654435761u) >> (32 - LZ4_HASH_LOG);
+		int ref = table[h];
+		table[h] = ip;
+		if (ref < 0 || ip - ref > LZ4_MAX_OFFSET || lz4_read32(src + ref) != seq) {
+			ip++;
+			continue;
+		}
+
+		//extend match backwards into pending literals
+		while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+			ip--;
+			ref--;
+		}
+		int match_len = LZ4_MIN_MATCH;
+		while (ip + match_len < matchlimit && src[ip + match_len] == src[ref + match_len]) {
+			match_len++;
+		}
+
+		int lit_len = ip - anchor;
+		if (op + 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1 > oend) {
+			return -1;
+		}
+		unsigned char* token = op++;
+		if (lit_len >= 15) {
+			*token = 15 << 4;
+			op = lz4_write_length(op, lit_len - 15);
+		}
+		else *token = lit_len << 4;
+		memcpy(op, src + anchor, lit_len);
+		op += lit_len;
+
+		int offset = ip - ref;
+		*op++ = offset & 0xFF;
+		*op++ = offset >> 8;
+
+		int ml = match_len - LZ4_MIN_MATCH;
+		if (ml >= 15) {
+			*token |= 15;
+			op = lz4_write_length(op, ml - 15);
+		}
+		else *token |= ml;
+
+		ip += match_len;
+		anchor = ip;
+	}
+
+	//trailing literals
+	int lit_len = len - anchor;
+	if (op + 1 + lit_len / 255 + 1 + lit_len > oend) {
+		return -1;
+	}
+	unsigned char* token = op++;
+	if (lit_len >= 15) {
+		*token = 15 << 4;
+		op = lz4_write_length(op, lit_len - 15);
+	}
+	else *token = lit_len << 4;
+	memcpy(op, src + anchor, lit_len);
+	op += lit_len;
+
+	return op - dst;
+}
+
+//compress a host file page-by-page into a malloc'd buffer laid out as described by INITRD_NODE_LZ4
+static unsigned char* compress_file(const char* path, unsigned long long length, unsigned long long* out_len) {
+	unsigned int pages = (length + INITRD_PAGE_SIZE - 1) / INITRD_PAGE_SIZE;
+	unsigned int table_size = sizeof(unsigned int) * (pages + 1);
+	unsigned char* out = malloc(table_size + (unsigned long long)pages * INITRD_PAGE_SIZE);
+	unsigned int* table = (unsigned int*)out;
+
+	FILE* stream = fopen(path, "rb");
+	if (!stream) {
+		printf("Error: file not found: %s\n", path);
+		exit(1);
+	}
+
+	unsigned int off = table_size;
+	for (unsigned int i = 0; i < pages; i++) {
+		unsigned char page[INITRD_PAGE_SIZE];
+		int page_len = fread(page, 1, sizeof(page), stream);
+
+		table[i] = off;
+		//store pages LZ4 can't shrink verbatim
+		int comp_len = lz4_compress_block(page, page_len, out + off, page_len - 1);
+		if (comp_len < 0) {
+			memcpy(out + off, page, page_len);
+			comp_len = page_len;
+		}
+		off += comp_len;
+	}
+	table[pages] = off;
+	fclose(stream);
+
+	*out_len = off;
+	return out;
+}
+
+static unsigned long long page_align(unsigned long long off) {
+	return (off + INITRD_PAGE_SIZE - 1) & ~((unsigned long long)INITRD_PAGE_SIZE - 1);
+}
+
+static int compare_tree_nodes(const void* a, const void* b) {
+	const tree_node* lhs = *(const tree_node**)a;
+	const tree_node* rhs = *(const tree_node**)b;
+	return strcmp(lhs->name, rhs->name);
+}
+
+static tree_node* scan_tree(const char* path, const char* name, tree_node* parent) {
+	struct stat st;
+	if (stat(path, &st)) {
+		printf("Error: couldn't stat %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+	if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode)) {
+		printf("Found non-file %s, skipping\n", path);
+		return NULL;
+	}
+	if (strlen(name) > INITRD_NAME_MAX) {
+		printf("Error: name too long: %s\n", path);
+		exit(1);
+	}
+
+	tree_node* node = calloc(1, sizeof(tree_node));
+	node->name = strdup(name);
+	node->path = strdup(path);
+	node->parent = parent;
+
+	if (S_ISREG(st.st_mode)) {
+		node->length = st.st_size;
+		return node;
+	}
+
+	node->is_dir = 1;
+	DIR* dp = opendir(path);
+	if (!dp) {
+		perror("Couldn't open directory");
+		exit(1);
+	}
+	struct dirent* ep;
+	while ((ep = readdir(dp))) {
+		if (!strcmp(ep->d_name, ".") || !strcmp(ep->d_name, "..")) {
+			continue;
+		}
+		char child_path[1024];
+		snprintf(child_path, sizeof(child_path), "%s/%s", path, ep->d_name);
+		tree_node* child = scan_tree(child_path, ep->d_name, node);
+		if (!child) continue;
+
+		node->children = realloc(node->children, sizeof(tree_node*) * (node->child_count + 1));
+		node->children[node->child_count++] = child;
+	}
+	closedir(dp);
+
+	qsort(node->children, node->child_count, sizeof(tree_node*), compare_tree_nodes);
+	return node;
+}
+
+static unsigned int count_tree(tree_node* node) {
+	unsigned int count = 1;
+	for (unsigned int i = 0; i < node->child_count; i++) {
+		count += count_tree(node->children[i]);
+	}
+	return count;
+}
+
+static void write_padding(FILE* stream, unsigned long long target) {
+	static const char zeroes[INITRD_PAGE_SIZE];
+	unsigned long long pos = ftell(stream);
+	while (pos < target) {
+		unsigned long long chunk = target - pos;
+		if (chunk > sizeof(zeroes)) chunk = sizeof(zeroes);
+		fwrite(zeroes, 1, chunk, stream);
+		pos += chunk;
+	}
+}
+
+void write_dir_v2(const char* dirname, int compress) {
+	tree_node* root = scan_tree(dirname, "", NULL);
+	if (!root || !root->is_dir) {
+		printf("Error: %s is not a directory\n", dirname);
+		exit(1);
+	}
+
+	//flatten breadth-first so each directory's (sorted) children occupy a contiguous run of indices
+	unsigned int node_count = count_tree(root);
+	tree_node** order = malloc(sizeof(tree_node*) * node_count);
+	rd2_node* nodes = calloc(node_count, sizeof(rd2_node));
+	unsigned int head = 0;
+	unsigned int tail = 0;
+	order[tail++] = root;
+	while (head < tail) {
+		tree_node* node = order[head];
+		node->index = head++;
+		nodes[node->index].first_child = tail;
+		for (unsigned int i = 0; i < node->child_count; i++) {
+			order[tail++] = node->children[i];
+		}
+	}
+
+	//string table
+	unsigned int string_table_size = 0;
+	for (unsigned int i = 0; i < node_count; i++) {
+		string_table_size += strlen(order[i]->name) + 1;
+	}
+	char* strings = malloc(string_table_size);
+	unsigned int string_off = 0;
+
+	rd2_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = INITRD_V2_MAGIC;
+	header.version = INITRD_V2_VERSION;
+	header.node_count = node_count;
+	header.node_table_offset = sizeof(rd2_header);
+	header.string_table_offset = header.node_table_offset + sizeof(rd2_node) * node_count;
+	header.string_table_size = string_table_size;
+	header.data_offset = page_align(header.string_table_offset + string_table_size);
+
+	unsigned long long data_off = header.data_offset;
+	unsigned long long raw_bytes = 0;
+	for (unsigned int i = 0; i < node_count; i++) {
+		tree_node* node = order[i];
+		rd2_node* ent = &nodes[i];
+
+		ent->parent = node->parent ? node->parent->index : 0;
+		ent->name_offset = string_off;
+		ent->name_len = strlen(node->name);
+		memcpy(strings + string_off, node->name, ent->name_len + 1);
+		string_off += ent->name_len + 1;
+
+		if (node->is_dir) {
+			ent->flags = INITRD_NODE_DIR;
+			ent->child_count = node->child_count;
+			if (!node->child_count) ent->first_child = 0;
+		}
+		else {
+			ent->flags = INITRD_NODE_FILE;
+			ent->first_child = 0;
+			ent->offset = data_off;
+			ent->length = node->length;
+			node->offset = data_off;
+			node->stored_length = node->length;
+
+			if (compress && node->length) {
+				node->compressed = compress_file(node->path, node->length, &node->stored_length);
+				//not worth decompressing if we saved less than a page
+				if (page_align(node->stored_length) >= page_align(node->length)) {
+					free(node->compressed);
+					node->compressed = NULL;
+					node->stored_length = node->length;
+				}
+				else {
+					ent->flags |= INITRD_NODE_LZ4;
+				}
+			}
+			raw_bytes += node->length;
+			data_off = page_align(data_off + node->stored_length);
+			printf("writing file %s at 0x%llx (%llu bytes, %llu stored)\n", node->path, ent->offset, ent->length, node->stored_length);
+		}
+	}
+
+	FILE* wstream = fopen("./initrd.img", "wb");
+	if (!wstream) {
+		perror("Couldn't create initrd.img");
+		exit(1);
+	}
+	fwrite(&header, sizeof(header), 1, wstream);
+	fwrite(nodes, sizeof(rd2_node), node_count, wstream);
+	fwrite(strings, 1, string_table_size, wstream);
+
+	for (unsigned int i = 0; i < node_count; i++) {
+		tree_node* node = order[i];
+		if (node->is_dir) continue;
+
+		write_padding(wstream, node->offset);
+		if (node->compressed) {
+			fwrite(node->compressed, 1, node->stored_length, wstream);
+			free(node->compressed);
+			continue;
+		}
+		FILE* stream = fopen(node->path, "rb");
+		if (!stream) {
+			printf("Error: file not found: %s\n", node->path);
+			exit(1);
+		}
+		char buf[INITRD_PAGE_SIZE];
+		size_t read;
+		while ((read = fread(buf, 1, sizeof(buf), stream)) > 0) {
+			fwrite(buf, 1, read, wstream);
+		}
+		fclose(stream);
+	}
+	//pad final file out to a full page so the kernel can map the image page-wise
+	write_padding(wstream, data_off);
+	fclose(wstream);
+
+	printf("wrote %u nodes, %llu bytes to initrd (%llu bytes of file data, %llu stored)\n", node_count, data_off, raw_bytes, data_off - header.data_offset);
+	free(strings);
+	free(nodes);
+	free(order);
+}
+
 int main(int argc, char *argv[]) {
+	int legacy = 0;
+	int compress = 0;
 	for (int arg = 1; arg < argc; arg++) {
-		write_dir(argv[arg]);
+		if (!strcmp(argv[arg], "--legacy")) {
+			legacy = 1;
+			continue;
+		}
+		if (!strcmp(argv[arg], "-c") || !strcmp(argv[arg], "--compress")) {
+			compress = 1;
+			continue;
+		}
+		if (legacy) {
+			write_dir(argv[arg]);
+		}
+		else {
+			write_dir_v2(argv[arg], compress);
+		}
 	}
 	return EXIT_SUCCESS;
 }
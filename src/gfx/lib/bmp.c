@@ -31,9 +31,7 @@ Bmp* _load_jpg(Rect frame, FILE* file) {
 	printf("bg.jpg = %d bytes (%f kb)\n", size, size / 1024.0);
 
 	char* jpeg_buf = kmalloc(size);
-	for (int i = 0; i < size; i++) {
-		jpeg_buf[i] = fgetc(file);
-	}
+	fread(jpeg_buf, sizeof(char), size, file);
 
 	nj_result_t r = njDecode(jpeg_buf, size);
 	if (r != NJ_OK) {
@@ -76,8 +74,19 @@ Bmp* _load_jpg(Rect frame, FILE* file) {
 }
 
 Bmp* _load_bmp(Rect frame, FILE* file) {
-	unsigned char header[54];
-	fread(&header, sizeof(char), 54, file);
+	fseek(file, 0, SEEK_END);
+	int size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	//pull the whole image in at once, rather than a byte at a time while scaling
+	uint8_t* contents = kmalloc(size);
+	size = fread(contents, sizeof(char), size, file);
+	if (size < 54) {
+		printk_err("BMP too small for its header");
+		kfree(contents);
+		return NULL;
+	}
+	unsigned char* header = contents;
 
 	//get width and height from header
 	int file_width = *(int*)&header[18];
@@ -103,15 +112,17 @@ Bmp* _load_bmp(Rect frame, FILE* file) {
 
 			int idx = (translated_y * file_width * bpp) + (translated_x * bpp);
 			//if (idx + 2 > file_width * file_height * bpp) break;
-			fseek(file, idx, SEEK_END);
+			//pixels are found counting back from the end of the file
+			int pos = size - MIN(idx, size);
 
 			int draw_idx = (draw_y * width * bpp) + (draw_x * bpp);
 			//we process 3 bytes at a time because image is stored in BGR, we need RGB
-			layer->raw[draw_idx + 2] = fgetc(file);
-			layer->raw[draw_idx + 1] = fgetc(file);
-			layer->raw[draw_idx + 0] = fgetc(file);
+			layer->raw[draw_idx + 2] = pos + 0 < size ? contents[pos + 0] : EOF;
+			layer->raw[draw_idx + 1] = pos + 1 < size ? contents[pos + 1] : EOF;
+			layer->raw[draw_idx + 0] = pos + 2 < size ? contents[pos + 2] : EOF;
 		}
 	}
+	kfree(contents);
 
 	Bmp* bmp = create_bmp(frame, layer);
 	printk_dbg("load_bmp() made bmp %x", bmp);
@@ -8,12 +8,14 @@
 #include <std/string.h>
 #include <std/memory.h>
 #include <std/common.h>
+#include <std/math.h>
 
 //kernel headers
 #include <kernel/drivers/text_mode/text_mode.h>
 #include <kernel/multiboot.h>
 #include <kernel/boot.h>
 #include <kernel/assert.h>
+#include <kernel/util/elf/elf.h>
 
 #include "boot_info.h"
 
@@ -82,12 +84,54 @@ static void boot_info_dump_boot_device(boot_info_t* info) {
 }
 
 static void multiboot_interpret_modules(struct multiboot_info* mboot_data, boot_info_t* out_info) {
-    if (!(mboot_data->flags & MULTIBOOT_INFO_MODS)) {
+    if (!(mboot_data->flags & MULTIBOOT_INFO_MODS) || !mboot_data->mods_count) {
         printf("0 boot modules.\n");
         return;
     }
-    printf("There are boot modules!\n");
-    NotImplemented();
+    //the first module is the initrd
+    //any others aren't used yet
+    multiboot_module_t* modules = (multiboot_module_t*)mboot_data->mods_addr;
+    out_info->initrd_start = modules[0].mod_start;
+    out_info->initrd_end = modules[0].mod_end;
+    out_info->initrd_size = modules[0].mod_end - modules[0].mod_start;
+    if (mboot_data->mods_count > 1) {
+        printf("Ignoring %d extra boot modules\n", mboot_data->mods_count - 1);
+    }
+}
+
+static void boot_info_dump_modules(boot_info_t* info) {
+    if (!info->initrd_size) {
+        return;
+    }
+    printf("Initrd at     [0x%08x to 0x%08x]. Size: 0x%x\n", info->initrd_start, info->initrd_end, info->initrd_size);
+}
+
+//record where the symbol table and its strings ended up, so the PMM keeps them
+//paging is still off, so the section headers can be read at their physical address
+static void multiboot_locate_kernel_symbols(boot_info_t* out_info) {
+    multiboot_elf_section_header_table_t* table = &out_info->symbol_table_info;
+    if (table->size != sizeof(elf_s_header)) {
+        return;
+    }
+    elf_s_header* sections = (elf_s_header*)table->addr;
+    for (uint32_t i = 0; i < table->num; i++) {
+        if (sections[i].type != SHT_SYMTAB || sections[i].link >= table->num) {
+            continue;
+        }
+        elf_s_header* symtab = &sections[i];
+        elf_s_header* strtab = &sections[symtab->link];
+        if (!symtab->addr || !strtab->addr) {
+            return;
+        }
+        uint32_t start = MIN(symtab->addr, strtab->addr);
+        uint32_t end = MAX(symtab->addr + symtab->size, strtab->addr + strtab->size);
+        //the headers are needed to find the tables again later
+        start = MIN(start, table->addr);
+        end = MAX(end, table->addr + table->num * table->size);
+        out_info->kernel_symbols_start = start;
+        out_info->kernel_symbols_end = end;
+        return;
+    }
 }
 
 static void multiboot_interpret_symbol_table(struct multiboot_info* mboot_data, boot_info_t* out_info) {
@@ -97,11 +141,15 @@ static void multiboot_interpret_symbol_table(struct multiboot_info* mboot_data,
     }
     else if (mboot_data->flags & MULTIBOOT_INFO_ELF_SHDR) {
         out_info->symbol_table_info = mboot_data->u.elf_sec;
+        multiboot_locate_kernel_symbols(out_info);
     }
 }
 
 static void boot_info_dump_symbol_table(boot_info_t* info) {
     printf("Symbol table: %d entries starting at 0x%08x\n", info->symbol_table_info.num, info->symbol_table_info.addr);
+    if (info->kernel_symbols_end) {
+        printf("Kernel symbols at [0x%08x to 0x%08x]\n", info->kernel_symbols_start, info->kernel_symbols_end);
+    }
 }
 
 static void multiboot_interpret_bootloader(struct multiboot_info* mboot_data, boot_info_t* out_info) {
@@ -196,6 +244,7 @@ void boot_info_dump() {
     printf("Kernel image at [0x%08x to 0x%08x]. Size: 0x%x\n", info->kernel_image_start, info->kernel_image_end, info->kernel_image_size);
     printf("Kernel stack at [0x%08x to 0x%08x]. Size: 0x%x\n", info->boot_stack_bottom_phys, info->boot_stack_top_phys, info->boot_stack_size);
 
+    boot_info_dump_modules(info);
     boot_info_dump_memory_map(info);
     boot_info_dump_boot_device(info);
     boot_info_dump_symbol_table(info);
@@ -46,8 +46,17 @@ typedef struct boot_info {
     uint32_t mem_region_count;
     physical_memory_region_t mem_regions[32];
 
+    //physical range of the initrd multiboot module, or 0 if none was loaded
+    uint32_t initrd_start;
+    uint32_t initrd_end;
+    uint32_t initrd_size;
+
     multiboot_boot_device_t boot_device;
     multiboot_elf_section_header_table_t symbol_table_info;
+    //physical range holding the kernel's .symtab and the strings it names, loaded by GRUB past the image
+    //both are 0 if there's no symbol table
+    uint32_t kernel_symbols_start;
+    uint32_t kernel_symbols_end;
     framebuffer_info_t framebuffer;
 
     page_directory_t* vmm_kernel;
@@ -0,0 +1,82 @@
+#include "boot_timeline.h"
+#include <std/common.h>
+#include <std/printf.h>
+#include <kernel/drivers/pit/pit.h>
+
+//the extra slot holds the end of the last stage
+static boot_stage_t stages[BOOT_STAGES_MAX + 1];
+static uint32_t stage_count = 0;
+static bool finished = false;
+
+static void boot_stage_record(const char* name) {
+    stages[stage_count].name = name;
+    stages[stage_count].tsc = rdtsc();
+    stages[stage_count].ticks = tick_count();
+    stage_count++;
+}
+
+void boot_stage(const char* name) {
+    if (finished || stage_count >= BOOT_STAGES_MAX) {
+        return;
+    }
+    boot_stage_record(name);
+}
+
+//TSC cycles per ms, or 0 if too few PIT ticks were seen to tell
+//the span starts at the first stage after the PIT was running, so none of it is missed
+static uint32_t boot_timeline_tsc_rate(void) {
+    if (!finished) {
+        return 0;
+    }
+    boot_stage_t* end = &stages[stage_count - 1];
+    for (uint32_t i = 0; i < stage_count - 1; i++) {
+        if (!stages[i].ticks) continue;
+        uint32_t ms = end->ticks - stages[i].ticks;
+        if (ms < BOOT_CALIBRATE_MIN_MS) {
+            return 0;
+        }
+        return (uint32_t)((end->tsc - stages[i].tsc) / ms);
+    }
+    return 0;
+}
+
+static void boot_timeline_dump(int (*out)(const char*, ...)) {
+    if (!finished) {
+        out("Boot timeline isn't complete\n");
+        return;
+    }
+    uint32_t rate = boot_timeline_tsc_rate();
+    uint64_t total = stages[stage_count - 1].tsc - stages[0].tsc;
+    //the TSC counts from reset, so this is firmware and bootloader time
+    out("boot: %d kcycles before kernel_main()\n", (uint32_t)(stages[0].tsc / 1000));
+    for (uint32_t i = 0; i < stage_count - 1; i++) {
+        uint64_t cycles = stages[i + 1].tsc - stages[i].tsc;
+        uint32_t permille = total ? (uint32_t)((cycles * 1000) / total) : 0;
+        if (rate) {
+            out("boot: %s: %d kcycles, %d.%03d ms (%d.%d%%)\n", stages[i].name, (uint32_t)(cycles / 1000),
+                (uint32_t)(cycles / rate), (uint32_t)(((cycles % rate) * 1000) / rate), permille / 10, permille % 10);
+        }
+        else {
+            out("boot: %s: %d kcycles (%d.%d%%)\n", stages[i].name, (uint32_t)(cycles / 1000), permille / 10, permille % 10);
+        }
+    }
+    if (rate) {
+        out("boot: total %d kcycles, %d ms at %d kcycles/ms\n", (uint32_t)(total / 1000), (uint32_t)(total / rate), rate / 1000);
+    }
+    else {
+        out("boot: total %d kcycles, too few PIT ticks to estimate the TSC rate\n", (uint32_t)(total / 1000));
+    }
+}
+
+void boot_timeline_finish(void) {
+    if (finished || !stage_count) {
+        return;
+    }
+    boot_stage_record("end");
+    finished = true;
+    boot_timeline_dump(printk);
+}
+
+void boot_timeline_print(void) {
+    boot_timeline_dump(printf);
+}
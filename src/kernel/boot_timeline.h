@@ -0,0 +1,31 @@
+#ifndef BOOT_TIMELINE_H
+#define BOOT_TIMELINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//timeline of kernel_main(), built from a TSC timestamp taken as each boot stage starts
+//a stage lasts until the next one starts, and the last until boot_timeline_finish()
+//the TSC rate is estimated from the PIT ticks seen during boot, so stages can be shown in
+//milliseconds as well as cycles once enough of them have passed
+
+#define BOOT_STAGES_MAX         32
+//PIT ticks (ms) needed before the TSC rate is trusted
+#define BOOT_CALIBRATE_MIN_MS   10
+
+typedef struct boot_stage {
+    const char* name;
+    uint64_t tsc;
+    uint32_t ticks;     //PIT ticks, which stay 0 until the PIT and interrupts are set up
+} boot_stage_t;
+
+//end the current boot stage and start @p name, which must be a string literal or otherwise outlive boot
+void boot_stage(const char* name);
+
+//end the last stage, and write the timeline to the syslog
+void boot_timeline_finish(void);
+
+//print the timeline recorded during boot
+void boot_timeline_print(void);
+
+#endif
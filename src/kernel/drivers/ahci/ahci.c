@@ -0,0 +1,519 @@
+#include "ahci.h"
+#include <std/std.h>
+#include <std/common.h>
+#include <std/math.h>
+#include <kernel/vmm/vmm.h>
+#include <kernel/interrupts/interrupts.h>
+#include <kernel/drivers/pci/pci_detect.h>
+#include <kernel/util/blkq/blkq.h>
+
+#define SECTOR_SIZE ((uint32_t)512)
+//iterations to wait for the HBA to acknowledge a state change
+#define AHCI_SPIN_LIMIT	1000000
+
+//a batch handed over by blkq, which may need several commands if it's large
+typedef struct ahci_batch {
+	blk_request_t* head;	//NULL if the entry is unused
+	blk_request_t* cursor;	//request the next command starts in, NULL once every command is issued
+	uint32_t cursor_done;	//sectors of cursor covered by earlier commands
+	uint32_t lba;		//sector the next command starts at
+	uint32_t commands;	//issued and not yet completed
+	int status;
+} ahci_batch_t;
+
+typedef struct ahci_port {
+	int index;
+	int drive;		//blkq drive number
+	uint32_t sectors;
+	bool ncq;
+	uint32_t slots;		//commands which may be outstanding at once
+
+	ahci_cmd_header_t* cmd_list;
+	ahci_cmd_table_t* tables[AHCI_MAX_SLOTS];
+	uint32_t busy_slots;	//bitmap of slots holding an issued command
+	ahci_batch_t* slot_batch[AHCI_MAX_SLOTS];
+	//blkq never starts more batches than there are slots
+	ahci_batch_t batches[AHCI_MAX_SLOTS];
+
+	uint32_t commands;
+	uint32_t max_outstanding;
+	uint32_t errors;
+} ahci_port_t;
+
+static uint32_t hba = 0;	//virtual address of the HBA's registers
+static uint32_t hba_slots = 0;
+static bool hba_ncq = false;
+static ahci_port_t* ports[AHCI_MAX_PORTS] = {0};
+static int disk_count = 0;
+
+static uint32_t hba_read(uint32_t reg) {
+	return *(volatile uint32_t*)(hba + reg);
+}
+
+static void hba_write(uint32_t reg, uint32_t val) {
+	*(volatile uint32_t*)(hba + reg) = val;
+}
+
+static uint32_t port_read(ahci_port_t* port, uint32_t reg) {
+	return hba_read(AHCI_PORT_BASE + (port->index * AHCI_PORT_SIZE) + reg);
+}
+
+static void port_write(ahci_port_t* port, uint32_t reg, uint32_t val) {
+	hba_write(AHCI_PORT_BASE + (port->index * AHCI_PORT_SIZE) + reg, val);
+}
+
+//returns false if the bits didn't clear in time
+static bool port_wait_clear(ahci_port_t* port, uint32_t reg, uint32_t mask) {
+	for (int i = 0; i < AHCI_SPIN_LIMIT; i++) {
+		if (!(port_read(port, reg) & mask)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool ahci_port_stop(ahci_port_t* port) {
+	port_write(port, AHCI_PxCMD, port_read(port, AHCI_PxCMD) & ~(AHCI_PxCMD_ST | AHCI_PxCMD_FRE));
+	if (!port_wait_clear(port, AHCI_PxCMD, AHCI_PxCMD_CR | AHCI_PxCMD_FR)) {
+		printf_err("AHCI port %d didn't stop", port->index);
+		return false;
+	}
+	return true;
+}
+
+static void ahci_port_start(ahci_port_t* port) {
+	port_wait_clear(port, AHCI_PxCMD, AHCI_PxCMD_CR);
+	port_write(port, AHCI_PxCMD, port_read(port, AHCI_PxCMD) | AHCI_PxCMD_SUD | AHCI_PxCMD_POD | AHCI_PxCMD_FRE);
+	port_write(port, AHCI_PxCMD, port_read(port, AHCI_PxCMD) | AHCI_PxCMD_ST);
+}
+
+//describe a virtually contiguous buffer in @p table's PRDT, starting at entry @p prds
+//returns the number of entries now in use
+static uint32_t ahci_add_buffer(ahci_cmd_table_t* table, uint32_t prds, uint32_t addr, uint32_t len) {
+	while (len) {
+		uint32_t chunk = MIN(len, PAGE_SIZE - (addr & (PAGE_SIZE - 1)));
+		uint32_t phys = vmm_get_phys_for_virt(addr);
+
+		//extend the previous entry if this continues it in physical memory
+		ahci_prd_t* prev = prds ? &table->prdt[prds - 1] : NULL;
+		if (prev && prev->dba + prev->dbc + 1 == phys && prev->dbc + 1 + chunk <= AHCI_PRD_MAX_BYTES) {
+			prev->dbc += chunk;
+		}
+		else {
+			table->prdt[prds].dba = phys;
+			table->prdt[prds].dbau = 0;
+			table->prdt[prds].reserved = 0;
+			table->prdt[prds].dbc = chunk - 1;
+			prds++;
+		}
+		addr += chunk;
+		len -= chunk;
+	}
+	return prds;
+}
+
+static void ahci_fill_fis(fis_reg_h2d_t* fis, uint8_t command, uint64_t lba) {
+	memset(fis, 0, sizeof(fis_reg_h2d_t));
+	fis->type = FIS_TYPE_REG_H2D;
+	fis->flags = FIS_H2D_COMMAND;
+	fis->command = command;
+	fis->device = 0x40;	//LBA addressing
+	fis->lba0 = lba & 0xFF;
+	fis->lba1 = (lba >> 8) & 0xFF;
+	fis->lba2 = (lba >> 16) & 0xFF;
+	fis->lba3 = (lba >> 24) & 0xFF;
+	fis->lba4 = (lba >> 32) & 0xFF;
+	fis->lba5 = (lba >> 40) & 0xFF;
+}
+
+//put the next part of @p batch into command slot @p slot, and issue it
+static void ahci_issue_command(ahci_port_t* port, int slot, ahci_batch_t* batch) {
+	ahci_cmd_table_t* table = port->tables[slot];
+	uint32_t prds = 0;
+	uint32_t sectors = 0;
+	//a sector may straddle two pages
+	while (batch->cursor && prds + 2 <= AHCI_PRDT_ENTRIES && sectors < AHCI_MAX_COMMAND_SECTORS) {
+		uint32_t addr = (uint32_t)batch->cursor->buf + (batch->cursor_done * SECTOR_SIZE);
+		prds = ahci_add_buffer(table, prds, addr, SECTOR_SIZE);
+		sectors++;
+		if (++batch->cursor_done == batch->cursor->count) {
+			batch->cursor = batch->cursor->merge_next;
+			batch->cursor_done = 0;
+		}
+	}
+
+	bool write = batch->head->direction == BLKQ_WRITE;
+	fis_reg_h2d_t* fis = (fis_reg_h2d_t*)table->cfis;
+	if (port->ncq) {
+		ahci_fill_fis(fis, write ? AHCI_ATA_CMD_WRITE_FPDMA_QUEUED : AHCI_ATA_CMD_READ_FPDMA_QUEUED, batch->lba);
+		//queued commands carry their length in the features field, and their slot in the count
+		fis->feature_low = sectors & 0xFF;
+		fis->feature_high = (sectors >> 8) & 0xFF;
+		fis->count_low = slot << 3;
+	}
+	else {
+		ahci_fill_fis(fis, write ? AHCI_ATA_CMD_WRITE_DMA_EXT : AHCI_ATA_CMD_READ_DMA_EXT, batch->lba);
+		fis->count_low = sectors & 0xFF;
+		fis->count_high = (sectors >> 8) & 0xFF;
+	}
+	batch->lba += sectors;
+
+	ahci_cmd_header_t* header = &port->cmd_list[slot];
+	header->flags = (sizeof(fis_reg_h2d_t) / sizeof(uint32_t)) | (write ? AHCI_CMD_WRITE : 0);
+	header->prdtl = prds;
+	header->prdbc = 0;
+
+	port->slot_batch[slot] = batch;
+	port->busy_slots |= (1u << slot);
+	batch->commands++;
+	port->commands++;
+
+	uint32_t outstanding = 0;
+	for (uint32_t b = port->busy_slots; b; b &= b - 1) {
+		outstanding++;
+	}
+	port->max_outstanding = MAX(port->max_outstanding, outstanding);
+
+	if (port->ncq) {
+		port_write(port, AHCI_PxSACT, 1u << slot);
+	}
+	port_write(port, AHCI_PxCI, 1u << slot);
+}
+
+static int ahci_free_slot(ahci_port_t* port) {
+	for (uint32_t slot = 0; slot < port->slots; slot++) {
+		if (!(port->busy_slots & (1u << slot))) {
+			return slot;
+		}
+	}
+	return -1;
+}
+
+//fill free command slots from started batches which still have sectors to issue
+//must be called with interrupts disabled
+static void ahci_port_issue(ahci_port_t* port) {
+	for (uint32_t i = 0; i < port->slots; i++) {
+		ahci_batch_t* batch = &port->batches[i];
+		while (batch->head && batch->cursor) {
+			int slot = ahci_free_slot(port);
+			if (slot < 0) {
+				return;
+			}
+			ahci_issue_command(port, slot, batch);
+		}
+	}
+}
+
+//after an error the port stops processing commands, and anything it had queued is lost
+//restart it so later commands can run, and leave the caller to fail what was outstanding
+static void ahci_port_recover(ahci_port_t* port) {
+	ahci_port_stop(port);
+	port_write(port, AHCI_PxSERR, 0xFFFFFFFF);
+	port_write(port, AHCI_PxIS, 0xFFFFFFFF);
+	ahci_port_start(port);
+}
+
+//retire every command the port has finished, and issue more in their place
+//must be called with interrupts disabled
+static void ahci_port_complete(ahci_port_t* port) {
+	uint32_t is = port_read(port, AHCI_PxIS);
+	port_write(port, AHCI_PxIS, is);
+
+	//queued commands are finished once their SACT bit clears, others once their CI bit does
+	uint32_t outstanding = port_read(port, AHCI_PxCI) | (port->ncq ? port_read(port, AHCI_PxSACT) : 0);
+	int error = 0;
+	if (is & AHCI_PxIS_ERRORS) {
+		//report the ATA error register, or 1 if the failure was on the host's side
+		error = (port_read(port, AHCI_PxTFD) >> 8) & 0xFF;
+		error = error ? error : 1;
+		port->errors++;
+		ahci_port_recover(port);
+		outstanding = 0;
+	}
+
+	uint32_t done = port->busy_slots & ~outstanding;
+	for (int slot = 0; done; slot++) {
+		if (!(done & (1u << slot))) {
+			continue;
+		}
+		done &= ~(1u << slot);
+		port->busy_slots &= ~(1u << slot);
+
+		ahci_batch_t* batch = port->slot_batch[slot];
+		port->slot_batch[slot] = NULL;
+		batch->commands--;
+		if (error) {
+			//don't issue the rest of a failed batch
+			batch->status = error;
+			batch->cursor = NULL;
+		}
+		if (!batch->commands && !batch->cursor) {
+			blk_request_t* head = batch->head;
+			batch->head = NULL;
+			blkq_complete(head, batch->status);
+		}
+	}
+	ahci_port_issue(port);
+}
+
+static int ahci_irq(register_state_t* UNUSED(regs)) {
+	uint32_t pending = hba_read(AHCI_REG_IS);
+	if (!pending) {
+		return 0;
+	}
+	for (int i = 0; i < AHCI_MAX_PORTS; i++) {
+		if (!(pending & (1u << i))) {
+			continue;
+		}
+		if (ports[i]) {
+			ahci_port_complete(ports[i]);
+		}
+		else {
+			hba_write(AHCI_PORT_BASE + (i * AHCI_PORT_SIZE) + AHCI_PxIS, 0xFFFFFFFF);
+		}
+	}
+	//port bits must be cleared after the port's own status, or the IRQ is raised again
+	hba_write(AHCI_REG_IS, pending);
+	return 0;
+}
+
+static int ahci_start(uint32_t unit, blk_request_t* head) {
+	ahci_port_t* port = ports[unit];
+	uint32_t total = 0;
+	for (blk_request_t* req = head; req; req = req->merge_next) {
+		//PRD addresses must be word aligned
+		if ((uint32_t)req->buf & 1) {
+			return 1;
+		}
+		total += req->count;
+	}
+	if (head->lba >= port->sectors || total > port->sectors - head->lba) {
+		return 1;
+	}
+
+	bool ints = interrupts_enabled();
+	kernel_begin_critical();
+	ahci_batch_t* batch = NULL;
+	for (uint32_t i = 0; i < port->slots && !batch; i++) {
+		if (!port->batches[i].head) {
+			batch = &port->batches[i];
+		}
+	}
+	if (batch) {
+		batch->head = head;
+		batch->cursor = head;
+		batch->cursor_done = 0;
+		batch->lba = head->lba;
+		batch->commands = 0;
+		batch->status = 0;
+		ahci_port_issue(port);
+	}
+	if (ints) {
+		kernel_end_critical();
+	}
+	//blkq keeps within the queue depth, so this shouldn't happen
+	return batch ? 0 : 1;
+}
+
+static void ahci_poll(uint32_t unit) {
+	bool ints = interrupts_enabled();
+	kernel_begin_critical();
+	ahci_port_complete(ports[unit]);
+	hba_write(AHCI_REG_IS, 1u << ports[unit]->index);
+	if (ints) {
+		kernel_end_critical();
+	}
+}
+
+static uint32_t ahci_capacity(uint32_t unit) {
+	return ports[unit] ? ports[unit]->sectors : 0;
+}
+
+static const blk_driver_t ahci_driver = {
+	.name = "ahci",
+	.read = NULL,
+	.write = NULL,
+	.capacity = ahci_capacity,
+	.transfer_sg = NULL,
+	.start = ahci_start,
+	.poll = ahci_poll,
+};
+
+//run IDENTIFY DEVICE on a freshly started port, polling for completion
+//fills in the port's size and whether the disk can queue commands
+static bool ahci_port_identify(ahci_port_t* port) {
+	uint32_t buf = vmm_alloc_kernel_page();
+	memset((uint8_t*)buf, 0, PAGE_SIZE);
+
+	ahci_cmd_table_t* table = port->tables[0];
+	memset(table, 0, AHCI_CMD_TABLE_SIZE);
+	ahci_fill_fis((fis_reg_h2d_t*)table->cfis, AHCI_ATA_CMD_IDENTIFY, 0);
+	((fis_reg_h2d_t*)table->cfis)->device = 0;
+	uint32_t prds = ahci_add_buffer(table, 0, buf, SECTOR_SIZE);
+
+	ahci_cmd_header_t* header = &port->cmd_list[0];
+	header->flags = sizeof(fis_reg_h2d_t) / sizeof(uint32_t);
+	header->prdtl = prds;
+	header->prdbc = 0;
+
+	bool ok = port_wait_clear(port, AHCI_PxTFD, AHCI_PxTFD_BSY | AHCI_PxTFD_DRQ);
+	if (ok) {
+		port_write(port, AHCI_PxCI, 1);
+		ok = port_wait_clear(port, AHCI_PxCI, 1) && !(port_read(port, AHCI_PxTFD) & AHCI_PxTFD_ERR);
+	}
+	port_write(port, AHCI_PxIS, 0xFFFFFFFF);
+	if (!ok) {
+		vmm_free_kernel_page(buf);
+		return false;
+	}
+
+	uint16_t* ident = (uint16_t*)buf;
+	//prefer the 48-bit sector count when the disk supports it
+	if (ident[83] & (1 << 10)) {
+		bool huge = ident[102] || ident[103];
+		port->sectors = huge ? 0xFFFFFFFF : ident[100] | ((uint32_t)ident[101] << 16);
+	}
+	else {
+		port->sectors = ident[60] | ((uint32_t)ident[61] << 16);
+	}
+	port->ncq = hba_ncq && (ident[76] & (1 << 8));
+	port->slots = port->ncq ? MIN(hba_slots, (uint32_t)(ident[75] & 0x1F) + 1) : 1;
+
+	vmm_free_kernel_page(buf);
+	return true;
+}
+
+//stop a port which failed to initialize, and free its command list, FIS area and command tables
+static void ahci_port_release(ahci_port_t* port) {
+	//the HBA may still write to a port which didn't stop, so its pages can't be reused
+	if (ahci_port_stop(port)) {
+		uint32_t per_page = PAGE_SIZE / AHCI_CMD_TABLE_SIZE;
+		for (uint32_t slot = 0; slot < hba_slots; slot += per_page) {
+			vmm_free_kernel_page((uint32_t)port->tables[slot]);
+		}
+		vmm_free_kernel_page((uint32_t)port->cmd_list);
+	}
+	kfree(port);
+}
+
+static void ahci_port_init(int index) {
+	uint32_t base = AHCI_PORT_BASE + (index * AHCI_PORT_SIZE);
+	uint32_t ssts = hba_read(base + AHCI_PxSSTS);
+	if ((ssts & 0xF) != AHCI_SSTS_DET_PRESENT || ((ssts >> 8) & 0xF) != AHCI_SSTS_IPM_ACTIVE) {
+		return;
+	}
+	uint32_t sig = hba_read(base + AHCI_PxSIG);
+	if (sig != AHCI_SIG_ATA) {
+		printf_info("AHCI port %d isn't a SATA disk (signature 0x%x)", index, sig);
+		return;
+	}
+
+	ahci_port_t* port = kmalloc(sizeof(ahci_port_t));
+	memset(port, 0, sizeof(ahci_port_t));
+	port->index = index;
+	ahci_port_stop(port);
+
+	//the command list and received FIS area share a page
+	uint32_t page = vmm_alloc_kernel_page();
+	memset((uint8_t*)page, 0, PAGE_SIZE);
+	uint32_t phys = vmm_get_phys_for_virt(page);
+	port->cmd_list = (ahci_cmd_header_t*)page;
+	port_write(port, AHCI_PxCLB, phys);
+	port_write(port, AHCI_PxCLBU, 0);
+	port_write(port, AHCI_PxFB, phys + sizeof(ahci_cmd_header_t) * AHCI_MAX_SLOTS);
+	port_write(port, AHCI_PxFBU, 0);
+
+	//command tables are packed a page at a time, so each is physically contiguous
+	uint32_t per_page = PAGE_SIZE / AHCI_CMD_TABLE_SIZE;
+	for (uint32_t slot = 0; slot < hba_slots; slot += per_page) {
+		uint32_t tables = vmm_alloc_kernel_page();
+		memset((uint8_t*)tables, 0, PAGE_SIZE);
+		uint32_t tables_phys = vmm_get_phys_for_virt(tables);
+		for (uint32_t j = 0; j < per_page && slot + j < hba_slots; j++) {
+			port->tables[slot + j] = (ahci_cmd_table_t*)(tables + j * AHCI_CMD_TABLE_SIZE);
+			port->cmd_list[slot + j].ctba = tables_phys + j * AHCI_CMD_TABLE_SIZE;
+			port->cmd_list[slot + j].ctbau = 0;
+		}
+	}
+
+	port_write(port, AHCI_PxSERR, 0xFFFFFFFF);
+	port_write(port, AHCI_PxIS, 0xFFFFFFFF);
+	ahci_port_start(port);
+
+	if (!ahci_port_identify(port)) {
+		printf_err("AHCI port %d didn't identify itself", index);
+		ahci_port_release(port);
+		return;
+	}
+
+	port->drive = blkq_register_drive(&ahci_driver, index);
+	if (port->drive < 0) {
+		printf_err("AHCI port %d: no free blkq drive number", index);
+		ahci_port_release(port);
+		return;
+	}
+	ports[index] = port;
+	blkq_set_queue_depth(port->drive, port->slots);
+	port_write(port, AHCI_PxIE, AHCI_PxIS_DHRS | AHCI_PxIS_PSS | AHCI_PxIS_DSS | AHCI_PxIS_SDBS | AHCI_PxIS_ERRORS);
+	disk_count++;
+
+	printf_info("AHCI port %d: %d MB, %s depth %d, blkq drive %d", index, port->sectors / 2048, port->ncq ? "NCQ" : "no NCQ,", port->slots, port->drive);
+}
+
+int ahci_install(void) {
+	if (hba) {
+		return disk_count;
+	}
+	pci_device* controller = pci_find_class(PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_SATA);
+	if (!controller) {
+		printf_info("No AHCI controller found");
+		return 0;
+	}
+	//ABAR is memory mapped
+	uint32_t abar = controller->bar[5];
+	if ((abar & 0x1) || !(abar & 0xFFFFFFF0)) {
+		printf_err("AHCI controller has no register BAR");
+		return 0;
+	}
+	uint16_t command = pci_config_readw(controller->bus, controller->slot, controller->func, PCI_REG_COMMAND);
+	pci_config_writew(controller->bus, controller->slot, controller->func, PCI_REG_COMMAND, command | PCI_COMMAND_MEM_SPACE);
+	pci_enable_bus_master(controller);
+
+	hba = vmm_map_kernel_mmio(abar & 0xFFFFFFF0, AHCI_ABAR_SIZE);
+	//stay in AHCI mode rather than legacy IDE emulation
+	hba_write(AHCI_REG_GHC, hba_read(AHCI_REG_GHC) | AHCI_GHC_AE);
+
+	uint32_t cap = hba_read(AHCI_REG_CAP);
+	hba_slots = AHCI_CAP_NCS(cap);
+	hba_ncq = (cap & AHCI_CAP_SNCQ) != 0;
+	uint32_t version = hba_read(AHCI_REG_VS);
+	printf_info("AHCI %d.%d controller, %d command slots, %s", version >> 16, (version >> 8) & 0xFF, hba_slots, hba_ncq ? "NCQ" : "no NCQ");
+
+	//ports are set up by polling, and only then is the IRQ let through
+	//the line may be shared with other PCI devices, and ahci_irq() ignores interrupts the HBA didn't raise
+	interrupt_setup_shared_callback(INT_VECOR_IRQ0 + controller->irq_line, &ahci_irq);
+	uint32_t implemented = hba_read(AHCI_REG_PI);
+	for (int i = 0; i < AHCI_MAX_PORTS; i++) {
+		if (implemented & (1u << i)) {
+			ahci_port_init(i);
+		}
+	}
+	hba_write(AHCI_REG_IS, 0xFFFFFFFF);
+	hba_write(AHCI_REG_GHC, hba_read(AHCI_REG_GHC) | AHCI_GHC_IE);
+	return disk_count;
+}
+
+void ahci_print_stats(void) {
+	if (!disk_count) {
+		printf("ahci: no disks\n");
+		return;
+	}
+	for (int i = 0; i < AHCI_MAX_PORTS; i++) {
+		ahci_port_t* port = ports[i];
+		if (!port) {
+			continue;
+		}
+		printf("ahci: port %d is blkq drive %d, %d sectors, %s depth %d\n", i, port->drive, port->sectors, port->ncq ? "NCQ" : "unqueued,", port->slots);
+		printf("ahci: port %d issued %d commands, at most %d outstanding, %d errors\n", i, port->commands, port->max_outstanding, port->errors);
+	}
+}
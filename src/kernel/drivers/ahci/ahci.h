@@ -0,0 +1,141 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//AHCI SATA host bus adapter, such as qemu's ich9-ahci
+//every port with a disk attached is registered with blkq as its own drive
+//disks supporting native command queuing are handed up to 32 transfers at once,
+//each in its own command slot, and finish them in whatever order suits the disk
+//other disks are given a single command at a time
+
+#define AHCI_MAX_PORTS		32
+#define AHCI_MAX_SLOTS		32
+//enough to fill out each command table to 1kb
+#define AHCI_PRDT_ENTRIES	56
+#define AHCI_CMD_TABLE_SIZE	1024
+//largest transfer placed in a single command, larger ones are split over several
+#define AHCI_MAX_COMMAND_SECTORS	8192
+//a PRD covers at most 4MB
+#define AHCI_PRD_MAX_BYTES	0x400000
+
+//generic host control registers
+#define AHCI_REG_CAP	0x00
+#define AHCI_REG_GHC	0x04
+#define AHCI_REG_IS	0x08
+#define AHCI_REG_PI	0x0C
+#define AHCI_REG_VS	0x10
+#define AHCI_PORT_BASE	0x100
+#define AHCI_PORT_SIZE	0x80
+#define AHCI_ABAR_SIZE	(AHCI_PORT_BASE + (AHCI_MAX_PORTS * AHCI_PORT_SIZE))
+
+#define AHCI_CAP_NCS(cap)	((((cap) >> 8) & 0x1F) + 1)	//command slots per port
+#define AHCI_CAP_SSS		(1 << 27)	//supports staggered spin-up
+#define AHCI_CAP_SNCQ		(1 << 30)	//supports native command queuing
+#define AHCI_GHC_IE		(1 << 1)
+#define AHCI_GHC_AE		(1u << 31)
+
+//port registers, offsets from the port's base
+#define AHCI_PxCLB	0x00
+#define AHCI_PxCLBU	0x04
+#define AHCI_PxFB	0x08
+#define AHCI_PxFBU	0x0C
+#define AHCI_PxIS	0x10
+#define AHCI_PxIE	0x14
+#define AHCI_PxCMD	0x18
+#define AHCI_PxTFD	0x20
+#define AHCI_PxSIG	0x24
+#define AHCI_PxSSTS	0x28
+#define AHCI_PxSERR	0x30
+#define AHCI_PxSACT	0x34
+#define AHCI_PxCI	0x38
+
+#define AHCI_PxCMD_ST	(1 << 0)	//process the command list
+#define AHCI_PxCMD_SUD	(1 << 1)	//spin up device
+#define AHCI_PxCMD_POD	(1 << 2)	//power on device
+#define AHCI_PxCMD_FRE	(1 << 4)	//accept received FISes
+#define AHCI_PxCMD_FR	(1 << 14)	//FIS receive running
+#define AHCI_PxCMD_CR	(1 << 15)	//command list running
+
+#define AHCI_PxIS_DHRS	(1 << 0)	//device to host register FIS, ends non-queued commands
+#define AHCI_PxIS_PSS	(1 << 1)	//PIO setup FIS
+#define AHCI_PxIS_DSS	(1 << 2)	//DMA setup FIS
+#define AHCI_PxIS_SDBS	(1 << 3)	//set device bits FIS, ends queued commands
+#define AHCI_PxIS_IFS	(1 << 27)	//interface fatal error
+#define AHCI_PxIS_HBDS	(1 << 28)	//host bus data error
+#define AHCI_PxIS_HBFS	(1 << 29)	//host bus fatal error
+#define AHCI_PxIS_TFES	(1 << 30)	//task file error
+#define AHCI_PxIS_ERRORS	(AHCI_PxIS_IFS | AHCI_PxIS_HBDS | AHCI_PxIS_HBFS | AHCI_PxIS_TFES)
+
+#define AHCI_PxTFD_ERR	0x01
+#define AHCI_PxTFD_DRQ	0x08
+#define AHCI_PxTFD_BSY	0x80
+
+#define AHCI_SSTS_DET_PRESENT	3	//device present and link up
+#define AHCI_SSTS_IPM_ACTIVE	1
+#define AHCI_SIG_ATA		0x00000101
+
+#define AHCI_ATA_CMD_IDENTIFY		0xEC
+#define AHCI_ATA_CMD_READ_DMA_EXT	0x25
+#define AHCI_ATA_CMD_WRITE_DMA_EXT	0x35
+#define AHCI_ATA_CMD_READ_FPDMA_QUEUED	0x60
+#define AHCI_ATA_CMD_WRITE_FPDMA_QUEUED	0x61
+
+#define FIS_TYPE_REG_H2D	0x27
+#define FIS_H2D_COMMAND		0x80	//FIS carries a command, rather than a control update
+
+//entry in a port's command list
+typedef struct ahci_cmd_header {
+	uint16_t flags;		//FIS length in dwords, and the bits below
+	uint16_t prdtl;		//entries in the PRDT
+	volatile uint32_t prdbc;	//bytes transferred, written by the HBA
+	uint32_t ctba;		//physical address of the command table, 128-byte aligned
+	uint32_t ctbau;
+	uint32_t reserved[4];
+} __attribute__((packed)) ahci_cmd_header_t;
+#define AHCI_CMD_WRITE		(1 << 6)
+
+//physical region descriptor
+typedef struct ahci_prd {
+	uint32_t dba;		//physical address, word aligned
+	uint32_t dbau;
+	uint32_t reserved;
+	uint32_t dbc;		//bytes - 1
+} __attribute__((packed)) ahci_prd_t;
+
+typedef struct ahci_cmd_table {
+	uint8_t cfis[64];
+	uint8_t acmd[16];
+	uint8_t reserved[48];
+	ahci_prd_t prdt[AHCI_PRDT_ENTRIES];
+} __attribute__((packed)) ahci_cmd_table_t;
+
+typedef struct fis_reg_h2d {
+	uint8_t type;
+	uint8_t flags;
+	uint8_t command;
+	uint8_t feature_low;	//sector count for queued commands
+	uint8_t lba0;
+	uint8_t lba1;
+	uint8_t lba2;
+	uint8_t device;
+	uint8_t lba3;
+	uint8_t lba4;
+	uint8_t lba5;
+	uint8_t feature_high;
+	uint8_t count_low;	//command slot << 3 for queued commands
+	uint8_t count_high;
+	uint8_t icc;
+	uint8_t control;
+	uint8_t reserved[4];
+} __attribute__((packed)) fis_reg_h2d_t;
+
+//find an AHCI controller and register each disk on it with blkq
+//returns the number of disks found
+int ahci_install(void);
+
+//print each disk's blkq drive number, queue depth and command counts
+void ahci_print_stats(void);
+
+#endif
@@ -1,11 +1,14 @@
 #include "ide.h"
 #include <std/common.h>
 #include <std/math.h>
+#include <kernel/vmm/vmm.h>
+#include <kernel/interrupts/interrupts.h>
+#include <kernel/drivers/pci/pci_detect.h>
+#include <kernel/multitasking/tasks/task_small.h>
 
 //defined in kernel/util/fat/fat.h
 int sectors_from_bytes(int bytes);
 
-#define IO_WAIT_DELAY 10
 
 struct IDEChannelRegisters {
 	unsigned short base;  // I/O Base.
@@ -17,7 +20,6 @@ struct IDEChannelRegisters {
 int package[4];
 
 unsigned char ide_buf[2048] = {0};
-static unsigned char ide_irq_invoked = 0;
 static unsigned char atapi_packet[12] = {0xA8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
 struct ide_device {
@@ -30,10 +32,34 @@ struct ide_device {
 	unsigned int   CommandSets; // Command Sets Supported.
 	unsigned int   Size;        // Size in Sectors.
 	unsigned char  Model[41];   // Model in string.
+	unsigned short MultipleSectors; // Sectors per DRQ block in READ/WRITE MULTIPLE mode, 0 if unsupported.
 } ide_devices[4];
 
 #define SECTOR_SIZE ((uint32_t)512)
 
+//physical region descriptor
+//tells the bus master where to transfer the next chunk of a DMA request
+typedef struct ide_prd {
+	uint32_t phys_addr;
+	uint16_t byte_count;	//0 means 64kb
+	uint16_t flags;
+} __attribute__((packed)) ide_prd_t;
+#define PRD_FLAG_EOT 0x8000 //last descriptor in table
+
+//one PRD table per channel, each a single page so it can't cross a 64kb boundary
+static ide_prd_t* prd_tables[2] = {0};
+static uint32_t prd_tables_phys[2] = {0};
+static volatile unsigned char channel_irq_fired[2] = {0};
+//tasks sleeping until a channel raises its IRQ
+static wait_queue_t channel_waiters[2] = {0};
+//held from programming a channel's registers until its transfer is over,
+//as the task doing it sleeps in between and another could start a command
+static sleep_lock_t channel_locks[2] = {0};
+//set once the IRQ 14/15 handlers are registered
+static bool irq_handlers_installed = false;
+static bool dma_enabled = true;
+static uint64_t dma_idle_cycles = 0;
+
 void ide_write(unsigned char channel, unsigned char reg, unsigned char data);
 
 unsigned char ide_read(unsigned char channel, unsigned char reg) {
@@ -88,12 +114,17 @@ void ide_read_buffer(unsigned char channel, unsigned char reg, unsigned int buff
 		ide_write(channel, ATA_REG_CONTROL, channels[channel].nIEN);
 }
 
+//give the drive 400ns to update its status after a command or drive select
+static void ide_delay_400ns(unsigned char channel) {
+	for(int i = 0; i < 4; i++)
+		ide_read(channel, ATA_REG_ALTSTATUS); // Reading the Alternate Status port wastes 100ns; loop four times.
+}
+
 unsigned char ide_polling(unsigned char channel, unsigned int advanced_check) {
 
 	// (I) Delay 400 nanosecond for BSY to be set:
 	// -------------------------------------------------
-	for(int i = 0; i < 4; i++)
-		ide_read(channel, ATA_REG_ALTSTATUS); // Reading the Alternate Status port wastes 100ns; loop four times.
+	ide_delay_400ns(channel);
 
 	// (II) Wait for BSY to be cleared:
 	// -------------------------------------------------
@@ -152,6 +183,27 @@ unsigned char ide_print_error(unsigned int drive, unsigned char err) {
 }
 
 
+//enable READ/WRITE MULTIPLE with the largest block size the drive supports
+//in this mode the drive only raises DRQ once per block of sectors instead of once per sector
+static void ide_set_multiple_mode(int device, unsigned char max_multiple) {
+	unsigned char channel = ide_devices[device].Channel;
+	ide_devices[device].MultipleSectors = 0;
+	if (max_multiple < 2) {
+		return;
+	}
+
+	ide_write(channel, ATA_REG_HDDEVSEL, 0xA0 | (ide_devices[device].Drive << 4));
+	ide_write(channel, ATA_REG_SECCOUNT0, max_multiple);
+	ide_write(channel, ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE_MODE);
+	ide_polling(channel, 0);
+
+	if (ide_read(channel, ATA_REG_STATUS) & (ATA_SR_ERR | ATA_SR_DF)) {
+		printf_err("IDE: drive %d rejected SET MULTIPLE MODE %d", device, max_multiple);
+		return;
+	}
+	ide_devices[device].MultipleSectors = max_multiple;
+}
+
 void ide_initialize(unsigned int BAR0, unsigned int BAR1, unsigned int BAR2, unsigned int BAR3, unsigned int BAR4) {
 	int i, j, k, count = 0;
 
@@ -177,12 +229,11 @@ void ide_initialize(unsigned int BAR0, unsigned int BAR1, unsigned int BAR2, uns
 
 			// (I) Select Drive:
 			ide_write(i, ATA_REG_HDDEVSEL, 0xA0 | (j << 4)); // Select Drive.
-			sleep(IO_WAIT_DELAY); // Wait 1ms for drive select to work.
+			ide_delay_400ns(i); // Drive select takes 400ns to settle.
 
 			// (II) Send ATA Identify Command:
 			ide_write(i, ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
-			sleep(IO_WAIT_DELAY); // This function should be implemented in your OS. which waits for 1 ms.
-			// it is based on System Timer Device Driver.
+			ide_delay_400ns(i); // Status is only valid 400ns after a command.
 
 			// (III) Polling:
 			if (ide_read(i, ATA_REG_STATUS) == 0) continue; // If Status = 0, No Device.
@@ -212,7 +263,7 @@ void ide_initialize(unsigned int BAR0, unsigned int BAR1, unsigned int BAR2, uns
 					continue; // Unknown Type (may not be a device).
 
 				ide_write(i, ATA_REG_COMMAND, ATA_CMD_IDENTIFY_PACKET);
-				sleep(IO_WAIT_DELAY);
+				ide_polling(i, 0);
 			}
 
 			// (V) Read Identification Space of the Device:
@@ -243,23 +294,136 @@ void ide_initialize(unsigned int BAR0, unsigned int BAR1, unsigned int BAR2, uns
 				ide_devices[count].Model[k + 1] = ide_buf[ATA_IDENT_MODEL + k];}
 			ide_devices[count].Model[40] = 0; // Terminate String.
 
+			// (IX) Transfer several sectors per DRQ block if the drive allows it:
+			if (type == IDE_ATA) {
+				ide_set_multiple_mode(count, ide_buf[ATA_IDENT_MAX_MULTIPLE]);
+			}
+
 			count++;
 		}
 	//print summary
 	for (int i = 0; i < 4; i++) {
 		if (ide_devices[i].Reserved == 1) {
-			printf("[%d] Found %s Drive %dGB - %s\n",
+			printf("[%d] Found %s Drive %dGB - %s (%d sectors/block)\n",
 					i,
 					//type
 					(const char*[]){"ATA", "ATAPI"}[ide_devices[i].Type],
 					//size
 					ide_devices[i].Size / 1024 / 1024 / 2,
-					ide_devices[i].Model);
+					ide_devices[i].Model,
+					MAX(ide_devices[i].MultipleSectors, 1));
 		}
 	}
 }
 
-unsigned char ide_ata_access(unsigned char direction, unsigned char drive, unsigned int lba, unsigned int edi, unsigned int byte_count) {
+static bool ide_dma_available(unsigned char drive, unsigned int edi) {
+	unsigned int channel = ide_devices[drive].Channel;
+	//PRD addresses must be word aligned
+	return dma_enabled && prd_tables[channel] && (ide_devices[drive].Capabilities & 0x100) && !(edi & 1);
+}
+
+//describe the buffer to the bus master and arm it, but don't start the transfer yet
+static void ide_dma_prepare(unsigned char channel, unsigned char direction, unsigned int edi, unsigned int byte_count) {
+	ide_prd_t* prd = prd_tables[channel];
+	int count = 0;
+
+	//the buffer is virtually contiguous, but its frames may not be
+	//emit a descriptor per physically contiguous run, never crossing a 64kb boundary
+	while (byte_count) {
+		uint32_t chunk = MIN(byte_count, PAGE_SIZE - (edi & (PAGE_SIZE - 1)));
+		uint32_t phys = vmm_get_phys_for_virt(edi);
+
+		ide_prd_t* prev = count ? &prd[count - 1] : NULL;
+		if (prev && prev->phys_addr + prev->byte_count == phys &&
+				(prev->phys_addr >> 16) == ((phys + chunk - 1) >> 16) &&
+				prev->byte_count + chunk < 0x10000) {
+			prev->byte_count += chunk;
+		}
+		else {
+			prd[count].phys_addr = phys;
+			prd[count].byte_count = chunk;
+			prd[count].flags = 0;
+			count++;
+		}
+		edi += chunk;
+		byte_count -= chunk;
+	}
+	prd[count - 1].flags = PRD_FLAG_EOT;
+
+	outl(channels[channel].bmide + (ATA_REG_BMPRDT - ATA_REG_BMCOMMAND), prd_tables_phys[channel]);
+	ide_write(channel, ATA_REG_BMCOMMAND, direction == ATA_READ ? BM_CMD_READ : 0);
+	//error and interrupt bits are cleared by writing 1s
+	ide_write(channel, ATA_REG_BMSTATUS, ide_read(channel, ATA_REG_BMSTATUS) | BM_SR_ERR | BM_SR_IRQ);
+}
+
+static void ide_dma_start(unsigned char channel) {
+	ide_write(channel, ATA_REG_BMCOMMAND, ide_read(channel, ATA_REG_BMCOMMAND) | BM_CMD_START);
+}
+
+//can we sleep until the drive interrupts, rather than polling its status?
+static bool ide_irq_driven(void) {
+	return irq_handlers_installed && interrupts_enabled();
+}
+
+//block the calling task until the channel raises its IRQ, then rearm for the next one
+//other tasks keep running in the meantime
+//returns false without waiting if IRQs can't be delivered, in which case the caller must poll
+static bool ide_wait_irq(unsigned char channel) {
+	if (!ide_irq_driven()) {
+		return false;
+	}
+	//check the flag and block with interrupts off so the IRQ can't land in between
+	asm volatile("cli");
+	while (!channel_irq_fired[channel]) {
+		if (tasking_is_active()) {
+			wait_queue_sleep(&channel_waiters[channel], IRQ_WAIT);
+		}
+		else {
+			asm volatile("sti; hlt; cli");
+		}
+	}
+	channel_irq_fired[channel] = 0;
+	asm volatile("sti");
+	return true;
+}
+
+//sleep until the channel's IRQ reports the transfer done, then stop the bus master
+static unsigned char ide_dma_finish(unsigned char channel) {
+	uint64_t idle_start = rdtsc();
+	if (!ide_wait_irq(channel)) {
+		while (!(ide_read(channel, ATA_REG_BMSTATUS) & BM_SR_IRQ)) {
+			;
+		}
+	}
+	dma_idle_cycles += rdtsc() - idle_start;
+
+	unsigned char bm_status = ide_read(channel, ATA_REG_BMSTATUS);
+	ide_write(channel, ATA_REG_BMCOMMAND, ide_read(channel, ATA_REG_BMCOMMAND) & ~BM_CMD_START);
+	ide_write(channel, ATA_REG_BMSTATUS, bm_status | BM_SR_ERR | BM_SR_IRQ);
+
+	unsigned char status = ide_read(channel, ATA_REG_STATUS);
+	if ((bm_status & BM_SR_ERR) || (status & ATA_SR_ERR)) {
+		return 2;
+	}
+	if (status & ATA_SR_DF) {
+		return 1;
+	}
+	return 0;
+}
+
+//commit the drive's write cache, sleeping until it's done
+static void ide_ata_flush_cache(unsigned char channel, unsigned char lba_mode) {
+	channel_irq_fired[channel] = 0;
+	ide_write(channel, ATA_REG_COMMAND, (char[]){
+			ATA_CMD_CACHE_FLUSH,
+			ATA_CMD_CACHE_FLUSH,
+			ATA_CMD_CACHE_FLUSH_EXT}[lba_mode]);
+	ide_wait_irq(channel);
+	//polling
+	ide_polling(channel, 0);
+}
+
+static unsigned char ide_ata_access_locked(unsigned char direction, unsigned char drive, unsigned int lba, unsigned int edi, unsigned int byte_count) {
 	unsigned char lba_mode /* 0: CHS, 1:LBA28, 2: LBA48 */, dma /* 0: No DMA, 1: DMA */, cmd;
 	unsigned char lba_io[6];
 	unsigned int  channel      = ide_devices[drive].Channel; // Read the Channel.
@@ -268,11 +432,18 @@ unsigned char ide_ata_access(unsigned char direction, unsigned char drive, unsig
 	unsigned short cyl, i;
 	unsigned char head, sect, err;
 	unsigned int numsects = sectors_from_bytes(byte_count);
+	if (!numsects || numsects > IDE_MAX_SECTORS_PER_COMMAND) {
+		return 0x2;
+	}
 
-	ide_write(channel, ATA_REG_CONTROL, channels[channel].nIEN = (ide_irq_invoked = 0x0) + 0x02);
+	//see if we can let the bus master move the data
+	dma = ide_dma_available(drive, edi);
+
+	//DMA completion is signalled by IRQ, and PIO blocks are too if we can sleep on them
+	ide_write(channel, ATA_REG_CONTROL, channels[channel].nIEN = (dma || ide_irq_driven()) ? 0x00 : 0x02);
 
 	//select one from LBA28, LBA48, or CHS
-	if (lba >= 0x10000000) {
+	if (lba + numsects > 0x10000000) {
 		//LBA48:
 		lba_mode  = 2;
 		lba_io[0] = (lba & 0x000000FF) >> 0;
@@ -313,8 +484,9 @@ unsigned char ide_ata_access(unsigned char direction, unsigned char drive, unsig
 		head 	  = (lba + 1 - sect) % (16 * 63) / (63);
 	}
 
-	//see if drive supports DMA or not
-	dma = 0;
+	//transfer a block of sectors per DRQ if the drive was put in multiple mode
+	unsigned char multiple = !dma && numsects > 1 && ide_devices[drive].MultipleSectors > 1;
+	unsigned int block_sects = multiple ? ide_devices[drive].MultipleSectors : 1;
 
 	//wait if drive is busy
 	while (ide_read(channel, ATA_REG_STATUS) & ATA_SR_BSY) {
@@ -333,12 +505,13 @@ unsigned char ide_ata_access(unsigned char direction, unsigned char drive, unsig
 
 	//write parameters
 	if (lba_mode == 2) {
-		ide_write(channel, ATA_REG_SECCOUNT1, 0);
+		ide_write(channel, ATA_REG_SECCOUNT1, (numsects >> 8) & 0xFF);
 		ide_write(channel, ATA_REG_LBA3, lba_io[3]);
 		ide_write(channel, ATA_REG_LBA4, lba_io[4]);
 		ide_write(channel, ATA_REG_LBA5, lba_io[5]);
 	}
-	ide_write(channel, ATA_REG_SECCOUNT0, numsects);
+	//a count of 256 is written as 0
+	ide_write(channel, ATA_REG_SECCOUNT0, numsects & 0xFF);
 	ide_write(channel, ATA_REG_LBA0, lba_io[0]);
 	ide_write(channel, ATA_REG_LBA1, lba_io[1]);
 	ide_write(channel, ATA_REG_LBA2, lba_io[2]);
@@ -355,57 +528,126 @@ unsigned char ide_ata_access(unsigned char direction, unsigned char drive, unsig
 	if (lba_mode == 0 && dma == 1 && direction == 1) cmd = ATA_CMD_WRITE_DMA;
 	if (lba_mode == 1 && dma == 1 && direction == 1) cmd = ATA_CMD_WRITE_DMA;
 	if (lba_mode == 2 && dma == 1 && direction == 1) cmd = ATA_CMD_WRITE_DMA_EXT;
+	if (multiple && direction == 0) cmd = (lba_mode == 2) ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE;
+	if (multiple && direction == 1) cmd = (lba_mode == 2) ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_MULTIPLE;
+	if (dma) {
+		ide_dma_prepare(channel, direction, edi, numsects * SECTOR_SIZE);
+	}
+
 	//send command
+	//an IRQ left over from an earlier command mustn't satisfy this one
+	channel_irq_fired[channel] = 0;
 	ide_write(channel, ATA_REG_COMMAND, cmd);
 
 	if (dma) {
-		printf_err("DMA is not supported.\n");
-		return -1;
+		ide_dma_start(channel);
+		if ((err = ide_dma_finish(channel))) {
+			return err;
+		}
+		if (direction == 1) {
+			ide_ata_flush_cache(channel, lba_mode);
+		}
 	}
 	else {
 		if (direction == 0) {
 			//PIO read
-			for (i = 0; i < numsects; i++) {
+			//the drive raises DRQ once per block, which is a single sector unless we're in multiple mode
+			//each block is announced by an IRQ, so sleep until it's ready
+			for (i = 0; i < numsects; i += block_sects) {
+				ide_wait_irq(channel);
 				if ((err = ide_polling(channel, 1))) {
 					//polling, set error and exit if there is
 					return err;
 				}
 
-				int words = SECTOR_SIZE / 2;
+				int words = MIN(block_sects, numsects - i) * SECTOR_SIZE / 2;
 				insw(bus, edi, words);
 				edi += (words * 2);
 			}
 		}
 		else {
 			//PIO write
-			for (uint32_t i = 0; i < numsects; i++) {
+			//the drive asks for the first block without interrupting,
+			//then raises an IRQ once it's taken each block
+			for (uint32_t i = 0; i < numsects; i += block_sects) {
+				if (i > 0) {
+					ide_wait_irq(channel);
+				}
 				//polling
 				ide_polling(channel, 0);
 
-				int words = SECTOR_SIZE / 2;
-				asm("rep outsw"::"c"(words), "d"(bus), "S"(edi)); //send data
+				int words = MIN(block_sects, numsects - i) * SECTOR_SIZE / 2;
+				asm volatile("rep outsw"::"c"(words), "d"(bus), "S"(edi)); //send data
 				edi += (words * 2);
 			}
-			ide_write(channel, ATA_REG_COMMAND, (char[]){
-					ATA_CMD_CACHE_FLUSH,
-					ATA_CMD_CACHE_FLUSH,
-					ATA_CMD_CACHE_FLUSH_EXT}[lba_mode]);
-			//polling
-			ide_polling(channel, 0);
+			ide_wait_irq(channel);
+			ide_ata_flush_cache(channel, lba_mode);
 		}
 	}
 
 	return 0;
 }
 
-void ide_wait_irq() {
-	while (ide_irq_invoked)
-		;
-	ide_irq_invoked = 0;
+unsigned char ide_ata_access(unsigned char direction, unsigned char drive, unsigned int lba, unsigned int edi, unsigned int byte_count) {
+	unsigned int channel = ide_devices[drive].Channel;
+	sleep_lock_acquire(&channel_locks[channel]);
+	unsigned char err = ide_ata_access_locked(direction, drive, lba, edi, byte_count);
+	sleep_lock_release(&channel_locks[channel]);
+	return err;
+}
+
+static void ide_channel_irq(unsigned char channel) {
+	//reading the status register acknowledges the interrupt on the drive's side
+	ide_read(channel, ATA_REG_STATUS);
+	channel_irq_fired[channel] = 1;
+	wait_queue_wake_all(&channel_waiters[channel]);
+}
+
+static int ide_primary_irq(register_state_t* UNUSED(regs)) {
+	ide_channel_irq(ATA_PRIMARY);
+	return 0;
+}
+
+static int ide_secondary_irq(register_state_t* UNUSED(regs)) {
+	ide_channel_irq(ATA_SECONDARY);
+	return 0;
 }
 
-void ide_irq() {
-	ide_irq_invoked = 1;
+void ide_dma_set_enabled(bool enabled) {
+	dma_enabled = enabled;
+}
+
+uint64_t ide_dma_idle_cycles(void) {
+	return dma_idle_cycles;
+}
+
+void ide_install(void) {
+	pci_device* controller = pci_find_class(PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_IDE);
+	if (!controller) {
+		printf_err("No PCI IDE controller found");
+		return;
+	}
+
+	interrupt_setup_callback(INT_VECTOR_IRQ14, &ide_primary_irq);
+	interrupt_setup_callback(INT_VECTOR_IRQ15, &ide_secondary_irq);
+
+	//BARs 0-3 read as 0 for channels in compatibility mode, in which case ide_initialize uses the legacy ports
+	//BAR4 holds the bus master registers for both channels
+	uint32_t bar4 = controller->bar[4];
+	ide_initialize(controller->bar[0], controller->bar[1], controller->bar[2], controller->bar[3], bar4);
+	irq_handlers_installed = true;
+
+	//bus master registers must be in I/O space
+	if (!(bar4 & 0x1) || !(bar4 & 0xFFFFFFFC)) {
+		printf_info("IDE controller has no bus master, using PIO");
+		return;
+	}
+	pci_enable_bus_master(controller);
+	for (int i = 0; i < 2; i++) {
+		prd_tables[i] = (ide_prd_t*)kmalloc_ap(PAGE_SIZE, &prd_tables_phys[i]);
+		memset(prd_tables[i], 0, PAGE_SIZE);
+	}
+	printf_info("IDE bus master DMA at 0x%x", bar4 & 0xFFFFFFFC);
 }
 
 unsigned char ide_atapi_read(unsigned char drive, unsigned int lba, unsigned char numsects, unsigned int edi) {
@@ -418,7 +660,7 @@ unsigned char ide_atapi_read(unsigned char drive, unsigned int lba, unsigned cha
 	int i;
 
 	//enable IRQs
-	ide_write(channel, ATA_REG_CONTROL, channels[channel].nIEN = ide_irq_invoked = 0x0);
+	ide_write(channel, ATA_REG_CONTROL, channels[channel].nIEN = 0x0);
 
 	//setup SCSI packet
 	atapi_packet[ 0] = ATAPI_CMD_READ;
@@ -453,6 +695,7 @@ unsigned char ide_atapi_read(unsigned char drive, unsigned int lba, unsigned cha
 	ide_write(channel, ATA_REG_LBA2, (words*2) >> 8);
 
 	//send packet command
+	channel_irq_fired[channel] = 0;
 	ide_write(channel, ATA_REG_COMMAND, ATA_CMD_PACKET);
 
 	//waiting for driver to finish or return error code
@@ -464,7 +707,7 @@ unsigned char ide_atapi_read(unsigned char drive, unsigned int lba, unsigned cha
 	//receiving data
 	for (i = 0; i < numsects; i++) {
 		//wait for IRQ
-		ide_wait_irq();
+		ide_wait_irq(channel);
 		if ((err = ide_polling(channel, 1))) {
 			return err;
 		}
@@ -474,7 +717,7 @@ unsigned char ide_atapi_read(unsigned char drive, unsigned int lba, unsigned cha
 	}
 
 	//wait for IRQ
-	ide_wait_irq();
+	ide_wait_irq(channel);
 
 	//wait for BSY & DRQ to clear
 	while (ide_read(channel, ATA_REG_STATUS) & (ATA_SR_BSY | ATA_SR_DRQ))
@@ -495,102 +738,167 @@ void ide_ata_write_int(unsigned char drive, unsigned int lba, unsigned int val,
 	ide_ata_write(drive, lba, (unsigned int)bytes, sizeof(int), offset);
 }
 
-void ide_ata_read(unsigned char drive, unsigned int lba, unsigned int edi, unsigned int byte_count, unsigned int offset) {
-	//if offset is greater than a sector, offset lba so we're starting at the correct sector
-	int sector_offset = offset / SECTOR_SIZE;
-	lba += sector_offset;
-	offset -= (sector_offset * SECTOR_SIZE);
+uint32_t ide_ata_sector_count(unsigned char drive) {
+	if (drive > 3 || ide_devices[drive].Reserved == 0 || ide_devices[drive].Type != IDE_ATA) {
+		return 0;
+	}
+	return ide_devices[drive].Size;
+}
 
-	unsigned int numsects = sectors_from_bytes(byte_count);
+//check that @p count sectors from @p lba can be accessed on @p drive
+static unsigned char ide_ata_check_range(unsigned char drive, unsigned int lba, unsigned int count) {
 	//check if drive present
 	if (drive > 3 || ide_devices[drive].Reserved == 0) {
 		//drive not found
-		package[0] = 0x1;
+		return 0x1;
 	}
-
 	//check if inputs are valid
-	else if (((lba + numsects) > ide_devices[drive].Size) && (ide_devices[drive].Type == IDE_ATA)) {
+	if (((lba + count) > ide_devices[drive].Size) && (ide_devices[drive].Type == IDE_ATA)) {
 		//seeking to invalid position
-		package[0] = 0x2;
+		return 0x2;
 	}
+	return 0;
+}
 
-	//read in PIO mode through polling and IRQs
-	else {
-		unsigned char err;
-		if (ide_devices[drive].Type == IDE_ATA) {
-			for (uint32_t i = 0; i < numsects; i++) {
-				int sector = lba + i;
-				char sector_buf[512];
-				err = ide_ata_access(ATA_READ, drive, sector, (uint32_t)sector_buf, SECTOR_SIZE);
-
-				//only copy a sector at at time!
-				int copy_count = MIN(byte_count, SECTOR_SIZE);
-
-				memcpy((unsigned char*)edi, &sector_buf[offset], copy_count);
-				//if we've just accounted for the requested offset, remove the offset
-				offset = 0;
-				//we've copied 'copy_count' bytes, decrement from amount left to copy
-				byte_count -= copy_count;
-			}
+unsigned char ide_ata_read_sectors(unsigned char drive, unsigned int lba, unsigned int count, void* buf) {
+	unsigned char err = ide_ata_check_range(drive, lba, count);
+	if (err) {
+		return err;
+	}
+	if (ide_devices[drive].Type != IDE_ATA) {
+		return 20;
+	}
+
+	unsigned int edi = (unsigned int)buf;
+	while (count) {
+		unsigned int chunk = MIN(count, IDE_MAX_SECTORS_PER_COMMAND);
+		if ((err = ide_ata_access(ATA_READ, drive, lba, edi, chunk * SECTOR_SIZE))) {
+			return err;
 		}
-		else if (ide_devices[drive].Type == IDE_ATAPI) {
-			for (uint32_t i = 0; i < numsects; i++) {
-				err = ide_atapi_read(drive, lba + i, 1, edi + (i*2048));
-			}
+		lba += chunk;
+		edi += chunk * SECTOR_SIZE;
+		count -= chunk;
+	}
+	return 0;
+}
+
+unsigned char ide_ata_write_sectors(unsigned char drive, unsigned int lba, unsigned int count, const void* buf) {
+	unsigned char err = ide_ata_check_range(drive, lba, count);
+	if (err) {
+		return err;
+	}
+	if (ide_devices[drive].Type != IDE_ATA) {
+		//write protected
+		return 4;
+	}
+
+	unsigned int esi = (unsigned int)buf;
+	while (count) {
+		unsigned int chunk = MIN(count, IDE_MAX_SECTORS_PER_COMMAND);
+		if ((err = ide_ata_access(ATA_WRITE, drive, lba, esi, chunk * SECTOR_SIZE))) {
+			return err;
 		}
-		package[0] = ide_print_error(drive, err);
+		lba += chunk;
+		esi += chunk * SECTOR_SIZE;
+		count -= chunk;
 	}
-	ide_print_error(drive, package[0]);
+	return 0;
 }
 
-void ide_ata_write(unsigned char drive, unsigned int lba, unsigned int edi, unsigned int byte_count, unsigned int offset) {
+void ide_ata_read(unsigned char drive, unsigned int lba, unsigned int edi, unsigned int byte_count, unsigned int offset) {
 	//if offset is greater than a sector, offset lba so we're starting at the correct sector
 	int sector_offset = offset / SECTOR_SIZE;
 	lba += sector_offset;
 	offset -= (sector_offset * SECTOR_SIZE);
 
-	unsigned int numsects = sectors_from_bytes(byte_count);
+	unsigned int numsects = sectors_from_bytes(offset + byte_count);
+	package[0] = ide_ata_check_range(drive, lba, numsects);
+	if (package[0]) {
+		ide_print_error(drive, package[0]);
+		return;
+	}
 
-	//check if drive is present
-	if (drive > 3 || ide_devices[drive].Reserved == 0) {
-		//drive not found!
-		package[0] = 0x1;
+	unsigned char err = 0;
+	if (ide_devices[drive].Type == IDE_ATA) {
+		unsigned char* out = (unsigned char*)edi;
+		char sector_buf[512];
+
+		//partial leading sector goes through a bounce buffer
+		if (offset || byte_count < SECTOR_SIZE) {
+			err = ide_ata_read_sectors(drive, lba, 1, sector_buf);
+			int copy_count = MIN(byte_count, SECTOR_SIZE - offset);
+			memcpy(out, &sector_buf[offset], copy_count);
+			out += copy_count;
+			byte_count -= copy_count;
+			lba++;
+		}
+		//whole sectors are transferred straight into the caller's buffer
+		unsigned int whole_sects = byte_count / SECTOR_SIZE;
+		if (!err && whole_sects) {
+			err = ide_ata_read_sectors(drive, lba, whole_sects, out);
+			out += whole_sects * SECTOR_SIZE;
+			byte_count -= whole_sects * SECTOR_SIZE;
+			lba += whole_sects;
+		}
+		//partial trailing sector
+		if (!err && byte_count) {
+			err = ide_ata_read_sectors(drive, lba, 1, sector_buf);
+			memcpy(out, sector_buf, byte_count);
+		}
 	}
-	//check if inputs are valid
-	else if (((lba + numsects) > ide_devices[drive].Size) && (ide_devices[drive].Type == IDE_ATA)) {
-		//seeking to invalid position
-		package[0] = 0x2;
+	else if (ide_devices[drive].Type == IDE_ATAPI) {
+		for (uint32_t i = 0; i < numsects; i++) {
+			err = ide_atapi_read(drive, lba + i, 1, edi + (i*2048));
+		}
 	}
-	//read in PIO mode through polling and IRQs
-	else {
-		unsigned char err;
-		if (ide_devices[drive].Type == IDE_ATA) {
-			for (uint32_t i = 0; i < numsects; i++) {
-				int sector = lba + i;
-				char sector_buf[512];
-				memset(sector_buf, 0, sizeof(sector_buf));
-				ide_ata_read(drive, sector, (uint32_t)sector_buf, SECTOR_SIZE, 0);
-
-				//copy over data to write
-				//only copy a sector at at time!
-				int copy_count = MIN(byte_count, SECTOR_SIZE);
-
-				memcpy(&sector_buf[offset], (unsigned char*)edi, copy_count);
-				//if we've just accounted for the requested offset, remove the offset
-				offset = 0;
-				//we've copied 'copy_count' bytes, decrement from amount left to copy
-				byte_count -= copy_count;
-
-				//copy back to actual sector
-				err = ide_ata_access(ATA_WRITE, drive, sector, (uint32_t)sector_buf, SECTOR_SIZE);
-			}
+	package[0] = ide_print_error(drive, err);
+}
+
+void ide_ata_write(unsigned char drive, unsigned int lba, unsigned int edi, unsigned int byte_count, unsigned int offset) {
+	//if offset is greater than a sector, offset lba so we're starting at the correct sector
+	int sector_offset = offset / SECTOR_SIZE;
+	lba += sector_offset;
+	offset -= (sector_offset * SECTOR_SIZE);
+
+	unsigned int numsects = sectors_from_bytes(offset + byte_count);
+	package[0] = ide_ata_check_range(drive, lba, numsects);
+	if (package[0]) {
+		return;
+	}
+
+	unsigned char err = 0;
+	if (ide_devices[drive].Type == IDE_ATA) {
+		const unsigned char* in = (const unsigned char*)edi;
+		char sector_buf[512];
+
+		//partial sectors are read, modified, then written back
+		if (offset || byte_count < SECTOR_SIZE) {
+			err = ide_ata_read_sectors(drive, lba, 1, sector_buf);
+			int copy_count = MIN(byte_count, SECTOR_SIZE - offset);
+			memcpy(&sector_buf[offset], in, copy_count);
+			if (!err) err = ide_ata_write_sectors(drive, lba, 1, sector_buf);
+			in += copy_count;
+			byte_count -= copy_count;
+			lba++;
 		}
-		else if (ide_devices[drive].Type == IDE_ATAPI) {
-			//write protected
-			err = 4;
+		unsigned int whole_sects = byte_count / SECTOR_SIZE;
+		if (!err && whole_sects) {
+			err = ide_ata_write_sectors(drive, lba, whole_sects, in);
+			in += whole_sects * SECTOR_SIZE;
+			byte_count -= whole_sects * SECTOR_SIZE;
+			lba += whole_sects;
 		}
-		package[0] = ide_print_error(drive, err);
+		if (!err && byte_count) {
+			err = ide_ata_read_sectors(drive, lba, 1, sector_buf);
+			memcpy(sector_buf, in, byte_count);
+			if (!err) err = ide_ata_write_sectors(drive, lba, 1, sector_buf);
+		}
+	}
+	else if (ide_devices[drive].Type == IDE_ATAPI) {
+		//write protected
+		err = 4;
 	}
+	package[0] = ide_print_error(drive, err);
 }
 
 void ide_atapi_eject(unsigned char drive) {
@@ -598,7 +906,6 @@ void ide_atapi_eject(unsigned char drive) {
 	unsigned int 	slavebit = ide_devices[drive].Drive;
 	unsigned int 	bus 	 = channels[channel].base;
 	unsigned char   err 	 = 0;
-	ide_irq_invoked = 0;
 
 	//check if drive present
 	if (drive > 3 || ide_devices[drive].Reserved == 0) {
@@ -613,7 +920,7 @@ void ide_atapi_eject(unsigned char drive) {
 	//eject ATAPI driver
 	else {
 		//enable IRQs
-		ide_write(channel, ATA_REG_CONTROL, channels[channel].nIEN = ide_irq_invoked = 0x0);
+		ide_write(channel, ATA_REG_CONTROL, channels[channel].nIEN = 0x0);
 
 		//setup SCSI packet
 		atapi_packet[ 0] = ATAPI_CMD_EJECT;
@@ -639,6 +946,7 @@ void ide_atapi_eject(unsigned char drive) {
 		}
 
 		//send packet command
+		channel_irq_fired[channel] = 0;
 		ide_write(channel, ATA_REG_COMMAND, ATA_CMD_PACKET);
 
 		//waiting for the driver to finish/invoke error
@@ -650,7 +958,7 @@ void ide_atapi_eject(unsigned char drive) {
 		else {
 			asm("rep outsw"::"c"(6), "d"(bus), "S"(atapi_packet));
 			//wait for IRQ
-			ide_wait_irq();
+			ide_wait_irq(channel);
 			//polling and get error code
 			err = ide_polling(channel, 1);
 			//DRQ is not needed here
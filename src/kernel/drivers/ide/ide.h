@@ -2,6 +2,7 @@
 #define IDE_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <std/std.h>
 
 #define ATA_SR_BSY	0x80 //busy
@@ -30,6 +31,11 @@
 #define ATA_CMD_WRITE_PIO_EXT	0x34
 #define ATA_CMD_WRITE_DMA		0xCA
 #define ATA_CMD_WRITE_DMA_EXT	0x35
+#define ATA_CMD_READ_MULTIPLE		0xC4
+#define ATA_CMD_READ_MULTIPLE_EXT	0x29
+#define ATA_CMD_WRITE_MULTIPLE		0xC5
+#define ATA_CMD_WRITE_MULTIPLE_EXT	0x39
+#define ATA_CMD_SET_MULTIPLE_MODE	0xC6
 #define ATA_CMD_CACHE_FLUSH		0xE7
 #define ATA_CMD_CACHE_FLUSH_EXT	0xEA
 #define ATA_CMD_PACKET			0xA0
@@ -46,6 +52,7 @@
 #define ATA_IDENT_SERIAL				20
 #define ATA_IDENT_MODEL					54
 #define ATA_IDENT_CAPABILITIES			98
+#define ATA_IDENT_MAX_MULTIPLE			94
 #define ATA_IDENT_FIELDVALID			106
 #define ATA_IDENT_MAX_LBA				120
 #define ATA_IDENT_COMMANDSETS			164
@@ -71,6 +78,20 @@
 #define ATA_REG_CONTROL    0x0C
 #define ATA_REG_ALTSTATUS  0x0C
 #define ATA_REG_DEVADDRESS 0x0D
+//bus master IDE registers, relative to the channel's BMIDE base
+#define ATA_REG_BMCOMMAND  0x0E
+#define ATA_REG_BMSTATUS   0x10
+#define ATA_REG_BMPRDT     0x12
+
+#define BM_CMD_START	0x01 //start/stop bus master transfer
+#define BM_CMD_READ	0x08 //transfer direction is device to memory
+#define BM_SR_ACTIVE	0x01 //transfer in progress
+#define BM_SR_ERR	0x02 //transfer failed, write 1 to clear
+#define BM_SR_IRQ	0x04 //device raised its interrupt, write 1 to clear
+
+//most sectors a single READ/WRITE command will transfer
+//(a sector count register of 0 means 256)
+#define IDE_MAX_SECTORS_PER_COMMAND 256u
 
 // Channels:
 #define      ATA_PRIMARY      0x00
@@ -82,6 +103,22 @@
 
 void ide_initialize(unsigned int BAR0, unsigned int BAR1, unsigned int BAR2, unsigned int BAR3, unsigned int BAR4);
 
+/**
+ * @brief Find the IDE controller on the PCI bus, detect its drives, and set up bus-master DMA if available
+ * @warning pci_install() must have been called first
+ */
+void ide_install(void);
+
+/**
+ * @brief Allow or forbid bus-master DMA. When forbidden, all transfers use PIO
+ */
+void ide_dma_set_enabled(bool enabled);
+
+/**
+ * @brief Cycles spent waiting for DMA completion interrupts, during which the CPU runs other tasks or halts
+ */
+uint64_t ide_dma_idle_cycles(void);
+
 /**
  * @brief Reads @p numsects hard drive sectors from the drive specified by @p drive into the buffer @p buf
  * @param drive IDE drive channel to read from
@@ -102,6 +139,27 @@ void ide_ata_read(unsigned char drive, unsigned int lba, unsigned int buf, unsig
  */
 void ide_ata_write(unsigned char drive, unsigned int lba, unsigned int buf, unsigned int count, unsigned int offset);
 
+/**
+ * @brief Reads @p count whole sectors starting at @p lba directly into @p buf
+ * @param drive IDE drive to read from
+ * @param lba Block to begin reading from
+ * @param count Number of 512-byte sectors to read. Transfers are split into commands of up to IDE_MAX_SECTORS_PER_COMMAND sectors
+ * @param buf Buffer of at least @p count * 512 bytes
+ * @return 0 on success, or an IDE error code
+ */
+unsigned char ide_ata_read_sectors(unsigned char drive, unsigned int lba, unsigned int count, void* buf);
+
+/**
+ * @brief Writes @p count whole sectors from @p buf to the disk starting at @p lba
+ * @return 0 on success, or an IDE error code
+ */
+unsigned char ide_ata_write_sectors(unsigned char drive, unsigned int lba, unsigned int count, const void* buf);
+
+/**
+ * @brief Size of ATA drive @p drive in sectors, or 0 if it isn't present
+ */
+uint32_t ide_ata_sector_count(unsigned char drive);
+
 void ide_ata_write_int(unsigned char drive, unsigned int lba, unsigned int val, unsigned int offset);
 uint32_t ide_ata_read_int(unsigned char drive, unsigned int lba, unsigned int offset);
 
@@ -29,6 +29,28 @@ uint16_t pci_config_readw(uint8_t bus, uint8_t slot, uint8_t function, uint8_t o
 	return (in);
 }
 
+static uint32_t pci_config_address(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+	return (uint32_t)(((uint32_t)bus << 16) | ((uint32_t)slot << 11) | ((uint32_t)function << 8) | (offset & 0xfc) | ((uint32_t)0x80000000));
+}
+
+uint32_t pci_config_readl(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+	outl(0xCF8, pci_config_address(bus, slot, function, offset));
+	return inl(0xCFC);
+}
+
+void pci_config_writel(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint32_t val) {
+	outl(0xCF8, pci_config_address(bus, slot, function, offset));
+	outl(0xCFC, val);
+}
+
+void pci_config_writew(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint16_t val) {
+	//config space is accessed a dword at a time, so preserve the other half of the register
+	uint32_t reg = pci_config_readl(bus, slot, function, offset);
+	uint32_t shift = (offset & 2) * 8;
+	reg = (reg & ~(0xFFFF << shift)) | ((uint32_t)val << shift);
+	pci_config_writel(bus, slot, function, offset, reg);
+}
+
 uint16_t pci_vendor_id(uint8_t bus, uint8_t slot, uint8_t function) {
 	//try and read first config register
 	uint16_t vendor = pci_config_readw(bus, slot, function, 0);
@@ -148,9 +170,22 @@ void pci_traverse_buses(void) {
 
 				uint16_t device_id = pci_device_id(bus, slot, func);
 				pci_device* device = (pci_device*)kmalloc(sizeof(pci_device));
+				memset(device, 0, sizeof(pci_device));
 				device->vendor = vendor;
 				device->device = device_id;
 				device->func = func;
+				device->bus = bus;
+				device->slot = slot;
+
+				uint32_t class_reg = pci_config_readl(bus, slot, func, PCI_REG_CLASS);
+				device->class_code = class_reg >> 24;
+				device->subclass = (class_reg >> 16) & 0xFF;
+				device->prog_if = (class_reg >> 8) & 0xFF;
+				device->irq_line = pci_config_readl(bus, slot, func, PCI_REG_IRQ_LINE) & 0xFF;
+				for (int i = 0; i < 6; i++) {
+					device->bar[i] = pci_config_readl(bus, slot, func, PCI_REG_BAR0 + (i * 4));
+				}
+
 				array_m_insert(devices, device);
 			}
 		}
@@ -179,6 +214,22 @@ pci_device* pci_get_device(uint16_t vendor_id, uint16_t device_id) {
 	return NULL;
 }
 
+pci_device* pci_find_class(uint8_t class_code, uint8_t subclass) {
+	for (int i = 0; i < devices->size; i++) {
+		pci_device* tmp = array_m_lookup(devices, i);
+		if (tmp->class_code == class_code && tmp->subclass == subclass) {
+			return tmp;
+		}
+	}
+	return NULL;
+}
+
+void pci_enable_bus_master(pci_device* device) {
+	uint16_t command = pci_config_readw(device->bus, device->slot, device->func, PCI_REG_COMMAND);
+	command |= PCI_COMMAND_BUS_MASTER;
+	pci_config_writew(device->bus, device->slot, device->func, PCI_REG_COMMAND, command);
+}
+
 void pci_install() {
 	printf_info("Registering pci devices...");
 
@@ -3,13 +3,46 @@
 
 #include <std/std.h>
 
+//configuration space registers
+#define PCI_REG_COMMAND		0x04
+#define PCI_REG_CLASS		0x08
+#define PCI_REG_BAR0		0x10
+#define PCI_REG_IRQ_LINE	0x3C
+
+#define PCI_COMMAND_IO_SPACE	0x1
+#define PCI_COMMAND_MEM_SPACE	0x2
+#define PCI_COMMAND_BUS_MASTER	0x4
+
+#define PCI_CLASS_MASS_STORAGE	0x01
+#define PCI_SUBCLASS_IDE	0x01
+#define PCI_SUBCLASS_SATA	0x06
+
 typedef struct pci_device {
 	uint16_t vendor;
 	uint16_t device;
 	uint16_t func;
+	uint8_t bus;
+	uint8_t slot;
+	uint8_t class_code;
+	uint8_t subclass;
+	uint8_t prog_if;
+	uint8_t irq_line;
+	uint32_t bar[6];
 } pci_device;
 
 void pci_install(void);
 void pci_list(void);
 
+uint16_t pci_config_readw(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset);
+uint32_t pci_config_readl(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset);
+void pci_config_writew(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint16_t val);
+void pci_config_writel(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint32_t val);
+
+//find a detected device by vendor and device ID
+pci_device* pci_get_device(uint16_t vendor_id, uint16_t device_id);
+//find the first detected device with the given class and subclass
+pci_device* pci_find_class(uint8_t class_code, uint8_t subclass);
+//allow @p device to initiate DMA
+void pci_enable_bus_master(pci_device* device);
+
 #endif
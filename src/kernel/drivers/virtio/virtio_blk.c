@@ -0,0 +1,301 @@
+#include "virtio_blk.h"
+#include <std/std.h>
+#include <std/common.h>
+#include <std/math.h>
+#include <kernel/vmm/vmm.h>
+#include <kernel/interrupts/interrupts.h>
+#include <kernel/drivers/pci/pci_detect.h>
+#include <kernel/multitasking/tasks/task_small.h>
+#include <kernel/util/blkq/blkq.h>
+
+#define SECTOR_SIZE ((uint32_t)512)
+
+static uint16_t io_base = 0;
+static uint16_t queue_size = 0;
+static virtq_desc_t* desc = 0;
+static virtq_avail_t* avail = 0;
+static volatile virtq_used_t* used = 0;
+//used->idx as of the last completion we've seen
+static uint16_t last_used = 0;
+//descriptors filled in for the request being built
+static uint16_t desc_count = 0;
+
+//header and status byte of the request in flight share a page
+//blkq issues one transfer at a time, so only one request is ever in flight
+static virtio_blk_req_header_t* header = 0;
+static uint32_t header_phys = 0;
+static volatile uint8_t* status = 0;
+static uint32_t status_phys = 0;
+
+static uint32_t capacity = 0;	//sectors
+static int blkq_drive = -1;
+
+static volatile bool irq_fired = false;
+static wait_queue_t irq_waiters = {0};
+static bool irq_handler_installed = false;
+
+static struct {
+	uint32_t requests;
+	uint32_t sectors;
+	uint32_t descriptors;
+	uint32_t errors;
+	uint64_t wait_cycles;
+} stats;
+
+static int virtio_blk_irq(register_state_t* UNUSED(regs)) {
+	//reading the ISR acknowledges the interrupt, and reads 0 if it wasn't ours
+	if (!inb(io_base + VIRTIO_REG_ISR)) {
+		return 0;
+	}
+	irq_fired = true;
+	wait_queue_wake_all(&irq_waiters);
+	return 0;
+}
+
+//block the calling task until the device raises its IRQ, then rearm for the next one
+//returns false without waiting if IRQs can't be delivered, in which case the caller must poll
+static bool virtio_blk_wait_irq(void) {
+	if (!irq_handler_installed || !interrupts_enabled()) {
+		return false;
+	}
+	//check the flag and block with interrupts off so the IRQ can't land in between
+	asm volatile("cli");
+	while (!irq_fired) {
+		if (tasking_is_active()) {
+			wait_queue_sleep(&irq_waiters, IRQ_WAIT);
+		}
+		else {
+			asm volatile("sti; hlt; cli");
+		}
+	}
+	irq_fired = false;
+	asm volatile("sti");
+	return true;
+}
+
+static void virtio_blk_add_desc(uint32_t phys, uint32_t len, uint16_t flags, bool may_merge) {
+	//extend the previous descriptor if this continues it in physical memory
+	virtq_desc_t* prev = desc_count ? &desc[desc_count - 1] : NULL;
+	if (may_merge && prev && prev->flags == flags && prev->addr + prev->len == phys) {
+		prev->len += len;
+		return;
+	}
+	desc[desc_count].addr = phys;
+	desc[desc_count].len = len;
+	desc[desc_count].flags = flags;
+	desc[desc_count].next = 0;
+	desc_count++;
+}
+
+//describe a virtually contiguous buffer, one descriptor per physically contiguous run
+static void virtio_blk_add_buffer(uint32_t addr, uint32_t len, uint16_t flags, bool may_merge) {
+	while (len) {
+		uint32_t chunk = MIN(len, PAGE_SIZE - (addr & (PAGE_SIZE - 1)));
+		virtio_blk_add_desc(vmm_get_phys_for_virt(addr), chunk, flags, may_merge);
+		may_merge = true;
+		addr += chunk;
+		len -= chunk;
+	}
+}
+
+//hand the chain built in desc to the device, and wait for it to complete
+static int virtio_blk_issue(void) {
+	for (int i = 0; i < desc_count - 1; i++) {
+		desc[i].flags |= VIRTQ_DESC_F_NEXT;
+		desc[i].next = i + 1;
+	}
+	stats.descriptors += desc_count;
+
+	*status = 0xFF;
+	avail->ring[avail->idx % queue_size] = 0;
+	//the device must see the ring entry before the index which publishes it
+	__sync_synchronize();
+	irq_fired = false;
+	avail->idx++;
+	__sync_synchronize();
+	outw(io_base + VIRTIO_REG_QUEUE_NOTIFY, 0);
+
+	uint64_t wait_start = rdtsc();
+	while (used->idx == last_used) {
+		//an IRQ may also report a configuration change, so keep checking the ring
+		virtio_blk_wait_irq();
+	}
+	stats.wait_cycles += rdtsc() - wait_start;
+	last_used++;
+
+	if (*status != VIRTIO_BLK_S_OK) {
+		stats.errors++;
+		return 1 + *status;
+	}
+	return 0;
+}
+
+//transfer consecutive sectors starting at @p lba, spread over the buffers in @p segs
+//split into as many requests as the queue's descriptors require
+static int virtio_blk_transfer(uint8_t direction, uint32_t lba, blk_segment_t* segs, uint32_t seg_count) {
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < seg_count; i++) {
+		count += segs[i].count;
+	}
+	if (lba >= capacity || count > capacity - lba) {
+		return 1;
+	}
+
+	uint16_t data_flags = (direction == BLKQ_READ) ? VIRTQ_DESC_F_WRITE : 0;
+	uint32_t seg = 0;
+	uint32_t seg_done = 0;	//sectors of segs[seg] already described
+
+	while (seg < seg_count) {
+		desc_count = 0;
+		header->type = (direction == BLKQ_WRITE) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+		header->reserved = 0;
+		header->sector = lba;
+		virtio_blk_add_desc(header_phys, sizeof(virtio_blk_req_header_t), 0, false);
+
+		//a sector may straddle two pages, and the status byte needs the last descriptor
+		uint32_t sectors = 0;
+		while (seg < seg_count && desc_count + 3 <= queue_size) {
+			uint32_t addr = (uint32_t)segs[seg].buf + (seg_done * SECTOR_SIZE);
+			virtio_blk_add_buffer(addr, SECTOR_SIZE, data_flags, sectors > 0);
+			sectors++;
+			if (++seg_done == segs[seg].count) {
+				seg++;
+				seg_done = 0;
+			}
+		}
+		virtio_blk_add_desc(status_phys, 1, VIRTQ_DESC_F_WRITE, false);
+
+		int err = virtio_blk_issue();
+		if (err) {
+			return err;
+		}
+		stats.requests++;
+		stats.sectors += sectors;
+		lba += sectors;
+	}
+	return 0;
+}
+
+//the device has a single unit, so the unit numbers below are always 0
+static int virtio_blk_transfer_sg(uint32_t UNUSED(unit), uint8_t direction, uint32_t lba, blk_segment_t* segs, uint32_t seg_count) {
+	return virtio_blk_transfer(direction, lba, segs, seg_count);
+}
+
+static int virtio_blk_read(uint32_t UNUSED(unit), uint32_t lba, uint32_t count, uint8_t* buf) {
+	blk_segment_t seg = {buf, count};
+	return virtio_blk_transfer(BLKQ_READ, lba, &seg, 1);
+}
+
+static int virtio_blk_write(uint32_t UNUSED(unit), uint32_t lba, uint32_t count, const uint8_t* buf) {
+	blk_segment_t seg = {(uint8_t*)buf, count};
+	return virtio_blk_transfer(BLKQ_WRITE, lba, &seg, 1);
+}
+
+static uint32_t virtio_blk_capacity(uint32_t UNUSED(unit)) {
+	return capacity;
+}
+
+static const blk_driver_t virtio_blk_driver = {
+	.name = "virtio-blk",
+	.read = virtio_blk_read,
+	.write = virtio_blk_write,
+	.capacity = virtio_blk_capacity,
+	.transfer_sg = virtio_blk_transfer_sg,
+};
+
+//bytes of memory a legacy virtqueue of @p size entries occupies
+static uint32_t virtq_bytes(uint16_t size) {
+	uint32_t rings = (sizeof(virtq_desc_t) * size) + (sizeof(uint16_t) * (3 + size));
+	uint32_t used_ring = (sizeof(uint16_t) * 3) + (sizeof(virtq_used_elem_t) * size);
+	return ((rings + VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1)) + ((used_ring + VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1));
+}
+
+static int virtio_blk_fail(const char* reason) {
+	outb(io_base + VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+	printf_err("virtio-blk: %s", reason);
+	return -1;
+}
+
+int virtio_blk_install(void) {
+	if (blkq_drive >= 0) {
+		return blkq_drive;
+	}
+	pci_device* device = pci_get_device(VIRTIO_VENDOR, VIRTIO_BLK_DEVICE);
+	if (!device) {
+		printf_info("No virtio block device found");
+		return -1;
+	}
+	//legacy devices put their registers in I/O space
+	if (!(device->bar[0] & 0x1)) {
+		printf_err("virtio-blk BAR0 isn't an I/O port range");
+		return -1;
+	}
+	io_base = device->bar[0] & 0xFFFC;
+	pci_enable_bus_master(device);
+
+	//reset, then tell the device we've found it and know how to drive it
+	outb(io_base + VIRTIO_REG_STATUS, 0);
+	outb(io_base + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACK);
+	outb(io_base + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+	//no optional features are needed
+	inl(io_base + VIRTIO_REG_DEVICE_FEATURES);
+	outl(io_base + VIRTIO_REG_GUEST_FEATURES, 0);
+
+	//the device picks the size of the queue
+	outw(io_base + VIRTIO_REG_QUEUE_SELECT, 0);
+	queue_size = inw(io_base + VIRTIO_REG_QUEUE_SIZE);
+	//a request needs at least a header, a sector and a status byte
+	if (queue_size < 4) {
+		return virtio_blk_fail("request queue unavailable");
+	}
+	uint32_t ring_pages = virtq_bytes(queue_size) / PAGE_SIZE;
+	uint32_t ring_phys = 0;
+	uint32_t ring = vmm_alloc_kernel_pages_contiguous(ring_pages, &ring_phys);
+	if (!ring) {
+		return virtio_blk_fail("couldn't allocate request queue");
+	}
+	memset((uint8_t*)ring, 0, ring_pages * PAGE_SIZE);
+	desc = (virtq_desc_t*)ring;
+	avail = (virtq_avail_t*)(ring + (sizeof(virtq_desc_t) * queue_size));
+	uint32_t used_offset = (sizeof(virtq_desc_t) * queue_size) + (sizeof(uint16_t) * (3 + queue_size));
+	used_offset = (used_offset + VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1);
+	used = (volatile virtq_used_t*)(ring + used_offset);
+	last_used = 0;
+
+	uint32_t request_page = vmm_alloc_kernel_page();
+	memset((uint8_t*)request_page, 0, PAGE_SIZE);
+	header = (virtio_blk_req_header_t*)request_page;
+	header_phys = vmm_get_phys_for_virt(request_page);
+	status = (volatile uint8_t*)(request_page + sizeof(virtio_blk_req_header_t));
+	status_phys = header_phys + sizeof(virtio_blk_req_header_t);
+
+	outl(io_base + VIRTIO_REG_QUEUE_PFN, ring_phys / VIRTQ_ALIGN);
+
+	//blkq addresses sectors with 32 bits, so larger disks are truncated
+	uint32_t capacity_high = inl(io_base + VIRTIO_BLK_REG_CAPACITY + 4);
+	capacity = capacity_high ? 0xFFFFFFFF : inl(io_base + VIRTIO_BLK_REG_CAPACITY);
+
+	memset(&stats, 0, sizeof(stats));
+	//PCI lines are often shared, and the ISR read tells us whether the interrupt was ours
+	interrupt_setup_shared_callback(INT_VECOR_IRQ0 + device->irq_line, &virtio_blk_irq);
+	irq_handler_installed = true;
+
+	outb(io_base + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+	blkq_drive = blkq_register_drive(&virtio_blk_driver, 0);
+	if (blkq_drive < 0) {
+		return virtio_blk_fail("no free blkq drive number");
+	}
+	printf_info("virtio-blk: %d MB on IRQ %d, queue of %d, blkq drive %d", capacity / 2048, device->irq_line, queue_size, blkq_drive);
+	return blkq_drive;
+}
+
+void virtio_blk_print_stats(void) {
+	if (blkq_drive < 0) {
+		printf("virtio-blk: no device\n");
+		return;
+	}
+	printf("virtio-blk: blkq drive %d, %d sectors, queue of %d\n", blkq_drive, capacity, queue_size);
+	printf("virtio-blk: %d requests, %d sectors, avg %d descriptors per request, %d errors\n", stats.requests, stats.sectors, stats.requests ? stats.descriptors / stats.requests : 0, stats.errors);
+	printf("virtio-blk: %d Mcycles waiting on the device\n", (uint32_t)(stats.wait_cycles / 1000000));
+}
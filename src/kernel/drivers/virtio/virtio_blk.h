@@ -0,0 +1,79 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//legacy (virtio 0.9.5) PCI block device, such as qemu's -drive if=virtio
+//requests are described to the device on a single virtqueue and completed by its IRQ
+//the disk is registered with blkq, so the block cache and FAT can sit on top of it
+
+#define VIRTIO_VENDOR		0x1AF4
+#define VIRTIO_BLK_DEVICE	0x1001
+
+//legacy register layout, as offsets into the I/O space at BAR0
+#define VIRTIO_REG_DEVICE_FEATURES	0x00
+#define VIRTIO_REG_GUEST_FEATURES	0x04
+#define VIRTIO_REG_QUEUE_PFN		0x08
+#define VIRTIO_REG_QUEUE_SIZE		0x0C
+#define VIRTIO_REG_QUEUE_SELECT		0x0E
+#define VIRTIO_REG_QUEUE_NOTIFY		0x10
+#define VIRTIO_REG_STATUS		0x12
+#define VIRTIO_REG_ISR			0x13
+//device specific configuration follows, for block devices starting with the capacity in sectors
+#define VIRTIO_BLK_REG_CAPACITY		0x14
+
+#define VIRTIO_STATUS_ACK		0x01
+#define VIRTIO_STATUS_DRIVER		0x02
+#define VIRTIO_STATUS_DRIVER_OK		0x04
+#define VIRTIO_STATUS_FAILED		0x80
+
+#define VIRTQ_DESC_F_NEXT	0x1	//chain continues in the next field
+#define VIRTQ_DESC_F_WRITE	0x2	//device writes into this buffer
+
+//legacy devices expect the used ring to start on its own page
+#define VIRTQ_ALIGN		4096
+
+#define VIRTIO_BLK_T_IN		0	//read
+#define VIRTIO_BLK_T_OUT	1	//write
+#define VIRTIO_BLK_S_OK		0
+
+typedef struct virtq_desc {
+	uint64_t addr;		//physical
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;
+} __attribute__((packed)) virtq_desc_t;
+
+typedef struct virtq_avail {
+	uint16_t flags;
+	uint16_t idx;
+	uint16_t ring[];
+} __attribute__((packed)) virtq_avail_t;
+
+typedef struct virtq_used_elem {
+	uint32_t id;		//head of the completed chain
+	uint32_t len;
+} __attribute__((packed)) virtq_used_elem_t;
+
+typedef struct virtq_used {
+	uint16_t flags;
+	uint16_t idx;
+	virtq_used_elem_t ring[];
+} __attribute__((packed)) virtq_used_t;
+
+//leads every request, followed by its data and then a status byte
+typedef struct virtio_blk_req_header {
+	uint32_t type;
+	uint32_t reserved;
+	uint64_t sector;
+} __attribute__((packed)) virtio_blk_req_header_t;
+
+//find and set up a virtio block device, and register it with blkq
+//returns its blkq drive number, or -1 if there's no usable device
+int virtio_blk_install(void);
+
+//print request counts and time spent waiting on the device
+void virtio_blk_print_stats(void);
+
+#endif
@@ -10,6 +10,8 @@
 #include <kernel/assert.h>
 
 static int_callback_t interrupt_handlers[256] = {0};
+//callbacks of vectors set up with interrupt_setup_shared_callback()
+static int_callback_t shared_handlers[256][INTERRUPT_SHARED_MAX] = {{0}};
 
 #define IRQ0  32
 #define IRQ1  33
@@ -111,9 +113,43 @@ void interrupt_init(void) {
     asm("sti");
 }
 
+static int interrupt_dispatch_shared(register_state_t* regs) {
+    int ret = 0;
+    for (int i = 0; i < INTERRUPT_SHARED_MAX; i++) {
+        int_callback_t handler = shared_handlers[regs->int_no][i];
+        if (!handler) {
+            break;
+        }
+        ret |= handler(regs);
+    }
+    return ret;
+}
+
 void interrupt_setup_callback(uint8_t interrupt_num, int_callback_t callback) {
+    //joining the chain keeps the line's other devices working
+    if (interrupt_handlers[interrupt_num] == interrupt_dispatch_shared) {
+        interrupt_setup_shared_callback(interrupt_num, callback);
+        return;
+    }
     if (interrupt_handlers[interrupt_num] != 0) {
-        assert("Tried to overwrite handler for interrupt %d", interrupt_num);
+        printf_err("Overwriting handler for interrupt %d", interrupt_num);
     }
     interrupt_handlers[interrupt_num] = callback;
 }
+
+void interrupt_setup_shared_callback(uint8_t interrupt_num, int_callback_t callback) {
+    int_callback_t* chain = shared_handlers[interrupt_num];
+    //a callback already installed the usual way becomes the first of the chain
+    int_callback_t existing = interrupt_handlers[interrupt_num];
+    if (existing && existing != interrupt_dispatch_shared) {
+        chain[0] = existing;
+    }
+    for (int i = 0; i < INTERRUPT_SHARED_MAX; i++) {
+        if (!chain[i]) {
+            chain[i] = callback;
+            interrupt_handlers[interrupt_num] = interrupt_dispatch_shared;
+            return;
+        }
+    }
+    panic("too many devices sharing an interrupt");
+}
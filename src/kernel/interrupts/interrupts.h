@@ -16,4 +16,12 @@ void interrupt_init(void);
 //processed by the CPU
 void interrupt_setup_callback(uint8_t interrupt_num, int_callback_t callback);
 
+//most devices that may share an interrupt line, such as PCI INTx
+#define INTERRUPT_SHARED_MAX 4
+
+//like interrupt_setup_callback(), but `callback` is chained with the other callbacks of
+//`interrupt_num` rather than replacing them. every callback runs on each interrupt,
+//so each must check its own device and ignore interrupts which weren't its own
+void interrupt_setup_shared_callback(uint8_t interrupt_num, int_callback_t callback);
+
 #endif
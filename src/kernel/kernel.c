@@ -12,6 +12,7 @@
 #include <kernel/boot.h>
 #include <kernel/assert.h>
 #include <kernel/boot_info.h>
+#include <kernel/boot_timeline.h>
 #include <kernel/segmentation/gdt.h>
 #include <kernel/interrupts/interrupts.h>
 
@@ -25,6 +26,15 @@
 #include <kernel/vmm/vmm.h>
 #include <std/kheap.h>
 #include <kernel/syscall/syscall.h>
+#include <kernel/util/vfs/initrd.h>
+#include <kernel/util/tmpfs/tmpfs.h>
+#include <kernel/util/devfs/devfs.h>
+#include <kernel/util/fat/fat.h>
+#include <kernel/util/elf/elf_module.h>
+#include <kernel/drivers/pci/pci_detect.h>
+#include <kernel/drivers/ide/ide.h>
+#include <kernel/drivers/virtio/virtio_blk.h>
+#include <kernel/drivers/ahci/ahci.h>
 
 //testing!
 #include <kernel/multitasking/tasks/task.h>
@@ -41,7 +51,9 @@ void system_mem() {
 }
 
 void drivers_init(void) {
+    boot_stage("pit");
     pit_timer_init(PIT_TICK_GRANULARITY_1MS);
+    boot_stage("serial");
     serial_init();
 }
 
@@ -55,26 +67,66 @@ uint32_t initial_esp = 0;
 void kernel_main(struct multiboot_info* mboot_ptr, uint32_t initial_stack) {
     initial_esp = initial_stack;
     //set up this driver first so we can output to framebuffer
+    boot_stage("text mode");
     text_mode_init();
 
     //environment info
+    boot_stage("boot info");
     boot_info_read(mboot_ptr);
     boot_info_dump();
 
     //x86 descriptor tables
+    boot_stage("gdt");
     gdt_init();
+    boot_stage("idt");
     interrupt_init();
 
     //external device drivers
     drivers_init();
 
     //kernel features
+    boot_stage("pmm");
     pmm_init();
+    boot_stage("vmm");
     vmm_init();
+    boot_stage("heap");
     kheap_init();
+    //drivers not needed at boot can be loaded as modules later
+    boot_stage("symbols");
+    elf_module_init();
+
+    boot_stage("initrd");
+    boot_info_t* info = boot_info_get();
+    if (info->initrd_size) {
+        initrd_install(info->initrd_start, info->initrd_end, INITRD_VIRT_BASE);
+    }
+    //scratch space in RAM
+    boot_stage("tmpfs");
+    tmpfs_install();
+
+    //disk drivers
+    //these need the heap, and IRQs so disk waits can sleep
+    boot_stage("pci");
+    pci_install();
+    boot_stage("ide");
+    ide_install();
+    boot_stage("virtio-blk");
+    virtio_blk_install();
+    boot_stage("ahci");
+    ahci_install();
+    //disks are exposed as files once every driver has registered its drives
+    boot_stage("devfs");
+    devfs_install();
+    boot_stage("fat");
+    fat_install_first_disk();
+
+    boot_stage("syscalls");
     syscall_init();
     //testing!
+    boot_stage("tasking");
     tasking_init_small();
+    //the scheduler may have run other tasks in the meantime, which counts towards tasking
+    boot_timeline_finish();
 
     while (1) {}
     kernel_spinloop();
@@ -0,0 +1,10 @@
+#include <std/printf.h>
+#include <kernel/drivers/mouse/mouse.h>
+
+//brings up the PS/2 mouse the first time something asks for it, rather than at boot
+//mouse_install() and printf_info() are bound to the kernel's own copies when the module is loaded
+int module_init(void) {
+	mouse_install();
+	printf_info("PS/2 mouse enabled");
+	return 0;
+}
@@ -5,6 +5,7 @@
 #include <kernel/drivers/kb/kb.h>
 #include <kernel/interrupts/interrupts.h>
 #include <kernel/vmm/vmm.h>
+#include <kernel/vmm/vm_area.h>
 #include <kernel/multitasking//util.h>
 #include <kernel/syscall//sysfuncs.h>
 #include <kernel/drivers/rtc/clock.h>
@@ -308,6 +309,8 @@ void destroy_task(task_t* task) {
     //printf_info("%s[%d] destroyed.", task->name, task->id);
     //free task's page directory
     free_directory(task->page_dir);
+    //exit() has already released the areas' frames, while the task's address space was active
+    vm_area_free_all(&task->vm_areas);
     array_m_destroy(task->child_tasks);
     std_stream_destroy(task);
 
@@ -687,6 +690,9 @@ int fork(char* name) {
         }
     }
 
+    //pages the parent hasn't touched yet are still populated on demand
+    child->vm_areas = vm_area_clone(parent->vm_areas);
+
     _tasking_register_process(child);
 
     //set parent process of newly created process to currently running task
@@ -1034,6 +1040,12 @@ void proc() {
                 case IRQ_WAIT:
                 printk("(blocked by IRQ)");
                 break;
+                case IO_WAIT:
+                printk("(blocked by disk I/O)");
+                break;
+                case LOCK_WAIT:
+                printk("(blocked by lock)");
+                break;
                 default:
                 break;
             }
@@ -31,6 +31,8 @@ typedef enum task_state {
 	PIPE_FULL,
 	PIPE_EMPTY,
 	IRQ_WAIT,
+	IO_WAIT, //waiting on a block device request
+	LOCK_WAIT, //waiting for a sleep lock to be released
 } task_state;
 
 typedef enum mlfq_option {
@@ -39,6 +41,7 @@ typedef enum mlfq_option {
 } mlfq_option;
 
 struct fd_entry;
+struct vm_area;
 typedef struct task {
 	char* name; //user-printable process name
 	int id;  //PID
@@ -70,6 +73,8 @@ typedef struct task {
 	uint32_t prog_break;
 	//virtual address of .bss segment
 	uint32_t bss_loc;
+	//lazily populated parts of the address space, such as ELF segments and the stack
+	struct vm_area* vm_areas;
 
 	/* array of child tasks this process has spawned
 	 * each time a process fork()'s,
@@ -3,6 +3,7 @@
 #include <kernel/util/mutex/mutex.h>
 #include <kernel/segmentation/gdt_structures.h>
 #include <std/timer.h>
+#include <kernel/drivers/rtc/clock.h>
 
 #define TASK_QUANTUM 20
 
@@ -30,13 +31,26 @@ void new_my_task2() {
 }
 
 static task_small_t* _tasking_get_next_task(task_small_t* previous_task) {
-    //pick tasks in round-robin
-    task_small_t* next_task = previous_task->next;
-    //end of list?
-    if (next_task == NULL) {
-        next_task = _task_list_head;
-    }
-    return next_task;
+    //pick runnable tasks in round-robin
+    //every other task is tried first, then previous_task itself
+    task_small_t* next_task = previous_task;
+    do {
+        next_task = next_task->next;
+        //end of list?
+        if (next_task == NULL) {
+            next_task = _task_list_head;
+        }
+        //sleepers are woken by the scheduler once their time comes
+        if (next_task->state == PIT_WAIT && time() >= next_task->wake_timestamp) {
+            task_unblock(next_task);
+        }
+        if (next_task->state == RUNNABLE) {
+            return next_task;
+        }
+    } while (next_task != previous_task);
+    //nothing is runnable
+    //stay on the current task, which halts in task_block() until an interrupt wakes someone
+    return previous_task;
 }
 
 static task_small_t* _tasking_last_task_in_runlist() {
@@ -104,6 +118,76 @@ void task_switch_now() {
     asm("hlt");
 }
 
+void task_block(task_state reason) {
+    _current_task->state = reason;
+    while (_current_task->state != RUNNABLE) {
+        //give up the rest of our timeslice
+        _current_task->current_timeslice_end_date = time();
+        timer_deliver_immediately(pit_callback);
+        //sti takes effect after the next instruction, so no interrupt can slip in before the hlt
+        asm volatile("sti; hlt; cli");
+    }
+}
+
+void task_unblock(task_small_t* task) {
+    task->state = RUNNABLE;
+}
+
+void wait_queue_sleep(wait_queue_t* queue, task_state reason) {
+    //a blocked task waits on one queue at a time, so it can be linked in place
+    _current_task->wait_next = queue->head;
+    queue->head = _current_task;
+    task_block(reason);
+}
+
+void wait_queue_wake_all(wait_queue_t* queue) {
+    task_small_t* task = queue->head;
+    queue->head = NULL;
+    while (task) {
+        task_small_t* next = task->wait_next;
+        task->wait_next = NULL;
+        task_unblock(task);
+        task = next;
+    }
+}
+
+void task_sleep_until(uint32_t date) {
+    bool ints = interrupts_enabled();
+    kernel_begin_critical();
+    _current_task->wake_timestamp = date;
+    task_block(PIT_WAIT);
+    if (ints) {
+        kernel_end_critical();
+    }
+}
+
+void sleep_lock_acquire(sleep_lock_t* lock) {
+    bool ints = interrupts_enabled();
+    kernel_begin_critical();
+    while (lock->held) {
+        //before tasking there's nobody else who could release it
+        if (!tasking_is_active()) {
+            panic("sleep lock taken twice before tasking");
+        }
+        wait_queue_sleep(&lock->waiters, LOCK_WAIT);
+    }
+    lock->held = true;
+    if (ints) {
+        kernel_end_critical();
+    }
+}
+
+void sleep_lock_release(sleep_lock_t* lock) {
+    bool ints = interrupts_enabled();
+    kernel_begin_critical();
+    lock->held = false;
+    //every waiter rechecks the lock, and all but one go back to sleep
+    wait_queue_wake_all(&lock->waiters);
+    if (ints) {
+        kernel_end_critical();
+    }
+}
+
 static void _tasking_add_task_to_runlist(task_small_t* task) {
     if (!_current_task) {
         _current_task = task;
@@ -122,11 +206,13 @@ task_small_t* task_construct(uint32_t entry_point) {
     initial_register_state.ds = GDT_BYTE_INDEX_KERNEL_DATA;
     initial_register_state.eip = entry_point;
 
+    //stack grows downwards, so start at the top of the allocation
     char* stack = kmalloc(0x1000);
-    initial_register_state.esp = stack;
-    initial_register_state.ebp = stack;
+    initial_register_state.esp = (uint32_t)(stack + 0x1000);
+    initial_register_state.ebp = (uint32_t)(stack + 0x1000);
 
     new_task->register_state = initial_register_state;
+    new_task->stack = stack;
     new_task->_has_run = false;
 
     _tasking_add_task_to_runlist(new_task);
@@ -134,6 +220,32 @@ task_small_t* task_construct(uint32_t entry_point) {
     return new_task;
 }
 
+void task_reap(task_small_t* task) {
+    if (task == _current_task || task == _task_list_head) {
+        panic("task_reap() can't free the running or first task");
+    }
+    while (task->state != ZOMBIE) {
+        task_sleep_until(time() + 1);
+    }
+
+    //a zombie is never scheduled again, so once it's unlinked nothing refers to it
+    bool ints = interrupts_enabled();
+    kernel_begin_critical();
+    task_small_t* prev = _task_list_head;
+    while (prev && (task_small_t*)prev->next != task) {
+        prev = (task_small_t*)prev->next;
+    }
+    if (prev) {
+        prev->next = task->next;
+    }
+    if (ints) {
+        kernel_end_critical();
+    }
+
+    kfree(task->stack);
+    kfree(task);
+}
+
 int getpid() {
     if (!_current_task) {
         return -1;
@@ -141,6 +253,10 @@ int getpid() {
     return _current_task->id;
 }
 
+task_small_t* tasking_get_current_task() {
+    return _current_task;
+}
+
 bool tasking_is_active() {
     //return (queues && queues->size >= 1 && current_task);
     return _current_task != 0;
@@ -20,12 +20,50 @@ typedef struct task_small {
 	uint32_t relinquish_date;
 	uint32_t lifespan;
 	struct task* next;
+    struct task_small* wait_next; //next task blocked on the same wait queue
+    char* stack; //allocated by task_construct()
 
     bool _has_run; //has the task ever been scheduled?
 } task_small_t;
 
+//tasks blocked waiting on the same event, linked through the tasks themselves
+//whoever raises the event wakes every waiter, and each waiter rechecks its own condition
+typedef struct wait_queue {
+    task_small_t* head;
+} wait_queue_t;
+
 void tasking_init_small();
+//create a kernel task which begins executing at entry_point, and add it to the runlist
+task_small_t* task_construct(uint32_t entry_point);
+//wait for @p task to block as a ZOMBIE, then remove it from the runlist and free it
+void task_reap(task_small_t* task);
 void task_switch_now();
 bool tasking_is_active();
+task_small_t* tasking_get_current_task();
+
+//stop scheduling the current task until task_unblock() is called on it
+//must be called with interrupts disabled, so a wakeup can't be missed between
+//the caller checking its condition and blocking. Returns with interrupts disabled
+void task_block(task_state reason);
+//make a blocked task runnable again. Safe to call from interrupt context
+void task_unblock(task_small_t* task);
+
+//block the current task on @p queue. Same interrupt requirements as task_block()
+void wait_queue_sleep(wait_queue_t* queue, task_state reason);
+//unblock every task waiting on @p queue. Safe to call from interrupt context
+void wait_queue_wake_all(wait_queue_t* queue);
+
+//block the current task until time() reaches @p date
+void task_sleep_until(uint32_t date);
+
+//lock whose contenders sleep until it's released, rather than spinning
+//it may be held across sleeps such as disk I/O, but mustn't be taken from interrupt context
+typedef struct sleep_lock {
+    bool held;
+    wait_queue_t waiters;
+} sleep_lock_t;
+
+void sleep_lock_acquire(sleep_lock_t* lock);
+void sleep_lock_release(sleep_lock_t* lock);
 
 #endif
\ No newline at end of file
@@ -9,7 +9,13 @@
 
 void pmm_reserve_mem_region(pmm_state_t* pmm, uint32_t start, uint32_t size);
 
-static uint32_t first_usable_pmm_index(pmm_state_t* pmm) {
+//frames asked of the reclaim hook each time the PMM runs dry
+#define PMM_RECLAIM_BATCH 32
+
+static pmm_reclaim_hook_t reclaim_hook = 0;
+
+//returns -1 if every frame is in use
+static int32_t first_usable_pmm_index(pmm_state_t* pmm) {
     for (int i = 0; i < ADDRESS_SPACE_BITMAP_SIZE; i++) {
         uint32_t system_frames_entry = pmm->system_accessible_frames.set[i];
         //skip early if either of these entries are unusable
@@ -40,8 +46,7 @@ static uint32_t first_usable_pmm_index(pmm_state_t* pmm) {
             return BITMAP_BIT_INDEX(i, j);
         }
     }
-    panic("first_usable_pmm_index() found nothing!");
-    return 0;
+    return -1;
 }
 
 static void set_memory_region(address_space_frame_bitmap_t* bitmap, uint32_t region_start_addr, uint32_t region_len) {
@@ -117,6 +122,28 @@ void pmm_init() {
     pmm_reserve_mem_region(pmm, kernel_max, extra_identity_map_region_size);
     //map out framebuffer
     pmm_reserve_mem_region(pmm, info->framebuffer.address, info->framebuffer.size);
+
+    //the initrd is mapped in place rather than copied, so its frames must never be handed out
+    //processes map uncompressed initrd pages directly, so the frames stay allocated for good
+    if (info->initrd_size) {
+        uint32_t start = addr_space_frame_floor(info->initrd_start);
+        uint32_t end = addr_space_frame_ceil(info->initrd_end);
+        for (uint32_t frame = start; frame < end; frame += PAGING_FRAME_SIZE) {
+            pmm_alloc_address(frame);
+        }
+    }
+
+    //the kernel's symbols stay where GRUB put them, for resolving kernel modules against
+    if (info->kernel_symbols_end) {
+        uint32_t start = addr_space_frame_floor(info->kernel_symbols_start);
+        uint32_t end = addr_space_frame_ceil(info->kernel_symbols_end);
+        for (uint32_t frame = start; frame < end; frame += PAGING_FRAME_SIZE) {
+            //they may share a frame with the initrd
+            if (!addr_space_bitmap_check_address(&pmm->allocation_state, frame)) {
+                pmm_alloc_address(frame);
+            }
+        }
+    }
 }
 
 //marks a block of physical memory as unallocatable
@@ -137,15 +164,51 @@ void pmm_alloc_address(uint32_t address) {
     addr_space_bitmap_set_address(&pmm->allocation_state, address);
 }
 
+void pmm_set_reclaim_hook(pmm_reclaim_hook_t hook) {
+    reclaim_hook = hook;
+}
+
 uint32_t pmm_alloc(void) {
     pmm_state_t* pmm = pmm_get();
-    uint32_t index = first_usable_pmm_index(pmm);
+    int32_t index = first_usable_pmm_index(pmm);
+    if (index < 0) {
+        //out of memory, ask caches to give some frames back before giving up
+        if (reclaim_hook && reclaim_hook(PMM_RECLAIM_BATCH)) {
+            index = first_usable_pmm_index(pmm);
+        }
+        if (index < 0) {
+            panic("first_usable_pmm_index() found nothing!");
+        }
+    }
     uint32_t frame_address = index * PAGING_FRAME_SIZE;
     pmm_alloc_address(frame_address);
     return frame_address;
 }
 
 
+uint32_t pmm_alloc_contiguous(uint32_t count) {
+    pmm_state_t* pmm = pmm_get();
+    uint32_t run = 0;
+    //frame 0 is never usable RAM, so it doubles as the failure value
+    for (uint32_t i = 1; i < ADDRESS_SPACE_BITMAP_SIZE * BITS_PER_BITMAP_ENTRY; i++) {
+        uint32_t frame_address = i * PAGING_FRAME_SIZE;
+        if (!addr_space_bitmap_check_address(&pmm->system_accessible_frames, frame_address) ||
+            addr_space_bitmap_check_address(&pmm->allocation_state, frame_address)) {
+            run = 0;
+            continue;
+        }
+        if (++run < count) {
+            continue;
+        }
+        uint32_t first = (i + 1 - count) * PAGING_FRAME_SIZE;
+        for (uint32_t j = 0; j < count; j++) {
+            pmm_alloc_address(first + j * PAGING_FRAME_SIZE);
+        }
+        return first;
+    }
+    return 0;
+}
+
 void pmm_free(uint32_t frame_address) {
     pmm_state_t* pmm = pmm_get();
     //sanity check
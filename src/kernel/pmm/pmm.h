@@ -18,9 +18,17 @@ pmm_state_t* pmm_get(void);
 void pmm_init(void);
 
 uint32_t pmm_alloc(void);
+//allocate @p count physically consecutive frames, and return the address of the first
+//returns 0 if no long enough run is free
+uint32_t pmm_alloc_contiguous(uint32_t count);
 void pmm_alloc_address(uint32_t address);
 void pmm_free(uint32_t frame_addr);
 
 void pmm_dump(void);
 
+//called when no free frame is left, to release up to @p count frames held by caches
+//returns the number of frames released
+typedef uint32_t (*pmm_reclaim_hook_t)(uint32_t count);
+void pmm_set_reclaim_hook(pmm_reclaim_hook_t hook);
+
 #endif
@@ -2,6 +2,7 @@
 #include <kernel/multitasking/tasks/task_small.h>
 #include <std/printf.h>
 #include <kernel/util/paging/paging.h>
+#include <kernel/vmm/vm_area.h>
 #include <kernel/util/elf/elf.h>
 #include <kernel/util/unistd/unistd.h>
 #include <user/xserv/api.h>
@@ -10,6 +11,8 @@
 #include <gfx/lib/rect.h>
 #include <user/xserv/xserv.h>
 #include <kernel/util/shmem/shmem.h>
+#include <kernel/multitasking/fd.h>
+#include <kernel/drivers/rtc/clock.h>
 #include <gfx/lib/surface.h>
 
 void yield(task_state reason) {
@@ -27,14 +30,26 @@ void yield(task_state reason) {
 	block_task(current_task, reason);
 }
 
-int lseek(int UNUSED(fd), int UNUSED(offset), int UNUSED(whence)) {
-	printf("lseek called\n");
-	return 0;
+int lseek(int fd, int offset, int whence) {
+	task_t* current = task_with_pid(getpid());
+	if (fd < 0 || fd >= FD_MAX || fd_empty(current->fd_table[fd])) {
+		return -1;
+	}
+	fd_entry ent = current->fd_table[fd];
+	if (ent.type != FILE_TYPE) {
+		//pipes and terminals can't seek
+		return -1;
+	}
+	FILE* stream = (FILE*)ent.payload;
+	fseek(stream, offset, whence);
+	return ftell(stream);
 }
 
 extern task_t* current_task;
 int exit(int code) {
 	current_task->exit_code = code;
+	//the address space is only active here, so shared frames and page cache pins are released now
+	vm_area_replace(&current_task->vm_areas, NULL);
 	_kill();
 	return code;
 }
@@ -52,6 +67,11 @@ Surface* surface_create(uint32_t width, uint32_t height) {
 	return surface_make(width, height, getpid());
 }
 
+//milliseconds since boot, for programs timing themselves
+uint32_t uptime(void) {
+	return time();
+}
+
 int aipc_send(char* data, uint32_t size, uint32_t dest_pid, char** destination) {
 	return ipc_send(data, size, dest_pid, destination);
 }
@@ -83,6 +103,7 @@ DEFN_SYSCALL(getdents, 21, unsigned int, struct dirent*, unsigned int);
 DEFN_SYSCALL(shmem_create, 22, uint32_t);
 DEFN_SYSCALL(surface_create, 23, uint32_t, uint32_t);
 DEFN_SYSCALL(aipc_send, 24, char*, uint32_t, uint32_t, char**);
+DEFN_SYSCALL(uptime, 25);
 
 void create_sysfuncs() {
 	syscall_add((void*)&_kill);
@@ -110,4 +131,5 @@ void create_sysfuncs() {
 	syscall_add((void*)&shmem_create);
 	syscall_add((void*)&surface_create);
 	syscall_add((void*)&aipc_send);
+	syscall_add((void*)&uptime);
 }
@@ -49,5 +49,6 @@ DECL_SYSCALL(getdents, unsigned int, struct dirent*, unsigned int);
 DECL_SYSCALL(shmem_create, uint32_t);
 DECL_SYSCALL(surface_create, uint32_t, uint32_t);
 DECL_SYSCALL(aipc_send, char*, uint32_t, uint32_t, char**);
+DECL_SYSCALL(uptime);
 
 #endif
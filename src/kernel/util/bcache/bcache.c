@@ -0,0 +1,450 @@
+#include "bcache.h"
+#include <std/std.h>
+#include <std/math.h>
+#include <kernel/vmm/vmm.h>
+#include <kernel/drivers/rtc/clock.h>
+#include <kernel/multitasking/tasks/task_small.h>
+
+static bcache_buf_t* buffers = 0;
+static bcache_buf_t* buckets[BCACHE_BUCKETS];
+static bcache_buf_t* lru_head = 0;	//most recently used
+static bcache_buf_t* lru_tail = 0;	//next to be evicted
+//held across disk reads, so contending tasks sleep rather than spin
+static sleep_lock_t mutex = {0};
+static bool flusher_running = false;
+
+static struct {
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t writebacks;
+	uint32_t evictions;
+	uint32_t direct_reads;
+	uint32_t direct_sectors;
+	uint32_t prefetches;
+	uint32_t prefetch_hits;
+	uint64_t hit_cycles;
+	uint64_t miss_cycles;
+} stats;
+
+static uint32_t bcache_hash(uint8_t drive, uint32_t lba) {
+	return (lba ^ (drive << 24)) % BCACHE_BUCKETS;
+}
+
+static void lru_unlink(bcache_buf_t* b) {
+	if (b->lru_prev) b->lru_prev->lru_next = b->lru_next;
+	else lru_head = b->lru_next;
+
+	if (b->lru_next) b->lru_next->lru_prev = b->lru_prev;
+	else lru_tail = b->lru_prev;
+
+	b->lru_prev = b->lru_next = 0;
+}
+
+static void lru_push_front(bcache_buf_t* b) {
+	b->lru_prev = 0;
+	b->lru_next = lru_head;
+	if (lru_head) lru_head->lru_prev = b;
+	lru_head = b;
+	if (!lru_tail) lru_tail = b;
+}
+
+static void hash_remove(bcache_buf_t* b) {
+	bcache_buf_t** slot = &buckets[bcache_hash(b->drive, b->lba)];
+	while (*slot) {
+		if (*slot == b) {
+			*slot = b->hash_next;
+			break;
+		}
+		slot = &(*slot)->hash_next;
+	}
+	b->hash_next = 0;
+}
+
+static void hash_insert(bcache_buf_t* b) {
+	uint32_t bucket = bcache_hash(b->drive, b->lba);
+	b->hash_next = buckets[bucket];
+	buckets[bucket] = b;
+}
+
+//a buffer whose write fails stays dirty, so the data is retried rather than lost
+static int bcache_writeback(bcache_buf_t* b) {
+	int status = blkq_write(b->drive, b->lba, 1, b->data);
+	if (status) {
+		printk("bcache: write of drive %d sector %d failed (%d)\n", b->drive, b->lba, status);
+		return status;
+	}
+	b->dirty = false;
+	stats.writebacks++;
+	return 0;
+}
+
+//stop looking up @p b, whose contents aren't the sector's
+static void bcache_drop(bcache_buf_t* b) {
+	if (b->valid) {
+		hash_remove(b);
+	}
+	b->valid = false;
+	b->dirty = false;
+	b->prefetched = false;
+	//reuse it first
+	lru_unlink(b);
+	b->lru_prev = lru_tail;
+	if (lru_tail) lru_tail->lru_next = b;
+	lru_tail = b;
+	if (!lru_head) lru_head = b;
+}
+
+static void bcache_flush_task() {
+	while (1) {
+		task_sleep_until(time() + BCACHE_FLUSH_INTERVAL);
+		bcache_sync();
+	}
+}
+
+//the flush task can only be started once tasking is up
+//until then dirty buffers are only written on sync, and the first write afterwards starts it
+static void bcache_start_flusher(void) {
+	if (flusher_running || !tasking_is_active()) {
+		return;
+	}
+	flusher_running = true;
+	task_construct((uint32_t)&bcache_flush_task);
+}
+
+void bcache_init(void) {
+	if (buffers) {
+		return;
+	}
+	memset(buckets, 0, sizeof(buckets));
+	memset(&stats, 0, sizeof(stats));
+
+	buffers = (bcache_buf_t*)kmalloc(sizeof(bcache_buf_t) * BCACHE_BUFFERS);
+	memset(buffers, 0, sizeof(bcache_buf_t) * BCACHE_BUFFERS);
+
+	//sector data lives in whole pages outside the kernel heap
+	uint32_t per_page = PAGE_SIZE / BCACHE_BLOCK_SIZE;
+	uint8_t* page = 0;
+	for (int i = 0; i < BCACHE_BUFFERS; i++) {
+		if (!(i % per_page)) {
+			page = (uint8_t*)vmm_alloc_kernel_page();
+		}
+		buffers[i].data = page + ((i % per_page) * BCACHE_BLOCK_SIZE);
+		lru_push_front(&buffers[i]);
+	}
+
+	bcache_start_flusher();
+	printf_info("bcache: %d buffers of %d bytes", BCACHE_BUFFERS, BCACHE_BLOCK_SIZE);
+}
+
+//wait for a prefetch into @p b to land
+//a failed prefetch is retried synchronously, and if that fails too the buffer is dropped
+//returns 0, or the status of the failed read
+static int bcache_finish_prefetch(bcache_buf_t* b) {
+	if (!b->prefetching) {
+		return 0;
+	}
+	b->prefetching = false;
+	if (!blkq_wait(&b->req)) {
+		return 0;
+	}
+	int status = blkq_read(b->drive, b->lba, 1, b->data);
+	if (status) {
+		bcache_drop(b);
+	}
+	return status;
+}
+
+//count the first use of a prefetched buffer
+static void bcache_note_use(bcache_buf_t* b) {
+	if (b->prefetched) {
+		b->prefetched = false;
+		stats.prefetch_hits++;
+	}
+}
+
+//find the buffer caching (drive, lba), or NULL if it isn't resident
+static bcache_buf_t* bcache_find(uint8_t drive, uint32_t lba) {
+	for (bcache_buf_t* b = buckets[bcache_hash(drive, lba)]; b; b = b->hash_next) {
+		if (b->valid && b->drive == drive && b->lba == lba) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+//find the buffer caching (drive, lba), loading it from disk if it isn't resident
+//if @p will_overwrite is set, the caller replaces the whole sector, so a miss skips the disk read
+//returns 0 and sets @p out, or the status of the disk transfer that failed
+static int bcache_get(uint8_t drive, uint32_t lba, bool will_overwrite, bcache_buf_t** out) {
+	uint64_t start = rdtsc();
+
+	bcache_buf_t* hit = bcache_find(drive, lba);
+	if (hit) {
+		int status = bcache_finish_prefetch(hit);
+		if (status) {
+			return status;
+		}
+		bcache_note_use(hit);
+		lru_unlink(hit);
+		lru_push_front(hit);
+		stats.hits++;
+		stats.hit_cycles += rdtsc() - start;
+		*out = hit;
+		return 0;
+	}
+
+	//recycle least recently used buffer
+	bcache_buf_t* b = lru_tail;
+	//the disk mustn't land a prefetch in a buffer we've handed to another sector
+	bcache_finish_prefetch(b);
+	b->prefetched = false;
+	if (b->valid) {
+		if (b->dirty) {
+			int status = bcache_writeback(b);
+			if (status) {
+				return status;
+			}
+		}
+		hash_remove(b);
+		stats.evictions++;
+	}
+
+	b->drive = drive;
+	b->lba = lba;
+	b->dirty = false;
+	b->valid = false;
+	if (!will_overwrite) {
+		int status = blkq_read(drive, lba, 1, b->data);
+		if (status) {
+			return status;
+		}
+	}
+	b->valid = true;
+	hash_insert(b);
+	lru_unlink(b);
+	lru_push_front(b);
+
+	stats.misses++;
+	stats.miss_cycles += rdtsc() - start;
+	*out = b;
+	return 0;
+}
+
+int bcache_read(uint8_t drive, uint32_t lba, uint8_t* buf, uint32_t byte_count, uint32_t offset) {
+	bcache_init();
+	lba += offset / BCACHE_BLOCK_SIZE;
+	offset %= BCACHE_BLOCK_SIZE;
+
+	sleep_lock_acquire(&mutex);
+	int status = 0;
+	while (byte_count) {
+		uint32_t chunk = MIN(byte_count, BCACHE_BLOCK_SIZE - offset);
+		bcache_buf_t* b;
+		status = bcache_get(drive, lba, false, &b);
+		if (status) {
+			break;
+		}
+		memcpy(buf, b->data + offset, chunk);
+
+		buf += chunk;
+		byte_count -= chunk;
+		offset = 0;
+		lba++;
+	}
+	sleep_lock_release(&mutex);
+	return status;
+}
+
+int bcache_write(uint8_t drive, uint32_t lba, const uint8_t* buf, uint32_t byte_count, uint32_t offset) {
+	bcache_init();
+	bcache_start_flusher();
+	lba += offset / BCACHE_BLOCK_SIZE;
+	offset %= BCACHE_BLOCK_SIZE;
+
+	sleep_lock_acquire(&mutex);
+	int status = 0;
+	while (byte_count) {
+		uint32_t chunk = MIN(byte_count, BCACHE_BLOCK_SIZE - offset);
+		bcache_buf_t* b;
+		status = bcache_get(drive, lba, chunk == BCACHE_BLOCK_SIZE, &b);
+		if (status) {
+			break;
+		}
+		memcpy(b->data + offset, buf, chunk);
+		b->dirty = true;
+
+		buf += chunk;
+		byte_count -= chunk;
+		offset = 0;
+		lba++;
+	}
+	sleep_lock_release(&mutex);
+	return status;
+}
+
+int bcache_read_sectors(uint8_t drive, uint32_t lba, uint32_t count, uint8_t* buf) {
+	bcache_init();
+
+	sleep_lock_acquire(&mutex);
+	int status = 0;
+	uint32_t i = 0;
+	while (i < count) {
+		//resident sectors may be dirty, so they must come from the cache
+		bcache_buf_t* b = bcache_find(drive, lba + i);
+		if (b) {
+			status = bcache_finish_prefetch(b);
+			if (status) {
+				break;
+			}
+			bcache_note_use(b);
+			memcpy(buf + (i * BCACHE_BLOCK_SIZE), b->data, BCACHE_BLOCK_SIZE);
+			stats.hits++;
+			i++;
+			continue;
+		}
+		//read the whole uncached stretch straight into the caller's buffer
+		uint32_t run = 1;
+		while (i + run < count && !bcache_find(drive, lba + i + run)) {
+			run++;
+		}
+		status = blkq_read(drive, lba + i, run, buf + (i * BCACHE_BLOCK_SIZE));
+		if (status) {
+			break;
+		}
+		stats.direct_reads++;
+		stats.direct_sectors += run;
+		i += run;
+	}
+	sleep_lock_release(&mutex);
+	return status;
+}
+
+void bcache_prefetch(uint8_t drive, uint32_t lba, uint32_t count) {
+	bcache_init();
+
+	sleep_lock_acquire(&mutex);
+	for (uint32_t i = 0; i < count; i++) {
+		if (bcache_find(drive, lba + i)) {
+			continue;
+		}
+		//a prefetch is only a hint, so never wait on the disk to make room for one
+		bcache_buf_t* b = lru_tail;
+		if (b->prefetching || (b->valid && b->dirty)) {
+			break;
+		}
+		if (b->valid) {
+			hash_remove(b);
+			stats.evictions++;
+		}
+
+		b->drive = drive;
+		b->lba = lba + i;
+		b->dirty = false;
+		b->valid = true;
+		b->prefetching = true;
+		b->prefetched = true;
+		hash_insert(b);
+		lru_unlink(b);
+		lru_push_front(b);
+
+		//neighbouring requests are merged by the queue into one transfer
+		memset(&b->req, 0, sizeof(blk_request_t));
+		b->req.drive = drive;
+		b->req.direction = BLKQ_READ;
+		b->req.lba = lba + i;
+		b->req.count = 1;
+		b->req.buf = b->data;
+		blkq_submit(&b->req);
+		stats.prefetches++;
+	}
+	sleep_lock_release(&mutex);
+}
+
+uint32_t bcache_read_int(uint8_t drive, uint32_t lba, uint32_t offset) {
+	uint32_t val;
+	if (bcache_read(drive, lba, (uint8_t*)&val, sizeof(val), offset)) {
+		return 0;
+	}
+	return val;
+}
+
+int bcache_write_int(uint8_t drive, uint32_t lba, uint32_t val, uint32_t offset) {
+	return bcache_write(drive, lba, (const uint8_t*)&val, sizeof(val), offset);
+}
+
+int bcache_sync(void) {
+	if (!buffers) {
+		return 0;
+	}
+	//queue every dirty buffer at once, so the elevator can sort them and merge neighbouring sectors
+	static blk_request_t requests[BCACHE_BUFFERS];
+	static bcache_buf_t* written[BCACHE_BUFFERS];
+	int count = 0;
+	int status = 0;
+
+	sleep_lock_acquire(&mutex);
+	for (int i = 0; i < BCACHE_BUFFERS; i++) {
+		bcache_buf_t* b = &buffers[i];
+		if (!b->valid || !b->dirty) {
+			continue;
+		}
+		blk_request_t* req = &requests[count++];
+		memset(req, 0, sizeof(blk_request_t));
+		req->drive = b->drive;
+		req->direction = BLKQ_WRITE;
+		req->lba = b->lba;
+		req->count = 1;
+		req->buf = b->data;
+		blkq_submit(req);
+		written[count - 1] = b;
+	}
+	//the lock keeps the buffers from changing until their writes complete
+	for (int i = 0; i < count; i++) {
+		int ret = blkq_wait(&requests[i]);
+		if (ret) {
+			printk("bcache: write of drive %d sector %d failed (%d)\n", written[i]->drive, written[i]->lba, ret);
+			if (!status) status = ret;
+			continue;
+		}
+		written[i]->dirty = false;
+		stats.writebacks++;
+	}
+	sleep_lock_release(&mutex);
+	return status;
+}
+
+void bcache_invalidate(void) {
+	if (!buffers) {
+		return;
+	}
+	//buffers that couldn't be written back are dropped with the rest
+	bcache_sync();
+
+	sleep_lock_acquire(&mutex);
+	for (int i = 0; i < BCACHE_BUFFERS; i++) {
+		bcache_buf_t* b = &buffers[i];
+		bcache_finish_prefetch(b);
+		if (b->valid) {
+			hash_remove(b);
+		}
+		b->valid = false;
+		b->prefetched = false;
+	}
+	sleep_lock_release(&mutex);
+}
+
+void bcache_print_stats(void) {
+	uint32_t dirty = 0;
+	for (int i = 0; buffers && i < BCACHE_BUFFERS; i++) {
+		if (buffers[i].valid && buffers[i].dirty) dirty++;
+	}
+	uint32_t lookups = stats.hits + stats.misses;
+	uint32_t percent = lookups ? (stats.hits * 100) / lookups : 0;
+	printf("bcache: %d lookups, %d hits, %d misses (%d%% hit rate)\n", lookups, stats.hits, stats.misses, percent);
+	printf("bcache: %d evictions, %d writebacks, %d dirty\n", stats.evictions, stats.writebacks, dirty);
+	printf("bcache: %d uncached reads of %d sectors\n", stats.direct_reads, stats.direct_sectors);
+	printf("bcache: %d sectors prefetched, %d used\n", stats.prefetches, stats.prefetch_hits);
+	printf("bcache: avg hit %d cycles, avg miss %d cycles\n",
+			stats.hits ? (uint32_t)(stats.hit_cycles / stats.hits) : 0,
+			stats.misses ? (uint32_t)(stats.miss_cycles / stats.misses) : 0);
+}
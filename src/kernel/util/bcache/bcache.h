@@ -0,0 +1,71 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <kernel/util/blkq/blkq.h>
+
+//block buffer cache sitting between filesystems and disk drivers
+//sectors are cached in fixed-size buffers, looked up by (drive, lba) through a hash table
+//writes are deferred: buffers are marked dirty and written back on eviction,
+//by the periodic flush task, or on bcache_sync()
+
+#define BCACHE_BLOCK_SIZE	512
+#define BCACHE_BUFFERS		256
+#define BCACHE_BUCKETS		64
+//how often the flush task writes dirty buffers back, in ms
+#define BCACHE_FLUSH_INTERVAL	5000
+
+typedef struct bcache_buf {
+	uint8_t drive;
+	uint32_t lba;
+	bool valid;	//buffer holds the sector's contents
+	bool dirty;	//buffer has been modified since it was read or last written back
+	bool prefetching;	//req is reading the sector in, and must complete before data is used
+	bool prefetched;	//filled by a prefetch and not yet used
+	uint8_t* data;
+	blk_request_t req;
+
+	struct bcache_buf* hash_next;
+	struct bcache_buf* lru_prev;
+	struct bcache_buf* lru_next;
+} bcache_buf_t;
+
+//set up buffers and start the flush task, or leave it to the first write if tasking isn't up yet
+//safe to call more than once
+void bcache_init(void);
+
+//read @p byte_count bytes starting @p offset bytes into sector @p lba
+//the range may span several sectors
+//returns 0, or the status of the disk transfer that failed. sectors that couldn't be read aren't cached
+int bcache_read(uint8_t drive, uint32_t lba, uint8_t* buf, uint32_t byte_count, uint32_t offset);
+//write @p byte_count bytes starting @p offset bytes into sector @p lba
+//data reaches the disk at the next flush
+//returns 0, or the status of the disk transfer that failed to make room for the data
+int bcache_write(uint8_t drive, uint32_t lba, const uint8_t* buf, uint32_t byte_count, uint32_t offset);
+
+//read @p count whole sectors starting at @p lba
+//cached sectors are copied from the cache, and each stretch of uncached sectors is read
+//from disk in one request without being cached, so a large read doesn't flush the cache
+//returns 0, or the status of the first disk read that failed
+int bcache_read_sectors(uint8_t drive, uint32_t lba, uint32_t count, uint8_t* buf);
+
+//start reading any uncached sectors of @p count sectors from @p lba into the cache, without waiting
+//prefetching stops early rather than evicting dirty or in-flight buffers
+void bcache_prefetch(uint8_t drive, uint32_t lba, uint32_t count);
+
+//reads that fail return 0
+uint32_t bcache_read_int(uint8_t drive, uint32_t lba, uint32_t offset);
+int bcache_write_int(uint8_t drive, uint32_t lba, uint32_t val, uint32_t offset);
+
+//write every dirty buffer back to disk
+//returns 0, or the status of the first write that failed. buffers that failed stay dirty
+int bcache_sync(void);
+
+//write back and then forget every buffer, so following reads go to the disk
+void bcache_invalidate(void);
+
+//print hit rate, write-back counts and average latencies
+void bcache_print_stats(void);
+
+#endif
@@ -0,0 +1,437 @@
+#include "blkq.h"
+#include <std/std.h>
+#include <std/common.h>
+#include <std/math.h>
+#include <kernel/interrupts/interrupts.h>
+#include <kernel/drivers/ide/ide.h>
+#include <kernel/multitasking/tasks/task_small.h>
+
+typedef struct blkq {
+	blk_request_t* pending;	//sorted by lba
+	uint32_t head_lba;	//sector just past the last transfer, where the sweep continues from
+} blkq_t;
+
+typedef struct blk_drive {
+	const blk_driver_t* driver;	//NULL if the drive number is unused
+	uint32_t unit;			//passed back to the driver to pick its device
+	uint32_t depth;			//transfers which may be started at once
+	uint32_t in_flight;		//transfers started and not yet completed
+} blk_drive_t;
+
+static blkq_t queues[BLKQ_MAX_DRIVES];
+static blk_drive_t drives[BLKQ_MAX_DRIVES];
+static bool initialized = false;
+static bool worker_running = false;
+//staging area for merged requests, whose buffers needn't be adjacent in memory
+static uint8_t* bounce = 0;
+//segments of a merged transfer, for drivers which can scatter/gather
+//every merged request is at least a sector, so there can't be more segments than this
+static blk_segment_t segments[BLKQ_MAX_MERGE_SECTORS];
+static wait_queue_t worker_waiters = {0};
+static wait_queue_t completion_waiters = {0};
+//batches finished by asynchronous drivers, waiting for the worker to complete them
+//linked through next, which isn't used once a request has left its pending list
+static blk_request_t* finished = NULL;
+
+static struct {
+	uint32_t submitted;
+	uint32_t merged;
+	uint32_t dispatches;
+	uint32_t sectors;
+	uint32_t scattered;
+	uint32_t max_in_flight;
+} stats;
+
+static int blkq_ide_read(uint32_t unit, uint32_t lba, uint32_t count, uint8_t* buf) {
+	return ide_ata_read_sectors(unit, lba, count, buf);
+}
+
+static int blkq_ide_write(uint32_t unit, uint32_t lba, uint32_t count, const uint8_t* buf) {
+	return ide_ata_write_sectors(unit, lba, count, buf);
+}
+
+static uint32_t blkq_ide_capacity(uint32_t unit) {
+	return ide_ata_sector_count(unit);
+}
+
+static const blk_driver_t ide_driver = {
+	.name = "ide",
+	.read = blkq_ide_read,
+	.write = blkq_ide_write,
+	.capacity = blkq_ide_capacity,
+	.transfer_sg = NULL,
+};
+
+//queues are shared with the worker task, so guard them by disabling interrupts
+//returns whether interrupts were enabled beforehand
+static bool blkq_lock(void) {
+	bool enabled = interrupts_enabled();
+	kernel_begin_critical();
+	return enabled;
+}
+
+static void blkq_unlock(bool enabled) {
+	if (enabled) {
+		kernel_end_critical();
+	}
+}
+
+static void blkq_worker();
+
+static void blkq_start_worker(void) {
+	if (worker_running || !tasking_is_active()) {
+		return;
+	}
+	worker_running = true;
+	task_construct((uint32_t)&blkq_worker);
+}
+
+void blkq_init(void) {
+	if (initialized) {
+		return;
+	}
+	initialized = true;
+	memset(queues, 0, sizeof(queues));
+	memset(&stats, 0, sizeof(stats));
+	bounce = kmalloc(BLKQ_MAX_MERGE_SECTORS * BLKQ_SECTOR_SIZE);
+
+	memset(drives, 0, sizeof(drives));
+	for (int i = 0; i < BLKQ_IDE_DRIVES; i++) {
+		drives[i].driver = &ide_driver;
+		drives[i].unit = i;
+		drives[i].depth = 1;
+	}
+
+	blkq_start_worker();
+}
+
+//insert after any requests for the same lba, so those keep their submission order
+static void blkq_insert(blkq_t* q, blk_request_t* req) {
+	blk_request_t** slot = &q->pending;
+	while (*slot && (*slot)->lba <= req->lba) {
+		slot = &(*slot)->next;
+	}
+	req->next = *slot;
+	*slot = req;
+}
+
+//pick the next request in C-LOOK order, and merge in any requests that continue it on disk
+static blk_request_t* blkq_next_batch(blkq_t* q) {
+	blk_request_t** slot = &q->pending;
+	while (*slot && (*slot)->lba < q->head_lba) {
+		slot = &(*slot)->next;
+	}
+	//nothing further up the disk, sweep back to the lowest pending lba
+	if (!*slot) {
+		slot = &q->pending;
+	}
+
+	blk_request_t* head = *slot;
+	*slot = head->next;
+	head->next = NULL;
+	head->merge_next = NULL;
+
+	blk_request_t* tail = head;
+	uint32_t end = head->lba + head->count;
+	uint32_t total = head->count;
+	while (*slot) {
+		blk_request_t* req = *slot;
+		if (req->lba != end || req->direction != head->direction || total + req->count > BLKQ_MAX_MERGE_SECTORS) {
+			break;
+		}
+		*slot = req->next;
+		req->next = NULL;
+		req->merge_next = NULL;
+		tail->merge_next = req;
+		tail = req;
+
+		end += req->count;
+		total += req->count;
+		stats.merged++;
+	}
+	q->head_lba = end;
+	return head;
+}
+
+int blkq_register_drive(const blk_driver_t* driver, uint32_t unit) {
+	blkq_init();
+	for (int i = BLKQ_IDE_DRIVES; i < BLKQ_MAX_DRIVES; i++) {
+		if (!drives[i].driver) {
+			drives[i].driver = driver;
+			drives[i].unit = unit;
+			drives[i].depth = 1;
+			drives[i].in_flight = 0;
+			return i;
+		}
+	}
+	return -1;
+}
+
+void blkq_set_queue_depth(int drive, uint32_t depth) {
+	if (drive < 0 || drive >= BLKQ_MAX_DRIVES || !depth) {
+		return;
+	}
+	drives[drive].depth = depth;
+}
+
+uint32_t blkq_capacity(uint8_t drive) {
+	blkq_init();
+	if (drive >= BLKQ_MAX_DRIVES || !drives[drive].driver) {
+		return 0;
+	}
+	return drives[drive].driver->capacity(drives[drive].unit);
+}
+
+static int blkq_transfer(uint8_t drive, uint8_t direction, uint32_t lba, uint32_t count, uint8_t* buf) {
+	blk_drive_t* d = &drives[drive];
+	if (direction == BLKQ_WRITE) {
+		return d->driver->write(d->unit, lba, count, buf);
+	}
+	return d->driver->read(d->unit, lba, count, buf);
+}
+
+//issue a merged batch straight into each request's buffer
+static int blkq_transfer_sg(blk_request_t* head) {
+	uint32_t seg_count = 0;
+	for (blk_request_t* req = head; req; req = req->merge_next) {
+		segments[seg_count].buf = req->buf;
+		segments[seg_count].count = req->count;
+		seg_count++;
+	}
+	stats.scattered++;
+	blk_drive_t* d = &drives[head->drive];
+	return d->driver->transfer_sg(d->unit, head->direction, head->lba, segments, seg_count);
+}
+
+//report the outcome of a batch to each of its requests and their waiters
+static void blkq_finish(blk_request_t* head, int status) {
+	blk_request_t* req = head;
+	while (req) {
+		//the callback may reuse the request, so step past it first
+		blk_request_t* next = req->merge_next;
+		req->status = status;
+		req->done = true;
+		if (req->complete) {
+			req->complete(req, status);
+		}
+		req = next;
+	}
+
+	bool ints = blkq_lock();
+	wait_queue_wake_all(&completion_waiters);
+	blkq_unlock(ints);
+}
+
+static uint32_t blkq_batch_sectors(blk_request_t* head) {
+	uint32_t total = 0;
+	for (blk_request_t* req = head; req; req = req->merge_next) {
+		total += req->count;
+	}
+	return total;
+}
+
+void blkq_complete(blk_request_t* head, int status) {
+	head->status = status;
+	if (!worker_running) {
+		drives[head->drive].in_flight--;
+		blkq_finish(head, status);
+		return;
+	}
+	//may be running in an IRQ handler, so leave the callbacks to the worker
+	bool ints = blkq_lock();
+	head->next = finished;
+	finished = head;
+	wait_queue_wake_all(&worker_waiters);
+	blkq_unlock(ints);
+}
+
+//hand a batch to a driver which completes it later
+static void blkq_start(blk_request_t* head) {
+	blk_drive_t* d = &drives[head->drive];
+	stats.dispatches++;
+	stats.sectors += blkq_batch_sectors(head);
+
+	int status = d->driver->start(d->unit, head);
+	if (status) {
+		bool ints = blkq_lock();
+		d->in_flight--;
+		blkq_unlock(ints);
+		blkq_finish(head, status);
+	}
+}
+
+//issue a request and everything merged behind it as one transfer, then complete them all
+static void blkq_dispatch(blk_request_t* head) {
+	if (drives[head->drive].driver->start) {
+		blkq_start(head);
+		return;
+	}
+
+	uint32_t total = blkq_batch_sectors(head);
+	int status;
+	if (!head->merge_next) {
+		status = blkq_transfer(head->drive, head->direction, head->lba, head->count, head->buf);
+	}
+	else if (drives[head->drive].driver->transfer_sg) {
+		status = blkq_transfer_sg(head);
+	}
+	else {
+		if (head->direction == BLKQ_WRITE) {
+			uint8_t* dst = bounce;
+			for (blk_request_t* req = head; req; req = req->merge_next) {
+				memcpy(dst, req->buf, req->count * BLKQ_SECTOR_SIZE);
+				dst += req->count * BLKQ_SECTOR_SIZE;
+			}
+		}
+		status = blkq_transfer(head->drive, head->direction, head->lba, total, bounce);
+		if (head->direction == BLKQ_READ && !status) {
+			uint8_t* src = bounce;
+			for (blk_request_t* req = head; req; req = req->merge_next) {
+				memcpy(req->buf, src, req->count * BLKQ_SECTOR_SIZE);
+				src += req->count * BLKQ_SECTOR_SIZE;
+			}
+		}
+	}
+	stats.dispatches++;
+	stats.sectors += total;
+
+	blkq_finish(head, status);
+}
+
+static void blkq_worker() {
+	int next_drive = 0;
+	while (1) {
+		bool ints = blkq_lock();
+		blk_request_t* done = finished;
+		finished = NULL;
+		if (done) {
+			for (blk_request_t* b = done; b; b = b->next) {
+				drives[b->drive].in_flight--;
+			}
+			blkq_unlock(ints);
+			while (done) {
+				//the batch may be resubmitted by its callbacks, so step past it first
+				blk_request_t* next = done->next;
+				blkq_finish(done, done->status);
+				done = next;
+			}
+			continue;
+		}
+
+		blk_request_t* batch = NULL;
+		//service drives round-robin so a busy one can't starve the others
+		for (int i = 0; i < BLKQ_MAX_DRIVES && !batch; i++) {
+			int drive = (next_drive + i) % BLKQ_MAX_DRIVES;
+			blk_drive_t* d = &drives[drive];
+			//drives which finish transfers later are only handed as many as they can hold
+			if (queues[drive].pending && (!d->driver->start || d->in_flight < d->depth)) {
+				batch = blkq_next_batch(&queues[drive]);
+				next_drive = drive + 1;
+				if (d->driver->start) {
+					d->in_flight++;
+					stats.max_in_flight = MAX(stats.max_in_flight, d->in_flight);
+				}
+			}
+		}
+		if (!batch) {
+			wait_queue_sleep(&worker_waiters, IO_WAIT);
+			blkq_unlock(ints);
+			continue;
+		}
+		blkq_unlock(ints);
+
+		blkq_dispatch(batch);
+	}
+}
+
+void blkq_submit(blk_request_t* req) {
+	blkq_init();
+	blkq_start_worker();
+
+	req->status = 0;
+	req->done = false;
+	req->next = NULL;
+	req->merge_next = NULL;
+	stats.submitted++;
+
+	if (req->drive >= BLKQ_MAX_DRIVES || !drives[req->drive].driver) {
+		req->status = 0x1;
+		req->done = true;
+		if (req->complete) {
+			req->complete(req, req->status);
+		}
+		return;
+	}
+
+	if (!worker_running) {
+		//nobody to hand the request to, so service it now
+		blk_drive_t* d = &drives[req->drive];
+		if (d->driver->start) {
+			d->in_flight++;
+		}
+		blkq_dispatch(req);
+		while (!req->done) {
+			d->driver->poll(d->unit);
+		}
+		return;
+	}
+
+	bool ints = blkq_lock();
+	blkq_insert(&queues[req->drive], req);
+	wait_queue_wake_all(&worker_waiters);
+	blkq_unlock(ints);
+}
+
+int blkq_wait(blk_request_t* req) {
+	bool ints = blkq_lock();
+	while (!req->done) {
+		wait_queue_sleep(&completion_waiters, IO_WAIT);
+	}
+	blkq_unlock(ints);
+	return req->status;
+}
+
+int blkq_submit_wait(blk_request_t* req) {
+	blkq_submit(req);
+	return blkq_wait(req);
+}
+
+int blkq_read(uint8_t drive, uint32_t lba, uint32_t count, uint8_t* buf) {
+	blk_request_t req = {0};
+	req.drive = drive;
+	req.direction = BLKQ_READ;
+	req.lba = lba;
+	req.count = count;
+	req.buf = buf;
+	return blkq_submit_wait(&req);
+}
+
+int blkq_write(uint8_t drive, uint32_t lba, uint32_t count, const uint8_t* buf) {
+	blk_request_t req = {0};
+	req.drive = drive;
+	req.direction = BLKQ_WRITE;
+	req.lba = lba;
+	req.count = count;
+	req.buf = (uint8_t*)buf;
+	return blkq_submit_wait(&req);
+}
+
+void blkq_print_stats(void) {
+	uint32_t pending = 0;
+	bool ints = blkq_lock();
+	for (int i = 0; i < BLKQ_MAX_DRIVES; i++) {
+		for (blk_request_t* req = queues[i].pending; req; req = req->next) {
+			pending++;
+		}
+	}
+	blkq_unlock(ints);
+
+	printf("blkq: %d requests, %d merged, %d pending\n", stats.submitted, stats.merged, pending);
+	printf("blkq: %d transfers, avg %d sectors per transfer, %d scatter/gather\n", stats.dispatches, stats.dispatches ? stats.sectors / stats.dispatches : 0, stats.scattered);
+	printf("blkq: at most %d transfers in flight on one drive\n", MAX(stats.max_in_flight, 1u));
+	for (int i = BLKQ_IDE_DRIVES; i < BLKQ_MAX_DRIVES; i++) {
+		if (drives[i].driver) {
+			printf("blkq: drive %d is %s unit %d, queue depth %d\n", i, drives[i].driver->name, drives[i].unit, drives[i].depth);
+		}
+	}
+}
@@ -0,0 +1,115 @@
+#ifndef BLKQ_H
+#define BLKQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//asynchronous block request queue
+//each drive has its own queue of pending requests, kept sorted by lba
+//a worker task services the queues in C-LOOK order: it sweeps upwards from the
+//last serviced lba, then jumps back to the lowest pending lba
+//requests that continue each other on disk are merged into a single transfer
+//drivers which can start a transfer and finish it later are handed several at once,
+//up to the queue depth they set, and the worker goes on to other drives meanwhile
+//overlapping requests aren't ordered against each other, so a caller must wait
+//for one to complete before submitting another touching the same sectors
+//drives 0-3 are the IDE drives, other block drivers register for the numbers after them
+
+#define BLKQ_MAX_DRIVES		8
+#define BLKQ_IDE_DRIVES		4
+#define BLKQ_SECTOR_SIZE	512
+//largest transfer built out of merged requests
+//a single request larger than this is still issued as-is
+#define BLKQ_MAX_MERGE_SECTORS	128
+
+#define BLKQ_READ	0
+#define BLKQ_WRITE	1
+
+struct blk_request;
+
+//part of a transfer landing in its own buffer
+typedef struct blk_segment {
+	uint8_t* buf;
+	uint32_t count;		//sectors
+} blk_segment_t;
+
+//device backing a drive number
+//read and write return 0 on success, or a nonzero driver-specific error code
+//drivers with a start op are never asked for synchronous transfers, and may leave them NULL
+typedef struct blk_driver {
+	const char* name;
+	int (*read)(uint32_t unit, uint32_t lba, uint32_t count, uint8_t* buf);
+	int (*write)(uint32_t unit, uint32_t lba, uint32_t count, const uint8_t* buf);
+	//sectors on the device, or 0 if nothing is attached
+	uint32_t (*capacity)(uint32_t unit);
+	//optional, a single transfer of consecutive sectors spread over several buffers
+	//lets merged requests skip the bounce buffer
+	int (*transfer_sg)(uint32_t unit, uint8_t direction, uint32_t lba, blk_segment_t* segs, uint32_t seg_count);
+
+	//optional, for devices which work on several transfers at once, such as NCQ disks
+	//start a request and everything merged behind it, and return without waiting for it
+	//the driver reports completion with blkq_complete(), which may be called from its IRQ handler
+	//returns nonzero if the transfer couldn't be started, and it's failed with that status
+	int (*start)(uint32_t unit, struct blk_request* batch);
+	//required with start, report any finished transfers without relying on IRQs
+	//used when there's no worker task, before tasking has started
+	void (*poll)(uint32_t unit);
+} blk_driver_t;
+//called from the worker task once a request has been serviced
+//@p status is 0 on success, or an error code from the drive's driver
+typedef void (*blk_complete_t)(struct blk_request* req, int status);
+
+typedef struct blk_request {
+	uint8_t drive;
+	uint8_t direction;	//BLKQ_READ or BLKQ_WRITE
+	uint32_t lba;
+	uint32_t count;		//sectors
+	uint8_t* buf;
+	blk_complete_t complete;	//optional
+	void* ctx;		//for the owner's use
+
+	//filled in by the queue
+	int status;
+	volatile bool done;
+	struct blk_request* next;	//pending list
+	struct blk_request* merge_next;	//requests merged behind this one
+} blk_request_t;
+
+//set up the per-drive queues and start the worker task
+//safe to call more than once
+void blkq_init(void);
+
+//give unit @p unit of @p driver a drive number, which is returned
+//returns -1 if every drive number is taken
+int blkq_register_drive(const blk_driver_t* driver, uint32_t unit);
+
+//let up to @p depth transfers be started on @p drive before any complete
+//only has an effect for drivers with a start op
+void blkq_set_queue_depth(int drive, uint32_t depth);
+
+//called by drivers with a start op once the batch led by @p head has finished
+void blkq_complete(blk_request_t* head, int status);
+
+//sectors on @p drive, or 0 if there's no such drive
+uint32_t blkq_capacity(uint8_t drive);
+
+//queue @p req and return immediately
+//@p req must stay valid until it completes
+//if tasking is inactive there's no worker, and the request is serviced before this returns
+void blkq_submit(blk_request_t* req);
+
+//block until @p req has completed, and return its status
+//must not be called from a completion callback, as those run on the worker task
+int blkq_wait(blk_request_t* req);
+
+//queue @p req and block until it completes
+int blkq_submit_wait(blk_request_t* req);
+
+//convenience wrappers building a request on the stack
+int blkq_read(uint8_t drive, uint32_t lba, uint32_t count, uint8_t* buf);
+int blkq_write(uint8_t drive, uint32_t lba, uint32_t count, const uint8_t* buf);
+
+//print request, merge and dispatch counts, and the most transfers seen in flight at once
+void blkq_print_stats(void);
+
+#endif
@@ -0,0 +1,167 @@
+#include "devfs.h"
+#include <std/std.h>
+#include <std/math.h>
+#include <kernel/util/fat/fat.h>
+#include <kernel/util/bcache/bcache.h>
+
+static fs_node_t root;
+static devfs_entry_t* entries = 0;
+static uint32_t devfs_dev = 0;
+static bool installed = false;
+
+static fs_node_t* devfs_op_lookup(fs_node_t* UNUSED(node), char* name) {
+	for (devfs_entry_t* ent = entries; ent; ent = ent->next) {
+		if (!strcmp(ent->node.name, name)) {
+			return &ent->node;
+		}
+	}
+	return NULL;
+}
+
+//move [@p offset, @p offset + @p size) of the drive behind @p node to or from @p buffer
+//the caller's buffer may belong to a user address space, which the blkq worker
+//and DMA can't see, so data is staged in a kernel buffer
+static uint32_t devfs_transfer(fs_node_t* node, uint8_t direction, uint32_t offset, uint32_t size, uint8_t* buffer) {
+	if (offset >= node->length) {
+		return 0;
+	}
+	size = MIN(size, node->length - offset);
+	if (!size) {
+		return 0;
+	}
+
+	uint8_t drive = node->impl;
+	//the filesystem's cached blocks would be written back over anything written underneath it
+	if (fat_mounted_on(drive)) {
+		if (direction == BLKQ_WRITE) {
+			printk("devfs: %s is mounted, refusing raw write\n", node->name);
+			return 0;
+		}
+		bcache_sync();
+	}
+	uint32_t first = offset / BLKQ_SECTOR_SIZE;
+	uint32_t last = (offset + size - 1) / BLKQ_SECTOR_SIZE;
+	uint8_t* bounce = kmalloc(MIN(last - first + 1, DEVFS_BOUNCE_SECTORS) * BLKQ_SECTOR_SIZE);
+
+	uint32_t done = 0;
+	while (done < size) {
+		uint32_t pos = offset + done;
+		uint32_t lba = pos / BLKQ_SECTOR_SIZE;
+		uint32_t sector_off = pos % BLKQ_SECTOR_SIZE;
+		uint32_t sectors = MIN(last - lba + 1, DEVFS_BOUNCE_SECTORS);
+		uint32_t chunk = MIN(size - done, (sectors * BLKQ_SECTOR_SIZE) - sector_off);
+
+		if (direction == BLKQ_READ) {
+			if (blkq_read(drive, lba, sectors, bounce)) {
+				break;
+			}
+			memcpy(buffer + done, bounce + sector_off, chunk);
+		}
+		else {
+			//partly covered sectors keep the rest of their contents
+			bool partial = sector_off || chunk % BLKQ_SECTOR_SIZE;
+			if (partial && blkq_read(drive, lba, sectors, bounce)) {
+				break;
+			}
+			memcpy(bounce + sector_off, buffer + done, chunk);
+			if (blkq_write(drive, lba, sectors, bounce)) {
+				break;
+			}
+		}
+		done += chunk;
+	}
+	kfree(bounce);
+	return done;
+}
+
+static uint32_t devfs_op_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+	return devfs_transfer(node, BLKQ_READ, offset, size, buffer);
+}
+
+static uint32_t devfs_op_write(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+	return devfs_transfer(node, BLKQ_WRITE, offset, size, buffer);
+}
+
+static struct dirent* devfs_op_readdir(fs_node_t* UNUSED(node), uint32_t index) {
+	static struct dirent result;
+	devfs_entry_t* ent = entries;
+	for (uint32_t i = 0; ent && i < index; i++) {
+		ent = ent->next;
+	}
+	if (!ent) {
+		return NULL;
+	}
+	memset(&result, 0, sizeof(result));
+	strcpy(result.d_name, ent->node.name);
+	result.d_ino = ent->node.inode;
+	result.d_off = index + 1;
+	result.d_reclen = sizeof(struct dirent);
+	return &result;
+}
+
+static uint32_t devfs_op_getdents(fs_node_t* UNUSED(node), uint32_t* pos, struct dirent* dirp, uint32_t count) {
+	devfs_entry_t* ent = entries;
+	for (uint32_t i = 0; ent && i < *pos; i++) {
+		ent = ent->next;
+	}
+
+	uint32_t used = 0;
+	for (; ent; ent = ent->next) {
+		uint32_t reclen = fs_dirent_pack(dirp, used, count, ent->node.name, ent->node.inode, *pos + 1, DT_UNKNOWN);
+		if (!reclen) {
+			break;
+		}
+		used += reclen;
+		(*pos)++;
+	}
+	return used;
+}
+
+static const fs_ops_t devfs_ops = {
+	.lookup = devfs_op_lookup,
+	.read = devfs_op_read,
+	.write = devfs_op_write,
+	.readdir = devfs_op_readdir,
+	.getdents = devfs_op_getdents,
+	.allocates_nodes = false,
+	.uncached = true,
+};
+
+void devfs_install(void) {
+	if (installed) {
+		return;
+	}
+	installed = true;
+	devfs_dev = fs_dev_alloc();
+
+	memset(&root, 0, sizeof(root));
+	strcpy(root.name, "dev");
+	root.flags = FS_DIRECTORY;
+	root.dev = devfs_dev;
+
+	devfs_entry_t** tail = &entries;
+	for (int drive = 0; drive < BLKQ_MAX_DRIVES; drive++) {
+		uint32_t sectors = blkq_capacity(drive);
+		if (!sectors) {
+			continue;
+		}
+		devfs_entry_t* ent = kmalloc(sizeof(devfs_entry_t));
+		memset(ent, 0, sizeof(devfs_entry_t));
+		snprintf(ent->node.name, sizeof(ent->node.name), "blk%d", drive);
+		ent->node.flags = FS_BLOCKDEVICE;
+		ent->node.inode = drive + 1;
+		ent->node.dev = devfs_dev;
+		//lengths are 32-bit byte counts, so only the first 4GB of a drive is reachable
+		ent->node.length = MIN(sectors, 0xFFFFFFFF / BLKQ_SECTOR_SIZE) * BLKQ_SECTOR_SIZE;
+		ent->node.impl = drive;
+		ent->node.parent = &root;
+		*tail = ent;
+		tail = &ent->next;
+	}
+
+	if (fs_mount(DEVFS_MOUNT_PATH, &root, &devfs_ops)) {
+		printf_err("couldn't mount devfs at %s", DEVFS_MOUNT_PATH);
+		return;
+	}
+	printf_info("devfs mounted at %s", DEVFS_MOUNT_PATH);
+}
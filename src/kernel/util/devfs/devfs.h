@@ -0,0 +1,25 @@
+#ifndef DEVFS_H
+#define DEVFS_H
+
+#include <stdint.h>
+#include <kernel/util/vfs/fs.h>
+#include <kernel/util/blkq/blkq.h>
+
+//filesystem exposing each blkq drive as a file, so programs can read and write disks directly
+//drive n appears as DEVFS_MOUNT_PATH/blkn, as long as the drive's length
+//transfers go straight to blkq, bypassing the page cache and block cache
+//the drive FAT has mounted can't be written, and dirty cached blocks are written back before it's read
+
+#define DEVFS_MOUNT_PATH	"/dev"
+//largest single transfer to a drive, larger reads and writes are split
+#define DEVFS_BOUNCE_SECTORS	128
+
+typedef struct devfs_entry {
+	fs_node_t node;		//handed to the VFS, node.impl is the drive number
+	struct devfs_entry* next;
+} devfs_entry_t;
+
+//mount DEVFS_MOUNT_PATH with a node for each drive registered with blkq so far
+void devfs_install(void);
+
+#endif
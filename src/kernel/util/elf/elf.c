@@ -5,7 +5,11 @@
 #include <std/kheap.h>
 #include <kernel/util/paging/paging.h>
 #include <kernel/multitasking//tasks/task.h>
-#include <kernel/util/paging/paging.h>
+#include <std/math.h>
+#include <kernel/vmm/vm_area.h>
+#include "elf_dynamic.h"
+
+int sys__exit(int code);
 
 static bool elf_check_magic(elf_header* hdr) {
 	if (!hdr) return false;
@@ -38,7 +42,7 @@ static bool elf_check_supported(elf_header* hdr) {
 	if (hdr->ident[EI_VERSION] != EV_CURRENT) {
 		return false;
 	}
-	if (hdr->type != ET_REL && hdr->type != ET_EXEC) {
+	if (hdr->type != ET_REL && hdr->type != ET_EXEC && hdr->type != ET_DYN) {
 		return false;
 	}
 	return true;
@@ -54,12 +58,23 @@ bool elf_validate_header(elf_header* hdr) {
 	return true;
 }
 
+uint32_t elf_hash(const char* name) {
+	uint32_t h = 0;
+	while (*name) {
+		h = (h << 4) + (uint8_t)*name++;
+		uint32_t g = h & 0xF0000000;
+		if (g) h ^= g >> 24;
+		h &= ~g;
+	}
+	return h;
+}
+
 bool elf_validate(FILE* file) {
 	char buf[sizeof(elf_header)];
 	fseek(file, 0, SEEK_SET);
-	///fread(&buf, sizeof(elf_header), 1, file);
-	for (uint32_t i = 0; i < sizeof(elf_header); i++) {
-		buf[i] = fgetc(file);
+	if (fread(&buf, sizeof(char), sizeof(elf_header), file) != sizeof(elf_header)) {
+		fseek(file, 0, SEEK_SET);
+		return false;
 	}
 	elf_header* hdr = (elf_header*)(&buf);
 
@@ -67,200 +82,193 @@ bool elf_validate(FILE* file) {
 	return elf_validate_header(hdr);
 }
 
-bool elf_load_segment(page_directory_t* new_dir, unsigned char* src, elf_phdr* seg) {
+//record segment @p seg of @p node, moved up by @p base, as a region of @p areas, populated as it's touched
+static bool elf_load_segment(vm_area_t** areas, fs_node_t* node, elf_phdr* seg, uint32_t base) {
 	//loadable?
 	if (seg->type != PT_LOAD) {
-		printf_err("Tried to load non-loadable segment");
-		printk_err("Tried to load non-loadable segment");
 		return false; 
 	}
-
-	unsigned char* src_base = src + seg->offset;
-	//figure out range to map this binary to in virtual memory
-	uint32_t dest_base = seg->vaddr;
-	uint32_t dest_limit = dest_base + seg->memsz;
-
-	printf("dest_base %x dest_limit %x\n", dest_base, dest_limit);
-	//alloc enough mem for new task
-	for (uint32_t i = dest_base, page_counter = 0; i <= dest_limit; i += PAGE_SIZE, page_counter++) {
-		page_t* page = get_page(i, 1, new_dir);
-		ASSERT(page, "elf_load_segment couldn't get page in new addrspace at %x\n", i);
-		bool got_frame = alloc_frame(page, 0, 0);
-		ASSERT(got_frame, "elf_load_segment couldn't alloc frame for page %x\n", i);
-		
-		char* pagebuf = kmalloc_a(PAGE_SIZE);
-		page_t* local_page = get_page((uint32_t)pagebuf, 0, page_dir_current());
-		ASSERT(local_page, "couldn't get local_page!");
-		int old_frame = local_page->frame;
-		local_page->frame = page->frame;
-		invlpg(pagebuf);
-
-		//create buffer in current address space,
-		//copy data,
-		//and then map frame into new address space
-		memset(pagebuf, 0, (dest_limit - dest_base));
-		//only seg->filesz bytes are garuanteed to be in the file!
-		//_not_ memsz
-		//any extra bytes between filesz and memsz should be set to 0, which is done above
-		//memcpy(dest_base, src_base, seg->filesz);
-		memcpy(pagebuf, src_base + (page_counter * PAGE_SIZE), seg->filesz);
-
-		//now that we've copied the data in the local address space, 
-		//get the page in local address space, 
-		//and copy backing physical frame data to physical frame of
-		//page in new address space
-
-		//now that the buffer has been copied, we can safely free the buffer
-		local_page->frame = old_frame;
-		invlpg(pagebuf);
-		kfree(pagebuf);
-	}
-
-	// Copy data
-	//memset((void*)dest_base, 0, (void*)(dest_limit - dest_base));
-
+	uint32_t start = base + seg->vaddr;
+	uint32_t flags = (seg->flags & PF_W) ? VM_AREA_WRITE : 0;
+	//only filesz bytes are in the file, the rest up to memsz is zero
+	vm_area_add(areas, start, start + seg->memsz, flags, node, start, start + seg->filesz, seg->offset);
+	printk("ELF segment %x - %x %s\n", start, start + seg->memsz, flags ? "rw" : "ro");
 	return true;
 }
 
-uint32_t elf_load_small(page_directory_t* new_dir, unsigned char* src) {
-	elf_header* hdr = (elf_header*)src;
-	uintptr_t phdr_table_addr = (uint32_t)hdr + hdr->phoff;
+//does loadable segment @p seg, moved up by @p base, lie in user space?
+static bool elf_segment_in_user_space(elf_phdr* seg, uint32_t base) {
+	uint32_t start = base + seg->vaddr;
+	return start >= base && seg->filesz <= seg->memsz &&
+		   start < VMM_USER_SPACE_END && seg->memsz <= VMM_USER_SPACE_END - start;
+}
+
+bool elf_load_segments(vm_area_t** areas, FILE* elf, elf_header* hdr, uint32_t base, uint32_t* dynamic, uint32_t* start, uint32_t* limit) {
+	*dynamic = 0;
+	*start = VMM_USER_SPACE_END;
+	*limit = 0;
+	if (!hdr->phnum || hdr->phentsize < sizeof(elf_phdr)) return false;
+
+	uint32_t table_size = hdr->phnum * hdr->phentsize;
+	char* phdrs = kmalloc(table_size);
+	fseek(elf, hdr->phoff, SEEK_SET);
+	if (fread(phdrs, sizeof(char), table_size, elf) != table_size) {
+		kfree(phdrs);
+		return false;
+	}
 
-	int segcount = hdr->phnum; 
-	if (!segcount) return 0;
+	//a segment reaching into the kernel rejects the whole file, before anything is recorded
+	for (int i = 0; i < hdr->phnum; i++) {
+		elf_phdr* segment = (elf_phdr*)(phdrs + (i * hdr->phentsize));
+		if (segment->type == PT_LOAD && !elf_segment_in_user_space(segment, base)) {
+			printf_err("ELF segment %x - %x isn't in user space", segment->vaddr, segment->vaddr + segment->memsz);
+			kfree(phdrs);
+			return false;
+		}
+	}
 
 	bool found_loadable_seg = false;
-	//load each segment
-	for (int i = 0; i < segcount; i++) {
-		elf_phdr* segment = (elf_phdr*)(phdr_table_addr + (i * hdr->phentsize));
-		if (elf_load_segment(new_dir, src, segment)) {
+	for (int i = 0; i < hdr->phnum; i++) {
+		elf_phdr* segment = (elf_phdr*)(phdrs + (i * hdr->phentsize));
+		if (segment->type == PT_DYNAMIC) {
+			*dynamic = base + segment->vaddr;
+		}
+		if (elf_load_segment(areas, elf->node, segment, base)) {
 			found_loadable_seg = true;
+			*start = MIN(*start, base + segment->vaddr);
+			*limit = MAX(*limit, base + segment->vaddr + segment->memsz);
 		}
 	}
+	kfree(phdrs);
+	return found_loadable_seg;
+}
 
-	//return entry point
-	if (found_loadable_seg) {
-		return hdr->entry;
+//locate the .bss section, which sets the initial program break
+//its memory is part of the last loadable segment
+static void elf_find_bss(FILE* elf, elf_header* hdr, uint32_t* prog_break, uint32_t* bss_loc) {
+	if (!hdr->shnum || hdr->shstrndx >= hdr->shnum) return;
+
+	uint32_t table_size = hdr->shnum * hdr->shentsize;
+	char* shdrs = kmalloc(table_size);
+	fseek(elf, hdr->shoff, SEEK_SET);
+	if (fread(shdrs, sizeof(char), table_size, elf) != table_size) {
+		printf("Tried to read beyond the end of the file.\n");
+		kfree(shdrs);
+		return;
 	}
-	return 0;
-}
 
-char* elf_get_string_table(void* file, uint32_t binary_size) {
-	elf_header* hdr = (elf_header*)file;
-	char* string_table;
-	uint32_t i = 0;
-	for (int x = 0; x < hdr->shentsize * hdr->shnum; x += hdr->shentsize) {
-		if (hdr->shoff + x > binary_size) {
-			printf("ELF: Tried to read beyond the end of the file.\n");
-			return NULL;
+	elf_s_header* strtab = (elf_s_header*)(shdrs + (hdr->shstrndx * hdr->shentsize));
+	for (int i = 0; i < hdr->shnum; i++) {
+		elf_s_header* shdr = (elf_s_header*)(shdrs + (i * hdr->shentsize));
+		char name[sizeof(".bss")];
+		fseek(elf, strtab->offset + shdr->name, SEEK_SET);
+		if (fread(name, sizeof(char), sizeof(name), elf) != sizeof(name)) {
+			continue;
 		}
-		elf_s_header* shdr = (elf_s_header*)(file + (hdr->shoff + x));
-		if (i == hdr->shstrndx) {
-			string_table = (char *)(file + shdr->offset);
-			return string_table;
+		if (!memcmp(name, ".bss", sizeof(name))) {
+			printf("ELF .bss mapped @ %x - %x\n", shdr->addr, shdr->addr + shdr->size);
+			*prog_break = shdr->addr + shdr->size;
+			*bss_loc = shdr->addr;
+			break;
 		}
-		i++;
 	}
-	return NULL;
+	kfree(shdrs);
 }
 
-
-//map pages for bss segment pointed to by shdr
-//stores program break (end of .bss segment) in prog_break
-//stored start of .bss segment in bss_loc
-static void alloc_bss(page_directory_t* new_dir, elf_s_header* shdr, int* prog_break, int* bss_loc) {
-	printf("ELF .bss mapped @ %x - %x\n", shdr->addr, shdr->addr + shdr->size);
-	for (uint32_t i = 0; i <= shdr->size + PAGE_SIZE; i += PAGE_SIZE) {
-		page_t* page = get_page(shdr->addr + i, 1, new_dir);
-		if (!alloc_frame(page, 0, 1)) {
-			printf_err(".bss %x wasn't alloc'd", shdr->addr + i);
+//lay @p argv out as the page above the initial stack holds it: the pointer array, then the strings
+//@p page is a kernel copy of that page, which will be at user address @p base
+//returns argc, or -1 if the arguments don't fit
+static int elf_pack_argv(char** argv, uint8_t* page, uint32_t base) {
+	int argc = 0;
+	while (argv && argv[argc] != NULL) {
+		argc++;
+	}
+	uint32_t used = (argc + 1) * sizeof(uint32_t);
+	if (used > PAGE_SIZE) {
+		return -1;
+	}
+	uint32_t* ptrs = (uint32_t*)page;
+	for (int i = 0; i < argc; i++) {
+		uint32_t len = strlen(argv[i]) + 1;
+		if (len > PAGE_SIZE - used) {
+			return -1;
 		}
-
-		char* pagebuf = kmalloc_a(PAGE_SIZE);
-		//zero out .bss
-		memset(pagebuf, 0, PAGE_SIZE);
-
-		page_t* local_page = get_page((uint32_t)pagebuf, 1, page_dir_current());
-		ASSERT(local_page, "elf_load_segment couldn't find page for pagebuf");
-
-		extern void copy_page_physical(uint32_t page, uint32_t dest);
-		copy_page_physical(local_page->frame * PAGE_SIZE, page->frame * PAGE_SIZE);
-
-		//now that the buffer has been copied, we can safely free the buffer
-		kfree(pagebuf);
+		memcpy(page + used, argv[i], len);
+		ptrs[i] = base + used;
+		used += len;
 	}
-
-	//set program break to .bss segment
-	*prog_break = shdr->addr + shdr->size;
-	*bss_loc = shdr->addr;
+	ptrs[argc] = 0;
+	return argc;
 }
 
 void elf_load_file(char* name, FILE* elf, char** argv) {
-	//find file size
-	fseek(elf, 0, SEEK_END);
-	uint32_t binary_size = ftell(elf);
+	uint64_t load_start = rdtsc();
+	//only the headers are read up front
+	elf_header hdr;
 	fseek(elf, 0, SEEK_SET);
-
-	char* filebuf = kmalloc(binary_size);
-	for (uint32_t i = 0; i < binary_size; i++) {
-		filebuf[i] = fgetc(elf);
+	if (fread(&hdr, sizeof(char), sizeof(elf_header), elf) != sizeof(elf_header)) {
+		printf_err("Couldn't read ELF %s", name);
+		return;
 	}
-
-	elf_header* hdr = (elf_header*)filebuf;
-	if (!elf_validate_header(hdr)) {
+	if (!elf_validate_header(&hdr)) {
 		return;
 	}
 
-	uint32_t new_dir_phys = 0;
-	page_directory_t* new_dir = kmalloc_ap(sizeof(page_directory_t), &new_dir_phys);
-	memset((uint8_t*)new_dir, 0, sizeof(page_directory_t));
-	//get offset of tablesPhysical from start of page_directory_t
-	uint32_t offset = (uint32_t)new_dir->tablesPhysical - (uint32_t)new_dir;
-	new_dir->physicalAddr = new_dir_phys + offset;
-
-	for (int i = 0; i < 1024; i++) {
-		new_dir->tables[i] = page_dir_kern()->tables[i];
-		new_dir->tablesPhysical[i] = page_dir_kern()->tablesPhysical[i] & ~4;
+	//exec replaces the image of the calling process
+	//the new areas are put together on the side, so an exec failing here leaves the caller as it was
+	//nothing is mapped yet, segments and the stack are faulted in as they're first touched
+	vm_area_t* areas = NULL;
+	uint32_t dynamic = 0;
+	uint32_t start = 0;
+	uint32_t limit = 0;
+	if (hdr.type != ET_EXEC || !hdr.entry || !elf_load_segments(&areas, elf, &hdr, 0, &dynamic, &start, &limit)) {
+		printf_err("ELF wasn't loadable!");
+		vm_area_free_all(&areas);
+		return;
 	}
-
-	char* string_table = elf_get_string_table(hdr, binary_size);
+	uint32_t entry = hdr.entry;
 
 	uint32_t prog_break = 0;
 	uint32_t bss_loc = 0;
-	for (int x = 0; x < hdr->shentsize * hdr->shnum; x += hdr->shentsize) {
-		if (hdr->shoff + x > binary_size) {
-			printf("Tried to read beyond the end of the file.\n");
-			return;
-		}
-
-		elf_s_header* shdr = (elf_s_header*)((uintptr_t)filebuf + (hdr->shoff + x));
-		char* section_name = (char*)((uintptr_t)string_table + shdr->name);
-
-		//alloc memory for .bss segment
-		if (!strcmp(section_name, ".bss")) {
-			alloc_bss(new_dir, shdr, (int*)&prog_break, (int*)&bss_loc);
-		}
-	}
-
-	uint32_t entry = elf_load_small(new_dir, (unsigned char*)filebuf);
-	kfree(filebuf);
-
-	//alloc stack space
-	uint32_t stack_addr = 0x10000000;
-	//give user program a 128kb stack
-	for (int i = 0; i < 32; i++) {
-		page_t* stacktop = get_page(stack_addr, 1, new_dir);
-		//user, writeable
-		alloc_frame(stacktop, 0, 1);
-		stack_addr += PAGE_SIZE;
+	elf_find_bss(elf, &hdr, &prog_break, &bss_loc);
+
+	//reserve the largest stack, only the pages used are populated
+	vm_area_add(&areas, ELF_STACK_TOP - ELF_STACK_MAX, ELF_STACK_TOP, VM_AREA_WRITE, NULL, 0, 0, 0);
+	//start a page below the top, as the old eagerly mapped stack did
+	uint32_t stack_addr = ELF_STACK_TOP - PAGE_SIZE;
+
+	//the name and arguments may live in the image about to be unmapped, so they're copied out first
+	uint8_t* arg_page = kmalloc(PAGE_SIZE);
+	int argc = elf_pack_argv(argv, arg_page, stack_addr);
+	if (argc < 0) {
+		printf_err("Arguments to %s don't fit in a page", name);
+		kfree(arg_page);
+		vm_area_free_all(&areas);
+		return;
 	}
-	stack_addr -= PAGE_SIZE;
-
-	//calculate argc count
-	int argc = 0;
-	while (argv[argc] != NULL) {
-		argc++;
+	name = strdup(name);
+
+	//the linker reads and relocates the new image in place, so from here on there's nothing to go back to
+	task_t* current = task_current();
+	vm_area_replace(&current->vm_areas, areas);
+
+	//arguments fill the page above the initial stack, and crt0 finds argc and argv
+	//where a caller would have pushed them, above a return address
+	memcpy((void*)stack_addr, arg_page, PAGE_SIZE);
+	kfree(arg_page);
+	uint32_t* frame = (uint32_t*)(stack_addr - (3 * sizeof(uint32_t)));
+	frame[0] = 0;
+	frame[1] = argc;
+	frame[2] = stack_addr;
+	stack_addr = (uint32_t)frame;
+
+	//bring in shared libraries, and bind the program to them
+	uint32_t lib_count = 0;
+	if (dynamic && !elf_link_dynamic(&current->vm_areas, name, dynamic, start, limit, &lib_count)) {
+		printf_err("Couldn't link %s", name);
+		sys__exit(1);
 	}
+	printk("ELF %s: %d shared libraries, loaded in %d kcycles\n", name, lib_count, (uint32_t)((rdtsc() - load_start) / 1000));
 
 	if (entry) {
 		become_first_responder();
@@ -270,11 +278,11 @@ void elf_load_file(char* name, FILE* elf, char** argv) {
 		task_t* elf = task_with_pid(getpid());
 		elf->prog_break = prog_break;
 		elf->bss_loc = bss_loc;
-		elf->name = strdup(name);
+		elf->name = name;
 		elf->esp = elf->ebp = stack_addr;
 
 		elf->eip = entry;
-		elf->page_dir = new_dir;
+		elf->page_dir = (page_directory_t*)vmm_active_pdir();
 
 		void goto_pid(int id, bool x);
 		goto_pid(elf->id, false);
@@ -301,7 +309,7 @@ void elf_load_file(char* name, FILE* elf, char** argv) {
 	}
 	else {
 		printf_err("ELF wasn't loadable!");
-		return;
+		sys__exit(1);
 	}
 }
 
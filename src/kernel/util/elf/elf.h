@@ -75,6 +75,7 @@ enum elf_sym_tab_types {
 
 #define SHN_UNDEF 	(0x00) //undefined/not present
 #define SHN_ABS		(0xfff1)
+#define SHN_COMMON	(0xfff2) //uninitialized global, placed by the linker
 enum elf_sh_types {
 	SHT_NULL	= 0, //null section
 	SHT_PROGBITS	= 1, //program information
@@ -114,6 +115,7 @@ enum elf_type {
 	ET_NONE		= 0, //unknown type
 	ET_REL		= 1, //relocatable file
 	ET_EXEC		= 2, //executable file
+	ET_DYN		= 3, //shared object
 };
 
 #define EM_386		(3)  //x86 type
@@ -137,14 +139,55 @@ enum elf_rt_types {
 	R_386_NONE 	= 0, //no relocation
 	R_386_32	= 1, //symbol + offset
 	R_386_PC32	= 2, //symbol + offset - section offset
+	R_386_COPY	= 5, //copy symbol's initial value into the program
+	R_386_GLOB_DAT	= 6, //GOT entry = symbol
+	R_386_JMP_SLOT	= 7, //PLT's GOT entry = symbol
+	R_386_RELATIVE	= 8, //load base + offset
+};
+
+//entry in the dynamic section
+typedef struct {
+	int32_t		tag;
+	uint32_t	val;
+} elf_dyn;
+
+enum elf_dyn_tags {
+	DT_NULL		= 0,  //end of the dynamic section
+	DT_NEEDED	= 1,  //string table offset of a required library's name
+	DT_PLTRELSZ	= 2,
+	DT_HASH		= 4,
+	DT_STRTAB	= 5,
+	DT_SYMTAB	= 6,
+	DT_STRSZ	= 10, //size of the string table, in bytes
+	DT_REL		= 17,
+	DT_RELSZ	= 18,
+	DT_TEXTREL	= 22, //relocations modify read-only segments
+	DT_JMPREL	= 23, //PLT relocations
 };
 
 #define PT_LOAD		1
 #define PT_DYNAMIC	2
 #define PT_INTERP	3
 
+//user stack, reserved up to ELF_STACK_MAX bytes and populated as it grows
+#define ELF_STACK_TOP	0x10020000
+#define ELF_STACK_MAX	0x100000
+
+//segment permissions
+#define PF_X		0x1
+#define PF_W		0x2
+#define PF_R		0x4
+
 
 bool elf_validate(FILE* file);
+//check @p hdr describes a 32-bit x86 ELF we can load
+bool elf_validate_header(elf_header* hdr);
+//SysV hash of a symbol name, as used by DT_HASH tables
+uint32_t elf_hash(const char* name);
+//replace the calling process's image with the program in @p file, and run it
+//@p argv is copied to the new program's stack, and passed to its entry point along with argc
+//returns only if the program can't be loaded, leaving the caller's image as it was
+//failures once the old image is gone, such as a missing shared library, end the process
 void elf_load_file(char* filename, FILE* file, char** argv);
 
 #endif
@@ -0,0 +1,286 @@
+#include "elf_dynamic.h"
+#include <std/std.h>
+#include <std/printf.h>
+#include <std/kheap.h>
+
+//the objects' tables are read and relocations written through their mapped addresses,
+//which faults the pages in from the calling process's areas
+
+//does [@p addr, @p addr + @p size) lie within @p obj's segments, and in a writable area of @p areas if @p write is set?
+static bool elf_object_holds(vm_area_t* areas, elf_object_t* obj, uint32_t addr, uint64_t size, bool write) {
+	if (addr < obj->start || addr > obj->end || size > obj->end - addr) {
+		return false;
+	}
+	if (!write) {
+		return true;
+	}
+	for (vm_area_t* area = areas; area; area = area->next) {
+		if ((area->flags & VM_AREA_WRITE) && addr >= area->start && addr + size <= area->end) {
+			return true;
+		}
+	}
+	return false;
+}
+
+//fill in @p obj from the dynamic section at @p dynamic
+//returns false if the section, or a table it points to, lies outside the object
+static bool elf_object_parse(vm_area_t* areas, elf_object_t* obj, uint32_t dynamic) {
+	for (elf_dyn* dyn = (elf_dyn*)dynamic; ; dyn++) {
+		if (!elf_object_holds(areas, obj, (uint32_t)dyn, sizeof(elf_dyn), false)) {
+			return false;
+		}
+		if (dyn->tag == DT_NULL) {
+			break;
+		}
+		uint32_t addr = obj->base + dyn->val;
+		switch (dyn->tag) {
+			case DT_STRTAB:
+				obj->strtab = (const char*)addr;
+				break;
+			case DT_STRSZ:
+				obj->strtab_size = dyn->val;
+				break;
+			case DT_SYMTAB:
+				obj->symtab = (elf_sym_tab*)addr;
+				break;
+			case DT_HASH:
+				obj->hash = (uint32_t*)addr;
+				break;
+			case DT_REL:
+				obj->rel = (elf_rel*)addr;
+				break;
+			case DT_RELSZ:
+				obj->rel_size = dyn->val;
+				break;
+			case DT_JMPREL:
+				obj->jmprel = (elf_rel*)addr;
+				break;
+			case DT_PLTRELSZ:
+				obj->jmprel_size = dyn->val;
+				break;
+			case DT_TEXTREL:
+				obj->textrel = true;
+				break;
+		}
+	}
+
+	//names are looked up by offset, so the table must end in a terminator
+	if (obj->strtab && (!obj->strtab_size || !elf_object_holds(areas, obj, (uint32_t)obj->strtab, obj->strtab_size, false) ||
+						obj->strtab[obj->strtab_size - 1])) {
+		return false;
+	}
+	//the hash table's chain has an entry per symbol
+	if (obj->hash) {
+		if (!elf_object_holds(areas, obj, (uint32_t)obj->hash, 2 * sizeof(uint32_t), false) || !obj->hash[0]) {
+			return false;
+		}
+		uint64_t hash_size = (2ULL + obj->hash[0] + obj->hash[1]) * sizeof(uint32_t);
+		if (!elf_object_holds(areas, obj, (uint32_t)obj->hash, hash_size, false)) {
+			return false;
+		}
+		obj->sym_count = obj->hash[1];
+	}
+	if (obj->symtab && !elf_object_holds(areas, obj, (uint32_t)obj->symtab, (uint64_t)obj->sym_count * sizeof(elf_sym_tab), false)) {
+		return false;
+	}
+	if ((obj->rel_size && !elf_object_holds(areas, obj, (uint32_t)obj->rel, obj->rel_size, false)) ||
+		(obj->jmprel_size && !elf_object_holds(areas, obj, (uint32_t)obj->jmprel, obj->jmprel_size, false))) {
+		return false;
+	}
+	return true;
+}
+
+static elf_sym_tab* elf_object_lookup(elf_object_t* obj, const char* name) {
+	if (!obj->hash || !obj->symtab || !obj->strtab) {
+		return NULL;
+	}
+	uint32_t nbucket = obj->hash[0];
+	uint32_t* bucket = &obj->hash[2];
+	uint32_t* chain = &bucket[nbucket];
+	//a chain can't be longer than the symbol table, unless it loops
+	uint32_t steps = 0;
+	for (uint32_t i = bucket[elf_hash(name) % nbucket]; i && steps < obj->sym_count; i = chain[i], steps++) {
+		if (i >= obj->sym_count) {
+			return NULL;
+		}
+		elf_sym_tab* sym = &obj->symtab[i];
+		if (sym->shndx != SHN_UNDEF && sym->name < obj->strtab_size && !strcmp(obj->strtab + sym->name, name)) {
+			return sym;
+		}
+	}
+	return NULL;
+}
+
+//find the first definition of @p name, searching the program and then each library, skipping @p skip
+//returns the object defining it, and stores the symbol in @p def
+static elf_object_t* elf_resolve(elf_object_t* objs, uint32_t count, const char* name, elf_object_t* skip, elf_sym_tab** def) {
+	for (uint32_t i = 0; i < count; i++) {
+		if (&objs[i] == skip) continue;
+		*def = elf_object_lookup(&objs[i], name);
+		if (*def) {
+			return &objs[i];
+		}
+	}
+	*def = NULL;
+	return NULL;
+}
+
+static bool elf_relocate(vm_area_t* areas, elf_object_t* objs, uint32_t count, elf_object_t* obj, elf_rel* rels, uint32_t size) {
+	for (uint32_t i = 0; i < size / sizeof(elf_rel); i++) {
+		elf_rel* rel = &rels[i];
+		uint32_t* where = (uint32_t*)(obj->base + rel->offset);
+		uint32_t type = ELF_R_TYPE(rel->info);
+		uint32_t sym_idx = ELF_R_SYM(rel->info);
+		//text relocations are refused, so every target is in a writable segment of the object
+		if (type != R_386_NONE && !elf_object_holds(areas, obj, (uint32_t)where, sizeof(uint32_t), true)) {
+			printf_err("%s: relocation at %x is outside its writable segments", obj->name, (uint32_t)where);
+			return false;
+		}
+
+		uint32_t value = 0;
+		elf_sym_tab* def = NULL;
+		elf_object_t* owner = NULL;
+		if (sym_idx) {
+			if (sym_idx >= obj->sym_count || !obj->strtab || obj->symtab[sym_idx].name >= obj->strtab_size) {
+				printf_err("%s: relocation refers to bad symbol %d", obj->name, sym_idx);
+				return false;
+			}
+			elf_sym_tab* sym = &obj->symtab[sym_idx];
+			const char* sym_name = obj->strtab + sym->name;
+			//the program's copy of a variable is found first, except by the copy relocation filling it in
+			owner = elf_resolve(objs, count, sym_name, type == R_386_COPY ? obj : NULL, &def);
+			if (owner) {
+				value = owner->base + def->value;
+			}
+			else if (ELF32_ST_BIND(sym->info) != STB_WEAK) {
+				printf_err("%s: undefined symbol %s", obj->name, sym_name);
+				return false;
+			}
+		}
+
+		switch (type) {
+			case R_386_NONE:
+				break;
+			case R_386_32:
+				*where += value;
+				break;
+			case R_386_PC32:
+				*where += value - (uint32_t)where;
+				break;
+			case R_386_GLOB_DAT:
+			case R_386_JMP_SLOT:
+				*where = value;
+				break;
+			case R_386_RELATIVE:
+				*where += obj->base;
+				break;
+			case R_386_COPY:
+				if (def) {
+					if (!elf_object_holds(areas, obj, (uint32_t)where, def->size, true) ||
+						!elf_object_holds(areas, owner, value, def->size, false)) {
+						printf_err("%s: copy relocation at %x is out of bounds", obj->name, (uint32_t)where);
+						return false;
+					}
+					memcpy(where, (void*)value, def->size);
+				}
+				break;
+			default:
+				printf_err("%s: unsupported relocation type %d", obj->name, type);
+				return false;
+		}
+	}
+	return true;
+}
+
+//map library @p lib at *@p next_base, and advance *@p next_base past it
+static bool elf_load_library(vm_area_t** areas, const char* lib, elf_object_t* obj, uint32_t* next_base) {
+	char path[128];
+	snprintf(path, sizeof(path), "%s%s", ELF_LIB_PATH, lib);
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		snprintf(path, sizeof(path), "/%s", lib);
+		file = fopen(path, "rb");
+	}
+	if (!file) {
+		printf_err("Couldn't find shared library %s", lib);
+		return false;
+	}
+
+	elf_header hdr;
+	uint32_t dynamic = 0;
+	uint32_t start = 0;
+	uint32_t limit = 0;
+	fseek(file, 0, SEEK_SET);
+	bool usable = fread(&hdr, sizeof(char), sizeof(elf_header), file) == sizeof(elf_header) &&
+				  elf_validate_header(&hdr) && hdr.type == ET_DYN;
+	//areas keep their own copy of the file's node, so it can be closed straight away
+	if (usable) {
+		usable = elf_load_segments(areas, file, &hdr, *next_base, &dynamic, &start, &limit) && dynamic;
+	}
+	fclose(file);
+	if (!usable) {
+		printf_err("%s isn't a usable shared library", path);
+		return false;
+	}
+
+	obj->name = lib;
+	obj->base = *next_base;
+	obj->start = start;
+	obj->end = limit;
+	if (!elf_object_parse(*areas, obj, dynamic)) {
+		printf_err("%s has a malformed dynamic section", path);
+		return false;
+	}
+	if (obj->textrel) {
+		printf_err("%s needs text relocations, it must be built with -fPIC", path);
+		return false;
+	}
+	*next_base = (limit + ELF_LIB_ALIGN - 1) & ~(ELF_LIB_ALIGN - 1);
+	return true;
+}
+
+bool elf_link_dynamic(vm_area_t** areas, const char* name, uint32_t dynamic, uint32_t start, uint32_t limit, uint32_t* lib_count) {
+	elf_object_t objs[ELF_MAX_LIBS + 1];
+	memset(objs, 0, sizeof(objs));
+	objs[0].name = name;
+	objs[0].start = start;
+	objs[0].end = limit;
+	if (!elf_object_parse(*areas, &objs[0], dynamic)) {
+		printf_err("%s has a malformed dynamic section", name);
+		return false;
+	}
+	if (objs[0].textrel) {
+		printf_err("%s needs text relocations", name);
+		return false;
+	}
+
+	//every process gets the same layout, so library pages are shared between them
+	uint32_t count = 1;
+	uint32_t next_base = ELF_LIB_BASE;
+	for (elf_dyn* dyn = (elf_dyn*)dynamic; dyn->tag != DT_NULL; dyn++) {
+		if (dyn->tag != DT_NEEDED) continue;
+		if (!objs[0].strtab || dyn->val >= objs[0].strtab_size) {
+			printf_err("%s names a library outside its string table", name);
+			return false;
+		}
+		if (count > ELF_MAX_LIBS) {
+			printf_err("%s needs more than %d shared libraries", name, ELF_MAX_LIBS);
+			return false;
+		}
+		if (!elf_load_library(areas, objs[0].strtab + dyn->val, &objs[count], &next_base)) {
+			return false;
+		}
+		count++;
+	}
+	*lib_count = count - 1;
+
+	//libraries first, so data the program copies out of them has been relocated
+	for (uint32_t i = count; i-- > 0;) {
+		elf_object_t* obj = &objs[i];
+		if (!elf_relocate(*areas, objs, count, obj, obj->rel, obj->rel_size) ||
+			!elf_relocate(*areas, objs, count, obj, obj->jmprel, obj->jmprel_size)) {
+			return false;
+		}
+	}
+	return true;
+}
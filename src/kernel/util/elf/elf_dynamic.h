@@ -0,0 +1,54 @@
+#ifndef ELF_DYNAMIC_H
+#define ELF_DYNAMIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <kernel/vmm/vm_area.h>
+#include "elf.h"
+
+//in-kernel dynamic linking for programs built against shared libraries such as libc.so
+//each library a program needs (DT_NEEDED) is found in ELF_LIB_PATH, then the root directory,
+//and mapped at the same address in every process, so its text pages are shared between them
+//all relocations, including the PLT's, are bound at exec rather than lazily
+//libraries must be position independent, as those needing text relocations are refused.
+//they may not need libraries of their own, and their constructors aren't run
+
+#define ELF_LIB_PATH	"/lib/"
+#define ELF_LIB_BASE	0x40000000
+//libraries are placed one after another, each starting on a boundary of this size
+#define ELF_LIB_ALIGN	0x100000
+#define ELF_MAX_LIBS	4
+
+//a loaded program or library, with the tables its dynamic section points to
+typedef struct elf_object {
+	const char* name;
+	uint32_t base;		//added to every address in the object, 0 for the program
+	uint32_t start;		//range covered by its loadable segments, which every table must lie within
+	uint32_t end;
+	const char* strtab;
+	uint32_t strtab_size;
+	elf_sym_tab* symtab;
+	uint32_t sym_count;
+	uint32_t* hash;		//SysV hash table, which also gives the number of symbols
+	elf_rel* rel;
+	uint32_t rel_size;
+	elf_rel* jmprel;
+	uint32_t jmprel_size;
+	bool textrel;
+} elf_object_t;
+
+//record every loadable segment of @p elf in @p areas, moved up by @p base
+//stores the address of its dynamic section, or 0, in @p dynamic,
+//and the range from its lowest segment to the end of its highest in @p start and @p limit
+//returns false if it has nothing to load, or a segment doesn't lie in user space
+bool elf_load_segments(vm_area_t** areas, FILE* elf, elf_header* hdr, uint32_t base, uint32_t* dynamic, uint32_t* start, uint32_t* limit);
+
+//load the libraries needed by program @p name, whose dynamic section is at @p dynamic, into @p areas,
+//then bind the relocations of the program and its libraries
+//the program's segments, spanning [@p start, @p limit), must already be in @p areas, as the tables are read in place
+//stores the number of libraries loaded in @p lib_count
+//returns false if a library is missing or unusable, a symbol can't be resolved,
+//or a table or relocation lies outside its object
+bool elf_link_dynamic(vm_area_t** areas, const char* name, uint32_t dynamic, uint32_t start, uint32_t limit, uint32_t* lib_count);
+
+#endif
@@ -0,0 +1,325 @@
+#include "elf_module.h"
+#include <std/std.h>
+#include <std/printf.h>
+#include <std/kheap.h>
+#include <kernel/boot_info.h>
+#include <kernel/vmm/vmm.h>
+
+#define KERNEL_SYM_BUCKETS	1024
+
+static elf_sym_tab* kernel_symtab = NULL;
+static const char* kernel_strtab = NULL;
+static uint32_t kernel_strtab_size = 0;
+static uint32_t kernel_sym_buckets[KERNEL_SYM_BUCKETS];
+//next symbol with the same hash, or 0
+static uint32_t* kernel_sym_chain = NULL;
+
+static elf_module_t* modules = NULL;
+
+static bool elf_symbol_exported(elf_sym_tab* sym) {
+	uint8_t bind = ELF32_ST_BIND(sym->info);
+	return sym->shndx != SHN_UNDEF && (bind == STB_GLOBAL || bind == STB_WEAK);
+}
+
+void elf_module_init(void) {
+	boot_info_t* info = boot_info_get();
+	if (!info->kernel_symbols_end) {
+		printf_info("No kernel symbol table, modules won't be able to call into the kernel");
+		return;
+	}
+	//the tables usually sit past the identity map, in RAM the PMM keeps for them
+	uint32_t phys = info->kernel_symbols_start;
+	uint32_t virt = vmm_map_kernel_ram(phys, info->kernel_symbols_end - phys);
+	multiboot_elf_section_header_table_t* table = &info->symbol_table_info;
+	elf_s_header* sections = (elf_s_header*)(virt + (table->addr - phys));
+
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < table->num; i++) {
+		if (sections[i].type != SHT_SYMTAB || sections[i].link >= table->num) continue;
+		elf_s_header* strtab = &sections[sections[i].link];
+		//names are only read up to the end of the table, so it must be terminated
+		if (!strtab->size || strtab->addr < phys || strtab->addr + strtab->size > info->kernel_symbols_end) continue;
+		kernel_strtab = (const char*)(virt + (strtab->addr - phys));
+		if (kernel_strtab[strtab->size - 1]) continue;
+		kernel_strtab_size = strtab->size;
+		kernel_symtab = (elf_sym_tab*)(virt + (sections[i].addr - phys));
+		count = sections[i].size / sizeof(elf_sym_tab);
+		break;
+	}
+	if (!kernel_symtab) {
+		printf_info("Kernel symbol table is unusable, modules won't be able to call into the kernel");
+		return;
+	}
+
+	kernel_sym_chain = kmalloc(count * sizeof(uint32_t));
+	memset(kernel_sym_chain, 0, count * sizeof(uint32_t));
+	uint32_t exported = 0;
+	//symbol 0 is always null, so it doubles as the end of a chain
+	for (uint32_t i = 1; i < count; i++) {
+		if (!elf_symbol_exported(&kernel_symtab[i]) || kernel_symtab[i].name >= kernel_strtab_size) continue;
+		uint32_t bucket = elf_hash(kernel_strtab + kernel_symtab[i].name) % KERNEL_SYM_BUCKETS;
+		kernel_sym_chain[i] = kernel_sym_buckets[bucket];
+		kernel_sym_buckets[bucket] = i;
+		exported++;
+	}
+	printf_info("%d kernel symbols available to modules", exported);
+}
+
+static uint32_t elf_kernel_symbol(const char* name) {
+	if (!kernel_symtab) {
+		return 0;
+	}
+	for (uint32_t i = kernel_sym_buckets[elf_hash(name) % KERNEL_SYM_BUCKETS]; i; i = kernel_sym_chain[i]) {
+		//every symbol in a chain was checked when it was indexed
+		if (!strcmp(kernel_strtab + kernel_symtab[i].name, name)) {
+			return kernel_symtab[i].value;
+		}
+	}
+	return 0;
+}
+
+uint32_t elf_module_symbol(const char* name) {
+	uint32_t addr = elf_kernel_symbol(name);
+	if (addr) {
+		return addr;
+	}
+	for (elf_module_t* mod = modules; mod; mod = mod->next) {
+		for (uint32_t i = 1; i < mod->sym_count; i++) {
+			elf_sym_tab* sym = &mod->symtab[i];
+			//names were checked when the module was bound
+			const char* sym_name = mod->strtab + sym->name;
+			//every module has one
+			if (!elf_symbol_exported(sym) || !strcmp(sym_name, ELF_MODULE_INIT)) continue;
+			if (!strcmp(sym_name, name)) {
+				return sym->value;
+			}
+		}
+	}
+	return 0;
+}
+
+static void elf_module_free(elf_module_t* mod) {
+	if (mod->pages) {
+		vmm_free_kernel_pages(mod->base, mod->pages);
+	}
+	kfree(mod->symtab);
+	kfree(mod->strtab);
+	kfree(mod);
+}
+
+//module name from @p path, without its directory or .ko extension
+static void elf_module_name(const char* path, char* out) {
+	const char* base = path;
+	for (const char* c = path; *c; c++) {
+		if (*c == '/') base = c + 1;
+	}
+	strncpy(out, base, ELF_MODULE_NAME_MAX - 1);
+	out[ELF_MODULE_NAME_MAX - 1] = '\0';
+	uint32_t len = strlen(out);
+	if (len > 3 && !strcmp(out + len - 3, ".ko")) {
+		out[len - 3] = '\0';
+	}
+}
+
+//give each allocated section of @p mod its place, and copy them in
+//the sections' addresses are updated to where they were put
+static void elf_module_place(elf_module_t* mod, uint8_t* image, elf_s_header* sections, uint32_t count) {
+	uint32_t size = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		if (!(sections[i].flags & SHF_ALLOC) || !sections[i].size) continue;
+		uint32_t align = sections[i].addralign ? sections[i].addralign : 1;
+		size = (size + align - 1) & ~(align - 1);
+		sections[i].addr = size;
+		size += sections[i].size;
+	}
+
+	mod->pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+	if (!mod->pages) {
+		return;
+	}
+	mod->base = vmm_alloc_kernel_pages(mod->pages);
+	//covers .bss
+	memset((void*)mod->base, 0, mod->pages * PAGE_SIZE);
+	for (uint32_t i = 0; i < count; i++) {
+		if (!(sections[i].flags & SHF_ALLOC) || !sections[i].size) continue;
+		sections[i].addr += mod->base;
+		if (sections[i].type != SHT_NOBITS) {
+			memcpy((void*)sections[i].addr, image + sections[i].offset, sections[i].size);
+		}
+	}
+}
+
+//turn each symbol's value into its final address
+static bool elf_module_bind(elf_module_t* mod, elf_s_header* sections, uint32_t count) {
+	for (uint32_t i = 1; i < mod->sym_count; i++) {
+		elf_sym_tab* sym = &mod->symtab[i];
+		if (sym->name >= mod->strtab_size) {
+			printf_err("%s: symbol %d has a bad name", mod->name, i);
+			return false;
+		}
+		const char* name = mod->strtab + sym->name;
+		if (sym->shndx == SHN_UNDEF) {
+			sym->value = elf_module_symbol(name);
+			if (!sym->value && ELF32_ST_BIND(sym->info) != STB_WEAK) {
+				printf_err("%s: undefined symbol %s", mod->name, name);
+				return false;
+			}
+		}
+		else if (sym->shndx == SHN_COMMON) {
+			printf_err("%s: common symbol %s, build with -fno-common", mod->name, name);
+			return false;
+		}
+		else if (sym->shndx < count) {
+			sym->value += sections[sym->shndx].addr;
+		}
+		//anything else is absolute
+	}
+	return true;
+}
+
+static bool elf_module_relocate(elf_module_t* mod, uint8_t* image, elf_s_header* sections, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		if (sections[i].type == SHT_RELA) {
+			printf_err("%s: RELA relocations aren't used on x86", mod->name);
+			return false;
+		}
+		if (sections[i].type != SHT_REL || sections[i].info >= count) continue;
+		//relocations for debug info and the like aren't loaded
+		elf_s_header* target = &sections[sections[i].info];
+		if (!(target->flags & SHF_ALLOC)) continue;
+
+		elf_rel* rels = (elf_rel*)(image + sections[i].offset);
+		for (uint32_t j = 0; j < sections[i].size / sizeof(elf_rel); j++) {
+			uint32_t sym_idx = ELF_R_SYM(rels[j].info);
+			if (sym_idx >= mod->sym_count || rels[j].offset + sizeof(uint32_t) > target->size) {
+				printf_err("%s: bad relocation", mod->name);
+				return false;
+			}
+			uint32_t* where = (uint32_t*)(target->addr + rels[j].offset);
+			uint32_t value = mod->symtab[sym_idx].value;
+			switch (ELF_R_TYPE(rels[j].info)) {
+				case R_386_NONE:
+					break;
+				case R_386_32:
+					*where += value;
+					break;
+				case R_386_PC32:
+					*where += value - (uint32_t)where;
+					break;
+				default:
+					printf_err("%s: unsupported relocation type %d", mod->name, ELF_R_TYPE(rels[j].info));
+					return false;
+			}
+		}
+	}
+	return true;
+}
+
+//link the object file in @p image, of @p size bytes, into the kernel
+static elf_module_t* elf_module_link(const char* path, uint8_t* image, uint32_t size) {
+	elf_header* hdr = (elf_header*)image;
+	if (size < sizeof(elf_header) || !elf_validate_header(hdr) || hdr->type != ET_REL ||
+		hdr->shentsize != sizeof(elf_s_header) || hdr->shoff + hdr->shnum * sizeof(elf_s_header) > size) {
+		printf_err("%s isn't a relocatable x86 ELF object", path);
+		return NULL;
+	}
+	elf_s_header* sections = (elf_s_header*)(image + hdr->shoff);
+	elf_s_header* symtab = NULL;
+	for (uint32_t i = 0; i < hdr->shnum; i++) {
+		if (sections[i].type != SHT_NOBITS && sections[i].offset + sections[i].size > size) {
+			printf_err("%s is truncated", path);
+			return NULL;
+		}
+		if (sections[i].type == SHT_SYMTAB) {
+			symtab = &sections[i];
+		}
+	}
+	if (!symtab || symtab->link >= hdr->shnum) {
+		printf_err("%s has no symbol table", path);
+		return NULL;
+	}
+
+	elf_module_t* mod = kmalloc(sizeof(elf_module_t));
+	memset(mod, 0, sizeof(elf_module_t));
+	elf_module_name(path, mod->name);
+	//the module keeps its symbols, for those loaded after it
+	elf_s_header* strtab = &sections[symtab->link];
+	mod->sym_count = symtab->size / sizeof(elf_sym_tab);
+	mod->symtab = kmalloc(symtab->size);
+	memcpy(mod->symtab, image + symtab->offset, symtab->size);
+	mod->strtab = kmalloc(strtab->size + 1);
+	memcpy(mod->strtab, image + strtab->offset, strtab->size);
+	mod->strtab[strtab->size] = '\0';
+	mod->strtab_size = strtab->size;
+
+	elf_module_place(mod, image, sections, hdr->shnum);
+	if (!elf_module_bind(mod, sections, hdr->shnum) ||
+		!elf_module_relocate(mod, image, sections, hdr->shnum)) {
+		elf_module_free(mod);
+		return NULL;
+	}
+	return mod;
+}
+
+elf_module_t* elf_module_load(const char* path) {
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		printf_err("Couldn't find module %s", path);
+		return NULL;
+	}
+	uint32_t size = file->node->length;
+	uint8_t* image = kmalloc(size);
+	fseek(file, 0, SEEK_SET);
+	bool complete = fread(image, sizeof(char), size, file) == size;
+	fclose(file);
+
+	elf_module_t* mod = complete ? elf_module_link(path, image, size) : NULL;
+	kfree(image);
+	if (!mod) {
+		return NULL;
+	}
+
+	int (*init)(void) = NULL;
+	for (uint32_t i = 1; i < mod->sym_count; i++) {
+		if (elf_symbol_exported(&mod->symtab[i]) && !strcmp(mod->strtab + mod->symtab[i].name, ELF_MODULE_INIT)) {
+			init = (int(*)(void))mod->symtab[i].value;
+			break;
+		}
+	}
+	if (!init) {
+		printf_err("%s has no %s()", path, ELF_MODULE_INIT);
+		elf_module_free(mod);
+		return NULL;
+	}
+	int ret = init();
+	if (ret) {
+		printf_err("%s: %s() failed (%d)", mod->name, ELF_MODULE_INIT, ret);
+		elf_module_free(mod);
+		return NULL;
+	}
+	mod->next = modules;
+	modules = mod;
+	printf_info("Loaded module %s at 0x%08x", mod->name, mod->base);
+	return mod;
+}
+
+bool elf_module_require(const char* name) {
+	for (elf_module_t* mod = modules; mod; mod = mod->next) {
+		if (!strcmp(mod->name, name)) {
+			return true;
+		}
+	}
+	char path[128];
+	snprintf(path, sizeof(path), "%s%s.ko", ELF_MODULE_PATH, name);
+	return elf_module_load(path) != NULL;
+}
+
+void elf_module_print(void) {
+	if (!modules) {
+		printf("No modules loaded\n");
+		return;
+	}
+	for (elf_module_t* mod = modules; mod; mod = mod->next) {
+		printf("%s: %d pages at 0x%08x\n", mod->name, mod->pages, mod->base);
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef ELF_MODULE_H
+#define ELF_MODULE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "elf.h"
+
+//loadable kernel modules: relocatable ELF objects (gcc -c) linked into the running kernel
+//a module's undefined symbols are resolved against the kernel's own symbol table, which GRUB
+//loads alongside the image, and then against the globals of modules loaded before it
+//a module defines int module_init(void), called once it's linked. a nonzero return unloads it again
+//modules can't be unloaded once initialized, and must be built with -fno-common
+
+#define ELF_MODULE_PATH		"/modules/"
+#define ELF_MODULE_INIT		"module_init"
+#define ELF_MODULE_NAME_MAX	32
+
+//a loaded module, with its symbols bound to their final addresses
+typedef struct elf_module {
+	char name[ELF_MODULE_NAME_MAX];
+	uint32_t base;			//kernel pool pages holding the module's sections
+	uint32_t pages;
+	elf_sym_tab* symtab;
+	uint32_t sym_count;
+	char* strtab;		//terminated, beyond its strtab_size bytes
+	uint32_t strtab_size;
+	struct elf_module* next;
+} elf_module_t;
+
+//index the kernel's symbol table for resolving modules against
+//without one, only modules needing nothing from the kernel can be loaded
+void elf_module_init(void);
+
+//address of the kernel or loaded module global @p name, or 0 if there's none
+uint32_t elf_module_symbol(const char* name);
+
+//link the relocatable object at @p path into the kernel and run its init function
+//returns the module, or NULL if it couldn't be loaded or failed to initialize
+elf_module_t* elf_module_load(const char* path);
+
+//load module @p name from ELF_MODULE_PATH, unless it's already loaded
+//lets drivers be brought in the first time they're needed rather than at boot
+bool elf_module_require(const char* name);
+
+//print every loaded module
+void elf_module_print(void);
+
+#endif
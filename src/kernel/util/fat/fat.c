@@ -5,6 +5,11 @@
 #include <std/math.h>
 #include <std/string.h>
 #include <kernel/drivers/ide/ide.h>
+#include <kernel/util/vfs/dcache.h>
+#include <kernel/util/vfs/pagecache.h>
+#include <kernel/util/bcache/bcache.h>
+#include <kernel/util/blkq/blkq.h>
+#include <kernel/vmm/vmm.h>
 
 #define MBR_SECTOR 0
 #define SUPERBLOCK_SECTOR 1
@@ -16,9 +21,20 @@
 
 #define ROOT_DIRECTORY_SECTOR 0
 
+//most sectors reserved past the end of a file when it's appended to
+#define FAT_PREALLOC_MAX_SECTORS 64
+
+//sequential readers get a readahead window starting at MIN and doubling up to MAX sectors
+#define FAT_READAHEAD_MIN_SECTORS 8
+#define FAT_READAHEAD_MAX_SECTORS 64
+
+//index of an entry within its directory, when it isn't known
+#define FAT_NO_ENTRY (uint32_t)-1
+
 int fat_read_file(fat_dirent* file, char* buffer, int byte_count, int offset);
 int fat_write_file(fat_dirent* file, char* buffer, int byte_count, int offset);
 int fat_dir_read_dirent(fat_dirent* directory, char* name, fat_dirent* store);
+static int fat_dir_find(fat_dirent* directory, char* name, fat_dirent* store, uint32_t* index);
 bool dirent_for_start_sector(uint32_t desired_sector, fat_dirent* directory, fat_dirent* store);
 
 fat_dirent root_dir;
@@ -33,74 +49,193 @@ int sectors_from_bytes(int bytes) {
 }
 
 //current in use file allocation table
-//this table uses one uint32_t for each sector
+//this table uses one uint32_t for each sector, and is kept in memory while mounted
 static uint32_t* fat = NULL;
+static uint32_t fat_pages = 0;
+//one bit per data sector, set if the sector is free
+static uint32_t* free_bitmap = NULL;
+static uint32_t free_count = 0;
+//allocation resumes searching here
+static uint32_t next_free_hint = 0;
+//one bit per on-disk sector of the table, set if it's been modified since the last fat_flush()
+static uint32_t* dirty_table_sectors = NULL;
+
+//superblock fields, read at mount or written at format
+static struct {
+	uint32_t magic;
+	uint32_t sector_size;
+	uint32_t sector_count;
+	uint32_t data_region_start;
+} superblock;
+
 static unsigned char fat_disk;
+//device id used to key this filesystem's entries in the dentry cache
+static uint32_t fat_dev = 0;
+static bool readahead_enabled = true;
+
+#define BITMAP_WORDS(bits) (((bits) + 31) / 32)
+
+//number of disk sectors the table itself occupies
+static uint32_t fat_table_sectors(uint32_t sector_count) {
+	return sectors_from_bytes(sector_count * sizeof(uint32_t));
+}
+
+static void fat_free_table() {
+	if (fat) {
+		vmm_free_kernel_pages((uint32_t)fat, fat_pages);
+		kfree(free_bitmap);
+		kfree(dirty_table_sectors);
+	}
+	fat = NULL;
+	free_bitmap = NULL;
+	dirty_table_sectors = NULL;
+}
+
+//allocate an in-memory table for @p sector_count sectors, plus its bookkeeping
+//the table is too large for the kernel heap, so it lives in the kernel page pool
+static void fat_alloc_table(uint32_t sector_count) {
+	fat_free_table();
+
+	fat_pages = (sector_count * sizeof(uint32_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+	fat = (uint32_t*)vmm_alloc_kernel_pages(fat_pages);
+
+	free_bitmap = kmalloc(BITMAP_WORDS(sector_count) * sizeof(uint32_t));
+	memset(free_bitmap, 0, BITMAP_WORDS(sector_count) * sizeof(uint32_t));
+
+	uint32_t table_sectors = fat_table_sectors(sector_count);
+	dirty_table_sectors = kmalloc(BITMAP_WORDS(table_sectors) * sizeof(uint32_t));
+	memset(dirty_table_sectors, 0, BITMAP_WORDS(table_sectors) * sizeof(uint32_t));
+
+	free_count = 0;
+	next_free_hint = 0;
+}
+
+//update a table entry, keeping the free bitmap and dirty sectors in step
+static void fat_set(uint32_t sector, uint32_t value) {
+	bool was_free = fat[sector] == FREE_BLOCK;
+	bool is_free = value == FREE_BLOCK;
+	fat[sector] = value;
+
+	if (is_free && !was_free) {
+		free_bitmap[sector / 32] |= (1 << (sector % 32));
+		free_count++;
+		//freed sectors are preferred, to keep files near the start of the disk
+		if (sector < next_free_hint) {
+			next_free_hint = sector;
+		}
+	}
+	else if (was_free && !is_free) {
+		free_bitmap[sector / 32] &= ~(1 << (sector % 32));
+		free_count--;
+	}
+
+	uint32_t table_sector = (sector * sizeof(uint32_t)) / SECTOR_SIZE;
+	dirty_table_sectors[table_sector / 32] |= (1 << (table_sector % 32));
+}
+
+//rebuild the free bitmap from the table's contents
+//only the first @p usable entries have a data sector on the disk, so the rest are never free
+static void fat_scan_free(uint32_t sector_count, uint32_t usable) {
+	memset(free_bitmap, 0, BITMAP_WORDS(sector_count) * sizeof(uint32_t));
+	free_count = 0;
+	for (uint32_t i = 0; i < MIN(sector_count, usable); i++) {
+		if (fat[i] == FREE_BLOCK) {
+			free_bitmap[i / 32] |= (1 << (i % 32));
+			free_count++;
+		}
+	}
+	next_free_hint = 0;
+}
+
 static void fat_create(int fat_sector_count, unsigned char disk) { 
-	fat = kmalloc(fat_sector_count * sizeof(uint32_t));
-	memset(fat, FREE_BLOCK, fat_sector_count * sizeof(uint32_t));
 	fat_disk = disk;
+	fat_alloc_table(fat_sector_count);
+	memset(fat, FREE_BLOCK, fat_sector_count * sizeof(uint32_t));
+	fat_scan_free(fat_sector_count, fat_sector_count);
+
+	//a fresh table must be written out in full
+	uint32_t table_sectors = fat_table_sectors(fat_sector_count);
+	for (uint32_t i = 0; i < table_sectors; i++) {
+		dirty_table_sectors[i / 32] |= (1 << (i % 32));
+	}
+}
+
+//read the table of the filesystem described by superblock into memory
+static void fat_load() {
+	uint32_t sector_count = fat_read_sector_count();
+	fat_alloc_table(sector_count);
+
+	//a single large request, rather than cycling every table sector through the block cache
+	if (blkq_read(fat_disk, FAT_SECTOR, fat_table_sectors(sector_count), (uint8_t*)fat)) {
+		printf_err("FAT couldn't read allocation table from disk %d", fat_disk);
+	}
+	//older kernels gave the table an entry per disk sector, so its last entries lie past the end of the disk
+	uint32_t usable = sector_count;
+	uint32_t capacity = blkq_capacity(fat_disk);
+	if (capacity) {
+		usable = capacity > superblock.data_region_start ? capacity - superblock.data_region_start : 0;
+	}
+	fat_scan_free(sector_count, usable);
+	printf_info("FAT loaded: %d sectors, %d free", sector_count, free_count);
 }
 
 uint32_t* fat_get() {
 	return fat;
 }
 
+bool fat_mounted_on(unsigned char drive) {
+	return fat && fat_disk == drive;
+}
+
 bool is_valid_sector(int sector) {
 	return (sector >= 0 && sector < fat_read_sector_count());
 }
 
+static void fat_read_superblock() {
+	superblock.magic = bcache_read_int(fat_disk, SUPERBLOCK_SECTOR, 0);
+	superblock.sector_size = bcache_read_int(fat_disk, SUPERBLOCK_SECTOR, sizeof(uint32_t));
+	superblock.sector_count = bcache_read_int(fat_disk, SUPERBLOCK_SECTOR, sizeof(uint32_t) * 2);
+	superblock.data_region_start = bcache_read_int(fat_disk, SUPERBLOCK_SECTOR, sizeof(uint32_t) * 3);
+}
+
 int fat_read_magic() {
-	static int magic = 0;
-	if (!magic) {
-		magic = ide_ata_read_int(fat_disk, SUPERBLOCK_SECTOR, 0);
-	}
-	return magic;
+	return superblock.magic;
 }
 
 int fat_read_sector_size() {
-	static int sector_size = 0;
-	if (!sector_size) {
-		sector_size = ide_ata_read_int(fat_disk, SUPERBLOCK_SECTOR, sizeof(uint32_t));
-	}
-	return sector_size;
+	return superblock.sector_size;
 }
 
 int fat_read_sector_count() {
-	static int fat_size = 0;
-	if (!fat_size) {
-		fat_size = ide_ata_read_int(fat_disk, SUPERBLOCK_SECTOR, sizeof(uint32_t) * 2);
-	}
-	return fat_size;
+	return superblock.sector_count;
 }
 
 int fat_read_data_region() {
-	int data_region_start = ide_ata_read_int(fat_disk, SUPERBLOCK_SECTOR, sizeof(uint32_t) * 3);
-	return data_region_start;
+	return superblock.data_region_start;
 }
 
 #define FAT_MAGIC 0xFEEDFACE
 void fat_record_superblock(int sector_size, int fat_sector_count) {
-	char buf[SECTOR_SIZE];
-	memset(buf, 0, sizeof(buf));
-	itoa(sector_size, buf);
+	superblock.magic = FAT_MAGIC;
+	superblock.sector_size = sector_size;
+	superblock.sector_count = fat_sector_count;
+	//data follows the boot sector, superblock, and the table itself
+	superblock.data_region_start = FAT_SECTOR + fat_table_sectors(fat_sector_count);
 
 	int offset = 0;
-	ide_ata_write_int(fat_disk, SUPERBLOCK_SECTOR, FAT_MAGIC, offset);
+	bool failed = bcache_write_int(fat_disk, SUPERBLOCK_SECTOR, superblock.magic, offset) != 0;
 	offset += sizeof(uint32_t);
 
-	ide_ata_write_int(fat_disk, SUPERBLOCK_SECTOR, sector_size, offset);
+	failed |= bcache_write_int(fat_disk, SUPERBLOCK_SECTOR, superblock.sector_size, offset) != 0;
 	offset += sizeof(uint32_t);
 
-	ide_ata_write_int(fat_disk, SUPERBLOCK_SECTOR, fat_sector_count, offset);
+	failed |= bcache_write_int(fat_disk, SUPERBLOCK_SECTOR, superblock.sector_count, offset) != 0;
 	offset += sizeof(uint32_t);
 
-	int data_region_start = fat_sector_count / SECTOR_SIZE;
-	//account for boot sector plus superblock
-	//add 1 for boot sector
-	//add 1 for superblock
-	data_region_start += 2;
-	ide_ata_write_int(fat_disk, SUPERBLOCK_SECTOR, data_region_start, offset);
+	failed |= bcache_write_int(fat_disk, SUPERBLOCK_SECTOR, superblock.data_region_start, offset) != 0;
+	if (failed) {
+		printk("fat_record_superblock() disk write failed\n");
+	}
 }
 
 int fat_file_last_sector(int sector, uint32_t* sectors_in_file) {
@@ -132,11 +267,23 @@ int fat_file_last_sector(int sector, uint32_t* sectors_in_file) {
 
 int fat_first_free_sector() {
 	uint32_t sector_count = fat_read_sector_count();
-	for (uint32_t i = 0; i < sector_count; i++) {
-		if (fat[i] == FREE_BLOCK) {
-			//found unused sector!
-			return i;
+	uint32_t words = BITMAP_WORDS(sector_count);
+	for (uint32_t n = 0; free_count && n <= words; n++) {
+		uint32_t i = ((next_free_hint / 32) + n) % words;
+		uint32_t bits = free_bitmap[i];
+		//skip free sectors behind the hint on the first pass over its word
+		if (n == 0) {
+			bits &= ~((1 << (next_free_hint % 32)) - 1);
+		}
+		if (!bits) {
+			continue;
 		}
+		uint32_t sector = (i * 32) + __builtin_ctz(bits);
+		if (sector >= sector_count) {
+			continue;
+		}
+		next_free_hint = sector;
+		return sector;
 	}
 	//no free sectors!
 	printf("FAT ran out of usable sectors, %d allocated\n", sector_count);
@@ -147,38 +294,133 @@ void fat_dealloc_sector(uint32_t sector) {
 	uint32_t next = fat[sector];
 	//do we have to walk the entire FAT to find the parent of this node?
 	//is there a way to do this faster than O(n)?
-	uint32_t sector_count = 0;
-	fat_file_last_sector(sector, &sector_count);
+	uint32_t sector_count = fat_read_sector_count();
 	for (uint32_t i = 0; i < sector_count; i++) {
 		if (fat[i] == sector) {
 			//found the parent of the sector we're freeing!
 			//set the parent's link to the next block of the freed block
-			fat[i] = next;
+			fat_set(i, next);
+			break;
 		}
 	}
-	fat[sector] = FREE_BLOCK;
+	fat_set(sector, FREE_BLOCK);
 }
 
 int fat_alloc_sector(int parent) {
-	uint32_t sector = fat_first_free_sector();
+	int sector = fat_first_free_sector();
+	if (sector < 0) {
+		return -1;
+	}
 	if (is_valid_sector(parent)) {
 		int last_used_sector = fat_file_last_sector(parent, NULL);
-		fat[last_used_sector] = sector;
+		fat_set(last_used_sector, sector);
 	}
 
-	fat[sector] = EOF_BLOCK;
-
-	//fat_flush();
+	fat_set(sector, EOF_BLOCK);
+	next_free_hint = sector + 1;
 	return sector;
 }
 
-void fat_expand_file(uint32_t file, uint32_t size_increase) {
-	uint32_t sector_count = sectors_from_bytes(size_increase);
-	uint32_t sectors_in_file = 0;
-	int last = fat_file_last_sector(file, &sectors_in_file);
-	for (uint32_t i = 0; i < sector_count; i++) {
-		last = fat_alloc_sector(last);
+//find the free run that best fits @p count sectors: the shortest run at least that long,
+//or failing that the longest run there is, which the caller fills before looking again
+//returns the run's first sector and stores its length in @p run_len, or -1 if nothing is free
+static int fat_best_fit(uint32_t count, uint32_t* run_len) {
+	uint32_t sector_count = fat_read_sector_count();
+	int best = -1;
+	uint32_t best_len = 0;
+	int longest = -1;
+	uint32_t longest_len = 0;
+
+	uint32_t i = 0;
+	while (i < sector_count) {
+		//skip wholly allocated words
+		if (!(i % 32) && !free_bitmap[i / 32]) {
+			i += 32;
+			continue;
+		}
+		if (!(free_bitmap[i / 32] & (1 << (i % 32)))) {
+			i++;
+			continue;
+		}
+
+		uint32_t start = i;
+		while (i < sector_count && (free_bitmap[i / 32] & (1 << (i % 32)))) {
+			//and wholly free ones
+			if (!(i % 32) && free_bitmap[i / 32] == 0xFFFFFFFF) {
+				i += 32;
+				continue;
+			}
+			i++;
+		}
+		uint32_t len = MIN(i, sector_count) - start;
+
+		if (len >= count && (best < 0 || len < best_len)) {
+			best = start;
+			best_len = len;
+			if (len == count) {
+				break;
+			}
+		}
+		if (len > longest_len) {
+			longest = start;
+			longest_len = len;
+		}
+	}
+
+	if (best >= 0) {
+		*run_len = best_len;
+		return best;
+	}
+	*run_len = longest_len;
+	return longest;
+}
+
+//allocate @p count sectors as few contiguous extents as possible, and link them onto the end of @p parent's chain
+//if @p parent isn't a valid sector, the sectors start a new chain
+//returns the first newly allocated sector, or -1 if none could be allocated
+static int fat_alloc_extent(int parent, uint32_t count) {
+	int first = -1;
+	int last = is_valid_sector(parent) ? fat_file_last_sector(parent, NULL) : -1;
+
+	while (count) {
+		uint32_t run_len = 0;
+		int start = fat_best_fit(count, &run_len);
+		if (start < 0) {
+			printf("FAT ran out of usable sectors, %d still needed\n", count);
+			break;
+		}
+
+		uint32_t take = MIN(run_len, count);
+		for (uint32_t i = 0; i < take; i++) {
+			uint32_t sector = start + i;
+			if (last >= 0) {
+				fat_set(last, sector);
+			}
+			fat_set(sector, EOF_BLOCK);
+			last = sector;
+			if (first < 0) {
+				first = sector;
+			}
+		}
+		count -= take;
 	}
+	return first;
+}
+
+//extend @p file's chain by at least @p needed sectors
+//files being appended to get room for further appends up front, so they stay contiguous
+static int fat_grow_chain(uint32_t file, uint32_t needed) {
+	uint32_t sectors_in_file = 0;
+	fat_file_last_sector(file, &sectors_in_file);
+	uint32_t prealloc = MIN(sectors_in_file, FAT_PREALLOC_MAX_SECTORS);
+	int first = fat_alloc_extent(file, MAX(needed, prealloc));
+	fat_flush();
+	return first;
+}
+
+void fat_expand_file(uint32_t file, uint32_t size_increase) {
+	fat_alloc_extent(file, sectors_from_bytes(size_increase));
+	fat_flush();
 
 	fat_dirent* entry = NULL;
 	dirent_for_start_sector(file, &root_dir, entry);
@@ -203,19 +445,52 @@ int fat_file_sector_at_index(uint32_t file, uint32_t index) {
 }
 
 void fat_shrink_file(uint32_t file, uint32_t size_decrease) {
-	int sector_count = sectors_from_bytes(size_decrease);
-	int last = fat_file_last_sector(file, NULL);
-	for (int i = 0; i < sector_count; i++) {
-		fat_dealloc_sector(last - i);
+	uint32_t sector_count = sectors_from_bytes(size_decrease);
+	uint32_t sectors_in_file = 0;
+	fat_file_last_sector(file, &sectors_in_file);
+	//a file always keeps its first sector
+	uint32_t keep = MAX(1, (int)(sectors_in_file - sector_count));
+
+	uint32_t last = fat_file_sector_at_index(file, keep - 1);
+	uint32_t sector = fat[last];
+	fat_set(last, EOF_BLOCK);
+	while (is_valid_sector(sector)) {
+		uint32_t next = fat[sector];
+		fat_set(sector, FREE_BLOCK);
+		sector = next;
 	}
-	printf("Shrunk file %d by %d bytes, chain is now:\n", file, sector_count);
+	fat_flush();
+
+	printf("Shrunk file %d by %d sectors, chain is now:\n", file, sectors_in_file - keep);
 	fat_print_file_links(file);
 }
 
 void fat_flush() {
-	//find sector count from superblock
-	//write FAT starting at dedicated sector
-	ide_ata_write(fat_disk, FAT_SECTOR, (uint32_t)fat_get(), fat_read_sector_count() * sizeof(uint32_t), 0);
+	if (!fat) {
+		return;
+	}
+	//write each run of dirty table sectors as one block cache write
+	//the block cache batches these up with other dirty sectors when it flushes
+	uint32_t table_sectors = fat_table_sectors(fat_read_sector_count());
+	uint32_t i = 0;
+	while (i < table_sectors) {
+		if (!(dirty_table_sectors[i / 32] & (1 << (i % 32)))) {
+			i++;
+			continue;
+		}
+		uint32_t run_start = i;
+		while (i < table_sectors && (dirty_table_sectors[i / 32] & (1 << (i % 32)))) {
+			i++;
+		}
+		//sectors that couldn't be cached stay dirty for the next flush
+		if (bcache_write(fat_disk, FAT_SECTOR + run_start, (uint8_t*)fat + (run_start * SECTOR_SIZE), (i - run_start) * SECTOR_SIZE, 0)) {
+			printk("fat_flush() couldn't write table sectors %d-%d\n", run_start, i - 1);
+			continue;
+		}
+		for (uint32_t j = run_start; j < i; j++) {
+			dirty_table_sectors[j / 32] &= ~(1 << (j % 32));
+		}
+	}
 }
 
 typedef struct {
@@ -240,7 +515,9 @@ void fat_dir_add_file(fat_dirent* directory, fat_dirent* new_entry) {
 				//printf("fat_dir_add_file() found free entry @ sector %d pos %d\n", sector, j);
 				free_entry = &(sector_contents.entries[j]);
 				memcpy(free_entry, new_entry, sizeof(fat_dirent));
-				fat_write_file(directory, (char*)&sector_contents, sizeof(sector_contents), 0);
+				fat_write_file(directory, (char*)&sector_contents, sizeof(sector_contents), i * SECTOR_SIZE);
+				//drop any negative entry recorded for this name
+				dcache_invalidate(fat_dev, directory->first_sector, new_entry->name);
 				return;
 			}
 		}
@@ -249,50 +526,113 @@ void fat_dir_add_file(fat_dirent* directory, fat_dirent* new_entry) {
 	return;
 }
 
-static int sector_for_fat_index(int index) {
-	return index + FAT_SECTOR + fat_read_data_region();
+//record @p size in the entry for the file starting at @p first_sector, searching @p directory and the directories below it
+static bool fat_dir_set_size(fat_dirent* directory, uint32_t first_sector, uint32_t size) {
+	for (int i = 0; i * SECTOR_SIZE < (int)directory->size; i++) {
+		fat_directory sector_contents;
+		if (fat_read_file(directory, (char*)&sector_contents, sizeof(sector_contents), i * SECTOR_SIZE) != sizeof(sector_contents)) {
+			return false;
+		}
+
+		for (uint32_t j = 0; j < sizeof(sector_contents.entries) / sizeof(sector_contents.entries[0]); j++) {
+			fat_dirent* entry = &(sector_contents.entries[j]);
+			if (!strlen(entry->name)) continue;
+
+			if (entry->first_sector == first_sector) {
+				entry->size = size;
+				fat_write_file(directory, (char*)&sector_contents, sizeof(sector_contents), i * SECTOR_SIZE);
+				//cached nodes carry the old length
+				dcache_invalidate(fat_dev, directory->first_sector, entry->name);
+				return true;
+			}
+			if (entry->is_directory && fat_dir_set_size(entry, first_sector, size)) {
+				return true;
+			}
+		}
+	}
+	return false;
 }
 
-int fat_write_file(fat_dirent* file, char* buffer, int byte_count, int offset) {
-	/*
-	if (byte_count + offset > file->size) {
-		printf("fat_write_file() needs to handle EOF\n");
+//record @p size in entry @p index of the directory starting at @p dir_sector, if it still describes the file starting at @p first_sector
+static bool fat_dir_entry_set_size(uint32_t dir_sector, uint32_t index, uint32_t first_sector, uint32_t size) {
+	fat_dirent directory;
+	memset(&directory, 0, sizeof(directory));
+	directory.first_sector = dir_sector;
+
+	fat_directory sector_contents;
+	uint32_t per_sector = sizeof(sector_contents.entries) / sizeof(sector_contents.entries[0]);
+	int offset = (index / per_sector) * SECTOR_SIZE;
+	if (fat_read_file(&directory, (char*)&sector_contents, sizeof(sector_contents), offset) != sizeof(sector_contents)) {
+		return false;
+	}
+	fat_dirent* entry = &(sector_contents.entries[index % per_sector]);
+	if (!strlen(entry->name) || entry->first_sector != first_sector) {
+		return false;
+	}
+	entry->size = size;
+	fat_write_file(&directory, (char*)&sector_contents, sizeof(sector_contents), offset);
+	//cached nodes carry the old length
+	dcache_invalidate(fat_dev, dir_sector, entry->name);
+	return true;
+}
+
+//persist the size of @p file if a write has carried it past its recorded end
+//@p node locates the file's directory entry, if it was opened through one
+static void fat_file_grew(fs_node_t* node, fat_dirent* file, uint32_t end) {
+	if (end <= file->size) {
 		return;
 	}
-	*/
+	file->size = end;
+	if (node && node->impl && fat_dir_entry_set_size(node->impl - 1, node->impl_entry, file->first_sector, end)) {
+		return;
+	}
+	if (!fat_dir_set_size(&root_dir, file->first_sector, end)) {
+		printk("fat_file_grew(%s) couldn't find directory entry\n", file->name);
+	}
+}
+
+static int sector_for_fat_index(int index) {
+	return index + fat_read_data_region();
+}
+
+int fat_write_file(fat_dirent* file, char* buffer, int byte_count, int offset) {
 	int file_sector = file->first_sector;
+	if (!is_valid_sector(file_sector)) {
+		return 0;
+	}
+	pagecache_invalidate(fat_dev, file->first_sector, offset, byte_count);
+
 	int wrote_count = 0;
-	int sector_count = sectors_from_bytes(byte_count + offset);
-	int sectors_in_offset = sectors_from_bytes(offset);
-	for (int i = 0; i < sector_count; i++) {
-		if (!is_valid_sector(file_sector)) {
-			//were we still skipping to offset?
-			if (offset >= SECTOR_SIZE) {
-				printk("fat_write_file() offset was larger than file size\n");
-				return wrote_count;
-			}
-			return wrote_count;
-		}
+	while (byte_count > 0) {
 		if (offset >= SECTOR_SIZE) {
 			offset -= SECTOR_SIZE;
-			printk("fat_write_file() skipping sector %d sectors %d\n", file_sector);
 		}
 		else {
-			int offset_within_buf = SECTOR_SIZE * (i - sectors_in_offset);
-			char* bufptr = &(buffer[offset_within_buf]);
-
-			int bytes_to_write = MIN(SECTOR_SIZE, byte_count);
+			int bytes_to_write = MIN(SECTOR_SIZE - offset, byte_count);
 			int real_sector = sector_for_fat_index(file_sector);
 
 #ifdef DEBUG
-			printk("fat_write_file(%s) sect %d count %d offset %dk @ %x\n", file->name, file_sector, byte_count, offset, bufptr);
-			printk("writing %d from %x to IDE sector %d\n", bytes_to_write, bufptr, real_sector);
+			printk("fat_write_file(%s) sect %d count %d offset %d\n", file->name, file_sector, byte_count, offset);
 #endif
 
-			ide_ata_write(fat_disk, real_sector, (uint32_t)bufptr, bytes_to_write, offset);
+			if (bcache_write(fat_disk, real_sector, (uint8_t*)buffer + wrote_count, bytes_to_write, offset)) {
+				printk("fat_write_file(%s) disk write failed\n", file->name);
+				return wrote_count;
+			}
 			wrote_count += bytes_to_write;
-			offset = 0;
 			byte_count -= bytes_to_write;
+			offset = 0;
+			if (!byte_count) {
+				break;
+			}
+		}
+
+		//writing past the end of the chain appends to the file
+		if (fat[file_sector] == EOF_BLOCK) {
+			if (fat_grow_chain(file->first_sector, sectors_from_bytes(byte_count + offset)) < 0) {
+				printk("fat_write_file() couldn't grow %s\n", file->name);
+				return wrote_count;
+			}
 		}
 		//go to next link in file
 		file_sector = fat[file_sector];
@@ -302,66 +642,132 @@ int fat_write_file(fat_dirent* file, char* buffer, int byte_count, int offset) {
 
 int fat_read_file(fat_dirent* file, char* buffer, int byte_count, int offset) {
 	int file_sector = file->first_sector;
-	if (!is_valid_sector(file_sector)) {
-		return 0;
+	//skip whole sectors before offset
+	while (offset >= SECTOR_SIZE && is_valid_sector(file_sector)) {
+		file_sector = fat[file_sector];
+		offset -= SECTOR_SIZE;
 	}
 
 	int read_count = 0;
-	int sector_count = sectors_from_bytes(byte_count + offset);
-	int sectors_in_offset = sectors_from_bytes(offset);
-	printk("fat_read_file(%s) read %d sectors start %d\n", file->name, sector_count, file_sector);
-
-	for (int i = 0; i < sector_count; i++) {
-		if (!is_valid_sector(file_sector)) {
-			printk("fat_read_file() invalid sector %d\n", file_sector);
-			return read_count;
-		}
-		if (offset >= SECTOR_SIZE) {
-			offset -= SECTOR_SIZE;
-		}
-		else {
-			int offset_within_buf = SECTOR_SIZE * (i - sectors_in_offset);
-			char* bufptr = &(buffer[offset_within_buf]);
-			printk("fat_read_file(%s) sect %d count %d offset %d @ %x\n", file->name, file_sector, byte_count, offset, bufptr);
-			int bytes_to_read = MIN(SECTOR_SIZE, byte_count);
-			int real_sector = sector_for_fat_index(file_sector);
-			ide_ata_read(fat_disk, real_sector, (uint32_t)bufptr, bytes_to_read, offset);
-
+	while (byte_count > 0 && is_valid_sector(file_sector)) {
+		//partial sectors at either end go through the block cache
+		if (offset || byte_count < SECTOR_SIZE) {
+			int bytes_to_read = MIN(SECTOR_SIZE - offset, byte_count);
+			if (bcache_read(fat_disk, sector_for_fat_index(file_sector), (uint8_t*)buffer + read_count, bytes_to_read, offset)) {
+				printk("fat_read_file(%s) disk read failed\n", file->name);
+				break;
+			}
 			read_count += bytes_to_read;
 			byte_count -= bytes_to_read;
-
-			//we've now accounted for within-sector offset, no more need for this
 			offset = 0;
+			file_sector = fat[file_sector];
+			continue;
 		}
-		//go to next link in file
-		file_sector = fat[file_sector];
+
+		//read as much of this extent as we need in one transfer
+		int run_end = file_sector;
+		int run = 1;
+		while ((run + 1) * SECTOR_SIZE <= byte_count && fat[run_end] == (uint32_t)run_end + 1) {
+			run_end++;
+			run++;
+		}
+		if (bcache_read_sectors(fat_disk, sector_for_fat_index(file_sector), run, (uint8_t*)buffer + read_count)) {
+			printk("fat_read_file(%s) disk read failed\n", file->name);
+			break;
+		}
+		read_count += run * SECTOR_SIZE;
+		byte_count -= run * SECTOR_SIZE;
+		file_sector = fat[run_end];
 	}
 	return read_count;
 }
 
 int fat_file_create(int file_size) {
 	int sector_count = sectors_from_bytes(file_size);
-	int last_sector = EOF_BLOCK;
+	if (!sector_count) {
+		return -1;
+	}
+	int first_sector = fat_alloc_extent(EOF_BLOCK, sector_count);
+	fat_flush();
+
+	//new files read back as zeroes
 	char buf[SECTOR_SIZE];
-	int first_sector = -1;
 	memset(buf, 0, sizeof(buf));
+	for (int sector = first_sector; is_valid_sector(sector); sector = fat[sector]) {
+		if (bcache_write(fat_disk, sector_for_fat_index(sector), (uint8_t*)buf, sizeof(buf), 0)) {
+			printk("fat_file_create() couldn't clear sector %d\n", sector);
+		}
+	}
+	return first_sector;
+}
 
-	fat_dirent entry;
-	strcpy((char*)&entry.name, "(creating file)");
-	entry.size = file_size;
-	entry.first_sector = last_sector;
+void fat_print_fragmentation() {
+	if (!fat) {
+		printf("No FAT filesystem mounted\n");
+		return;
+	}
+	uint32_t sector_count = fat_read_sector_count();
 
-	for (int i = 0; i < sector_count; i++) {
-		last_sector = fat_alloc_sector(last_sector);
-		entry.first_sector = last_sector;
+	//a sector starts a chain if no other sector links to it
+	uint32_t* linked = kmalloc(BITMAP_WORDS(sector_count) * sizeof(uint32_t));
+	memset(linked, 0, BITMAP_WORDS(sector_count) * sizeof(uint32_t));
+	for (uint32_t i = 0; i < sector_count; i++) {
+		if (is_valid_sector(fat[i])) {
+			linked[fat[i] / 32] |= (1 << (fat[i] % 32));
+		}
+	}
 
-		fat_write_file(&entry, buf, sizeof(buf), 0);
+	uint32_t files = 0;
+	uint32_t used = 0;
+	uint32_t extents = 0;
+	uint32_t fragmented = 0;
+	uint32_t worst_file = 0;
+	uint32_t worst_extents = 0;
+	for (uint32_t i = 0; i < sector_count; i++) {
+		if (fat[i] == FREE_BLOCK || (linked[i / 32] & (1 << (i % 32)))) {
+			continue;
+		}
+		uint32_t file_extents = 1;
+		uint32_t sector = i;
+		used++;
+		while (is_valid_sector(fat[sector])) {
+			if (fat[sector] != sector + 1) {
+				file_extents++;
+			}
+			sector = fat[sector];
+			used++;
+		}
 
-		if (first_sector < 0) {
-			first_sector = last_sector;
+		files++;
+		extents += file_extents;
+		if (file_extents > 1) {
+			fragmented++;
+		}
+		if (file_extents > worst_extents) {
+			worst_extents = file_extents;
+			worst_file = i;
 		}
 	}
-	return first_sector;
+	kfree(linked);
+
+	uint32_t free_runs = 0;
+	uint32_t largest_free = 0;
+	uint32_t run = 0;
+	for (uint32_t i = 0; i <= sector_count; i++) {
+		if (i < sector_count && fat[i] == FREE_BLOCK) {
+			run++;
+			continue;
+		}
+		if (run) {
+			free_runs++;
+			largest_free = MAX(largest_free, run);
+		}
+		run = 0;
+	}
+
+	printf("FAT: %d files in %d sectors, %d extents (%d.%d per file)\n", files, used, extents, files ? extents / files : 0, files ? ((extents * 10) / files) % 10 : 0);
+	printf("FAT: %d files fragmented, worst is sector %d with %d extents\n", fragmented, worst_file, worst_extents);
+	printf("FAT: %d free sectors in %d runs, largest run %d sectors\n", free_count, free_runs, largest_free);
 }
 
 void fat_print_file_links(uint32_t sector) {
@@ -377,18 +783,211 @@ void fat_print_file_links(uint32_t sector) {
 	printf("EOF\n");
 }
 
-int fat_find_absolute_file(char* name, fat_dirent* store) {
-	char* name_copy = strdup(name);
-	char** save = NULL;
-	char* component = strtok_r(name_copy, "/", save);
+static fs_node_t* fat_node_from_dirent(fat_dirent* entry) {
+	fs_node_t* node = (fs_node_t*)kmalloc(sizeof(fs_node_t));
+	memset(node, 0, sizeof(fs_node_t));
+	strncpy(node->name, entry->name, sizeof(entry->name));
+	node->inode = entry->first_sector;
+	node->length = entry->size;
+	node->flags = (entry->is_directory & 1) ? FS_DIRECTORY : FS_FILE;
+	node->dev = fat_dev;
+	return node;
+}
 
-	fat_dirent current_dir_ent = root_dir;
-	int current_directory = current_dir_ent.first_sector;
+//remember that @p node's entry is entry @p index of the directory starting at @p dir_sector
+//impl holds the directory's first sector plus one, so 0 means the entry's location is unknown
+static void fat_node_set_entry(fs_node_t* node, uint32_t dir_sector, uint32_t index) {
+	if (index == FAT_NO_ENTRY) {
+		return;
+	}
+	node->impl = dir_sector + 1;
+	node->impl_entry = index;
+}
 
+static void fat_dirent_from_node(fs_node_t* node, fat_dirent* store) {
+	memset(store, 0, sizeof(fat_dirent));
+	strncpy(store->name, node->name, sizeof(store->name) - 1);
+	store->first_sector = node->inode;
+	store->size = node->length;
+	store->is_directory = (node->flags & 0x7) == FS_DIRECTORY;
+}
+
+//resolve a single path component within @p directory, and set @p index to its entry's index there
+//the dentry cache is consulted first so warm lookups never touch the disk
+static int fat_dir_lookup(fat_dirent* directory, char* name, fat_dirent* store, uint32_t* index) {
+	fs_node_t* cached = NULL;
+	switch (dcache_lookup(fat_dev, directory->first_sector, name, &cached)) {
+		case DCACHE_HIT:
+			fat_dirent_from_node(cached, store);
+			*index = cached->impl ? cached->impl_entry : FAT_NO_ENTRY;
+			return store->first_sector;
+		case DCACHE_NEGATIVE:
+			return -1;
+		case DCACHE_MISS:
+		default:
+			break;
+	}
+
+	int sector = fat_dir_find(directory, name, store, index);
+	if (sector < 0) {
+		dcache_insert(fat_dev, directory->first_sector, name, NULL, false);
+		return -1;
+	}
+	fs_node_t* node = fat_node_from_dirent(store);
+	fat_node_set_entry(node, directory->first_sector, *index);
+	dcache_insert(fat_dev, directory->first_sector, name, node, true);
+	return sector;
+}
+
+static fs_node_t* fat_op_lookup(fs_node_t* node, char* name) {
+	fat_dirent directory;
+	fat_dirent_from_node(node, &directory);
+	fat_dirent store;
+	uint32_t index;
+	if (fat_dir_find(&directory, name, &store, &index) < 0) {
+		return NULL;
+	}
+	fs_node_t* found = fat_node_from_dirent(&store);
+	fat_node_set_entry(found, directory.first_sector, index);
+	return found;
+}
+
+static uint32_t fat_op_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+	if (offset >= node->length) {
+		return 0;
+	}
+	fat_dirent file;
+	fat_dirent_from_node(node, &file);
+	return fat_read_file(&file, (char*)buffer, MIN(size, node->length - offset), offset);
+}
+
+static uint32_t fat_op_write(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+	fat_dirent file;
+	fat_dirent_from_node(node, &file);
+	int wrote_count = fat_write_file(&file, (char*)buffer, size, offset);
+	fat_file_grew(node, &file, offset + wrote_count);
+	node->length = file.size;
+	return wrote_count;
+}
+
+static struct dirent* fat_op_readdir(fs_node_t* node, uint32_t index) {
+	static struct dirent result;
+	fat_dirent directory;
+	fat_dirent_from_node(node, &directory);
+
+	//removed entries leave holes, so count only entries in use
+	uint32_t seen = 0;
+	for (int i = 0; i * SECTOR_SIZE < (int)directory.size; i++) {
+		fat_directory sector_contents;
+		if (fat_read_file(&directory, (char*)&sector_contents, sizeof(sector_contents), i * SECTOR_SIZE) != sizeof(sector_contents)) {
+			break;
+		}
+		for (uint32_t j = 0; j < sizeof(sector_contents.entries) / sizeof(sector_contents.entries[0]); j++) {
+			fat_dirent* entry = &sector_contents.entries[j];
+			if (!strlen(entry->name) || seen++ != index) {
+				continue;
+			}
+			memset(&result, 0, sizeof(result));
+			strncpy(result.d_name, entry->name, sizeof(entry->name));
+			result.d_ino = entry->first_sector;
+			result.d_off = index + 1;
+			result.d_reclen = sizeof(struct dirent);
+			return &result;
+		}
+	}
+	return NULL;
+}
+
+//directory sectors fetched at once when listing a directory
+#define FAT_GETDENTS_BATCH_SECTORS 8
+
+//@p pos counts directory slots, including unused ones, so a listing can resume without rescanning
+static uint32_t fat_op_getdents(fs_node_t* node, uint32_t* pos, struct dirent* dirp, uint32_t count) {
+	fat_dirent directory;
+	fat_dirent_from_node(node, &directory);
+
+	const uint32_t per_sector = sizeof(((fat_directory*)0)->entries) / sizeof(fat_dirent);
+	uint32_t sector_count = sectors_from_bytes(directory.size);
+	fat_directory* batch = kmalloc(sizeof(fat_directory) * FAT_GETDENTS_BATCH_SECTORS);
+
+	uint32_t used = 0;
+	bool full = false;
+	while (!full) {
+		uint32_t sector = *pos / per_sector;
+		if (sector >= sector_count) {
+			break;
+		}
+		uint32_t want = MIN(FAT_GETDENTS_BATCH_SECTORS, sector_count - sector);
+		int read_count = fat_read_file(&directory, (char*)batch, want * SECTOR_SIZE, sector * SECTOR_SIZE);
+		uint32_t slots = (read_count / SECTOR_SIZE) * per_sector;
+		if (!slots) {
+			break;
+		}
+
+		for (uint32_t slot = *pos - (sector * per_sector); slot < slots; slot++) {
+			fat_dirent* entry = &batch[slot / per_sector].entries[slot % per_sector];
+			if (strlen(entry->name)) {
+				char name[sizeof(entry->name) + 1];
+				strncpy(name, entry->name, sizeof(entry->name));
+				name[sizeof(entry->name)] = '\0';
+				uint8_t type = (entry->is_directory & 1) ? DT_DIR : DT_REG;
+
+				uint32_t reclen = fs_dirent_pack(dirp, used, count, name, entry->first_sector, *pos + 1, type);
+				if (!reclen) {
+					full = true;
+					break;
+				}
+				used += reclen;
+			}
+			(*pos)++;
+		}
+	}
+	kfree(batch);
+	return used;
+}
+
+static void fat_op_readahead(fs_node_t* node, file_readahead_t* ra, uint32_t pos, uint32_t len);
+
+static const fs_ops_t fat_ops = {
+	.lookup = fat_op_lookup,
+	.read = fat_op_read,
+	.write = fat_op_write,
+	.readdir = fat_op_readdir,
+	.readahead = fat_op_readahead,
+	.getdents = fat_op_getdents,
+	.allocates_nodes = true,
+};
+
+//mount point FAT filesystems are attached at
+#define FAT_MOUNT_PATH "/disk"
+static fs_node_t fat_root_node;
+
+static void fat_mount() {
+	fs_unmount(FAT_MOUNT_PATH);
+
+	fat_dirent root = root_dir;
+	fs_node_t* node = fat_node_from_dirent(&root);
+	memcpy(&fat_root_node, node, sizeof(fs_node_t));
+	kfree(node);
+	fs_mount(FAT_MOUNT_PATH, &fat_root_node, &fat_ops);
+}
+
+//like fat_find_absolute_file(), also locating the entry: entry @p index of the directory starting at @p dir_sector
+//@p index is FAT_NO_ENTRY for the root, or if the entry's location isn't known
+static int fat_find_file(char* name, fat_dirent* store, uint32_t* dir_sector, uint32_t* index) {
+	fat_dirent local_store;
 	if (!store) {
-		fat_dirent local_store;
 		store = &local_store;
 	}
+	*index = FAT_NO_ENTRY;
+
+	char* name_copy = strdup(name);
+	char* save = NULL;
+	char* component = strtok_r(name_copy, "/", &save);
+
+	fat_dirent current_dir_ent = root_dir;
+	int current_directory = current_dir_ent.first_sector;
+	memcpy(store, &root_dir, sizeof(fat_dirent));
 
 	while (component) {
 		if (!strcmp(component, ".")) {
@@ -402,21 +1001,27 @@ int fat_find_absolute_file(char* name, fat_dirent* store) {
 			return -1;
 		}
 		else if (strlen(component)) {
-			current_directory = fat_dir_read_dirent(&current_dir_ent, component, store);
-			printk("traversed to %s %d %d\n", store->name, store->size, store->first_sector);
-			current_dir_ent = *store;
+			*dir_sector = current_dir_ent.first_sector;
+			current_directory = fat_dir_lookup(&current_dir_ent, component, store, index);
 			if (current_directory < 0) {
 				//not found!
 				kfree(name_copy);
 				return -1;
 			}
+			current_dir_ent = *store;
 		}
-		component = strtok_r(NULL, "/", save);
+		component = strtok_r(NULL, "/", &save);
 	}
 	kfree(name_copy);
 	return current_directory;
 }
 
+int fat_find_absolute_file(char* name, fat_dirent* store) {
+	uint32_t dir_sector;
+	uint32_t index;
+	return fat_find_file(name, store, &dir_sector, &index);
+}
+
 int fat_read_absolute_file(char* name, char* buffer, int count, int offset) {
 	fat_dirent entry;
 	fat_find_absolute_file(name, &entry);
@@ -488,8 +1093,13 @@ int fat_dir_entry_at_index(fat_dirent* directory, int index, fat_dirent* store)
 }
 
 int fat_dir_read_dirent(fat_dirent* directory, char* name, fat_dirent* store) {
+	return fat_dir_find(directory, name, store, NULL);
+}
+
+//find @p name in @p directory, and set @p index, if given, to its entry's index there
+static int fat_dir_find(fat_dirent* directory, char* name, fat_dirent* store, uint32_t* index) {
+	fat_dirent local_store;
 	if (!store) {
-		fat_dirent local_store;
 		store = &local_store;
 	}
 
@@ -506,11 +1116,11 @@ int fat_dir_read_dirent(fat_dirent* directory, char* name, fat_dirent* store) {
 			fat_dirent entry = sector_contents.entries[j];
 			if (!strcmp(name, entry.name)) {
 				//found entry we're looking for!
-				strcpy(store->name, (const char*)&entry.name);
-				store->size = entry.size;
-				store->first_sector = entry.first_sector;
+				memcpy(store, &entry, sizeof(fat_dirent));
 				printf("fat_dir_read_dirent found entry idx %d %s %d %d \n", j, store->name, store->size, store->first_sector);
-				//memcpy(store, &entry, sizeof(fat_dirent));
+				if (index) {
+					*index = (i * (sizeof(sector_contents.entries) / sizeof(sector_contents.entries[0]))) + j;
+				}
 				return entry.first_sector;
 			}
 		}
@@ -567,6 +1177,47 @@ int fat_dir_new_file(fat_dirent* dir, char* name, uint32_t size, bool directory,
 	return new_file;
 }
 
+int fat_dir_remove_file(fat_dirent* directory, char* name) {
+	for (int i = 0; i * SECTOR_SIZE < (int)directory->size; i++) {
+		fat_directory sector_contents;
+		fat_read_file(directory, (char*)&sector_contents, sizeof(sector_contents), i * SECTOR_SIZE);
+
+		for (uint32_t j = 0; j < sizeof(sector_contents.entries) / sizeof(sector_contents.entries[0]); j++) {
+			fat_dirent* entry = &(sector_contents.entries[j]);
+			if (!strlen(entry->name) || strcmp(entry->name, name)) {
+				continue;
+			}
+
+			//release every sector in the file's chain
+			//the first sector names the file in the page cache, and may be handed to another file
+			pagecache_invalidate(fat_dev, entry->first_sector, 0, 0xFFFFFFFF);
+			uint32_t sector = entry->first_sector;
+			while (is_valid_sector(sector) && fat[sector] != FREE_BLOCK) {
+				uint32_t next = fat[sector];
+				fat_set(sector, FREE_BLOCK);
+				if (next == EOF_BLOCK) break;
+				sector = next;
+			}
+			fat_flush();
+
+			bool was_directory = entry->is_directory & 1;
+			memset(entry, 0, sizeof(fat_dirent));
+			fat_write_file(directory, (char*)&sector_contents, sizeof(sector_contents), i * SECTOR_SIZE);
+
+			if (was_directory) {
+				//cached children of this directory are keyed by a sector that may now be reused
+				dcache_purge_dev(fat_dev);
+			}
+			else {
+				dcache_invalidate(fat_dev, directory->first_sector, name);
+			}
+			return 0;
+		}
+	}
+	printf("fat_dir_remove_file(%s) not found\n", name);
+	return -1;
+}
+
 int fat_copy_initrd_file(fat_dirent* dir, char* name, fat_dirent* store) {
 	if (!store) {
 		fat_dirent local_store;
@@ -614,30 +1265,108 @@ int fat_copy_initrd_file(fat_dirent* dir, char* name, fat_dirent* store) {
 	return new_file;
 }
 
+//find the dirent describing the file @p stream has open
+static bool fat_stream_dirent(FILE* stream, fat_dirent* store) {
+	if (stream->node) {
+		fat_dirent_from_node(stream->node, store);
+		return true;
+	}
+	return dirent_for_start_sector(stream->start_sector, &root_dir, store);
+}
+
+void fat_set_readahead(bool enabled) {
+	readahead_enabled = enabled;
+}
+
+//start reading @p byte_count bytes of @p file from @p offset into the block cache, without waiting
+static void fat_prefetch(fat_dirent* file, uint32_t offset, uint32_t byte_count) {
+	uint32_t index = offset / SECTOR_SIZE;
+	uint32_t remaining = sectors_from_bytes(offset + byte_count) - index;
+	int sector = fat_file_sector_at_index(file->first_sector, index);
+
+	//one prefetch per extent
+	while (remaining && is_valid_sector(sector)) {
+		int run_end = sector;
+		uint32_t run = 1;
+		while (run < remaining && fat[run_end] == (uint32_t)run_end + 1) {
+			run_end++;
+			run++;
+		}
+		bcache_prefetch(fat_disk, sector_for_fat_index(sector), run);
+		remaining -= run;
+		sector = fat[run_end];
+	}
+}
+
+//called after each stream read of @p node covering [@p pos, @p pos + @p len)
+//sequential reads double the readahead window up to a limit, and any other access collapses it
+//prefetches are topped up once the reader has eaten into half the window, so they go out in large batches
+static void fat_op_readahead(fs_node_t* node, file_readahead_t* ra, uint32_t pos, uint32_t len) {
+	if (!readahead_enabled || pos != ra->next_pos) {
+		ra->window = 0;
+		ra->prefetched_to = 0;
+		ra->next_pos = pos + len;
+		return;
+	}
+	ra->window = ra->window ? MIN(ra->window * 2, FAT_READAHEAD_MAX_SECTORS) : FAT_READAHEAD_MIN_SECTORS;
+	ra->next_pos = pos + len;
+
+	uint32_t window_bytes = ra->window * SECTOR_SIZE;
+	if (ra->prefetched_to > ra->next_pos + (window_bytes / 2)) {
+		return;
+	}
+	uint32_t from = MAX(ra->prefetched_to, ra->next_pos);
+	uint32_t to = MIN(ra->next_pos + window_bytes, node->length);
+	if (to <= from) {
+		return;
+	}
+	fat_dirent file;
+	fat_dirent_from_node(node, &file);
+	fat_prefetch(&file, from, to - from);
+	ra->prefetched_to = to;
+}
+
 size_t fat_fread(void* ptr, size_t size, size_t count, FILE* stream) {
 	fat_dirent dirent; 
-	if (!dirent_for_start_sector(stream->start_sector, &root_dir, &dirent)) {
+	if (!fat_stream_dirent(stream, &dirent)) {
 		printf("fat_fread() dirent_for_start_sector(%d) failed\n", stream->start_sector);
 		return 0;
 	}
 
-	int read_count = fat_read_file(&dirent, (char*)ptr, count * size, 0);
+	uint32_t pos = stream->fpos;
+	if (pos >= dirent.size) {
+		return 0;
+	}
+	int byte_count = MIN(count * size, dirent.size - pos);
+	int read_count = fat_read_file(&dirent, (char*)ptr, byte_count, pos);
 	stream->fpos += read_count;
+
+	if (stream->node) {
+		fat_op_readahead(stream->node, &stream->readahead, pos, read_count);
+	}
 	return read_count;
 }
 
 size_t fat_fwrite(void* ptr, size_t size, size_t count, FILE* stream) {
 	fat_dirent dirent;
-	if (!dirent_for_start_sector(stream->start_sector, &root_dir, &dirent)) {
+	if (!fat_stream_dirent(stream, &dirent)) {
 		printf("fat_fwrite() dirent_for_start_sector(%d) failed\n", stream->start_sector);
 		return 0;
 	}
 	int wrote_count = fat_write_file(&dirent, (char*)ptr, count * size, stream->fpos);
+	fat_file_grew(stream->node, &dirent, stream->fpos + wrote_count);
+	if (stream->node) {
+		stream->node->length = dirent.size;
+	}
+	stream->fpos += wrote_count;
 	return wrote_count;
 }
 
 FILE* fat_fopen(char* filename, char* UNUSED(mode)) {
-	int fat_sector = fat_find_absolute_file(filename, NULL);
+	fat_dirent dirent;
+	uint32_t dir_sector;
+	uint32_t index;
+	int fat_sector = fat_find_file(filename, &dirent, &dir_sector, &index);
 	if (!is_valid_sector(fat_sector)) {
 		printf("fat_fopen(%s) No such file or directory\n", filename);
 		return NULL;
@@ -645,7 +1374,9 @@ FILE* fat_fopen(char* filename, char* UNUSED(mode)) {
 
 	FILE* stream = (FILE*)kmalloc(sizeof(FILE));
 	memset(stream, 0, sizeof(FILE));
-	stream->node = NULL;
+	//remember the file's size and location, rather than searching the tree on every access
+	stream->node = fat_node_from_dirent(&dirent);
+	fat_node_set_entry(stream->node, dir_sector, index);
 	stream->fpos = 0;
 	stream->start_sector = fat_sector;
 
@@ -715,44 +1446,87 @@ bool dirent_for_start_sector(uint32_t desired_sector, fat_dirent* directory, fat
 	return false;
 }
 
+//does the superblock last read describe a filesystem this kernel can mount?
+static bool fat_superblock_valid() {
+	//older kernels placed the data region on top of the table, so such disks can't be trusted
+	bool layout_valid = superblock.data_region_start >= FAT_SECTOR + fat_table_sectors(superblock.sector_count);
+	return (uint32_t)fat_read_magic() == FAT_MAGIC && layout_valid;
+}
+
+bool fat_install_first_disk() {
+	for (int drive = 0; drive < BLKQ_MAX_DRIVES; drive++) {
+		if (!blkq_capacity(drive)) continue;
+		fat_disk = drive;
+		fat_read_superblock();
+		if (fat_superblock_valid()) {
+			printf_info("Mounting FAT filesystem on drive %d", drive);
+			fat_install(drive, false);
+			return true;
+		}
+	}
+	printf_info("No drive holds a FAT filesystem, /disk won't be mounted");
+	return false;
+}
+
 #define ROOT_DIR_SIZE 0x2000
 void fat_install(unsigned char drive, bool force_format) {
+	//all disk access goes through the block cache
+	bcache_init();
+
 	//check if this drive has already been formatted
-	int magic = fat_read_magic();
-	if (!force_format && (uint32_t)magic == FAT_MAGIC) {
+	if (!fat_dev) {
+		fat_dev = fs_dev_alloc();
+	}
+
+	fat_disk = drive;
+	fat_read_superblock();
+	if (!force_format && fat_superblock_valid()) {
 		printf("FAT filesystem has already been formatted\n");	
+		fat_load();
 
 		strcpy((char*)&root_dir.name, "/");
 		root_dir.first_sector = 0;
 		root_dir.is_directory = true;
 		root_dir.size = ROOT_DIR_SIZE;
 
+		fat_mount();
 		return;
 	}
 
 	printf("Formatting FAT filesystem for first run/corrupted superblock...\n");
-	fat_format_disk(drive);
+	if (fat_format_disk(drive)) {
+		fat_mount();
+	}
 }
 
-void fat_format_disk(unsigned char UNUSED(drive)) {
+bool fat_format_disk(unsigned char drive) {
 	//skip the first 2 blocks, these are reserved for boot sector and super block
 	//create FAT in first unused block, block 3
-	
-	//TODO find disk size!
-	//assume 64MB for now
-	unsigned int disk_size = 64 * 1024;
-	//turn kb into b
-	disk_size *= 1024;
-	//512b sectors
-	unsigned int sectors = disk_size / SECTOR_SIZE;
+	uint32_t disk_sectors = blkq_capacity(drive);
+	//the table needs an entry per data sector, and the data region starts after the table
+	//sizing the table for the whole disk leaves at most a sector of slack
+	uint32_t reserved = FAT_SECTOR + fat_table_sectors(disk_sectors);
+	if (disk_sectors <= reserved + sectors_from_bytes(ROOT_DIR_SIZE)) {
+		printf_err("FAT can't format disk %d of %d sectors", drive, disk_sectors);
+		return false;
+	}
+	unsigned int sectors = disk_sectors - reserved;
 	printk("sector count for FAT: %d\n", sectors);
-	//use drive 0
-	fat_create(sectors, 0);
+	fat_create(sectors, drive);
+
+	//anything cached about the previous filesystem on this disk is now stale
+	if (!fat_dev) {
+		fat_dev = fs_dev_alloc();
+	}
+	dcache_purge_dev(fat_dev);
+	pagecache_purge_dev(fat_dev);
 
 	char zeroes[SECTOR_SIZE];
 	memset(zeroes, 0, sizeof(zeroes));
-	ide_ata_write(fat_disk, MBR_SECTOR, (uint32_t)zeroes, SECTOR_SIZE, 0);
-	ide_ata_write(fat_disk, SUPERBLOCK_SECTOR, (uint32_t)zeroes, SECTOR_SIZE, 0);
+	if (bcache_write(fat_disk, MBR_SECTOR, (uint8_t*)zeroes, SECTOR_SIZE, 0) ||
+		bcache_write(fat_disk, SUPERBLOCK_SECTOR, (uint8_t*)zeroes, SECTOR_SIZE, 0)) {
+		printk("fat_format_disk() couldn't clear the boot sectors\n");
+	}
 	fat_record_superblock(SECTOR_SIZE, sectors);
 
 	//after FAT, place root directory entry
@@ -774,6 +1548,10 @@ void fat_format_disk(unsigned char UNUSED(drive)) {
 	fat_dirent welcome_txt;
 	fat_dir_new_file(&include_dir, "welcome.txt", 0x200, false, &welcome_txt);
 
+	//make sure the parts of the table untouched by the above reach the disk too
+	fat_flush();
+	return true;
+
 	/*
 	char buf[SECTOR_SIZE];
 	strcpy(buf, "Welcome to axle OS.\n\nThis file is stored on a physical hard drive, retrieved using PIO mode on an ATA drive.\nThe drive is formatted with axle's FAT clone filesystem.\nThis filesystem supports expandable files, as well as directories.\nThere are also reserved directory entry sections to be used for file permissions, access times, etc.\n\nVisit www.github.com/codyd51/axle for this OS's source code.\n");
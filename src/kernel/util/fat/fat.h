@@ -55,12 +55,39 @@ void fat_expand_file(uint32_t file, uint32_t byte_count);
  */
 void fat_shrink_file(uint32_t file, uint32_t byte_count);
 
+/*!
+ * @brief Print how many extents files are split into, and how fragmented free space is
+ */
+void fat_print_fragmentation();
+
+/*!
+ * @brief Mount the FAT filesystem on @p drive at /disk
+ * @param drive The block queue drive number holding the filesystem
+ * @param force_format Format the drive even if it already holds a filesystem
+ */
+void fat_install(unsigned char drive, bool force_format);
+
+/*!
+ * @brief Mount the first block device already formatted with FAT at /disk
+ * Drives without a filesystem are left untouched.
+ * @return false if no drive holds a FAT filesystem.
+ */
+bool fat_install_first_disk();
+
+/*!
+ * @brief Whether the mounted FAT filesystem lives on @p drive
+ * @param drive The block queue drive number to check
+ */
+bool fat_mounted_on(unsigned char drive);
+
 /*!
  * @brief Format the IDE ATA drive @p drive with a FAT filesystem.
  * This function also sets the newly formatted FAT as the active filesystem.
- * @param drive The connected drive number, from 0-3, to format with FAT.
+ * The table and data region are sized to fit the drive's capacity.
+ * @param drive The block queue drive number to format with FAT.
+ * @return false if the drive's capacity is unknown or too small.
  */
-void fat_format_disk(unsigned char drive);
+bool fat_format_disk(unsigned char drive);
 
 /*!
  * @brief Write contents of current FAT to physical disk.
@@ -102,6 +129,17 @@ int fat_write_absolute_file(char* name, char* buffer, int count, int offset);
  */
 int fat_find_absolute_file(char* name, fat_dirent* store);
 
+/*!
+ * @brief Remove the entry named @p name from @p directory and free its sectors
+ * @return 0 on success, -1 if no such entry exists
+ */
+int fat_dir_remove_file(fat_dirent* directory, char* name);
+
+/*!
+ * @brief Enable or disable sequential readahead for FAT streams
+ */
+void fat_set_readahead(bool enabled);
+
 size_t fat_fread(void* ptr, size_t size, size_t count, FILE* stream);
 size_t fat_fwrite(void* ptr, size_t size, size_t count, FILE* stream);
 FILE* fat_fopen(char* filename, char* mode);
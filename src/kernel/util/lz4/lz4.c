@@ -0,0 +1,76 @@
+#include "lz4.h"
+#include <std/memory.h>
+
+#define LZ4_MIN_MATCH 4
+
+//read an extended length field, which continues while bytes are 255
+static int lz4_read_length(const uint8_t** ip, const uint8_t* iend, uint32_t* len) {
+	uint8_t b;
+	do {
+		if (*ip >= iend) return -1;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return 0;
+}
+
+int lz4_decompress_block(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap) {
+	const uint8_t* ip = src;
+	const uint8_t* iend = src + src_len;
+	uint8_t* op = dst;
+	uint8_t* oend = dst + dst_cap;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+
+		//literals
+		uint32_t lit_len = token >> 4;
+		if (lit_len == 15 && lz4_read_length(&ip, iend, &lit_len)) {
+			return -1;
+		}
+		if (lit_len > (uint32_t)(iend - ip) || lit_len > (uint32_t)(oend - op)) {
+			return -1;
+		}
+		memcpy(op, ip, lit_len);
+		ip += lit_len;
+		op += lit_len;
+
+		//the last sequence is literals only
+		if (ip >= iend) {
+			break;
+		}
+
+		//match
+		if (iend - ip < 2) {
+			return -1;
+		}
+		uint32_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (!offset || offset > (uint32_t)(op - dst)) {
+			return -1;
+		}
+
+		uint32_t match_len = token & 0xF;
+		if (match_len == 15 && lz4_read_length(&ip, iend, &match_len)) {
+			return -1;
+		}
+		match_len += LZ4_MIN_MATCH;
+		if (match_len > (uint32_t)(oend - op)) {
+			return -1;
+		}
+
+		const uint8_t* match = op - offset;
+		if (offset >= match_len) {
+			//source and destination don't overlap
+			memcpy(op, match, match_len);
+			op += match_len;
+		}
+		else {
+			//overlapping copy replicates the last @p offset bytes, so must go forwards byte by byte
+			for (uint32_t i = 0; i < match_len; i++) {
+				*op++ = *match++;
+			}
+		}
+	}
+	return op - dst;
+}
@@ -0,0 +1,11 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stdint.h>
+
+//decompress one raw LZ4 block (no frame header) from @p src into @p dst
+//returns the number of bytes written, or -1 if the block is malformed
+//or would overflow @p dst_cap
+int lz4_decompress_block(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap);
+
+#endif
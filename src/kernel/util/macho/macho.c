@@ -3,6 +3,7 @@
 #include "macho.h"
 #include <kernel/util/vfs/fs.h>
 #include <kernel/multitasking/tasks/task.h>
+#include <kernel/vmm/vmm.h>
 
 void mach_load_segments(FILE* mach, int* entry_point, uint32_t slide);
 
@@ -10,9 +11,8 @@ void mach_load_file(char* filename) {
 	printk("Loading Mach-O file \'%s\'\n", filename);
 
 	//figure out virtual memory slide
-	char* mach_slide = (char*)0xEFF00000;
 	task_t* mach_task = task_with_pid(getpid());
-	mach_task->vmem_slide = (uint32_t)mach_slide;
+	mach_task->vmem_slide = MACH_SLIDE;
 
 	FILE* mach = fopen(filename, "rb");
 	int entry_point = 0;
@@ -81,6 +81,16 @@ static void* mach_load_bytes(FILE* mach, int offset, int size) {
 	return buf;
 }
 
+//back [start, start + size) with fresh frames, leaving pages an earlier segment mapped alone
+static void mach_map_segment(uint32_t start, uint32_t size) {
+	uint32_t page = start & PAGING_FRAME_MASK;
+	for (; page < start + size; page += PAGING_PAGE_SIZE) {
+		if (!vmm_is_page_mapped(vmm_active_pdir(), page)) {
+			vmm_map_virt(vmm_active_pdir(), page, PAGE_PRESENT_FLAG|PAGE_WRITE_FLAG|PAGE_USER_FLAG);
+		}
+	}
+}
+
 static void mach_load_segment_commands(FILE* mach, int offset, int should_swap, int count, char* buf, int* entry_point, uint32_t slide) {
 	int real = offset;
 	for (int i = 0; i < count; i++) {
@@ -103,6 +113,7 @@ static void mach_load_segment_commands(FILE* mach, int offset, int should_swap,
 
 			char* segment_start = buf + segment->fileoff;
 			char* vmem_seg_start = slide + (char*)segment->vmaddr;
+			mach_map_segment((uint32_t)vmem_seg_start, segment->vmsize);
 			memset(vmem_seg_start, 0, segment->vmsize);
 			memcpy(vmem_seg_start, segment_start, segment->filesize);
 
@@ -107,6 +107,10 @@ struct load_command {
 	uint32_t cmdsize;
 };
 
+//Mach-O images are loaded here, in user space below ELF_LIB_BASE,
+//clear of the kernel heap and page pool above VMM_USER_SPACE_END
+#define MACH_SLIDE 0x20000000
+
 bool mach_validate(FILE* mach);
 void mach_load_file(char* filename);
 
@@ -7,6 +7,11 @@
 #include <kernel/multitasking/tasks/task.h>
 #include <kernel/boot_info.h>
 #include <kernel/address_space.h>
+#include <kernel/pmm/pmm.h>
+#include <kernel/multitasking/fd.h>
+#include <kernel/util/vfs/fs.h>
+#include <kernel/util/vfs/pagecache.h>
+#include <kernel/vmm/vm_area.h>
 
 //defined in kheap
 extern uint32_t placement_address;
@@ -20,7 +25,58 @@ page_directory_t* page_dir_current() {
     Deprecated();
 }
 
-void *mmap(void *addr, uint32_t length, int UNUSED(flags), int UNUSED(fd), uint32_t UNUSED(offset)) {
+//number of pages in [@p addr, @p addr + @p length), or 0 if the range is empty or reaches kernel space
+static uint32_t user_range_pages(uint32_t addr, uint32_t length) {
+    uint32_t page_count = (length / PAGE_SIZE) + ((length % PAGE_SIZE) ? 1 : 0);
+    if (addr >= VMM_USER_SPACE_END || page_count > (VMM_USER_SPACE_END - addr) / PAGE_SIZE) {
+        return 0;
+    }
+    return page_count;
+}
+
+//map @p length bytes of the file behind @p fd at @p addr, straight out of the page cache
+//every process mapping a file shares the cached frames, so the mapping is read-only
+static void* mmap_file(void* addr, uint32_t length, int fd, uint32_t offset) {
+    if (!addr || ((uint32_t)addr % PAGE_SIZE) || (offset % PAGE_SIZE)) {
+        return (void*)-1;
+    }
+    uint32_t page_count = user_range_pages((uint32_t)addr, length);
+    if (!page_count) {
+        return (void*)-1;
+    }
+    task_t* current = task_with_pid(getpid());
+    if (fd >= FD_MAX || fd_empty(current->fd_table[fd])) {
+        return (void*)-1;
+    }
+    fd_entry ent = current->fd_table[fd];
+    if (ent.type != FILE_TYPE) {
+        return (void*)-1;
+    }
+    fs_node_t* node = ((FILE*)ent.payload)->node;
+
+    vmm_pdir_t* dir = vmm_active_pdir();
+    //mapping over a page would leak its frame, or hand the file to kernel code
+    for (uint32_t i = 0; i < page_count; i++) {
+        if (vmm_is_page_mapped(dir, (uint32_t)addr + (i * PAGE_SIZE))) {
+            return (void*)-1;
+        }
+    }
+    for (uint32_t i = 0; i < page_count; i++) {
+        //the pin is held until munmap()
+        cached_page_t* page = pagecache_get(node, (offset / PAGE_SIZE) + i);
+        if (!page) {
+            //past the end of the file, leave unmapped
+            break;
+        }
+        vmm_map_virt_to_phys(dir, (uint32_t)addr + (i * PAGE_SIZE), page->frame, PAGE_PRESENT_FLAG | PAGE_USER_FLAG);
+    }
+    return addr;
+}
+
+void *mmap(void *addr, uint32_t length, int UNUSED(flags), int fd, uint32_t offset) {
+    if (fd >= 0) {
+        return mmap_file(addr, length, fd, offset);
+    }
     Deprecated();
     /*
 	char* chbuf = (char*)addr;
@@ -48,8 +104,28 @@ void *mmap(void *addr, uint32_t length, int UNUSED(flags), int UNUSED(fd), uint3
     */
 }
 
-int munmap(void *UNUSED(addr), uint32_t UNUSED(length)) {
-    NotImplemented();
+int munmap(void *addr, uint32_t length) {
+    if ((uint32_t)addr % PAGE_SIZE) {
+        return -1;
+    }
+    uint32_t page_count = user_range_pages((uint32_t)addr, length);
+    if (!page_count) {
+        return -1;
+    }
+    vmm_pdir_t* dir = vmm_active_pdir();
+    for (uint32_t i = 0; i < page_count; i++) {
+        uint32_t page_addr = (uint32_t)addr + (i * PAGE_SIZE);
+        //kernel mappings in the low region, such as the identity map, aren't the caller's to remove
+        if (!vmm_is_user_page(dir, page_addr)) {
+            continue;
+        }
+        uint32_t frame = vmm_unmap_page(dir, page_addr);
+        //program text and file mappings borrow their frames
+        if (!vm_area_put_frame(frame) && !pagecache_put_frame(frame)) {
+            pmm_free(frame);
+        }
+    }
+    return 0;
 }
 
 void* unsbrk(int UNUSED(increment)) {
@@ -151,15 +227,17 @@ vmm_pdir_t* vmm_clone_active_page_table_at_index(vmm_pdir_t* dst_dir, uint32_t t
         printf("contents of page %d = 0x%08x\n", src_table[page_idx]);
 		cloned_pages++;
 
-        printf("is this the same? 0x%08x 0x%08x\n", (src_table[page_idx] >> 22) * PAGING_FRAME_SIZE, src_table[page_idx]);
-
-        uint32_t source_frame = (src_table[page_idx] >> 22) * PAGING_FRAME_SIZE;
+        uint32_t source_frame = src_table[page_idx] & PAGING_FRAME_MASK;
+        //read-only file pages, such as program text, are shared rather than copied
+        if (!(src_table[page_idx] & PAGE_WRITE_FLAG) && vm_area_ref_frame(source_frame)) {
+            new_table[page_idx] = src_table[page_idx];
+            continue;
+        }
         uint32_t dest_frame = pmm_alloc();
 
-        new_table[page_idx] = dest_frame / PAGING_FRAME_SIZE;
         //clone the flags from the source
         //present, rw, user, accessed, dirty = 0b11111 = 0x1f
-        new_table[page_idx] |= src_table[page_idx] & 0x1f;
+        new_table[page_idx] = dest_frame | (src_table[page_idx] & 0x1f);
 
 		//physically copy data across
 		extern void copy_page_physical(uint32_t page, uint32_t dest);
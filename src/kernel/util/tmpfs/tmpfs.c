@@ -0,0 +1,276 @@
+#include "tmpfs.h"
+#include <std/std.h>
+#include <std/math.h>
+#include <kernel/vmm/vmm.h>
+
+static tmpfs_inode_t* root = 0;
+static uint32_t tmpfs_dev = 0;
+static uint32_t next_inode = 1;
+static uint32_t inode_count = 0;
+static uint32_t pages_used = 0;
+
+static tmpfs_inode_t* tmpfs_inode_for_node(fs_node_t* node) {
+	return (tmpfs_inode_t*)node->impl;
+}
+
+static tmpfs_inode_t* tmpfs_inode_create(const char* name, uint32_t flags) {
+	tmpfs_inode_t* inode = kmalloc(sizeof(tmpfs_inode_t));
+	memset(inode, 0, sizeof(tmpfs_inode_t));
+	strncpy(inode->node.name, name, sizeof(inode->node.name) - 1);
+	inode->node.flags = flags;
+	inode->node.inode = next_inode++;
+	inode->node.dev = tmpfs_dev;
+	inode->node.impl = (uint32_t)inode;
+	inode_count++;
+	return inode;
+}
+
+static void tmpfs_inode_destroy(tmpfs_inode_t* inode) {
+	for (uint32_t i = 0; i < inode->page_slots; i++) {
+		if (inode->pages[i]) {
+			vmm_free_kernel_page(inode->pages[i]);
+			pages_used--;
+		}
+	}
+	if (inode->pages) {
+		kfree(inode->pages);
+	}
+	kfree(inode);
+	inode_count--;
+}
+
+static tmpfs_dirent_t* tmpfs_dir_find(tmpfs_inode_t* dir, const char* name) {
+	for (tmpfs_dirent_t* ent = dir->children; ent; ent = ent->next) {
+		if (!strcmp(ent->name, name)) {
+			return ent;
+		}
+	}
+	return 0;
+}
+
+//make room for at least @p slots entries in @p inode's page list
+static void tmpfs_reserve_slots(tmpfs_inode_t* inode, uint32_t slots) {
+	if (slots <= inode->page_slots) {
+		return;
+	}
+	//grow geometrically so appending a page at a time doesn't copy the list every time
+	uint32_t new_slots = MAX(slots, inode->page_slots * 2);
+	uint32_t* pages = kmalloc(sizeof(uint32_t) * new_slots);
+	memset(pages, 0, sizeof(uint32_t) * new_slots);
+	if (inode->pages) {
+		memcpy(pages, inode->pages, sizeof(uint32_t) * inode->page_slots);
+		kfree(inode->pages);
+	}
+	inode->pages = pages;
+	inode->page_slots = new_slots;
+}
+
+static fs_node_t* tmpfs_op_lookup(fs_node_t* node, char* name) {
+	tmpfs_dirent_t* ent = tmpfs_dir_find(tmpfs_inode_for_node(node), name);
+	if (!ent) {
+		return NULL;
+	}
+	return &ent->inode->node;
+}
+
+static uint32_t tmpfs_op_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+	tmpfs_inode_t* inode = tmpfs_inode_for_node(node);
+	//streams hold copies of the node, so the inode has the authoritative length
+	uint32_t length = inode->node.length;
+	if (offset >= length) {
+		return 0;
+	}
+	size = MIN(size, length - offset);
+
+	uint32_t done = 0;
+	while (done < size) {
+		uint32_t pos = offset + done;
+		uint32_t idx = pos / PAGE_SIZE;
+		uint32_t page_off = pos % PAGE_SIZE;
+		uint32_t chunk = MIN(size - done, PAGE_SIZE - page_off);
+		if (idx < inode->page_slots && inode->pages[idx]) {
+			memcpy(buffer + done, (uint8_t*)inode->pages[idx] + page_off, chunk);
+		}
+		else {
+			//hole in a sparse file
+			memset(buffer + done, 0, chunk);
+		}
+		done += chunk;
+	}
+	return done;
+}
+
+static uint32_t tmpfs_op_write(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+	tmpfs_inode_t* inode = tmpfs_inode_for_node(node);
+	if (!size) {
+		return 0;
+	}
+	tmpfs_reserve_slots(inode, ((offset + size - 1) / PAGE_SIZE) + 1);
+
+	uint32_t done = 0;
+	while (done < size) {
+		uint32_t pos = offset + done;
+		uint32_t idx = pos / PAGE_SIZE;
+		uint32_t page_off = pos % PAGE_SIZE;
+		uint32_t chunk = MIN(size - done, PAGE_SIZE - page_off);
+		if (!inode->pages[idx]) {
+			if (pages_used >= TMPFS_MAX_PAGES) {
+				printf_err("tmpfs is full");
+				break;
+			}
+			inode->pages[idx] = vmm_alloc_kernel_page();
+			memset((uint8_t*)inode->pages[idx], 0, PAGE_SIZE);
+			pages_used++;
+		}
+		memcpy((uint8_t*)inode->pages[idx] + page_off, buffer + done, chunk);
+		done += chunk;
+	}
+
+	inode->node.length = MAX(inode->node.length, offset + done);
+	node->length = inode->node.length;
+	return done;
+}
+
+static int tmpfs_op_truncate(fs_node_t* node, uint32_t length) {
+	tmpfs_inode_t* inode = tmpfs_inode_for_node(node);
+	uint32_t keep = (length + PAGE_SIZE - 1) / PAGE_SIZE;
+	for (uint32_t i = keep; i < inode->page_slots; i++) {
+		if (inode->pages[i]) {
+			vmm_free_kernel_page(inode->pages[i]);
+			inode->pages[i] = 0;
+			pages_used--;
+		}
+	}
+	//a later extension must read back as zeroes, so clear the tail of the last page
+	if (length % PAGE_SIZE && keep <= inode->page_slots && inode->pages[keep - 1]) {
+		memset((uint8_t*)inode->pages[keep - 1] + (length % PAGE_SIZE), 0, PAGE_SIZE - (length % PAGE_SIZE));
+	}
+	inode->node.length = length;
+	node->length = length;
+	return 0;
+}
+
+static struct dirent* tmpfs_op_readdir(fs_node_t* node, uint32_t index) {
+	static struct dirent result;
+	tmpfs_dirent_t* ent = tmpfs_inode_for_node(node)->children;
+	for (uint32_t i = 0; ent && i < index; i++) {
+		ent = ent->next;
+	}
+	if (!ent) {
+		return NULL;
+	}
+	memset(&result, 0, sizeof(result));
+	strcpy(result.d_name, ent->name);
+	result.d_ino = ent->inode->node.inode;
+	result.d_off = index + 1;
+	result.d_reclen = sizeof(struct dirent);
+	return &result;
+}
+
+static uint32_t tmpfs_op_getdents(fs_node_t* node, uint32_t* pos, struct dirent* dirp, uint32_t count) {
+	tmpfs_dirent_t* ent = tmpfs_inode_for_node(node)->children;
+	for (uint32_t i = 0; ent && i < *pos; i++) {
+		ent = ent->next;
+	}
+
+	uint32_t used = 0;
+	for (; ent; ent = ent->next) {
+		uint8_t type = ((ent->inode->node.flags & 0x7) == FS_DIRECTORY) ? DT_DIR : DT_REG;
+		uint32_t reclen = fs_dirent_pack(dirp, used, count, ent->name, ent->inode->node.inode, *pos + 1, type);
+		if (!reclen) {
+			break;
+		}
+		used += reclen;
+		(*pos)++;
+	}
+	return used;
+}
+
+static int tmpfs_op_create(fs_node_t* node, char* name, uint32_t flags) {
+	tmpfs_inode_t* dir = tmpfs_inode_for_node(node);
+	if (strlen(name) >= TMPFS_NAME_MAX || tmpfs_dir_find(dir, name)) {
+		return -1;
+	}
+	if (flags != FS_FILE && flags != FS_DIRECTORY) {
+		return -1;
+	}
+
+	tmpfs_dirent_t* ent = kmalloc(sizeof(tmpfs_dirent_t));
+	memset(ent, 0, sizeof(tmpfs_dirent_t));
+	strcpy(ent->name, name);
+	ent->inode = tmpfs_inode_create(name, flags);
+	ent->inode->node.parent = &dir->node;
+
+	//append, so listings come back in creation order
+	tmpfs_dirent_t** slot = &dir->children;
+	while (*slot) {
+		slot = &(*slot)->next;
+	}
+	*slot = ent;
+	return 0;
+}
+
+static int tmpfs_op_unlink(fs_node_t* node, char* name) {
+	tmpfs_inode_t* dir = tmpfs_inode_for_node(node);
+	tmpfs_dirent_t** slot = &dir->children;
+	while (*slot && strcmp((*slot)->name, name)) {
+		slot = &(*slot)->next;
+	}
+	tmpfs_dirent_t* ent = *slot;
+	if (!ent || ent->inode->children) {
+		//missing, or a directory which isn't empty
+		return -1;
+	}
+	*slot = ent->next;
+	if (ent->inode->open_count) {
+		ent->inode->unlinked = true;
+	}
+	else {
+		tmpfs_inode_destroy(ent->inode);
+	}
+	kfree(ent);
+	return 0;
+}
+
+static void tmpfs_op_open(fs_node_t* node) {
+	tmpfs_inode_for_node(node)->open_count++;
+}
+
+static void tmpfs_op_close(fs_node_t* node) {
+	tmpfs_inode_t* inode = tmpfs_inode_for_node(node);
+	if (!--inode->open_count && inode->unlinked) {
+		tmpfs_inode_destroy(inode);
+	}
+}
+
+static const fs_ops_t tmpfs_ops = {
+	.lookup = tmpfs_op_lookup,
+	.read = tmpfs_op_read,
+	.write = tmpfs_op_write,
+	.readdir = tmpfs_op_readdir,
+	.getdents = tmpfs_op_getdents,
+	.create = tmpfs_op_create,
+	.unlink = tmpfs_op_unlink,
+	.truncate = tmpfs_op_truncate,
+	.open = tmpfs_op_open,
+	.close = tmpfs_op_close,
+	.allocates_nodes = false,
+	.uncached = true,
+};
+
+void tmpfs_install(void) {
+	if (root) {
+		return;
+	}
+	tmpfs_dev = fs_dev_alloc();
+	root = tmpfs_inode_create("tmp", FS_DIRECTORY);
+	if (fs_mount(TMPFS_MOUNT_PATH, &root->node, &tmpfs_ops)) {
+		printf_err("couldn't mount tmpfs at %s", TMPFS_MOUNT_PATH);
+		return;
+	}
+	printf_info("tmpfs mounted at %s", TMPFS_MOUNT_PATH);
+}
+
+void tmpfs_print_stats(void) {
+	printf("tmpfs: %d inodes, %d/%d pages in use (%d kb)\n", inode_count, pages_used, TMPFS_MAX_PAGES, pages_used * (PAGE_SIZE / 1024));
+}
@@ -0,0 +1,40 @@
+#ifndef TMPFS_H
+#define TMPFS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <kernel/util/vfs/fs.h>
+
+//filesystem living entirely in kernel pages, for scratch files
+//file contents are held a page at a time and only pages which have been
+//written are backed, so sparse files stay cheap and files grow a page at a time
+//nothing survives a reboot
+//open streams refer to the inode directly, so a file removed while it's open lives on until it's closed
+
+#define TMPFS_MOUNT_PATH	"/tmp"
+#define TMPFS_NAME_MAX		64
+//pages all tmpfs files may use between them, 16MB
+#define TMPFS_MAX_PAGES		4096
+
+typedef struct tmpfs_dirent {
+	char name[TMPFS_NAME_MAX];
+	struct tmpfs_inode* inode;
+	struct tmpfs_dirent* next;
+} tmpfs_dirent_t;
+
+typedef struct tmpfs_inode {
+	fs_node_t node;		//handed to the VFS, node.impl points back here
+	uint32_t* pages;	//kernel page holding each page of a file, 0 for holes
+	uint32_t page_slots;	//entries in pages
+	tmpfs_dirent_t* children;	//directories only
+	uint32_t open_count;	//streams with the inode open
+	bool unlinked;		//removed from its directory, and freed on the last close
+} tmpfs_inode_t;
+
+//create an empty tmpfs and mount it at TMPFS_MOUNT_PATH
+void tmpfs_install(void);
+
+//print inode and page usage
+void tmpfs_print_stats(void);
+
+#endif
@@ -130,7 +130,7 @@ int execve(const char *filename, char *const argv[], char *const UNUSED(envp[]))
 
 	elf_load_file((char*)filename, file, (char**)argv);
 
-	//we should never reach this point
-	ASSERT(0, "execve didn't exit");
-	sys__exit(1);
+	//the file couldn't be loaded, and the caller's image is untouched
+	fclose(file);
+	return -1;
 }
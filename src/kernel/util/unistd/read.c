@@ -5,6 +5,7 @@
 #include <kernel/util/vfs/fs.h>
 #include <kernel/multitasking/std_stream.h>
 #include <kernel/multitasking/pipe.h>
+#include <kernel/vmm/vm_area.h>
 
 #include <gfx/lib/gfx.h>
 #include <gfx/lib/Window.h>
@@ -40,6 +41,10 @@ uint32_t read(int fd, void* buf, uint32_t count) {
 	if (!count) {
 		return 0;
 	}
+	if (!vm_area_user_writable((uint32_t)buf, count)) {
+		//errno = EFAULT;
+		return -1;
+	}
 
 	unsigned char* chbuf = buf;
 	memset(chbuf, 0, count);
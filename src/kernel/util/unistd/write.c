@@ -3,6 +3,7 @@
 #include <kernel/multitasking/tasks/task.h>
 #include <kernel/multitasking/pipe.h>
 #include <kernel/multitasking/std_stream.h>
+#include <kernel/util/vfs/fs.h>
 #include <user/xserv/xserv.h>
 
 #include <gfx/lib/gfx.h>
@@ -88,9 +89,7 @@ int write(int fd, char* buf, int len) {
 		case STD_TYPE:
 			return std_write(current, fd, buf, len);
 		case FILE_TYPE:
-			//TODO implement this!
-			//return fwrite(fd, buf, len);
-			break;
+			return fwrite(buf, sizeof(char), len, (FILE*)ent.payload);
 		case PIPE_TYPE:
 		default:
 			return pipe_write(fd, buf, len);
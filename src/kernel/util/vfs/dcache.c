@@ -0,0 +1,177 @@
+#include "dcache.h"
+#include <std/std.h>
+
+static dentry_t* entries = 0;		//backing storage for every dentry
+static dentry_t* free_list = 0;		//unused entries, linked through hash_next
+static dentry_t* buckets[DCACHE_BUCKETS];
+static dentry_t* lru_head = 0;		//most recently used
+static dentry_t* lru_tail = 0;		//next to be evicted
+
+static uint32_t stat_hits = 0;
+static uint32_t stat_negative_hits = 0;
+static uint32_t stat_misses = 0;
+static uint32_t stat_evictions = 0;
+
+static void dcache_init() {
+	entries = (dentry_t*)kmalloc(sizeof(dentry_t) * DCACHE_MAX_ENTRIES);
+	memset(entries, 0, sizeof(dentry_t) * DCACHE_MAX_ENTRIES);
+	memset(buckets, 0, sizeof(buckets));
+
+	for (int i = 0; i < DCACHE_MAX_ENTRIES - 1; i++) {
+		entries[i].hash_next = &entries[i + 1];
+	}
+	free_list = &entries[0];
+}
+
+//FNV-1a over the name, seeded with the directory it lives in
+static uint32_t dcache_hash(uint32_t dev, uint32_t parent, const char* name) {
+	uint32_t hash = 2166136261u ^ (dev * 16777619u) ^ parent;
+	while (*name) {
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619u;
+	}
+	return hash % DCACHE_BUCKETS;
+}
+
+static void lru_unlink(dentry_t* ent) {
+	if (ent->lru_prev) ent->lru_prev->lru_next = ent->lru_next;
+	else lru_head = ent->lru_next;
+
+	if (ent->lru_next) ent->lru_next->lru_prev = ent->lru_prev;
+	else lru_tail = ent->lru_prev;
+
+	ent->lru_prev = ent->lru_next = 0;
+}
+
+static void lru_push_front(dentry_t* ent) {
+	ent->lru_prev = 0;
+	ent->lru_next = lru_head;
+	if (lru_head) lru_head->lru_prev = ent;
+	lru_head = ent;
+	if (!lru_tail) lru_tail = ent;
+}
+
+static dentry_t** dcache_find_slot(uint32_t dev, uint32_t parent, const char* name) {
+	dentry_t** slot = &buckets[dcache_hash(dev, parent, name)];
+	while (*slot) {
+		dentry_t* ent = *slot;
+		if (ent->dev == dev && ent->parent == parent && !strcmp(ent->name, name)) {
+			return slot;
+		}
+		slot = &ent->hash_next;
+	}
+	return 0;
+}
+
+//unlink entry from its hash chain and the LRU list, and return it to the free list
+static void dcache_release(dentry_t** slot) {
+	dentry_t* ent = *slot;
+	*slot = ent->hash_next;
+	lru_unlink(ent);
+
+	if (ent->owns_node && ent->node) {
+		kfree(ent->node);
+	}
+	memset(ent, 0, sizeof(dentry_t));
+	ent->hash_next = free_list;
+	free_list = ent;
+}
+
+static void dcache_evict_lru() {
+	dentry_t* victim = lru_tail;
+	if (!victim) return;
+
+	dentry_t** slot = dcache_find_slot(victim->dev, victim->parent, victim->name);
+	ASSERT(slot, "dcache LRU entry wasn't hashed");
+	dcache_release(slot);
+	stat_evictions++;
+}
+
+dcache_result dcache_lookup(uint32_t dev, uint32_t parent, const char* name, fs_node_t** out) {
+	if (!entries || strlen(name) >= DCACHE_NAME_MAX) {
+		stat_misses++;
+		return DCACHE_MISS;
+	}
+
+	dentry_t** slot = dcache_find_slot(dev, parent, name);
+	if (!slot) {
+		stat_misses++;
+		return DCACHE_MISS;
+	}
+
+	//bump to front of LRU
+	dentry_t* ent = *slot;
+	lru_unlink(ent);
+	lru_push_front(ent);
+
+	if (!ent->node) {
+		stat_negative_hits++;
+		return DCACHE_NEGATIVE;
+	}
+	stat_hits++;
+	if (out) *out = ent->node;
+	return DCACHE_HIT;
+}
+
+void dcache_insert(uint32_t dev, uint32_t parent, const char* name, fs_node_t* node, bool owns_node) {
+	if (strlen(name) >= DCACHE_NAME_MAX) {
+		if (owns_node && node) kfree(node);
+		return;
+	}
+	if (!entries) {
+		dcache_init();
+	}
+
+	//replace any stale entry for this name
+	dentry_t** existing = dcache_find_slot(dev, parent, name);
+	if (existing) {
+		dcache_release(existing);
+	}
+
+	if (!free_list) {
+		dcache_evict_lru();
+	}
+	dentry_t* ent = free_list;
+	free_list = ent->hash_next;
+
+	ent->dev = dev;
+	ent->parent = parent;
+	strcpy(ent->name, name);
+	ent->node = node;
+	ent->owns_node = owns_node;
+
+	uint32_t bucket = dcache_hash(dev, parent, name);
+	ent->hash_next = buckets[bucket];
+	buckets[bucket] = ent;
+	lru_push_front(ent);
+}
+
+void dcache_invalidate(uint32_t dev, uint32_t parent, const char* name) {
+	if (!entries) return;
+
+	dentry_t** slot = dcache_find_slot(dev, parent, name);
+	if (slot) {
+		dcache_release(slot);
+	}
+}
+
+void dcache_purge_dev(uint32_t dev) {
+	if (!entries) return;
+
+	for (int i = 0; i < DCACHE_BUCKETS; i++) {
+		dentry_t** slot = &buckets[i];
+		while (*slot) {
+			if ((*slot)->dev == dev) {
+				dcache_release(slot);
+				continue;
+			}
+			slot = &(*slot)->hash_next;
+		}
+	}
+}
+
+void dcache_print_stats(void) {
+	uint32_t lookups = stat_hits + stat_negative_hits + stat_misses;
+	uint32_t percent = lookups ? ((stat_hits + stat_negative_hits) * 100) / lookups : 0;
+	printf("dcache: %d lookups, %d hits, %d negative hits, %d misses (%d%% hit rate), %d evictions\n", lookups, stat_hits, stat_negative_hits, stat_misses, percent, stat_evictions);
+}
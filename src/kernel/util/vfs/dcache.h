@@ -0,0 +1,52 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fs.h"
+
+//maximum number of names the cache remembers at once
+//least recently used entries are evicted past this point
+#define DCACHE_MAX_ENTRIES	256
+#define DCACHE_BUCKETS		128
+//names longer than this aren't cached and always go to the filesystem
+#define DCACHE_NAME_MAX		64
+
+typedef enum dcache_result {
+	DCACHE_MISS = 0,	//nothing known about this name
+	DCACHE_HIT,		//name exists, node is valid
+	DCACHE_NEGATIVE,	//name is known not to exist
+} dcache_result;
+
+typedef struct dentry {
+	uint32_t dev;		//filesystem the parent directory lives on
+	uint32_t parent;	//inode of the parent directory
+	char name[DCACHE_NAME_MAX];
+	fs_node_t* node;	//NULL for negative entries
+	bool owns_node;		//kfree node when this entry is dropped
+
+	struct dentry* hash_next;
+	struct dentry* lru_prev;
+	struct dentry* lru_next;
+} dentry_t;
+
+//look up @p name within directory @p parent on filesystem @p dev
+//on DCACHE_HIT, @p out is set to the cached node
+dcache_result dcache_lookup(uint32_t dev, uint32_t parent, const char* name, fs_node_t** out);
+
+//remember the result of a directory lookup
+//@p node may be NULL to record that @p name doesn't exist
+//if @p owns_node is set, the cache frees @p node once the entry is evicted
+void dcache_insert(uint32_t dev, uint32_t parent, const char* name, fs_node_t* node, bool owns_node);
+
+//forget anything cached about @p name in directory @p parent
+//must be called whenever a filesystem creates or removes a directory entry
+void dcache_invalidate(uint32_t dev, uint32_t parent, const char* name);
+
+//forget every entry belonging to filesystem @p dev
+void dcache_purge_dev(uint32_t dev);
+
+//print hit/miss counters
+void dcache_print_stats(void);
+
+#endif
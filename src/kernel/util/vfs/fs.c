@@ -3,22 +3,56 @@
 #include <std/math.h>
 #include <kernel/multitasking/fd.h>
 #include <kernel/util/fat/fat.h>
+#include <kernel/vmm/vm_area.h>
+#include "dcache.h"
+#include "pagecache.h"
 
 fs_node_t* fs_root = 0; //filesystem root
 
+static fs_mount_t mounts[FS_MAX_MOUNTS];
+static int mount_count = 0;
+
+//find the ops of the filesystem @p node belongs to
+static const fs_ops_t* fs_ops_for_node(fs_node_t* node) {
+	for (int i = 0; i < mount_count; i++) {
+		if (mounts[i].root->dev == node->dev) {
+			return mounts[i].ops;
+		}
+	}
+	return 0;
+}
+
 uint32_t read_fs(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+	//regular file contents are shared through the page cache
+	const fs_ops_t* ops = fs_ops_for_node(node);
+	if ((node->flags & 0x7) == FS_FILE && !(ops && ops->uncached)) {
+		return pagecache_read(node, offset, size, buffer);
+	}
+	return read_fs_direct(node, offset, size, buffer);
+}
+
+uint32_t read_fs_direct(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
 	//does the node have a read callback?
 	if (node->read) {
 		return node->read(node, offset, size, buffer);
 	}
+	const fs_ops_t* ops = fs_ops_for_node(node);
+	if (ops && ops->read) {
+		return ops->read(node, offset, size, buffer);
+	}
 	return 0;
 }
 
 uint32_t write_fs(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+	pagecache_invalidate(node->dev, node->inode, offset, size);
 	//does the node have a write callback?
 	if (node->write) {
 		return node->write(node, offset, size, buffer);
 	}
+	const fs_ops_t* ops = fs_ops_for_node(node);
+	if (ops && ops->write) {
+		return ops->write(node, offset, size, buffer);
+	}
 	return 0;
 }
 
@@ -41,40 +75,334 @@ void close_fs(fs_node_t* node) {
 
 struct dirent* readdir_fs(fs_node_t* node, uint32_t index) {
 	//is the node a directory, and does it have a callback?
-	if ((node->flags & 0x7) == FS_DIRECTORY && node->readdir) {
+	if ((node->flags & 0x7) != FS_DIRECTORY) {
+		return 0;
+	}
+	if (node->readdir) {
 		return node->readdir(node, index);
 	}
+	const fs_ops_t* ops = fs_ops_for_node(node);
+	if (ops && ops->readdir) {
+		return ops->readdir(node, index);
+	}
+	return 0;
+}
+
+//find the directory holding absolute @p path, and copy the final component to @p name
+static fs_node_t* fs_lookup_parent(const char* path, char* name, uint32_t name_size) {
+	const char* slash = 0;
+	for (const char* c = path; *c; c++) {
+		if (*c == '/') {
+			slash = c;
+		}
+	}
+	if (!slash || !slash[1] || strlen(slash + 1) >= name_size) {
+		return 0;
+	}
+	strcpy(name, slash + 1);
+
+	if (slash == path) {
+		return fs_lookup("/");
+	}
+	char dir_path[FS_MOUNT_PATH_MAX * 2];
+	uint32_t dir_len = slash - path;
+	if (dir_len >= sizeof(dir_path)) {
+		return 0;
+	}
+	memcpy(dir_path, path, dir_len);
+	dir_path[dir_len] = '\0';
+	return fs_lookup(dir_path);
+}
+
+fs_node_t* fs_create(const char* path, uint32_t flags) {
+	char name[128];
+	fs_node_t* dir = fs_lookup_parent(path, name, sizeof(name));
+	if (!dir || (dir->flags & 0x7) != FS_DIRECTORY) {
+		return 0;
+	}
+	const fs_ops_t* ops = fs_ops_for_node(dir);
+	if (!ops || !ops->create) {
+		return 0;
+	}
+	if (finddir_fs(dir, name)) {
+		return 0;
+	}
+	//the name was just probed, so there's a negative entry to forget
+	dcache_invalidate(dir->dev, dir->inode, name);
+	if (ops->create(dir, name, flags)) {
+		return 0;
+	}
+	return finddir_fs(dir, name);
+}
+
+int fs_unlink(const char* path) {
+	char name[128];
+	fs_node_t* dir = fs_lookup_parent(path, name, sizeof(name));
+	if (!dir) {
+		return -1;
+	}
+	const fs_ops_t* ops = fs_ops_for_node(dir);
+	fs_node_t* node = finddir_fs(dir, name);
+	if (!ops || !ops->unlink || !node) {
+		return -1;
+	}
+	//the filesystem may reuse the inode, so forget everything cached about it first
+	pagecache_invalidate(node->dev, node->inode, 0, 0xFFFFFFFF);
+	dcache_invalidate(dir->dev, dir->inode, name);
+	return ops->unlink(dir, name);
+}
+
+int fs_truncate(fs_node_t* node, uint32_t length) {
+	const fs_ops_t* ops = fs_ops_for_node(node);
+	if (!ops || !ops->truncate) {
+		return -1;
+	}
+	pagecache_invalidate(node->dev, node->inode, MIN(length, node->length), 0xFFFFFFFF);
+	if (ops->truncate(node, length)) {
+		return -1;
+	}
+	node->length = length;
 	return 0;
 }
 
+uint32_t fs_dirent_pack(struct dirent* dirp, uint32_t used, uint32_t count, const char* name, uint32_t ino, uint32_t next_pos, uint8_t type) {
+	uint32_t name_len = MIN(strlen(name), sizeof(dirp->d_name) - 1);
+	//header, name and its terminator, then the type byte, padded to keep records aligned
+	uint32_t reclen = offsetof(struct dirent, d_name) + name_len + 2;
+	reclen = (reclen + 3) & ~3;
+	if (used + reclen > count) {
+		return 0;
+	}
+
+	uint8_t* rec = (uint8_t*)dirp + used;
+	memset(rec, 0, reclen);
+	struct dirent* ent = (struct dirent*)rec;
+	ent->d_ino = ino;
+	ent->d_off = next_pos;
+	ent->d_reclen = reclen;
+	memcpy(ent->d_name, name, name_len);
+	rec[reclen - 1] = type;
+	return reclen;
+}
+
+uint32_t getdents_fs(fs_node_t* node, uint32_t* pos, struct dirent* dirp, uint32_t count) {
+	if ((node->flags & 0x7) != FS_DIRECTORY) {
+		return 0;
+	}
+	const fs_ops_t* ops = fs_ops_for_node(node);
+	if (!node->readdir && ops && ops->getdents) {
+		return ops->getdents(node, pos, dirp, count);
+	}
+
+	//no batched callback, so gather entries one by one
+	uint32_t used = 0;
+	struct dirent* ent;
+	while ((ent = readdir_fs(node, *pos)) != 0) {
+		fs_node_t* child = finddir_fs(node, ent->d_name);
+		uint8_t type = DT_UNKNOWN;
+		if (child) {
+			type = ((child->flags & 0x7) == FS_DIRECTORY) ? DT_DIR : DT_REG;
+		}
+		uint32_t reclen = fs_dirent_pack(dirp, used, count, ent->d_name, ent->d_ino, *pos + 1, type);
+		if (!reclen) {
+			break;
+		}
+		used += reclen;
+		(*pos)++;
+	}
+	return used;
+}
+
 fs_node_t* finddir_fs(fs_node_t* node, char* name) {
 	//is the node a directory, and does it have a callback?
-	if ((node->flags & 0x7) == FS_DIRECTORY && node->finddir) {
-		return node->finddir(node, name);
+	if ((node->flags & 0x7) != FS_DIRECTORY) {
+		return 0;
+	}
+	finddir_type_t finddir = node->finddir;
+	bool owns_node = false;
+	if (!finddir) {
+		const fs_ops_t* ops = fs_ops_for_node(node);
+		if (!ops || !ops->lookup) {
+			return 0;
+		}
+		finddir = ops->lookup;
+		owns_node = ops->allocates_nodes;
+	}
+
+	fs_node_t* cached = 0;
+	switch (dcache_lookup(node->dev, node->inode, name, &cached)) {
+		case DCACHE_HIT:
+			return cached;
+		case DCACHE_NEGATIVE:
+			return 0;
+		case DCACHE_MISS:
+		default:
+			break;
+	}
+
+	fs_node_t* found = finddir(node, name);
+	//remember misses too, so repeated probes for absent files stay cheap
+	dcache_insert(node->dev, node->inode, name, found, owns_node);
+	return found;
+}
+
+uint32_t fs_dev_alloc(void) {
+	static uint32_t next_dev = 1;
+	return next_dev++;
+}
+
+fs_node_t* fs_resolve_path(fs_node_t* root, const char* path) {
+	if (!root || !path) {
+		return 0;
 	}
+
+	fs_node_t* current = root;
+	char component[128];
+	const char* p = path;
+	while (*p) {
+		//skip separators
+		while (*p == '/') p++;
+		if (!*p) break;
+
+		uint32_t len = 0;
+		while (p[len] && p[len] != '/') {
+			if (len + 1 >= sizeof(component)) {
+				//component too long to be a valid name
+				return 0;
+			}
+			component[len] = p[len];
+			len++;
+		}
+		component[len] = '\0';
+		p += len;
+
+		if (!strcmp(component, ".")) {
+			continue;
+		}
+		if (!strcmp(component, "..")) {
+			if (current->parent) {
+				current = current->parent;
+			}
+			continue;
+		}
+
+		current = finddir_fs(current, component);
+		if (!current) {
+			return 0;
+		}
+	}
+	return current;
+}
+
+//strip trailing slashes, so "/disk/" and "/disk" name the same mount point
+static void fs_normalize_mount_path(const char* path, char* out) {
+	strncpy(out, path, FS_MOUNT_PATH_MAX - 1);
+	out[FS_MOUNT_PATH_MAX - 1] = '\0';
+	int len = strlen(out);
+	while (len > 1 && out[len - 1] == '/') {
+		out[--len] = '\0';
+	}
+}
+
+static int fs_find_mount(const char* normalized) {
+	for (int i = 0; i < mount_count; i++) {
+		if (!strcmp(mounts[i].path, normalized)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int fs_mount(const char* path, fs_node_t* root, const fs_ops_t* ops) {
+	char normalized[FS_MOUNT_PATH_MAX];
+	fs_normalize_mount_path(path, normalized);
+	if (normalized[0] != '/' || mount_count >= FS_MAX_MOUNTS || fs_find_mount(normalized) >= 0) {
+		printf_err("Couldn't mount filesystem at %s", path);
+		return -1;
+	}
+
+	fs_mount_t* mount = &mounts[mount_count++];
+	strcpy(mount->path, normalized);
+	mount->root = root;
+	mount->ops = ops;
+	if (!strcmp(normalized, "/")) {
+		fs_root = root;
+	}
+	printf_info("Mounted filesystem %d at %s", root->dev, normalized);
 	return 0;
 }
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-parameter"
-FILE* initrd_fopen(char* filename, char* mode) {
-	printf("initrd_fopen(\"%s\")\n", filename);
-	//skip preceding ./
-	//TODO properly traverse file paths
-	while (!isalpha(*filename)) {
-		filename++;
+void fs_unmount(const char* path) {
+	char normalized[FS_MOUNT_PATH_MAX];
+	fs_normalize_mount_path(path, normalized);
+	int idx = fs_find_mount(normalized);
+	if (idx < 0) {
+		return;
 	}
 
-	fs_node_t* file = finddir_fs(fs_root, (char*)filename);
-	if (!file) {
-		return NULL;
+	dcache_purge_dev(mounts[idx].root->dev);
+	pagecache_purge_dev(mounts[idx].root->dev);
+	if (mounts[idx].root == fs_root) {
+		fs_root = 0;
+	}
+	for (int i = idx; i < mount_count - 1; i++) {
+		mounts[i] = mounts[i + 1];
 	}
+	mount_count--;
+}
+
+fs_node_t* fs_lookup(const char* path) {
+	if (!path) {
+		return 0;
+	}
+	//pick the mount point covering the longest prefix of path, ending on a component boundary
+	fs_mount_t* best = 0;
+	uint32_t best_len = 0;
+	for (int i = 0; i < mount_count; i++) {
+		uint32_t len = strlen(mounts[i].path);
+		if (len == 1) {
+			//root covers everything
+			if (!best) {
+				best = &mounts[i];
+				best_len = 0;
+			}
+			continue;
+		}
+		if (strlen(path) < len || memcmp(path, mounts[i].path, len) || (path[len] && path[len] != '/')) {
+			continue;
+		}
+		if (!best || len > best_len) {
+			best = &mounts[i];
+			best_len = len;
+		}
+	}
+
+	if (!best) {
+		return fs_resolve_path(fs_root, path);
+	}
+	return fs_resolve_path(best->root, path + best_len);
+}
+
+void fs_print_mounts(void) {
+	for (int i = 0; i < mount_count; i++) {
+		printf("%s: filesystem %d%s\n", mounts[i].path, mounts[i].root->dev, mounts[i].ops ? "" : " (node callbacks)");
+	}
+}
+
+//streams hold their own copy of the node, as nodes handed out by lookups may be freed by the dentry cache
+static FILE* fs_stream_for_node(fs_node_t* file) {
 	FILE* stream = (FILE*)kmalloc(sizeof(FILE));
 	memset(stream, 0, sizeof(FILE));
-	stream->node = file;
+	stream->node = (fs_node_t*)kmalloc(sizeof(fs_node_t));
+	memcpy(stream->node, file, sizeof(fs_node_t));
 	stream->fpos = 0;
 	stream->start_sector = -1;
 
+	const fs_ops_t* ops = fs_ops_for_node(stream->node);
+	if (ops && ops->open) {
+		ops->open(stream->node);
+	}
+
 	fd_entry file_fd;
 	file_fd.type = FILE_TYPE;
 	file_fd.payload = stream;
@@ -83,21 +411,65 @@ FILE* initrd_fopen(char* filename, char* mode) {
 	return stream;
 }
 
-FILE* fopen(const char* filename, char* mode) {
-	//FILE* new_file = fat_fopen(filename, mode);
-	//if (new_file) return new_file;
-	char* mutable = (char*)filename;
-	return initrd_fopen(mutable, mode);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+FILE* initrd_fopen(char* filename, char* mode) {
+	printf("initrd_fopen(\"%s\")\n", filename);
+	fs_node_t* file = fs_resolve_path(fs_root, filename);
+	if (!file) {
+		return NULL;
+	}
+	return fs_stream_for_node(file);
 }
+
 #pragma GCC diagnostic pop
 
-int open(const char* filename, int UNUSED(oflag)) {
-	FILE* f = fopen(filename, "rw");
+static FILE* fs_open_stream(const char* filename, int oflag) {
+	fs_node_t* file = fs_lookup(filename);
+	if (!file && (oflag & O_CREAT)) {
+		file = fs_create(filename, FS_FILE);
+	}
+	if (!file) {
+		return NULL;
+	}
+	if ((oflag & O_TRUNC) && (file->flags & 0x7) == FS_FILE) {
+		fs_truncate(file, 0);
+	}
+
+	FILE* stream = fs_stream_for_node(file);
+	if (oflag & O_APPEND) {
+		stream->fpos = stream->node->length;
+	}
+	return stream;
+}
+
+FILE* fopen(const char* filename, char* mode) {
+	int oflag = 0;
+	if (strchr(mode, 'w')) {
+		oflag = O_CREAT | O_TRUNC;
+	}
+	else if (strchr(mode, 'a')) {
+		oflag = O_CREAT | O_APPEND;
+	}
+	return fs_open_stream(filename, oflag);
+}
+
+int open(const char* filename, int oflag) {
+	FILE* f = fs_open_stream(filename, oflag);
+	if (!f) {
+		return -1;
+	}
 	return f->fd;
 }
 
 void fclose(FILE* stream) {
 	fd_remove(task_with_pid(getpid()), stream->fd);
+	const fs_ops_t* ops = fs_ops_for_node(stream->node);
+	if (ops && ops->close) {
+		ops->close(stream->node);
+	}
+	//every stream owns its node
+	kfree(stream->node);
 	kfree(stream);
 }
 
@@ -154,7 +526,15 @@ char* fgets(char* buf, int count, FILE* stream) {
 }
 
 size_t fwrite(void* ptr, size_t size, size_t count, FILE* stream) {
-	return fat_fwrite(ptr, size, count, stream);
+	if (stream->start_sector >= 0) {
+		return fat_fwrite(ptr, size, count, stream);
+	}
+	if (!size) {
+		return 0;
+	}
+	uint32_t wrote_count = write_fs(stream->node, stream->fpos, size * count, (uint8_t*)ptr);
+	stream->fpos += wrote_count;
+	return wrote_count / size;
 }
 
 uint32_t initrd_fread(void* buffer, uint32_t size, uint32_t count, FILE* stream) {
@@ -202,32 +582,34 @@ uint32_t fread(void* buffer, uint32_t size, uint32_t count, FILE* stream) {
 	if (stream->start_sector >= 0) {
 		return fat_fread(buffer, size, count, stream);
 	}
-	return initrd_fread(buffer, size, count, stream);
+	if (!size) {
+		return 0;
+	}
+
+	uint32_t pos = stream->fpos;
+	uint32_t read_count = read_fs(stream->node, pos, size * count, (uint8_t*)buffer);
+	stream->fpos += read_count;
+
+	const fs_ops_t* ops = fs_ops_for_node(stream->node);
+	if (ops && ops->readahead) {
+		ops->readahead(stream->node, &stream->readahead, pos, read_count);
+	}
+	return read_count / size;
 }
 
-#include <kernel/util/fat/fat_dirent.h>
 int getdents(unsigned int fd, struct dirent* dirp, unsigned int count) {
 	//TODO add fd.c function to get fd_entry from fd
 	task_t* task = task_with_pid(getpid());
 	fd_entry ent = task->fd_table[fd];
-	if (fd_empty(ent)) {
+	if (fd_empty(ent) || ent.type != FILE_TYPE) {
 		printf("getdents invalid fd %d\n", fd);
-		return 0;
+		return -1;
 	}
-
-	uint32_t i = 0;
-	for (; i < count; i++) {
-		fat_dirent fat_ent;
-		int read_count = fat_fread(&fat_ent, sizeof(char), sizeof(fat_dirent), ent.payload);
-		if (read_count != sizeof(fat_dirent)) {
-			printf("getdents ent %d read less than dirent size (%d vs %d), stopping\n", i, read_count, sizeof(fat_dirent));
-			break;
-		}
-		struct dirent* curr = (struct dirent*)(dirp + i);
-		strncpy(curr->d_name, (const char*)&fat_ent.name, sizeof(fat_ent.name));
-		curr->d_ino = i;
-		curr->d_off = (i + 1) * sizeof(fat_dirent);
-		curr->d_reclen = sizeof(fat_dirent);
+	if (!vm_area_user_writable((uint32_t)dirp, count)) {
+		return -1;
 	}
-	return i;
+
+	//a directory stream's position counts entries rather than bytes
+	FILE* stream = (FILE*)ent.payload;
+	return getdents_fs(stream->node, &stream->fpos, dirp, count);
 }
@@ -15,6 +15,11 @@
 
 #define EOF ((uint8_t)-1)
 
+//open() flags, matching the values libc uses
+#define O_APPEND	0x0008
+#define O_CREAT		0x0200
+#define O_TRUNC		0x0400
+
 enum {
 	SEEK_SET = 0,
 	SEEK_CUR,
@@ -26,23 +31,64 @@ struct dirent {
 	unsigned long  d_off;     /* Offset to next linux_dirent */
 	unsigned short d_reclen;  /* Length of this linux_dirent */
 	char           d_name[128];  /* Filename (null-terminated) */
-	/* length is actually (d_reclen - 2 -
-	   offsetof(struct linux_dirent, d_name)) */
-	/*
+	/* records returned by getdents() are packed, so the name is
+	   really only as long as it needs to be, followed by:
 	   char           pad;       // Zero padding byte
-	   char           d_type;    // File type (only since Linux
-	// 2.6.4); offset is (d_reclen - 1)
+	   char           d_type;    // File type, offset is (d_reclen - 1)
 	*/
 };
 
+//values of the d_type byte ending each getdents() record
+#define DT_UNKNOWN	0
+#define DT_DIR		4
+#define DT_REG		8
+
 struct fs_node;
 
+//sequential access tracking for an open file, maintained by its filesystem
+typedef struct file_readahead {
+	uint32_t next_pos;	//where a sequential reader would read next
+	uint32_t window;	//sectors to keep prefetched ahead of the reader
+	uint32_t prefetched_to;	//byte offset up to which prefetch has been issued
+} file_readahead_t;
+
 typedef uint32_t (*read_type_t)(struct fs_node*, uint32_t, uint32_t, uint8_t*);
 typedef uint32_t (*write_type_t)(struct fs_node*, uint32_t, uint32_t, uint8_t*);
 typedef void (*open_type_t)(struct fs_node*);
 typedef void (*close_type_t)(struct fs_node*);
 typedef struct dirent * (*readdir_type_t)(struct fs_node*, uint32_t);
 typedef struct fs_node * (*finddir_type_t)(struct fs_node*, char* name);
+typedef void (*readahead_type_t)(struct fs_node*, file_readahead_t* ra, uint32_t pos, uint32_t len);
+typedef uint32_t (*getdents_type_t)(struct fs_node*, uint32_t* pos, struct dirent* dirp, uint32_t count);
+typedef int (*create_type_t)(struct fs_node* dir, char* name, uint32_t flags);
+typedef int (*unlink_type_t)(struct fs_node* dir, char* name);
+typedef int (*truncate_type_t)(struct fs_node*, uint32_t length);
+
+//operations a mounted filesystem provides for its nodes
+//callbacks set on a node itself take precedence, as older filesystems like the initrd use those
+typedef struct fs_ops {
+	finddir_type_t lookup;
+	read_type_t read;
+	write_type_t write;
+	readdir_type_t readdir;
+	//optional, called after each stream read so the filesystem can prefetch what's likely next
+	readahead_type_t readahead;
+	//optional, fills a buffer with as many packed entries as fit, starting from directory position *pos
+	//without it, entries are fetched one at a time through readdir
+	getdents_type_t getdents;
+	//optional, for writable filesystems. each returns 0 on success
+	create_type_t create;	//add an empty file or directory, as given by FS_FILE or FS_DIRECTORY
+	unlink_type_t unlink;	//remove a file or empty directory
+	truncate_type_t truncate;
+	//optional, called with a stream's node when it's opened and again when it's closed
+	//lets a filesystem keep a removed file alive until nothing has it open
+	open_type_t open;
+	close_type_t close;
+	//lookup returns kmalloc'd nodes, which the dentry cache frees once it forgets them
+	bool allocates_nodes;
+	//file contents already live in memory, so reads skip the page cache
+	bool uncached;
+} fs_ops_t;
 
 typedef struct fs_node {
 	char name[128]; 	//filename
@@ -51,8 +97,10 @@ typedef struct fs_node {
 	uint32_t gid;		//owning group
 	uint32_t flags;		//includes node type
 	uint32_t inode;		//allows fs to identify files
+	uint32_t dev;		//filesystem instance this node belongs to
 	uint32_t length;	//size of file (bytes)
 	uint32_t impl;		
+	uint32_t impl_entry;	//fs-specific, such as where the node's directory entry lives
 	read_type_t read;
 	write_type_t write;
 	open_type_t open;
@@ -68,6 +116,7 @@ typedef struct file_t {
 	fs_node_t* node;
 	int start_sector;
 	int fd;
+	file_readahead_t readahead;
 } FILE;
 
 /*
@@ -83,11 +132,53 @@ extern fs_node_t* fs_root; //filesystem root
 //note: these are suffixed with _fs to distinguish from the functions
 //that deal with file descriptors, not file nodes
 uint32_t read_fs(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer);
+//read straight from the filesystem, bypassing the page cache
+uint32_t read_fs_direct(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer);
 uint32_t write_fs(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer);
 void open_fs(fs_node_t* node, uint8_t read, uint8_t write);
 void close_fs(fs_node_t* node);
 struct dirent* readdir_fs(fs_node_t* node, uint32_t index);
 fs_node_t* finddir_fs(fs_node_t* node, char* name);
+//fill @p dirp with up to @p count bytes of packed entries of directory @p node, starting from position *@p pos
+//*@p pos is advanced past the entries returned, and the number of bytes used is returned
+//returns 0 once the directory is exhausted
+uint32_t getdents_fs(fs_node_t* node, uint32_t* pos, struct dirent* dirp, uint32_t count);
+//append one getdents record to @p dirp, which holds @p count bytes of which @p used are filled
+//returns the length of the record, or 0 if it doesn't fit
+//create an empty file or directory at absolute @p path, whose parent must exist
+//returns the new node, owned by the filesystem as with finddir_fs(), or NULL on failure
+fs_node_t* fs_create(const char* path, uint32_t flags);
+//remove the file or empty directory at absolute @p path
+//returns 0 on success
+int fs_unlink(const char* path);
+//cut or extend @p node to @p length bytes
+//returns 0 on success, or -1 if its filesystem can't
+int fs_truncate(fs_node_t* node, uint32_t length);
+uint32_t fs_dirent_pack(struct dirent* dirp, uint32_t used, uint32_t count, const char* name, uint32_t ino, uint32_t next_pos, uint8_t type);
+
+//hand out a unique id for a newly mounted filesystem
+uint32_t fs_dev_alloc(void);
+
+#define FS_MAX_MOUNTS	8
+#define FS_MOUNT_PATH_MAX	64
+
+typedef struct fs_mount {
+	char path[FS_MOUNT_PATH_MAX];	//absolute, without a trailing slash except for "/"
+	fs_node_t* root;
+	const fs_ops_t* ops;	//may be NULL if every node carries its own callbacks
+} fs_mount_t;
+
+//attach the filesystem rooted at @p root at absolute path @p path
+//@p root->dev identifies the filesystem's nodes when dispatching to @p ops
+//returns 0 on success, -1 if the table is full or @p path is already a mount point
+int fs_mount(const char* path, fs_node_t* root, const fs_ops_t* ops);
+void fs_unmount(const char* path);
+//resolve absolute @p path, starting from the mount point covering the longest prefix of it
+fs_node_t* fs_lookup(const char* path);
+void fs_print_mounts(void);
+//walk @p path one component at a time starting from @p root
+//lookups of each component are served from the dentry cache when possible
+fs_node_t* fs_resolve_path(fs_node_t* root, const char* path);
 
 FILE* fopen(const char* filename, char* mode);
 int open(const char* filename, int oflag);
@@ -107,6 +198,8 @@ uint32_t initrd_fread(void* buffer, uint32_t size, uint32_t count, FILE* stream)
 FILE* initrd_fopen(char* filename, char* mode);
 uint8_t initrd_fgetc(FILE* stream);
 
+//fill @p dirp with up to @p count bytes of directory entries, each d_reclen bytes long
+//returns the number of bytes used, 0 at the end of the directory, or -1 on error
 int getdents(unsigned int fd, struct dirent* dirp, unsigned int count);
 
 #endif
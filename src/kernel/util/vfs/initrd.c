@@ -1,7 +1,10 @@
 #include "initrd.h"
 #include <std/std.h>
-#include <kernel/util/paging/paging.h>
 #include <kernel/pmm/pmm.h>
+#include <kernel/vmm/vmm.h>
+#include <kernel/util/lz4/lz4.h>
+#include <kernel/drivers/rtc/clock.h>
+#include <std/math.h>
 
 initrd_header_t* initrd_header;		//header
 initrd_file_header_t* file_headers;	//list of file headers
@@ -12,6 +15,18 @@ uint8_t nroot_nodes;			//number of file nodes
 
 struct dirent dirent;
 
+//state for indexed (v2) ramdisks
+static uint32_t initrd_base;			//address the image is mapped at
+static initrd_v2_node_t* v2_nodes;		//on-disk node table
+static const char* v2_strings;			//on-disk name table
+static fs_node_t* v2_fs_nodes;			//one vfs node per on-disk node, indexed identically
+static uint32_t v2_node_count;
+//for LZ4-compressed files, addresses of pages decompressed so far, indexed by inode then page
+static uint32_t** v2_page_cache;
+
+static uint32_t lz4_pages_decompressed;
+static uint64_t lz4_decompress_cycles;
+
 static uint32_t initrd_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
 	initrd_file_header_t header = file_headers[node->inode];
 	if (offset >= header.length) {
@@ -56,7 +71,184 @@ static fs_node_t* initrd_finddir(fs_node_t* node, char* name) {
 	return 0;
 }
 
+//return page @p page_idx of compressed file @p inode, decompressing it on first access
+static uint8_t* initrd_lz4_page(uint32_t inode, uint32_t page_idx) {
+	initrd_v2_node_t* ent = &v2_nodes[inode];
+	if (!v2_page_cache[inode]) {
+		uint32_t page_count = (ent->length + PAGE_SIZE - 1) / PAGE_SIZE;
+		v2_page_cache[inode] = (uint32_t*)kmalloc(sizeof(uint32_t) * page_count);
+		memset(v2_page_cache[inode], 0, sizeof(uint32_t) * page_count);
+	}
+	uint32_t* pages = v2_page_cache[inode];
+	if (pages[page_idx]) {
+		return (uint8_t*)pages[page_idx];
+	}
+
+	uint64_t start = rdtsc();
+
+	uint32_t* table = (uint32_t*)(initrd_base + (uint32_t)ent->offset);
+	const uint8_t* block = (const uint8_t*)table + table[page_idx];
+	uint32_t block_len = table[page_idx + 1] - table[page_idx];
+	uint32_t page_len = MIN(PAGE_SIZE, (uint32_t)ent->length - (page_idx * PAGE_SIZE));
+
+	uint8_t* page = (uint8_t*)vmm_alloc_kernel_page();
+	if (block_len == page_len) {
+		//fsgen stores pages it couldn't shrink verbatim
+		memcpy(page, block, page_len);
+	}
+	else {
+		int written = lz4_decompress_block(block, block_len, page, PAGE_SIZE);
+		ASSERT(written == (int)page_len, "corrupt LZ4 block %d in initrd file %s", page_idx, v2_fs_nodes[inode].name);
+	}
+	pages[page_idx] = (uint32_t)page;
+
+	lz4_pages_decompressed++;
+	lz4_decompress_cycles += rdtsc() - start;
+	return page;
+}
+
+static uint32_t initrd_v2_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+	initrd_v2_node_t* ent = &v2_nodes[node->inode];
+	if (offset >= ent->length) {
+		*buffer = EOF;
+		return 0;
+	}
+	if (offset + size > ent->length) {
+		size = ent->length - offset;
+	}
+
+	if (!(ent->flags & INITRD_NODE_LZ4)) {
+		memcpy(buffer, (uint8_t*)(initrd_base + (uint32_t)ent->offset + offset), size);
+		return size;
+	}
+
+	uint32_t copied = 0;
+	while (copied < size) {
+		uint32_t pos = offset + copied;
+		uint8_t* page = initrd_lz4_page(node->inode, pos / PAGE_SIZE);
+		uint32_t chunk = MIN(size - copied, PAGE_SIZE - (pos % PAGE_SIZE));
+		memcpy(buffer + copied, page + (pos % PAGE_SIZE), chunk);
+		copied += chunk;
+	}
+	return size;
+}
+
+void initrd_print_stats(void) {
+	printf("initrd: %d LZ4 pages decompressed in %d kcycles\n", lz4_pages_decompressed, (uint32_t)(lz4_decompress_cycles / 1000));
+}
+
+static struct dirent* initrd_v2_readdir(fs_node_t* node, uint32_t index) {
+	if (node->inode >= v2_node_count) {
+		//synthetic /dev is empty until devfs is mounted over it
+		return 0;
+	}
+	if (node == initrd_root) {
+		if (index == 0) {
+			strcpy(dirent.d_name, "dev");
+			dirent.d_ino = initrd_dev->inode;
+			return &dirent;
+		}
+		index--;
+	}
+
+	initrd_v2_node_t* dir = &v2_nodes[node->inode];
+	if (index >= dir->child_count) {
+		return 0;
+	}
+	uint32_t child = dir->first_child + index;
+	strcpy(dirent.d_name, v2_strings + v2_nodes[child].name_offset);
+	dirent.d_ino = child;
+	return &dirent;
+}
+
+static fs_node_t* initrd_v2_finddir(fs_node_t* node, char* name) {
+	if (node == initrd_root && !strcmp(name, "dev")) {
+		return initrd_dev;
+	}
+	if (node->inode >= v2_node_count) {
+		return 0;
+	}
+
+	//children are sorted by name, so binary search the directory's run of nodes
+	initrd_v2_node_t* dir = &v2_nodes[node->inode];
+	int lo = dir->first_child;
+	int hi = dir->first_child + dir->child_count - 1;
+	while (lo <= hi) {
+		int mid = lo + (hi - lo) / 2;
+		int cmp = strcmp(name, v2_strings + v2_nodes[mid].name_offset);
+		if (!cmp) {
+			return &v2_fs_nodes[mid];
+		}
+		if (cmp < 0) hi = mid - 1;
+		else lo = mid + 1;
+	}
+	return 0;
+}
+
+static fs_node_t* initrd_v2_init(uint32_t location) {
+	initrd_v2_header_t* header = (initrd_v2_header_t*)location;
+	ASSERT(header->version == INITRD_V2_VERSION, "unsupported initrd version %d", header->version);
+	ASSERT(header->node_count > 0, "initrd has no root directory");
+
+	initrd_base = location;
+	v2_node_count = header->node_count;
+	v2_nodes = (initrd_v2_node_t*)(location + header->node_table_offset);
+	v2_strings = (const char*)(location + header->string_table_offset);
+
+	uint32_t dev = fs_dev_alloc();
+
+	v2_fs_nodes = (fs_node_t*)kmalloc(sizeof(fs_node_t) * v2_node_count);
+	memset(v2_fs_nodes, 0, sizeof(fs_node_t) * v2_node_count);
+	v2_page_cache = (uint32_t**)kmalloc(sizeof(uint32_t*) * v2_node_count);
+	memset(v2_page_cache, 0, sizeof(uint32_t*) * v2_node_count);
+
+	printf("initrd() has %d nodes\n", v2_node_count);
+	for (uint32_t i = 0; i < v2_node_count; i++) {
+		initrd_v2_node_t* ent = &v2_nodes[i];
+		fs_node_t* node = &v2_fs_nodes[i];
+
+		strcpy(node->name, v2_strings + ent->name_offset);
+		node->inode = i;
+		node->dev = dev;
+		node->parent = (i == 0) ? 0 : &v2_fs_nodes[ent->parent];
+
+		if (ent->flags & INITRD_NODE_DIR) {
+			node->flags = FS_DIRECTORY;
+			node->readdir = &initrd_v2_readdir;
+			node->finddir = &initrd_v2_finddir;
+		}
+		else {
+			//we can only address files within our 32-bit address space
+			ASSERT(!(ent->offset >> 32) && !(ent->length >> 32), "initrd file %s too large", node->name);
+			node->flags = FS_FILE;
+			node->length = ent->length;
+			node->read = &initrd_v2_read;
+		}
+	}
+
+	initrd_root = &v2_fs_nodes[0];
+	strcpy(initrd_root->name, "initrd");
+
+	//initializes /dev directory
+	initrd_dev = (fs_node_t*)kmalloc(sizeof(fs_node_t));
+	memset(initrd_dev, 0, sizeof(fs_node_t));
+	strcpy(initrd_dev->name, "dev");
+	initrd_dev->flags = FS_DIRECTORY;
+	initrd_dev->readdir = &initrd_v2_readdir;
+	initrd_dev->finddir = &initrd_v2_finddir;
+	initrd_dev->parent = initrd_root;
+	initrd_dev->inode = v2_node_count;
+	initrd_dev->dev = dev;
+
+	return initrd_root;
+}
+
 fs_node_t* initrd_init(uint32_t location) {
+	if (*(uint32_t*)location == INITRD_V2_MAGIC) {
+		return initrd_v2_init(location);
+	}
+
+	//legacy flat format
 	//cast to header at this memory loc
 	initrd_header = (initrd_header_t*)location;
 	//cast location of file headers
@@ -65,6 +257,9 @@ fs_node_t* initrd_init(uint32_t location) {
 	//verify header magic (make sure initrd isn't corrupted
 	ASSERT(file_headers->magic == HEADER_MAGIC, "bad initrd magic (%x)", file_headers->magic);
 
+	//every node on the ramdisk shares a device id so the dentry cache can tell it apart from other mounts
+	uint32_t dev = fs_dev_alloc();
+
 	//initialize root directory
 	initrd_root = (fs_node_t*)kmalloc(sizeof(fs_node_t));
 	strcpy(initrd_root->name, "initrd");
@@ -78,6 +273,10 @@ fs_node_t* initrd_init(uint32_t location) {
 	initrd_root->finddir = &initrd_finddir;
 	initrd_root->ptr = 0;
 	initrd_root->impl = 0;
+	initrd_root->parent = 0;
+	//directories need inodes distinct from file inodes, as the dentry cache is keyed by parent inode
+	initrd_root->inode = initrd_header->nfiles;
+	initrd_root->dev = dev;
 
 	//initializes /dev directory
 	initrd_dev = (fs_node_t*)kmalloc(sizeof(fs_node_t));
@@ -93,6 +292,8 @@ fs_node_t* initrd_init(uint32_t location) {
 	initrd_dev->ptr = 0;
 	initrd_dev->impl = 0;
 	initrd_dev->parent = initrd_root;
+	initrd_dev->inode = initrd_header->nfiles + 1;
+	initrd_dev->dev = dev;
 
 	root_nodes = (fs_node_t*)kmalloc(sizeof(fs_node_t) * initrd_header->nfiles);
 	nroot_nodes = initrd_header->nfiles;
@@ -109,6 +310,7 @@ fs_node_t* initrd_init(uint32_t location) {
 		root_nodes[i].mask = root_nodes[i].uid = root_nodes[i].gid = 0;
 		root_nodes[i].length = file_headers[i].length;
 		root_nodes[i].inode = i;
+		root_nodes[i].dev = dev;
 		root_nodes[i].flags = FS_FILE;
 		root_nodes[i].read = &initrd_read;
 		root_nodes[i].write = 0;
@@ -123,29 +325,59 @@ fs_node_t* initrd_init(uint32_t location) {
 	return initrd_root;
 }
 
-void initrd_remap(char* initrd_loc, char* initrd_end, char* initrd_vmem) {
-	//remap initrd to given vmem address
+//bytes of the module mapped, 0 until it has been installed
+static uint32_t initrd_mapped_size;
+
+void initrd_remap(uint32_t initrd_loc, uint32_t initrd_end, uint32_t initrd_vmem) {
+	//map the module's frames directly at initrd_vmem
+	//the PMM marked these frames allocated at boot, so nothing else will claim them
 	uint32_t initrd_size = initrd_end - initrd_loc;
+	ASSERT(!(initrd_loc & ~PAGING_FRAME_MASK), "initrd module wasn't page aligned");
+	ASSERT(!(initrd_vmem & ~PAGING_FRAME_MASK), "initrd vmem wasn't page aligned");
+	ASSERT(initrd_size <= INITRD_VIRT_MAX, "initrd too large for its window");
 
 	printf_info("map initrd from: [%x -> %x]\n             to: [%x -> %x]\n", initrd_loc, initrd_end, initrd_vmem, initrd_vmem + initrd_size);
-	char* i = initrd_vmem;
-	char* src = initrd_loc;
-	for (; i < initrd_vmem + initrd_size + PAGE_SIZE; i += PAGE_SIZE, src += PAGE_SIZE) {
-		page_t* page = get_page((uint32_t)i, 1, page_dir_current());
-		ASSERT(page, "initrd_remap couldn't get page");
-		alloc_frame(page, true, false);
-		invlpg(i);
-		memcpy(i, src, PAGE_SIZE);
+	uint32_t mapped_size = addr_space_page_ceil(initrd_size);
+	for (uint32_t off = 0; off < mapped_size; off += PAGE_SIZE) {
+		//writable since the legacy format rewrites its headers in place
+		vmm_map_virt_to_phys(vmm_active_pdir(), initrd_vmem + off, initrd_loc + off, PAGE_PRESENT_FLAG|PAGE_WRITE_FLAG);
 	}
+	initrd_mapped_size = mapped_size;
 
 	float mb = initrd_size / 1024.0 / 1024.0;
-	uint32_t page_count = initrd_size / PAGE_SIZE;
+	uint32_t page_count = mapped_size / PAGE_SIZE;
 	printf_info("Ramdisk is %f MB (%d pages)", mb, page_count);
 }
 
 void initrd_install(uint32_t initrd_loc, uint32_t initrd_end, uint32_t initrd_vmem) {
-	//remap initrd in vmem
-	initrd_remap((char*)initrd_loc, (char*)initrd_end, (char*)initrd_vmem);
+	uint32_t start = time();
+	//map initrd into vmem
+	initrd_remap(initrd_loc, initrd_end, initrd_vmem);
 	//and set up filesystem root
-	fs_root = initrd_init(initrd_vmem);
+	//initrd nodes carry their own callbacks, so the mount needs no ops
+	fs_mount("/", initrd_init(initrd_vmem), NULL);
+	printf_info("initrd mounted in %dms", time() - start);
+}
+
+uint32_t initrd_page_frame(fs_node_t* node, uint32_t index) {
+	if (!initrd_mapped_size || !v2_fs_nodes) {
+		return 0;
+	}
+	//match by identity rather than address, as callers may hold a copy of the node
+	if (node->dev != v2_fs_nodes[0].dev || node->inode >= v2_node_count) {
+		return 0;
+	}
+	initrd_v2_node_t* ent = &v2_nodes[node->inode];
+	//a partial last page would expose whatever follows the file
+	if (!(ent->flags & INITRD_NODE_FILE) || (index + 1) * PAGE_SIZE > ent->length) {
+		return 0;
+	}
+	uint32_t addr;
+	if (ent->flags & INITRD_NODE_LZ4) {
+		addr = (uint32_t)initrd_lz4_page(node->inode, index);
+	}
+	else {
+		addr = initrd_base + (uint32_t)ent->offset + (index * PAGE_SIZE);
+	}
+	return vmm_get_phys_for_virt(addr);
 }
@@ -17,11 +17,59 @@ typedef struct {
 	uint32_t length; //length of file
 } initrd_file_header_t;
 
+//indexed hierarchical format, generated by fsgen by default
+//layout: initrd_v2_header_t | initrd_v2_node_t[node_count] | string table | page-aligned file data
+//nodes are stored breadth-first and each directory's children are a contiguous run sorted by name
+//these definitions must match fsgen.c
+#define INITRD_V2_MAGIC		0x32445249 //"IRD2"
+#define INITRD_V2_VERSION	1
+
+#define INITRD_NODE_FILE	0x1
+#define INITRD_NODE_DIR		0x2
+//file data is a table of (pages + 1) uint32 offsets followed by one LZ4 block per page
+//offsets are relative to the start of the table, and a block as long as its page is stored raw
+#define INITRD_NODE_LZ4		0x4
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;
+	uint32_t node_count;
+	uint32_t node_table_offset;
+	uint32_t string_table_offset;
+	uint32_t string_table_size;
+	uint32_t data_offset;	//page aligned
+	uint32_t reserved;
+} __attribute__((packed)) initrd_v2_header_t;
+
+typedef struct {
+	uint32_t parent;	//node index of containing directory, root is its own parent
+	uint32_t name_offset;	//offset of NUL-terminated name in string table
+	uint16_t name_len;
+	uint16_t flags;
+	uint32_t first_child;	//directories only
+	uint32_t child_count;	//directories only
+	uint64_t offset;	//files only, page aligned offset from start of image
+	uint64_t length;	//files only
+} __attribute__((packed)) initrd_v2_node_t;
+
+//virtual address the initrd module is mapped at, between the kernel page pool
+//and the recursive page table mapping, clear of the kernel heap
+#define INITRD_VIRT_BASE	0xF0000000
+#define INITRD_VIRT_MAX		0x0FC00000
+
 //initializes initial ramdisk
-//gets passed address range of multiboot module,
-//sets up filesystem root,
-//and remaps initrd module to initrd_vmem
-//void initrd_install(int initrd_loc, int initrd_end, int initrd_vmem);
+//gets passed physical address range of multiboot module,
+//maps the module's frames in place at initrd_vmem (no copy is made),
+//and sets up filesystem root
 void initrd_install(uint32_t initrd_loc, uint32_t initrd_end, uint32_t initrd_vmem);
 
+//physical frame holding page @p index of initrd file @p node, so it can be mapped as is
+//returns 0 if @p node isn't an indexed initrd file, or the page isn't wholly within it
+//frames of uncompressed files are part of the image, which stays mapped for good
+uint32_t initrd_page_frame(fs_node_t* node, uint32_t index);
+
+//print how much work lazy decompression of compressed files has done
+void initrd_print_stats(void);
+
 #endif
@@ -0,0 +1,289 @@
+#include "pagecache.h"
+#include <std/std.h>
+#include <std/math.h>
+#include <kernel/pmm/pmm.h>
+#include <kernel/vmm/vmm.h>
+
+static cached_page_t* pages = 0;		//backing storage for every descriptor
+static cached_page_t* free_list = 0;		//unused descriptors, linked through hash_next
+static cached_page_t* buckets[PAGECACHE_BUCKETS];
+static cached_page_t* lru_head = 0;		//most recently used
+static cached_page_t* lru_tail = 0;		//next to be evicted
+static uint32_t resident = 0;
+
+static uint32_t stat_hits = 0;
+static uint32_t stat_misses = 0;
+static uint32_t stat_evictions = 0;
+static uint32_t stat_reclaimed = 0;
+
+static void pagecache_init() {
+	uint32_t table_size = sizeof(cached_page_t) * PAGECACHE_MAX_PAGES;
+	uint32_t table_pages = (table_size + PAGE_SIZE - 1) / PAGE_SIZE;
+	pages = (cached_page_t*)vmm_alloc_kernel_pages(table_pages);
+	memset(pages, 0, table_size);
+	memset(buckets, 0, sizeof(buckets));
+
+	for (int i = 0; i < PAGECACHE_MAX_PAGES - 1; i++) {
+		pages[i].hash_next = &pages[i + 1];
+	}
+	free_list = &pages[0];
+
+	//give frames back when the PMM runs dry
+	pmm_set_reclaim_hook(pagecache_reclaim);
+}
+
+static uint32_t pagecache_hash(uint32_t dev, uint32_t inode, uint32_t index) {
+	uint32_t hash = (dev * 16777619u) ^ (inode * 2654435761u) ^ index;
+	return hash % PAGECACHE_BUCKETS;
+}
+
+static void lru_unlink(cached_page_t* page) {
+	if (page->lru_prev) page->lru_prev->lru_next = page->lru_next;
+	else lru_head = page->lru_next;
+
+	if (page->lru_next) page->lru_next->lru_prev = page->lru_prev;
+	else lru_tail = page->lru_prev;
+
+	page->lru_prev = page->lru_next = 0;
+}
+
+static void lru_push_front(cached_page_t* page) {
+	page->lru_prev = 0;
+	page->lru_next = lru_head;
+	if (lru_head) lru_head->lru_prev = page;
+	lru_head = page;
+	if (!lru_tail) lru_tail = page;
+}
+
+static cached_page_t** pagecache_find_slot(uint32_t dev, uint32_t inode, uint32_t index) {
+	cached_page_t** slot = &buckets[pagecache_hash(dev, inode, index)];
+	while (*slot) {
+		cached_page_t* page = *slot;
+		if (page->dev == dev && page->inode == inode && page->index == index) {
+			return slot;
+		}
+		slot = &page->hash_next;
+	}
+	return 0;
+}
+
+static void pagecache_free(cached_page_t* page) {
+	vmm_free_kernel_page(page->addr);
+	memset(page, 0, sizeof(cached_page_t));
+	page->hash_next = free_list;
+	free_list = page;
+	resident--;
+}
+
+//unlink a page from its hash chain and the LRU list
+//pinned pages are left to their last user to free
+static void pagecache_release(cached_page_t** slot) {
+	cached_page_t* page = *slot;
+	*slot = page->hash_next;
+	page->hash_next = 0;
+	lru_unlink(page);
+
+	if (page->pins) {
+		page->stale = true;
+		return;
+	}
+	pagecache_free(page);
+}
+
+//evict up to @p count unpinned pages from the cold end of the LRU list
+static uint32_t pagecache_evict(uint32_t count) {
+	uint32_t freed = 0;
+	cached_page_t* victim = lru_tail;
+	while (victim && freed < count) {
+		cached_page_t* prev = victim->lru_prev;
+		if (!victim->pins) {
+			cached_page_t** slot = pagecache_find_slot(victim->dev, victim->inode, victim->index);
+			ASSERT(slot, "pagecache LRU entry wasn't hashed");
+			pagecache_release(slot);
+			freed++;
+		}
+		victim = prev;
+	}
+	return freed;
+}
+
+//read page @p index of @p node from its filesystem and insert it
+static cached_page_t* pagecache_fill(fs_node_t* node, uint32_t index) {
+	uint32_t offset = index * PAGE_SIZE;
+	if (offset >= node->length) {
+		return 0;
+	}
+
+	//allocate and read before touching any lists, as both may reclaim pages
+	uint32_t addr = vmm_alloc_kernel_page();
+	uint32_t want = MIN((uint32_t)PAGE_SIZE, node->length - offset);
+	uint32_t valid = read_fs_direct(node, offset, want, (uint8_t*)addr);
+	if (valid < want) {
+		vmm_free_kernel_page(addr);
+		return 0;
+	}
+	memset((uint8_t*)addr + valid, 0, PAGE_SIZE - valid);
+
+	if (!free_list) {
+		uint32_t evicted = pagecache_evict(1);
+		stat_evictions += evicted;
+		if (!evicted) {
+			//every page is pinned, so this one can't be cached
+			vmm_free_kernel_page(addr);
+			return 0;
+		}
+	}
+	cached_page_t* page = free_list;
+	free_list = page->hash_next;
+
+	page->dev = node->dev;
+	page->inode = node->inode;
+	page->index = index;
+	page->addr = addr;
+	page->frame = vmm_get_phys_for_virt(addr);
+	page->valid = valid;
+	page->pins = 0;
+	page->stale = false;
+
+	uint32_t bucket = pagecache_hash(page->dev, page->inode, page->index);
+	page->hash_next = buckets[bucket];
+	buckets[bucket] = page;
+	lru_push_front(page);
+	resident++;
+	return page;
+}
+
+static cached_page_t* pagecache_lookup(fs_node_t* node, uint32_t index) {
+	if (!pages) {
+		pagecache_init();
+	}
+
+	cached_page_t** slot = pagecache_find_slot(node->dev, node->inode, index);
+	if (slot) {
+		//bump to front of LRU
+		cached_page_t* page = *slot;
+		lru_unlink(page);
+		lru_push_front(page);
+		stat_hits++;
+		return page;
+	}
+	stat_misses++;
+	return pagecache_fill(node, index);
+}
+
+cached_page_t* pagecache_get(fs_node_t* node, uint32_t index) {
+	cached_page_t* page = pagecache_lookup(node, index);
+	if (page) {
+		page->pins++;
+	}
+	return page;
+}
+
+void pagecache_put(cached_page_t* page) {
+	ASSERT(page->pins, "pagecache_put() on unpinned page");
+	page->pins--;
+	if (!page->pins && page->stale) {
+		pagecache_free(page);
+	}
+}
+
+bool pagecache_put_frame(uint32_t frame) {
+	if (!pages) {
+		return false;
+	}
+	for (int i = 0; i < PAGECACHE_MAX_PAGES; i++) {
+		if (pages[i].addr && pages[i].frame == frame && pages[i].pins) {
+			pagecache_put(&pages[i]);
+			return true;
+		}
+	}
+	return false;
+}
+
+uint32_t pagecache_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+	if (offset >= node->length) {
+		return 0;
+	}
+	size = MIN(size, node->length - offset);
+
+	uint32_t copied = 0;
+	while (copied < size) {
+		uint32_t pos = offset + copied;
+		cached_page_t* page = pagecache_get(node, pos / PAGE_SIZE);
+		if (!page) {
+			//nothing could be cached, so fall back to reading the rest directly
+			return copied + read_fs_direct(node, pos, size - copied, buffer + copied);
+		}
+		uint32_t page_off = pos % PAGE_SIZE;
+		uint32_t chunk = MIN(size - copied, PAGE_SIZE - page_off);
+		//stay pinned while copying, in case touching buffer allocates memory
+		memcpy(buffer + copied, (uint8_t*)page->addr + page_off, chunk);
+		pagecache_put(page);
+		copied += chunk;
+	}
+
+	//keep the cache within its soft limit
+	if (resident > PAGECACHE_MAX_PAGES - PAGECACHE_MAX_PAGES / 8) {
+		stat_evictions += pagecache_evict(resident - (PAGECACHE_MAX_PAGES - PAGECACHE_MAX_PAGES / 8));
+	}
+	return copied;
+}
+
+void pagecache_invalidate(uint32_t dev, uint32_t inode, uint32_t offset, uint32_t size) {
+	if (!pages || !size) return;
+
+	uint32_t first = offset / PAGE_SIZE;
+	uint32_t last = (size > 0xFFFFFFFF - offset) ? 0xFFFFFFFF / PAGE_SIZE : (offset + size - 1) / PAGE_SIZE;
+	if (last - first < PAGECACHE_BUCKETS) {
+		for (uint32_t index = first; index <= last; index++) {
+			cached_page_t** slot = pagecache_find_slot(dev, inode, index);
+			if (slot) {
+				pagecache_release(slot);
+			}
+		}
+		return;
+	}
+
+	//large ranges, such as a whole file, are quicker to find by walking every chain
+	for (int i = 0; i < PAGECACHE_BUCKETS; i++) {
+		cached_page_t** slot = &buckets[i];
+		while (*slot) {
+			cached_page_t* page = *slot;
+			if (page->dev == dev && page->inode == inode && page->index >= first && page->index <= last) {
+				pagecache_release(slot);
+				continue;
+			}
+			slot = &page->hash_next;
+		}
+	}
+}
+
+void pagecache_purge_dev(uint32_t dev) {
+	if (!pages) return;
+
+	for (int i = 0; i < PAGECACHE_BUCKETS; i++) {
+		cached_page_t** slot = &buckets[i];
+		while (*slot) {
+			if ((*slot)->dev == dev) {
+				pagecache_release(slot);
+				continue;
+			}
+			slot = &(*slot)->hash_next;
+		}
+	}
+}
+
+uint32_t pagecache_reclaim(uint32_t count) {
+	if (!pages) return 0;
+
+	uint32_t freed = pagecache_evict(count);
+	stat_reclaimed += freed;
+	return freed;
+}
+
+void pagecache_print_stats(void) {
+	uint32_t lookups = stat_hits + stat_misses;
+	uint32_t percent = lookups ? (stat_hits * 100) / lookups : 0;
+	printf("pagecache: %d pages resident (%d kb), %d lookups, %d hits, %d misses (%d%% hit rate)\n", resident, resident * (PAGE_SIZE / 1024), lookups, stat_hits, stat_misses, percent);
+	printf("pagecache: %d evicted at the size limit, %d reclaimed for the PMM\n", stat_evictions, stat_reclaimed);
+}
@@ -0,0 +1,60 @@
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fs.h"
+
+//cache of file contents, one page at a time, keyed by (dev, inode, page index)
+//shared by every reader of a file, so a second launch of a program or a reload of
+//an image is served from memory rather than the initrd or disk
+//unpinned pages are reclaimed in LRU order, either past the soft limit below
+//or when the PMM runs out of frames
+
+//resident pages past which the least recently used unpinned page is evicted
+#define PAGECACHE_MAX_PAGES	1024
+#define PAGECACHE_BUCKETS	256
+
+typedef struct cached_page {
+	uint32_t dev;
+	uint32_t inode;
+	uint32_t index;		//page within the file
+	uint32_t addr;		//kernel virtual address of the contents
+	uint32_t frame;		//physical frame backing addr
+	uint32_t valid;		//bytes of the page lying within the file, the rest is zero
+	uint32_t pins;		//users which need the page to stay resident, such as mappings
+	bool stale;		//invalidated while pinned, freed once the last pin is dropped
+
+	struct cached_page* hash_next;
+	struct cached_page* lru_prev;
+	struct cached_page* lru_next;
+} cached_page_t;
+
+//copy up to @p size bytes of @p node from @p offset into @p buffer, filling the cache as needed
+//returns the number of bytes copied
+uint32_t pagecache_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer);
+
+//return page @p index of @p node, pinned so it can't be reclaimed
+//returns NULL if the page lies past the end of the file, or couldn't be read
+//every successful call must be balanced by pagecache_put()
+cached_page_t* pagecache_get(fs_node_t* node, uint32_t index);
+void pagecache_put(cached_page_t* page);
+//drop a pin on whichever cached page is backed by @p frame
+//returns false if @p frame doesn't belong to the cache
+bool pagecache_put_frame(uint32_t frame);
+
+//forget cached contents of [@p offset, @p offset + @p size) of file @p inode on filesystem @p dev
+//must be called whenever a filesystem modifies a file, or frees its blocks
+//pass a @p size of 0xFFFFFFFF to drop everything from @p offset onwards
+void pagecache_invalidate(uint32_t dev, uint32_t inode, uint32_t offset, uint32_t size);
+//forget every page belonging to filesystem @p dev
+void pagecache_purge_dev(uint32_t dev);
+
+//free up to @p count unpinned pages, least recently used first
+//returns the number of pages freed
+uint32_t pagecache_reclaim(uint32_t count);
+
+//print hit/miss counters and residency
+void pagecache_print_stats(void);
+
+#endif
@@ -0,0 +1,306 @@
+#include "vm_area.h"
+#include <std/std.h>
+#include <std/math.h>
+#include <std/kheap.h>
+#include <kernel/vmm/vmm.h>
+#include <kernel/util/paging/paging.h>
+#include <kernel/util/vfs/pagecache.h>
+#include <kernel/util/vfs/initrd.h>
+#include <kernel/multitasking/tasks/task.h>
+
+static uint32_t stat_faults = 0;
+static uint32_t stat_shared = 0;
+
+static vm_shared_page_t* shared_by_key[VM_SHARED_BUCKETS];
+static vm_shared_page_t* shared_by_frame[VM_SHARED_BUCKETS];
+static uint32_t shared_resident = 0;
+static uint32_t shared_mappings = 0;
+
+vm_area_t* vm_area_add(vm_area_t** list, uint32_t start, uint32_t end, uint32_t flags,
+                       fs_node_t* node, uint32_t file_start, uint32_t file_end, uint32_t offset) {
+    vm_area_t* area = kmalloc(sizeof(vm_area_t));
+    memset(area, 0, sizeof(vm_area_t));
+    area->start = start & PAGING_FRAME_MASK;
+    area->end = (end + PAGE_SIZE - 1) & PAGING_FRAME_MASK;
+    area->flags = flags;
+    if (node) {
+        area->file_backed = true;
+        memcpy(&area->node, node, sizeof(fs_node_t));
+    }
+    area->file_start = file_start;
+    area->file_end = file_end;
+    area->offset = offset;
+
+    //drop anything already mapped here, so the first access faults
+    //a list being put together on the side is cleared when it's swapped in instead
+    task_t* current = task_current();
+    if (current && list == &current->vm_areas) {
+        munmap((void*)area->start, area->end - area->start);
+    }
+
+    area->next = *list;
+    *list = area;
+    return area;
+}
+
+void vm_area_free_all(vm_area_t** list) {
+    vm_area_t* area = *list;
+    while (area) {
+        vm_area_t* next = area->next;
+        kfree(area);
+        area = next;
+    }
+    *list = NULL;
+}
+
+void vm_area_replace(vm_area_t** list, vm_area_t* areas) {
+    //munmap() drops shared frame references and page cache pins, and frees private pages
+    for (vm_area_t* area = *list; area; area = area->next) {
+        munmap((void*)area->start, area->end - area->start);
+    }
+    vm_area_free_all(list);
+    //pages mapped outside the old areas, such as by mmap(), mustn't hide the new ones
+    for (vm_area_t* area = areas; area; area = area->next) {
+        munmap((void*)area->start, area->end - area->start);
+    }
+    *list = areas;
+}
+
+vm_area_t* vm_area_clone(vm_area_t* list) {
+    vm_area_t* head = NULL;
+    vm_area_t** tail = &head;
+    for (vm_area_t* area = list; area; area = area->next) {
+        vm_area_t* copy = kmalloc(sizeof(vm_area_t));
+        memcpy(copy, area, sizeof(vm_area_t));
+        copy->next = NULL;
+        *tail = copy;
+        tail = &copy->next;
+    }
+    return head;
+}
+
+static bool vm_area_overlaps(vm_area_t* area, uint32_t page) {
+    return page < area->end && page + PAGE_SIZE > area->start;
+}
+
+static uint32_t vm_shared_key_hash(uint32_t dev, uint32_t inode, uint32_t addr) {
+    return ((dev * 16777619u) ^ (inode * 2654435761u) ^ (addr / PAGE_SIZE)) % VM_SHARED_BUCKETS;
+}
+
+static uint32_t vm_shared_frame_hash(uint32_t frame) {
+    return (frame / PAGE_SIZE) % VM_SHARED_BUCKETS;
+}
+
+static vm_shared_page_t* vm_shared_find(fs_node_t* node, uint32_t addr) {
+    vm_shared_page_t* sp = shared_by_key[vm_shared_key_hash(node->dev, node->inode, addr)];
+    for (; sp; sp = sp->key_next) {
+        //a rebuilt binary likely has a different length, so won't pick up stale pages
+        if (sp->dev == node->dev && sp->inode == node->inode && sp->addr == addr && sp->length == node->length) {
+            return sp;
+        }
+    }
+    return NULL;
+}
+
+static vm_shared_page_t* vm_shared_find_frame(uint32_t frame) {
+    vm_shared_page_t* sp = shared_by_frame[vm_shared_frame_hash(frame)];
+    for (; sp; sp = sp->frame_next) {
+        if (sp->frame == frame) {
+            return sp;
+        }
+    }
+    return NULL;
+}
+
+static void vm_shared_unlink(vm_shared_page_t** slot, vm_shared_page_t* sp, bool by_frame) {
+    while (*slot != sp) {
+        slot = by_frame ? &(*slot)->frame_next : &(*slot)->key_next;
+    }
+    *slot = by_frame ? sp->frame_next : sp->key_next;
+}
+
+static void vm_shared_release(vm_shared_page_t* sp) {
+    vm_shared_unlink(&shared_by_key[vm_shared_key_hash(sp->dev, sp->inode, sp->addr)], sp, false);
+    vm_shared_unlink(&shared_by_frame[vm_shared_frame_hash(sp->frame)], sp, true);
+    if (sp->cached) {
+        pagecache_put(sp->cached);
+    }
+    else if (sp->kernel_addr) {
+        vmm_free_kernel_page(sp->kernel_addr);
+    }
+    //initrd frames are part of the image, so there's nothing to free
+    kfree(sp);
+    shared_resident--;
+}
+
+//copy whatever file contents the areas of @p list place in @p page to @p dest, which is otherwise zeroed
+static void vm_area_fill(vm_area_t* list, uint32_t page, uint8_t* dest) {
+    memset(dest, 0, PAGE_SIZE);
+    for (vm_area_t* a = list; a; a = a->next) {
+        if (!a->file_backed || !vm_area_overlaps(a, page)) continue;
+
+        uint32_t copy_start = MAX(page, a->file_start);
+        uint32_t copy_end = MIN(page + PAGE_SIZE, a->file_end);
+        if (copy_start >= copy_end) continue;
+
+        uint32_t len = copy_end - copy_start;
+        if (read_fs(&a->node, a->offset + (copy_start - a->file_start), len, dest + (copy_start - page)) != len) {
+            printf_err("couldn't read %x from %s", copy_start, a->node.name);
+        }
+    }
+}
+
+//find the frame read-only @p page of @p area should map, shared by every process
+//mapping the same page of the same file. takes a reference, dropped by vm_area_put_frame()
+static uint32_t vm_area_shared_frame(vm_area_t* list, vm_area_t* area, int covering, uint32_t page) {
+    vm_shared_page_t* sp = vm_shared_find(&area->node, page);
+    if (sp) {
+        sp->refs++;
+        shared_mappings++;
+        stat_shared++;
+        return sp->frame;
+    }
+
+    sp = kmalloc(sizeof(vm_shared_page_t));
+    memset(sp, 0, sizeof(vm_shared_page_t));
+    sp->dev = area->node.dev;
+    sp->inode = area->node.inode;
+    sp->length = area->node.length;
+    sp->addr = page;
+
+    //whole file pages lining up with memory pages are used in place
+    bool aligned = (area->file_start % PAGE_SIZE) == (area->offset % PAGE_SIZE);
+    bool whole = page >= area->file_start && page + PAGE_SIZE <= area->file_end;
+    if (covering == 1 && aligned && whole) {
+        uint32_t index = (area->offset - (area->file_start - page)) / PAGE_SIZE;
+        sp->frame = initrd_page_frame(&area->node, index);
+        if (!sp->frame) {
+            sp->cached = pagecache_get(&area->node, index);
+            if (sp->cached) {
+                sp->frame = sp->cached->frame;
+            }
+        }
+    }
+    if (sp->frame) {
+        stat_shared++;
+    }
+    else {
+        //misaligned, or zero-filled past the end of the file, so the page is put together once
+        sp->kernel_addr = vmm_alloc_kernel_page();
+        vm_area_fill(list, page, (uint8_t*)sp->kernel_addr);
+        sp->frame = vmm_get_phys_for_virt(sp->kernel_addr);
+    }
+
+    sp->refs = 1;
+    uint32_t key = vm_shared_key_hash(sp->dev, sp->inode, sp->addr);
+    sp->key_next = shared_by_key[key];
+    shared_by_key[key] = sp;
+    uint32_t frame_key = vm_shared_frame_hash(sp->frame);
+    sp->frame_next = shared_by_frame[frame_key];
+    shared_by_frame[frame_key] = sp;
+    shared_resident++;
+    shared_mappings++;
+    return sp->frame;
+}
+
+bool vm_area_ref_frame(uint32_t frame) {
+    vm_shared_page_t* sp = vm_shared_find_frame(frame);
+    if (!sp) {
+        return false;
+    }
+    sp->refs++;
+    shared_mappings++;
+    return true;
+}
+
+bool vm_area_put_frame(uint32_t frame) {
+    vm_shared_page_t* sp = vm_shared_find_frame(frame);
+    if (!sp) {
+        return false;
+    }
+    shared_mappings--;
+    if (!--sp->refs) {
+        vm_shared_release(sp);
+    }
+    return true;
+}
+
+bool vm_area_fault(uint32_t addr, bool write) {
+    task_t* current = task_current();
+    if (!current || !current->vm_areas) {
+        return false;
+    }
+    uint32_t page = addr & PAGING_FRAME_MASK;
+
+    //a page can be shared by two areas, where one segment ends and the next begins
+    vm_area_t* area = NULL;
+    vm_area_t* file_area = NULL;
+    int covering = 0;
+    bool writable = false;
+    for (vm_area_t* a = current->vm_areas; a; a = a->next) {
+        if (!vm_area_overlaps(a, page)) continue;
+        area = a;
+        if (a->file_backed) file_area = a;
+        covering++;
+        writable |= (a->flags & VM_AREA_WRITE) != 0;
+    }
+    if (!area || (write && !writable)) {
+        return false;
+    }
+    stat_faults++;
+
+    //read-only file contents are the same in every process running the file
+    if (!writable && file_area) {
+        uint32_t frame = vm_area_shared_frame(current->vm_areas, file_area, covering, page);
+        vmm_map_virt_to_phys(vmm_active_pdir(), page, frame, PAGE_PRESENT_FLAG | PAGE_USER_FLAG);
+        return true;
+    }
+
+    vmm_map_virt(vmm_active_pdir(), page, PAGE_PRESENT_FLAG | PAGE_WRITE_FLAG | PAGE_USER_FLAG);
+    vm_area_fill(current->vm_areas, page, (uint8_t*)page);
+    return true;
+}
+
+bool vm_area_user_writable(uint32_t addr, uint32_t length) {
+    if (!length) {
+        return true;
+    }
+    if (addr + length < addr) {
+        return false;
+    }
+    task_t* current = task_current();
+    uint32_t first = addr & PAGING_FRAME_MASK;
+    uint32_t last = (addr + length - 1) & PAGING_FRAME_MASK;
+    for (uint32_t page = first; page >= first && page <= last; page += PAGE_SIZE) {
+        if (vmm_is_page_mapped(vmm_active_pdir(), page)) {
+            if (vmm_is_read_only_user_page(vmm_active_pdir(), page)) {
+                return false;
+            }
+            continue;
+        }
+        //an unpopulated page will be faulted in with its areas' permissions
+        bool covered = false;
+        bool writable = false;
+        for (vm_area_t* a = current ? current->vm_areas : NULL; a; a = a->next) {
+            if (!vm_area_overlaps(a, page)) continue;
+            covered = true;
+            writable |= (a->flags & VM_AREA_WRITE) != 0;
+        }
+        if (covered && !writable) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void vm_area_get_stats(vm_area_stats_t* stats) {
+    stats->faults = stat_faults;
+    stats->shared = stat_shared;
+    stats->resident = shared_resident;
+    stats->mappings = shared_mappings;
+}
+
+void vm_area_print_stats(void) {
+    printf("vm_area: %d pages populated on demand, %d without copying\n", stat_faults, stat_shared);
+    printf("vm_area: %d read-only file pages resident, mapped %d times\n", shared_resident, shared_mappings);
+}
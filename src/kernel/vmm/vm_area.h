@@ -0,0 +1,93 @@
+#ifndef VM_AREA_H
+#define VM_AREA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <kernel/util/vfs/fs.h>
+#include <kernel/util/vfs/pagecache.h>
+
+//ranges of a process's address space which are populated lazily, a page at a time,
+//by the page fault handler on first access
+//file-backed areas map read-only pages straight from the page cache or initrd,
+//and give writable pages a private copy. the rest of an area is zero-filled
+//stacks are zero-filled areas reserving their largest size, so only pages used are populated
+//read-only pages are shared by every process mapping the same page of the same file,
+//and reference counted so the frame is released along with its last mapping
+
+#define VM_AREA_WRITE   0x1 //pages are mapped writable
+
+typedef struct vm_area {
+    uint32_t start;         //page aligned
+    uint32_t end;           //page aligned, exclusive
+    uint32_t flags;
+    bool file_backed;
+    fs_node_t node;         //copy of the backing file's node, which may be freed by the dentry cache
+    uint32_t file_start;    //address holding the byte at offset in node
+    uint32_t file_end;      //bytes from here to end are zero
+    uint32_t offset;
+    struct vm_area* next;
+} vm_area_t;
+
+#define VM_SHARED_BUCKETS   64
+
+//read-only page of a file, shared between every process that maps it at the same address
+typedef struct vm_shared_page {
+    uint32_t dev;
+    uint32_t inode;
+    uint32_t length;        //of the file when the page was read, to tell rebuilt binaries apart
+    uint32_t addr;          //user virtual address
+    uint32_t frame;
+    uint32_t refs;          //mappings in every address space
+    cached_page_t* cached;  //page cache page pinned for the frame, if it came from there
+    uint32_t kernel_addr;   //kernel page the frame was assembled in, if it was copied together
+    struct vm_shared_page* key_next;
+    struct vm_shared_page* frame_next;
+} vm_shared_page_t;
+
+//add an area covering [@p start, @p end) to @p list, rounded out to whole pages
+//for file-backed areas, [@p file_start, @p file_end) holds the contents of @p node from @p offset
+//@p node is copied, so it needn't outlive the area
+//if @p list is the current task's, pages of the range which are already mapped are unmapped
+vm_area_t* vm_area_add(vm_area_t** list, uint32_t start, uint32_t end, uint32_t flags,
+                       fs_node_t* node, uint32_t file_start, uint32_t file_end, uint32_t offset);
+
+//forget every area in @p list. pages already populated stay mapped, and keep their frames
+//vm_area_replace() releases them too, but needs the list's address space to be active
+void vm_area_free_all(vm_area_t** list);
+
+//swap @p areas in for the current task's areas in @p list, such as when exec replaces its image
+//every page of the old areas is unmapped and its frame released, as is anything mapped in the new areas' ranges
+void vm_area_replace(vm_area_t** list, vm_area_t* areas);
+
+//copy @p list, for a forked child whose address space is a copy of its parent's
+vm_area_t* vm_area_clone(vm_area_t* list);
+
+//populate the page of the current task containing @p addr, after a not-present fault
+//returns false if @p addr isn't within any of its areas, or the access isn't allowed
+bool vm_area_fault(uint32_t addr, bool write);
+
+//take another reference on a shared read-only frame, such as when fork() copies a mapping
+//returns false if @p frame isn't one
+bool vm_area_ref_frame(uint32_t frame);
+//drop a reference taken by a fault or vm_area_ref_frame(), once its mapping is removed
+//returns false if @p frame isn't a shared read-only frame
+bool vm_area_put_frame(uint32_t frame);
+
+//whether the kernel may write @p length bytes at @p addr on the current task's behalf, such as a syscall's buffer
+//user pages that are read-only, or would be populated read-only, are refused: with write protection on,
+//a kernel write there faults rather than landing in a frame shared with the page cache or initrd
+bool vm_area_user_writable(uint32_t addr, uint32_t length);
+
+typedef struct vm_area_stats {
+    uint32_t faults;    //pages populated on demand
+    uint32_t shared;    //of those, pages mapped straight from a cached file page rather than copied
+    uint32_t resident;  //read-only file pages currently resident
+    uint32_t mappings;  //how many times they're mapped
+} vm_area_stats_t;
+
+void vm_area_get_stats(vm_area_stats_t* stats);
+
+//print pages populated by faults, and how many of them came straight from cached file pages
+void vm_area_print_stats(void);
+
+#endif
@@ -8,6 +8,7 @@
 #include <kernel/multitasking//tasks/task.h>
 #include <kernel/boot_info.h>
 #include <kernel/address_space.h>
+#include "vm_area.h"
 
 #define PAGES_IN_PAGE_TABLE 1024
 #define PAGE_TABLES_IN_PAGE_DIR 1024
@@ -39,6 +40,9 @@ void set_cr3(uint32_t addr) {
 	asm volatile("mov %0, %%cr3" : : "r"(addr));
 	int cr0 = get_cr0();
 	cr0 |= 0x80000000; //enable paging bit
+	//read-only pages bind the kernel too, so it can't write through a process's
+	//mapping of a frame shared with the page cache, initrd, or other processes
+	cr0 |= 0x10000; //write protect bit
 	set_cr0(cr0);
 }
 
@@ -73,7 +77,8 @@ void vmm_init(void) {
 	kernel_directory.physicalAddr = (uint32_t)&kernel_directory.tablesPhysical;
 
     //identity-map everything up to the kernel image end, plus a little extra space
-    vmm_identity_map_region((vmm_pdir_t*)&kernel_directory, 0x0, info->kernel_image_end, PAGE_PRESENT_FLAG);
+    //writable, as the kernel's data lives here and write protection is on once paging is
+    vmm_identity_map_region((vmm_pdir_t*)&kernel_directory, 0x0, info->kernel_image_end, PAGE_PRESENT_FLAG|PAGE_WRITE_FLAG);
     //the extra space is to allow the PMM to allocate a few frames before paging is enabled
     //we reserve 1mb
     //NOTE: this variable is defined both here and in pmm.c
@@ -130,6 +135,11 @@ static void page_fault(const register_state_t* regs) {
 	int reserved = regs->err_code & 0x8; //overwritten CPU-reserved bits of page entry?
 	int id = regs->err_code & 0x10; //caused by instruction fetch?
 
+	//lazily populated user memory, such as demand-paged ELF segments and stacks
+	if (present && vm_area_fault(faulting_address, rw)) {
+		return;
+	}
+
 	//if this page was present, attempt to recover by allocating the page
 	if (present) {
 		//bool attempt = alloc_frame(get_page(faulting_address, 1, current_directory), 1, 1);
@@ -374,3 +384,177 @@ void vmm_identity_map_region(vmm_pdir_t* dir, uint32_t start, uint32_t size, uin
         vmm_map_virt_to_phys(dir, page_addr, frame_addr, flags);
     }
 }
+
+bool vmm_is_page_mapped(vmm_pdir_t* dir, uint32_t page_addr) {
+    if (dir != vmm_active_pdir()) {
+        panic("vmm_is_page_mapped() only supports the active pdir");
+    }
+    unsigned long pdindex = (unsigned long)page_addr >> 22;
+    unsigned long ptindex = (unsigned long)page_addr >> 12 & 0x03FF;
+
+    unsigned long * pd = (unsigned long *)0xFFFFF000;
+    if (!(pd[pdindex])) {
+        return false;
+    }
+    unsigned long * pt = ((unsigned long *)0xFFC00000) + (0x400 * pdindex);
+    return pt[ptindex] != 0;
+}
+
+bool vmm_is_user_page(vmm_pdir_t* dir, uint32_t page_addr) {
+    if (dir != vmm_active_pdir()) {
+        panic("vmm_is_user_page() only supports the active pdir");
+    }
+    unsigned long pdindex = (unsigned long)page_addr >> 22;
+    unsigned long ptindex = (unsigned long)page_addr >> 12 & 0x03FF;
+
+    unsigned long * pd = (unsigned long *)0xFFFFF000;
+    if (!(pd[pdindex])) {
+        return false;
+    }
+    unsigned long * pt = ((unsigned long *)0xFFC00000) + (0x400 * pdindex);
+    return (pt[ptindex] & (PAGE_PRESENT_FLAG|PAGE_USER_FLAG)) == (PAGE_PRESENT_FLAG|PAGE_USER_FLAG);
+}
+
+bool vmm_is_read_only_user_page(vmm_pdir_t* dir, uint32_t page_addr) {
+    if (!vmm_is_user_page(dir, page_addr)) {
+        return false;
+    }
+    unsigned long * pt = ((unsigned long *)0xFFC00000) + (0x400 * (page_addr >> 22));
+    return !(pt[page_addr >> 12 & 0x03FF] & PAGE_WRITE_FLAG);
+}
+
+uint32_t vmm_unmap_page(vmm_pdir_t* dir, uint32_t page_addr) {
+    if (dir != vmm_active_pdir()) {
+        panic("vmm_unmap_page() only supports the active pdir");
+    }
+    if (page_addr & ~PAGING_FRAME_MASK) {
+        panic("vmm_unmap_page() address not page aligned!");
+    }
+
+    unsigned long pdindex = (unsigned long)page_addr >> 22;
+    unsigned long ptindex = (unsigned long)page_addr >> 12 & 0x03FF;
+
+    unsigned long * pd = (unsigned long *)0xFFFFF000;
+    if (!(pd[pdindex])) {
+        panic("vmm_unmap_page() no pd entry");
+    }
+    unsigned long * pt = ((unsigned long *)0xFFC00000) + (0x400 * pdindex);
+    if (!(pt[ptindex])) {
+        panic("vmm_unmap_page() page wasn't mapped");
+    }
+
+    uint32_t frame_addr = pt[ptindex] & PAGING_FRAME_MASK;
+    pt[ptindex] = 0;
+    invlpg((void*)page_addr);
+    return frame_addr;
+}
+
+//one bit per page in the kernel page pool, set if the page is handed out
+static uint32_t kernel_page_pool[VMM_KERNEL_PAGE_POOL_SIZE / PAGING_PAGE_SIZE / 32] = {0};
+static uint32_t kernel_page_pool_hint = 0;
+
+uint32_t vmm_alloc_kernel_page(void) {
+    uint32_t word_count = sizeof(kernel_page_pool) / sizeof(kernel_page_pool[0]);
+    for (uint32_t n = 0; n < word_count; n++) {
+        uint32_t i = (kernel_page_pool_hint + n) % word_count;
+        //all pages tracked by this word in use?
+        if (!(~kernel_page_pool[i])) {
+            continue;
+        }
+        for (uint32_t j = 0; j < 32; j++) {
+            if (kernel_page_pool[i] & (1 << j)) {
+                continue;
+            }
+            kernel_page_pool[i] |= (1 << j);
+            kernel_page_pool_hint = i;
+
+            uint32_t page_addr = VMM_KERNEL_PAGE_POOL_START + ((i * 32) + j) * PAGING_PAGE_SIZE;
+            vmm_map_virt(vmm_active_pdir(), page_addr, PAGE_PRESENT_FLAG|PAGE_WRITE_FLAG);
+            return page_addr;
+        }
+    }
+    panic("kernel page pool exhausted");
+    return 0;
+}
+
+//reserve @p count consecutive pages of the kernel page pool, and return the index of the first
+static uint32_t kernel_page_pool_reserve_run(uint32_t count) {
+    uint32_t page_count = VMM_KERNEL_PAGE_POOL_SIZE / PAGING_PAGE_SIZE;
+    uint32_t run = 0;
+    for (uint32_t idx = 0; idx < page_count; idx++) {
+        if (kernel_page_pool[idx / 32] & (1 << (idx % 32))) {
+            run = 0;
+            continue;
+        }
+        if (++run < count) {
+            continue;
+        }
+        //found a long enough run of free pages ending at idx
+        uint32_t first = idx + 1 - count;
+        for (uint32_t i = first; i <= idx; i++) {
+            kernel_page_pool[i / 32] |= (1 << (i % 32));
+        }
+        return first;
+    }
+    panic("kernel page pool has no run of free pages long enough");
+    return 0;
+}
+
+uint32_t vmm_alloc_kernel_pages(uint32_t count) {
+    uint32_t first = kernel_page_pool_reserve_run(count);
+    for (uint32_t i = first; i < first + count; i++) {
+        vmm_map_virt(vmm_active_pdir(), VMM_KERNEL_PAGE_POOL_START + i * PAGING_PAGE_SIZE, PAGE_PRESENT_FLAG|PAGE_WRITE_FLAG);
+    }
+    return VMM_KERNEL_PAGE_POOL_START + first * PAGING_PAGE_SIZE;
+}
+
+uint32_t vmm_alloc_kernel_pages_contiguous(uint32_t count, uint32_t* phys) {
+    uint32_t frame = pmm_alloc_contiguous(count);
+    if (!frame) {
+        return 0;
+    }
+    uint32_t first = kernel_page_pool_reserve_run(count);
+    for (uint32_t i = 0; i < count; i++) {
+        vmm_map_virt_to_phys(vmm_active_pdir(), VMM_KERNEL_PAGE_POOL_START + (first + i) * PAGING_PAGE_SIZE, frame + i * PAGING_FRAME_SIZE, PAGE_PRESENT_FLAG|PAGE_WRITE_FLAG);
+    }
+    if (phys) {
+        *phys = frame;
+    }
+    return VMM_KERNEL_PAGE_POOL_START + first * PAGING_PAGE_SIZE;
+}
+
+//map [@p phys, @p phys + @p size) into the kernel page pool with @p flags, without the PMM's involvement
+static uint32_t vmm_map_kernel_phys_range(uint32_t phys, uint32_t size, uint16_t flags) {
+    uint32_t base = phys & ~(PAGING_PAGE_SIZE - 1);
+    uint32_t count = (phys + size - base + PAGING_PAGE_SIZE - 1) / PAGING_PAGE_SIZE;
+    uint32_t first = kernel_page_pool_reserve_run(count);
+    for (uint32_t i = 0; i < count; i++) {
+        _active_vmm_map_virt_to_phys(vmm_active_pdir(), VMM_KERNEL_PAGE_POOL_START + (first + i) * PAGING_PAGE_SIZE, base + i * PAGING_PAGE_SIZE, flags);
+    }
+    return VMM_KERNEL_PAGE_POOL_START + first * PAGING_PAGE_SIZE + (phys - base);
+}
+
+uint32_t vmm_map_kernel_mmio(uint32_t phys, uint32_t size) {
+    //device memory isn't RAM, so leave the PMM out of it
+    return vmm_map_kernel_phys_range(phys, size, PAGE_PRESENT_FLAG|PAGE_WRITE_FLAG|PAGE_CACHE_DISABLE_FLAG);
+}
+
+uint32_t vmm_map_kernel_ram(uint32_t phys, uint32_t size) {
+    //the PMM has already reserved the range for whoever owns it
+    return vmm_map_kernel_phys_range(phys, size, PAGE_PRESENT_FLAG|PAGE_WRITE_FLAG);
+}
+
+void vmm_free_kernel_pages(uint32_t page_addr, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        vmm_free_kernel_page(page_addr + i * PAGING_PAGE_SIZE);
+    }
+}
+
+void vmm_free_kernel_page(uint32_t page_addr) {
+    if (page_addr < VMM_KERNEL_PAGE_POOL_START || page_addr >= VMM_KERNEL_PAGE_POOL_START + VMM_KERNEL_PAGE_POOL_SIZE) {
+        panic("vmm_free_kernel_page() called on page outside pool");
+    }
+    uint32_t idx = (page_addr - VMM_KERNEL_PAGE_POOL_START) / PAGING_PAGE_SIZE;
+    kernel_page_pool[idx / 32] &= ~(1 << (idx % 32));
+    pmm_free(vmm_unmap_page(vmm_active_pdir(), page_addr));
+}
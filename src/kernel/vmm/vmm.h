@@ -13,6 +13,7 @@
 #define PAGE_PRESENT_FLAG 0x1
 #define PAGE_WRITE_FLAG 0x2
 #define PAGE_USER_FLAG 0x4
+#define PAGE_CACHE_DISABLE_FLAG 0x10
 
 typedef struct page {
 	uint32_t present	:  1; //page present in memory
@@ -144,5 +145,40 @@ vmm_pdir_t* vmm_active_pdir();
 uint32_t vmm_get_phys_for_virt(uint32_t virtualaddr);
 void vmm_map_virt_to_phys(vmm_pdir_t* dir, uint32_t page_addr, uint32_t frame_addr, uint16_t flags);
 void vmm_map_virt(vmm_pdir_t* dir, uint32_t page_addr, uint16_t flags);
+//whether page_addr is mapped in dir, which must be the active pdir
+bool vmm_is_page_mapped(vmm_pdir_t* dir, uint32_t page_addr);
+//whether page_addr is mapped in dir, which must be the active pdir, and accessible from user mode
+bool vmm_is_user_page(vmm_pdir_t* dir, uint32_t page_addr);
+//whether page_addr is a user page of dir, which must be the active pdir, that's mapped read-only
+bool vmm_is_read_only_user_page(vmm_pdir_t* dir, uint32_t page_addr);
+//remove the mapping for page_addr and return the frame it pointed to
+//the frame is not freed
+uint32_t vmm_unmap_page(vmm_pdir_t* dir, uint32_t page_addr);
+
+//the kernel heap and everything above it belong to the kernel, in every address space
+#define VMM_USER_SPACE_END  0xC0000000
+
+//window of kernel virtual memory handed out a page at a time,
+//for caches which would otherwise exhaust the kernel heap
+#define VMM_KERNEL_PAGE_POOL_START  0xE0000000
+#define VMM_KERNEL_PAGE_POOL_SIZE   0x10000000
+
+//map a fresh frame somewhere in the kernel page pool
+uint32_t vmm_alloc_kernel_page(void);
+//unmap a page from vmm_alloc_kernel_page() and free its frame
+void vmm_free_kernel_page(uint32_t page_addr);
+//map @p count fresh frames at consecutive addresses in the kernel page pool
+uint32_t vmm_alloc_kernel_pages(uint32_t count);
+//like vmm_alloc_kernel_pages(), but backed by physically contiguous frames, for devices doing DMA
+//the physical address of the first page is stored in @p phys
+//returns 0 if no long enough run of frames is free
+uint32_t vmm_alloc_kernel_pages_contiguous(uint32_t count, uint32_t* phys);
+//unmap and free a range from vmm_alloc_kernel_pages() or vmm_alloc_kernel_pages_contiguous()
+void vmm_free_kernel_pages(uint32_t page_addr, uint32_t count);
+//map @p size bytes of device registers at physical address @p phys into the kernel page pool, uncached
+//returns the virtual address of @p phys. the mapping lasts forever, and mustn't be freed
+uint32_t vmm_map_kernel_mmio(uint32_t phys, uint32_t size);
+//like vmm_map_kernel_mmio(), but cached, for RAM reserved at boot such as the kernel's symbol table
+uint32_t vmm_map_kernel_ram(uint32_t phys, uint32_t size);
 
 #endif
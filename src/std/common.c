@@ -65,3 +65,9 @@ char interrupts_enabled(void) {
 void cpuid(int code, uint32_t* a, uint32_t* d) {
 	asm volatile("cpuid" : "=a"(*a), "=d"(*d) : "0"(code) : "ebx", "ecx");
 }
+
+uint64_t rdtsc(void) {
+	uint32_t lo, hi;
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
@@ -55,6 +55,9 @@ STDAPI char interrupts_enabled(void);
 //requests CPUID
 STDAPI void cpuid(int code, uint32_t* a, uint32_t* d);
 
+//read the CPU timestamp counter
+STDAPI uint64_t rdtsc(void);
+
 //invalidate TLB entry associated with virtual address @p m
 void invlpg(void* m);
 
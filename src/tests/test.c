@@ -4,6 +4,22 @@
 #include <kernel/drivers/vesa/vesa.h>
 #include <kernel/drivers/rtc/clock.h>
 #include <crypto/crypto.h>
+#include <kernel/util/vfs/dcache.h>
+#include <kernel/util/vfs/pagecache.h>
+#include <kernel/util/vfs/initrd.h>
+#include <kernel/util/lz4/lz4.h>
+#include <kernel/drivers/ide/ide.h>
+#include <kernel/drivers/virtio/virtio_blk.h>
+#include <kernel/drivers/ahci/ahci.h>
+#include <std/math.h>
+#include <kernel/multitasking/tasks/task_small.h>
+#include <kernel/util/blkq/blkq.h>
+#include <kernel/util/bcache/bcache.h>
+#include <kernel/util/fat/fat.h>
+#include <kernel/util/tmpfs/tmpfs.h>
+#include <kernel/util/unistd/exec.h>
+#include <kernel/syscall/sysfuncs.h>
+#include <kernel/vmm/vm_area.h>
 
 void test_colors() {
 	printf("\e[1;@");
@@ -117,3 +133,623 @@ void test_crypto() {
 	printf_info("Testing AES...");
 	printf_info("AES test %s", aes_test() ? "passed":"failed");
 }
+
+void test_dcache() {
+	printf_info("Testing dentry cache...");
+
+	//use a device id no real filesystem will be assigned
+	uint32_t dev = 0xdcac4e;
+	fs_node_t* node = kmalloc(sizeof(fs_node_t));
+	memset(node, 0, sizeof(fs_node_t));
+
+	fs_node_t* found = NULL;
+	if (dcache_lookup(dev, 1, "file", &found) != DCACHE_MISS) {
+		printf_err("dcache test failed, expected miss on empty cache");
+		return;
+	}
+
+	dcache_insert(dev, 1, "file", node, true);
+	dcache_insert(dev, 1, "missing", NULL, false);
+	if (dcache_lookup(dev, 1, "file", &found) != DCACHE_HIT || found != node) {
+		printf_err("dcache test failed, expected hit for cached node");
+		return;
+	}
+	//same name in another directory must not collide
+	if (dcache_lookup(dev, 2, "file", &found) != DCACHE_MISS) {
+		printf_err("dcache test failed, entries leaked across directories");
+		return;
+	}
+	if (dcache_lookup(dev, 1, "missing", &found) != DCACHE_NEGATIVE) {
+		printf_err("dcache test failed, expected negative entry");
+		return;
+	}
+
+	dcache_invalidate(dev, 1, "missing");
+	if (dcache_lookup(dev, 1, "missing", &found) != DCACHE_MISS) {
+		printf_err("dcache test failed, invalidated entry still present");
+		return;
+	}
+
+	//node is owned by the cache and is freed here
+	dcache_purge_dev(dev);
+	if (dcache_lookup(dev, 1, "file", &found) != DCACHE_MISS) {
+		printf_err("dcache test failed, purge left entries behind");
+		return;
+	}
+	printf_info("dcache test passed");
+}
+
+void test_lz4() {
+	printf_info("Testing LZ4...");
+
+	//"abcd" as literals, then a 12-byte overlapping match at offset 4, then 5 trailing literals
+	const uint8_t block[] = {0x48, 'a', 'b', 'c', 'd', 0x04, 0x00, 0x50, 'x', 'y', 'z', 'w', 'v'};
+	const char* expected = "abcdabcdabcdabcdxyzwv";
+	char out[32];
+	memset(out, 0, sizeof(out));
+
+	int written = lz4_decompress_block(block, sizeof(block), (uint8_t*)out, sizeof(out));
+	if (written != (int)strlen(expected) || strcmp(out, expected)) {
+		printf_err("LZ4 test failed, got %d bytes: %s", written, out);
+		return;
+	}
+	//must refuse to write past the end of the output buffer
+	if (lz4_decompress_block(block, sizeof(block), (uint8_t*)out, 8) != -1) {
+		printf_err("LZ4 test failed, overflowed output buffer");
+		return;
+	}
+	printf_info("LZ4 test passed");
+}
+
+//benchmark of cold vs. warm reads of every file in the initrd root
+//with a compressed initrd, the cold read includes decompressing each page
+void test_initrd_read_latency() {
+	printf_info("Benchmarking initrd reads...");
+
+	uint8_t* buf = kmalloc(PAGE_SIZE);
+	uint64_t cold_total = 0;
+	uint64_t warm_total = 0;
+	uint32_t bytes_total = 0;
+
+	struct dirent* ent;
+	for (int i = 0; (ent = readdir_fs(fs_root, i)) != 0; i++) {
+		fs_node_t* node = finddir_fs(fs_root, ent->d_name);
+		if (!node || (node->flags & 0x7) != FS_FILE) continue;
+
+		uint64_t pass[2];
+		for (int p = 0; p < 2; p++) {
+			uint64_t start = rdtsc();
+			for (uint32_t off = 0; off < node->length; off += PAGE_SIZE) {
+				read_fs(node, off, MIN(PAGE_SIZE, node->length - off), buf);
+			}
+			pass[p] = rdtsc() - start;
+		}
+		printf_dbg("%s: %d bytes, first read %d kcycles, second %d kcycles", node->name, node->length, (uint32_t)(pass[0] / 1000), (uint32_t)(pass[1] / 1000));
+		cold_total += pass[0];
+		warm_total += pass[1];
+		bytes_total += node->length;
+	}
+	kfree(buf);
+
+	printf_info("initrd: %d bytes, first read %d kcycles, second read %d kcycles", bytes_total, (uint32_t)(cold_total / 1000), (uint32_t)(warm_total / 1000));
+	initrd_print_stats();
+}
+
+//read @p total_sects sectors from the start of @p drive, @p per_command at a time
+//returns false on a read error
+static bool ide_benchmark_pass(const char* label, unsigned char drive, uint32_t total_sects, uint32_t per_command, uint8_t* buf) {
+	uint64_t idle_start = ide_dma_idle_cycles();
+	uint32_t start = time();
+	uint64_t tsc_start = rdtsc();
+	for (uint32_t i = 0; i < total_sects; i += per_command) {
+		if (ide_ata_read_sectors(drive, i, per_command, buf)) {
+			printf_err("IDE benchmark failed reading sector %d", i);
+			return false;
+		}
+	}
+	uint32_t ms = time() - start;
+	uint64_t cycles = rdtsc() - tsc_start;
+	//cycles spent halted waiting on DMA weren't spent by the CPU moving data
+	uint64_t busy = cycles - (ide_dma_idle_cycles() - idle_start);
+
+	uint32_t kb = total_sects / 2;
+	printf_info("%s: %dKB in %dms, %dKB/s, %d busy kcycles per MB", label, kb, ms, ms ? (kb * 1000) / ms : 0, (uint32_t)((busy / 1000) * 1024 / kb));
+	return true;
+}
+
+//sequential read benchmark comparing one sector per command, multi-sector PIO, and bus-master DMA
+void test_ide_read_throughput(unsigned char drive) {
+	printf_info("Benchmarking IDE sequential reads...");
+
+	//1MB per pass
+	const uint32_t total_sects = 2048;
+	uint8_t* buf = kmalloc(IDE_MAX_SECTORS_PER_COMMAND * 512);
+
+	ide_dma_set_enabled(false);
+	if (ide_benchmark_pass("single-sector PIO", drive, total_sects, 1, buf) &&
+		ide_benchmark_pass("multi-sector PIO ", drive, total_sects, IDE_MAX_SECTORS_PER_COMMAND, buf)) {
+		ide_dma_set_enabled(true);
+		ide_benchmark_pass("bus-master DMA   ", drive, total_sects, IDE_MAX_SECTORS_PER_COMMAND, buf);
+	}
+	ide_dma_set_enabled(true);
+	kfree(buf);
+}
+
+#define FPS_FRAME_PAGES	300	//640x480 at 32bpp
+#define FPS_BASELINE_MS	2000
+#define FPS_COPY_SECTS	16384	//8MB
+
+static volatile bool fps_copy_done = false;
+static unsigned char fps_copy_drive = 0;
+
+//stands in for a large file copy: read a disk region and copy it out a page at a time
+static void fps_copy_task() {
+	uint8_t* chunk = kmalloc(IDE_MAX_SECTORS_PER_COMMAND * 512);
+	uint32_t dst = vmm_alloc_kernel_page();
+	for (uint32_t i = 0; i < FPS_COPY_SECTS; i += IDE_MAX_SECTORS_PER_COMMAND) {
+		if (ide_ata_read_sectors(fps_copy_drive, i, IDE_MAX_SECTORS_PER_COMMAND, chunk)) {
+			printf_err("Copy failed reading sector %d", i);
+			break;
+		}
+		for (uint32_t off = 0; off < IDE_MAX_SECTORS_PER_COMMAND * 512; off += PAGE_SIZE) {
+			memcpy((void*)dst, chunk + off, PAGE_SIZE);
+		}
+	}
+	vmm_free_kernel_page(dst);
+	kfree(chunk);
+
+	fps_copy_done = true;
+	//never scheduled again, and freed by task_reap()
+	asm volatile("cli");
+	task_block(ZOMBIE);
+}
+
+//redraw a full offscreen frame until @p ms pass or @p done is set, and return the frame rate
+static uint32_t fps_render_frames(uint32_t* frame_pages, uint32_t ms, volatile bool* done) {
+	uint32_t frames = 0;
+	uint32_t start = time();
+	while (time() - start < ms && !(done && *done)) {
+		for (int i = 0; i < FPS_FRAME_PAGES; i++) {
+			memset((void*)frame_pages[i], frames & 0xFF, PAGE_SIZE);
+		}
+		frames++;
+	}
+	uint32_t elapsed = time() - start;
+	return elapsed ? (frames * 1000) / elapsed : 0;
+}
+
+//compositor frame rate on its own, then while another task copies a large region of @p drive
+//disk waits sleep on the channel's IRQ, so the copy should barely dent the frame rate
+void test_ide_compositor_fps(unsigned char drive) {
+	if (!tasking_is_active()) {
+		printf_err("Compositor benchmark needs tasking");
+		return;
+	}
+	printf_info("Measuring compositor frame rate during disk I/O...");
+
+	uint32_t* frame_pages = kmalloc(sizeof(uint32_t) * FPS_FRAME_PAGES);
+	for (int i = 0; i < FPS_FRAME_PAGES; i++) {
+		frame_pages[i] = vmm_alloc_kernel_page();
+	}
+
+	uint32_t idle_fps = fps_render_frames(frame_pages, FPS_BASELINE_MS, NULL);
+
+	fps_copy_drive = drive;
+	fps_copy_done = false;
+	uint32_t copy_start = time();
+	task_small_t* copier = task_construct((uint32_t)&fps_copy_task);
+	uint32_t copy_fps = fps_render_frames(frame_pages, -1, &fps_copy_done);
+	uint32_t copy_ms = time() - copy_start;
+	task_reap(copier);
+
+	printf_info("compositor: %d fps idle, %d fps during %dKB copy (%dms), %d%% of idle", idle_fps, copy_fps, FPS_COPY_SECTS / 2, copy_ms, idle_fps ? (copy_fps * 100) / idle_fps : 0);
+
+	for (int i = 0; i < FPS_FRAME_PAGES; i++) {
+		vmm_free_kernel_page(frame_pages[i]);
+	}
+	kfree(frame_pages);
+}
+
+#define BLKQ_TEST_SECTS 64
+
+//submit single-sector reads out of order and check the elevator sorts and merges them
+//into a few large transfers, without mixing up whose data is whose
+void test_blkq_elevator(unsigned char drive) {
+	printf_info("Testing block request queue...");
+
+	uint8_t* expected = kmalloc(BLKQ_TEST_SECTS * BLKQ_SECTOR_SIZE);
+	uint8_t* actual = kmalloc(BLKQ_TEST_SECTS * BLKQ_SECTOR_SIZE);
+	blk_request_t* requests = kmalloc(sizeof(blk_request_t) * BLKQ_TEST_SECTS);
+	memset(actual, 0, BLKQ_TEST_SECTS * BLKQ_SECTOR_SIZE);
+	memset(requests, 0, sizeof(blk_request_t) * BLKQ_TEST_SECTS);
+
+	if (ide_ata_read_sectors(drive, 0, BLKQ_TEST_SECTS, expected)) {
+		printf_err("blkq test couldn't read drive %d", drive);
+		goto out;
+	}
+
+	//37 is coprime to 64, so this visits every sector once in a scrambled order
+	for (int i = 0; i < BLKQ_TEST_SECTS; i++) {
+		uint32_t lba = (i * 37) % BLKQ_TEST_SECTS;
+		requests[i].drive = drive;
+		requests[i].direction = BLKQ_READ;
+		requests[i].lba = lba;
+		requests[i].count = 1;
+		requests[i].buf = actual + (lba * BLKQ_SECTOR_SIZE);
+		blkq_submit(&requests[i]);
+	}
+	for (int i = 0; i < BLKQ_TEST_SECTS; i++) {
+		if (blkq_wait(&requests[i])) {
+			printf_err("blkq request for sector %d failed", requests[i].lba);
+			goto out;
+		}
+	}
+
+	if (memcmp(expected, actual, BLKQ_TEST_SECTS * BLKQ_SECTOR_SIZE)) {
+		printf_err("blkq reads returned the wrong data");
+	}
+	else {
+		printf_info("blkq reads match direct reads");
+	}
+	blkq_print_stats();
+
+out:
+	kfree(requests);
+	kfree(actual);
+	kfree(expected);
+}
+
+//stream @p path from a cold cache in 4kb reads, returning throughput in KB/s
+static uint32_t fat_stream_pass(char* path, uint8_t* buf, uint32_t* bytes) {
+	bcache_invalidate();
+	FILE* stream = fat_fopen(path, "r");
+	if (!stream) {
+		return 0;
+	}
+
+	uint32_t start = time();
+	uint32_t total = 0;
+	size_t read_count;
+	while ((read_count = fat_fread(buf, 1, PAGE_SIZE, stream)) > 0) {
+		total += read_count;
+	}
+	uint32_t ms = time() - start;
+	fclose(stream);
+
+	*bytes = total;
+	return ms ? ((total / 1024) * 1000) / ms : 0;
+}
+
+//sequential read throughput of a FAT file, without and then with readahead
+void test_fat_readahead(char* path) {
+	printf_info("Benchmarking FAT streaming reads of %s...", path);
+	uint8_t* buf = kmalloc(PAGE_SIZE);
+	uint32_t bytes = 0;
+
+	fat_set_readahead(false);
+	uint32_t without = fat_stream_pass(path, buf, &bytes);
+	fat_set_readahead(true);
+	uint32_t with = fat_stream_pass(path, buf, &bytes);
+
+	printf_info("%d bytes: %dKB/s without readahead, %dKB/s with", bytes, without, with);
+	bcache_print_stats();
+	kfree(buf);
+}
+
+//read @p path end to end through the VFS, returning the cycles taken and a checksum of its contents
+static uint64_t pagecache_read_pass(char* path, uint8_t* buf, uint32_t* checksum) {
+	FILE* stream = fopen(path, "r");
+	if (!stream) {
+		return 0;
+	}
+
+	uint64_t start = rdtsc();
+	uint32_t sum = 0;
+	size_t read_count;
+	while ((read_count = fread(buf, 1, PAGE_SIZE, stream)) > 0) {
+		for (uint32_t i = 0; i < read_count; i++) {
+			sum = (sum * 31) + buf[i];
+		}
+	}
+	uint64_t cycles = rdtsc() - start;
+	fclose(stream);
+
+	*checksum = sum;
+	return cycles;
+}
+
+//a second read of a file, as when relaunching a program, should be served by the page cache
+void test_pagecache(char* path) {
+	printf_info("Benchmarking page cache reads of %s...", path);
+	uint8_t* buf = kmalloc(PAGE_SIZE);
+
+	//start cold, in case something read this file already
+	fs_node_t* node = fs_lookup(path);
+	if (!node) {
+		printf_err("%s not found", path);
+		kfree(buf);
+		return;
+	}
+	pagecache_invalidate(node->dev, node->inode, 0, 0xFFFFFFFF);
+
+	uint32_t cold_sum = 0;
+	uint32_t warm_sum = 0;
+	uint64_t cold = pagecache_read_pass(path, buf, &cold_sum);
+	uint64_t warm = pagecache_read_pass(path, buf, &warm_sum);
+	ASSERT(cold_sum == warm_sum, "page cache returned different contents for %s", path);
+
+	printf_info("%d bytes: first read %d kcycles, second read %d kcycles", node->length, (uint32_t)(cold / 1000), (uint32_t)(warm / 1000));
+	pagecache_print_stats();
+	kfree(buf);
+}
+
+//list @p path through getdents_fs(), reporting how many calls the listing took
+void test_getdents(char* path) {
+	fs_node_t* dir = fs_lookup(path);
+	if (!dir) {
+		printf_err("%s not found", path);
+		return;
+	}
+
+	uint8_t* buf = kmalloc(PAGE_SIZE);
+	uint32_t pos = 0;
+	uint32_t calls = 0;
+	uint32_t entries = 0;
+	uint32_t used;
+	uint64_t start = rdtsc();
+	do {
+		used = getdents_fs(dir, &pos, (struct dirent*)buf, PAGE_SIZE);
+		calls++;
+		for (uint32_t off = 0; off < used; off += ((struct dirent*)(buf + off))->d_reclen) {
+			entries++;
+		}
+	} while (used);
+	uint64_t cycles = rdtsc() - start;
+	kfree(buf);
+
+	printf_info("%s: %d entries in %d calls, %d kcycles", path, entries, calls, (uint32_t)(cycles / 1000));
+}
+
+#define SCRATCH_BENCH_FILES	16
+#define SCRATCH_BENCH_FILE_SIZE	(16 * 1024)
+
+//write a set of scratch files into tmpfs, read them back, then delete them
+static void tmpfs_scratch_pass(uint8_t* buf, uint64_t* write_cycles, uint64_t* read_cycles) {
+	char path[32];
+	uint64_t start = rdtsc();
+	for (int i = 0; i < SCRATCH_BENCH_FILES; i++) {
+		snprintf(path, sizeof(path), "%s/bench%d", TMPFS_MOUNT_PATH, i);
+		fs_node_t* node = fs_create(path, FS_FILE);
+		ASSERT(node, "couldn't create %s", path);
+		for (uint32_t off = 0; off < SCRATCH_BENCH_FILE_SIZE; off += PAGE_SIZE) {
+			write_fs(node, off, PAGE_SIZE, buf);
+		}
+	}
+	*write_cycles = rdtsc() - start;
+
+	start = rdtsc();
+	for (int i = 0; i < SCRATCH_BENCH_FILES; i++) {
+		snprintf(path, sizeof(path), "%s/bench%d", TMPFS_MOUNT_PATH, i);
+		fs_node_t* node = fs_lookup(path);
+		for (uint32_t off = 0; off < SCRATCH_BENCH_FILE_SIZE; off += PAGE_SIZE) {
+			read_fs(node, off, PAGE_SIZE, buf);
+		}
+	}
+	*read_cycles = rdtsc() - start;
+
+	for (int i = 0; i < SCRATCH_BENCH_FILES; i++) {
+		snprintf(path, sizeof(path), "%s/bench%d", TMPFS_MOUNT_PATH, i);
+		fs_unlink(path);
+	}
+}
+
+//the same workload on FAT, including writing it back to disk and reading it back cold
+static void fat_scratch_pass(uint8_t* buf, uint64_t* write_cycles, uint64_t* read_cycles) {
+	fat_dirent root;
+	fat_find_absolute_file("/", &root);
+
+	char path[32];
+	uint64_t start = rdtsc();
+	for (int i = 0; i < SCRATCH_BENCH_FILES; i++) {
+		fat_dirent file;
+		memset(&file, 0, sizeof(file));
+		snprintf(file.name, sizeof(file.name), "bench%d", i);
+		file.size = SCRATCH_BENCH_FILE_SIZE;
+		file.first_sector = fat_file_create(SCRATCH_BENCH_FILE_SIZE);
+		fat_dir_add_file(&root, &file);
+
+		snprintf(path, sizeof(path), "/bench%d", i);
+		for (uint32_t off = 0; off < SCRATCH_BENCH_FILE_SIZE; off += PAGE_SIZE) {
+			fat_write_absolute_file(path, (char*)buf, PAGE_SIZE, off);
+		}
+	}
+	bcache_sync();
+	*write_cycles = rdtsc() - start;
+
+	bcache_invalidate();
+	start = rdtsc();
+	for (int i = 0; i < SCRATCH_BENCH_FILES; i++) {
+		snprintf(path, sizeof(path), "/bench%d", i);
+		for (uint32_t off = 0; off < SCRATCH_BENCH_FILE_SIZE; off += PAGE_SIZE) {
+			fat_read_absolute_file(path, (char*)buf, PAGE_SIZE, off);
+		}
+	}
+	*read_cycles = rdtsc() - start;
+
+	for (int i = 0; i < SCRATCH_BENCH_FILES; i++) {
+		snprintf(path, sizeof(path), "bench%d", i);
+		fat_dir_remove_file(&root, path);
+	}
+	bcache_sync();
+}
+
+//scratch file workload on tmpfs compared with FAT on disk
+void test_tmpfs_vs_fat() {
+	printf_info("Benchmarking %d scratch files of %dKB on tmpfs and FAT...", SCRATCH_BENCH_FILES, SCRATCH_BENCH_FILE_SIZE / 1024);
+	uint8_t* buf = kmalloc(PAGE_SIZE);
+	memset(buf, 0xA5, PAGE_SIZE);
+
+	uint64_t tmpfs_write, tmpfs_read;
+	tmpfs_scratch_pass(buf, &tmpfs_write, &tmpfs_read);
+	uint64_t fat_write, fat_read;
+	fat_scratch_pass(buf, &fat_write, &fat_read);
+
+	printf_info("tmpfs: write %d kcycles, read %d kcycles", (uint32_t)(tmpfs_write / 1000), (uint32_t)(tmpfs_read / 1000));
+	printf_info("FAT:   write %d kcycles, read %d kcycles", (uint32_t)(fat_write / 1000), (uint32_t)(fat_read / 1000));
+	tmpfs_print_stats();
+	kfree(buf);
+}
+
+#define BLKQ_BENCH_SECTS	4096	//2MB
+#define BLKQ_BENCH_BATCH	16
+
+//read the start of @p drive through blkq, first one large request at a time,
+//then as batches of page-sized requests queued together for the elevator to merge
+//returns false on a read error
+static bool blkq_benchmark_drive(const char* label, unsigned char drive, uint8_t* buf, blk_request_t* requests) {
+	uint64_t start = rdtsc();
+	for (uint32_t i = 0; i < BLKQ_BENCH_SECTS; i += BLKQ_MAX_MERGE_SECTORS) {
+		if (blkq_read(drive, i, BLKQ_MAX_MERGE_SECTORS, buf)) {
+			printf_err("%s benchmark failed reading sector %d", label, i);
+			return false;
+		}
+	}
+	uint64_t large = rdtsc() - start;
+
+	const uint32_t per_request = PAGE_SIZE / BLKQ_SECTOR_SIZE;
+	start = rdtsc();
+	for (uint32_t i = 0; i < BLKQ_BENCH_SECTS; i += per_request * BLKQ_BENCH_BATCH) {
+		for (int j = 0; j < BLKQ_BENCH_BATCH; j++) {
+			memset(&requests[j], 0, sizeof(blk_request_t));
+			requests[j].drive = drive;
+			requests[j].direction = BLKQ_READ;
+			requests[j].lba = i + (j * per_request);
+			requests[j].count = per_request;
+			requests[j].buf = buf + (j * PAGE_SIZE);
+			blkq_submit(&requests[j]);
+		}
+		for (int j = 0; j < BLKQ_BENCH_BATCH; j++) {
+			if (blkq_wait(&requests[j])) {
+				printf_err("%s benchmark failed reading sector %d", label, requests[j].lba);
+				return false;
+			}
+		}
+	}
+	uint64_t batched = rdtsc() - start;
+
+	printf_info("%s: %dKB as %d-sector reads in %d kcycles, as queued 4KB reads in %d kcycles", label, BLKQ_BENCH_SECTS / 2, BLKQ_MAX_MERGE_SECTORS, (uint32_t)(large / 1000), (uint32_t)(batched / 1000));
+	return true;
+}
+
+//compare sequential reads from an IDE drive and a virtio drive, both through blkq
+//and check both return the same data for the start of the disk, as when one is a copy of the other
+void test_virtio_vs_ide(unsigned char ide_drive, unsigned char virtio_drive) {
+	printf_info("Benchmarking virtio-blk against IDE...");
+
+	uint8_t* buf = kmalloc(BLKQ_MAX_MERGE_SECTORS * BLKQ_SECTOR_SIZE);
+	blk_request_t* requests = kmalloc(sizeof(blk_request_t) * BLKQ_BENCH_BATCH);
+
+	if (blkq_benchmark_drive("IDE   ", ide_drive, buf, requests)) {
+		blkq_benchmark_drive("virtio", virtio_drive, buf, requests);
+	}
+	virtio_blk_print_stats();
+	blkq_print_stats();
+
+	kfree(requests);
+	kfree(buf);
+}
+
+#define NCQ_TEST_REQUESTS	32
+#define NCQ_TEST_STRIDE		97	//sectors between requests, so none of them merge
+
+//queue scattered single-page reads all at once, so an NCQ disk has many in flight,
+//then check each against the same sectors read one request at a time
+void test_ahci_ncq(unsigned char drive) {
+	printf_info("Testing AHCI queued reads...");
+
+	uint32_t per_request = PAGE_SIZE / BLKQ_SECTOR_SIZE;
+	uint8_t* queued = kmalloc(NCQ_TEST_REQUESTS * PAGE_SIZE);
+	uint8_t* expected = kmalloc(PAGE_SIZE);
+	blk_request_t* requests = kmalloc(sizeof(blk_request_t) * NCQ_TEST_REQUESTS);
+	memset(requests, 0, sizeof(blk_request_t) * NCQ_TEST_REQUESTS);
+
+	uint64_t start = rdtsc();
+	for (int i = 0; i < NCQ_TEST_REQUESTS; i++) {
+		//walk the region backwards, so the disk rather than submission order picks what finishes first
+		requests[i].drive = drive;
+		requests[i].direction = BLKQ_READ;
+		requests[i].lba = (NCQ_TEST_REQUESTS - i) * NCQ_TEST_STRIDE;
+		requests[i].count = per_request;
+		requests[i].buf = queued + (i * PAGE_SIZE);
+		blkq_submit(&requests[i]);
+	}
+	for (int i = 0; i < NCQ_TEST_REQUESTS; i++) {
+		if (blkq_wait(&requests[i])) {
+			printf_err("queued read of sector %d failed", requests[i].lba);
+			goto out;
+		}
+	}
+	uint64_t cycles = rdtsc() - start;
+
+	for (int i = 0; i < NCQ_TEST_REQUESTS; i++) {
+		if (blkq_read(drive, requests[i].lba, per_request, expected)) {
+			printf_err("read of sector %d failed", requests[i].lba);
+			goto out;
+		}
+		if (memcmp(expected, queued + (i * PAGE_SIZE), PAGE_SIZE)) {
+			printf_err("queued read of sector %d returned the wrong data", requests[i].lba);
+			goto out;
+		}
+	}
+	printf_info("%d queued reads match, %d kcycles", NCQ_TEST_REQUESTS, (uint32_t)(cycles / 1000));
+	ahci_print_stats();
+	blkq_print_stats();
+
+out:
+	kfree(requests);
+	kfree(expected);
+	kfree(queued);
+}
+
+#define EXEC_TEST_RUNS 8
+
+int sys__exit(int);
+
+//run @p path EXEC_TEST_RUNS times, and print how long each exec took and how many of the pages it touched it got to share
+static void test_exec_footprint(char* path) {
+	vm_area_stats_t before;
+	vm_area_stats_t after;
+	vm_area_get_stats(&before);
+
+	char* argv[] = {path, "hello", NULL};
+	uint64_t start = rdtsc();
+	for (int i = 0; i < EXEC_TEST_RUNS; i++) {
+		int pid = sys_fork();
+		if (!pid) {
+			execve(path, argv, NULL);
+			sys__exit(1);
+		}
+		int status;
+		waitpid(pid, &status, 0);
+		if (status) {
+			printf_err("%s exited with status %d", path, status);
+			return;
+		}
+	}
+	uint32_t kcycles = (uint32_t)((rdtsc() - start) / 1000) / EXEC_TEST_RUNS;
+
+	vm_area_get_stats(&after);
+	uint32_t faults = (after.faults - before.faults) / EXEC_TEST_RUNS;
+	uint32_t shared = (after.shared - before.shared) / EXEC_TEST_RUNS;
+	printf_info("%s: %d kcycles per run, %d pages populated, %d shared, %d private",
+				path, kcycles, faults, shared, faults - shared);
+	printf_info("%s: %d read-only file pages still resident", path, after.resident);
+}
+
+//compare echo linked statically against the same program linked against /lib/libc.so
+void test_exec_shared_libc() {
+	printf_info("Testing static vs shared libc exec...");
+	test_exec_footprint("/echo");
+	test_exec_footprint("/echo-shared");
+	vm_area_print_stats();
+}
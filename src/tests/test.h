@@ -11,5 +11,18 @@ void test_printf();
 void test_time_unique();
 void test_malloc();
 void test_crypto();
+void test_dcache();
+void test_lz4();
+void test_initrd_read_latency();
+void test_ide_read_throughput(unsigned char drive);
+void test_ide_compositor_fps(unsigned char drive);
+void test_blkq_elevator(unsigned char drive);
+void test_fat_readahead(char* path);
+void test_pagecache(char* path);
+void test_getdents(char* path);
+void test_tmpfs_vs_fat();
+void test_virtio_vs_ide(unsigned char ide_drive, unsigned char virtio_drive);
+void test_ahci_ncq(unsigned char drive);
+void test_exec_shared_libc();
 
 #endif
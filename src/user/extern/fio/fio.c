@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+//storage benchmark in the spirit of fio
+//usage: fio <path> [rw=read|write|randread|randwrite] [bs=4096] [iodepth=1] [size=4M] [ops=N]
+//<path> is a raw drive under /dev, such as /dev/blk0, or a regular file
+//there's no asynchronous I/O syscall, so a queue depth of N is N jobs each keeping
+//one synchronous request outstanding, which still lets blkq and NCQ disks see N at once
+//every line of the report starts with "fio:" so it can be pulled out of the serial log
+
+#define FIO_MAX_JOBS	32
+#define FIO_MAX_BS	(1024 * 1024)
+#define FIO_SYSCALL_UPTIME	25
+
+typedef struct fio_options {
+	char* path;
+	char* mode;
+	int random;
+	int writing;
+	uint32_t bs;
+	uint32_t iodepth;
+	uint32_t size;
+	uint32_t ops;
+} fio_options_t;
+
+static uint32_t uptime(void) {
+	uint32_t ms;
+	asm volatile("int $0x80" : "=a"(ms) : "0"(FIO_SYSCALL_UPTIME));
+	return ms;
+}
+
+static uint64_t rdtsc(void) {
+	uint32_t lo, hi;
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+//TSC ticks per microsecond, measured against the kernel's millisecond clock
+static uint32_t tsc_per_us(void) {
+	uint32_t start = uptime();
+	//line up with a clock edge
+	while (uptime() == start) {}
+	start = uptime();
+	uint64_t tsc_start = rdtsc();
+	while (uptime() - start < 50) {}
+	uint64_t ticks = rdtsc() - tsc_start;
+	uint32_t rate = (uint32_t)(ticks / ((uptime() - start) * 1000));
+	return rate ? rate : 1;
+}
+
+//parse sizes such as 4096, 64k or 16M
+static uint32_t parse_size(const char* str) {
+	char* end;
+	uint32_t val = strtoul(str, &end, 0);
+	switch (*end) {
+		case 'k':
+		case 'K':
+			val *= 1024;
+			break;
+		case 'm':
+		case 'M':
+			val *= 1024 * 1024;
+			break;
+		case 'g':
+		case 'G':
+			val *= 1024 * 1024 * 1024;
+			break;
+	}
+	return val;
+}
+
+static int parse_args(int argc, char** argv, fio_options_t* opts) {
+	if (argc < 2) {
+		return -1;
+	}
+	memset(opts, 0, sizeof(fio_options_t));
+	opts->path = argv[1];
+	opts->mode = "read";
+	opts->bs = 4096;
+	opts->iodepth = 1;
+	opts->size = 4 * 1024 * 1024;
+
+	for (int i = 2; i < argc; i++) {
+		char* val = strchr(argv[i], '=');
+		if (!val) {
+			return -1;
+		}
+		*val++ = '\0';
+		if (!strcmp(argv[i], "rw")) opts->mode = val;
+		else if (!strcmp(argv[i], "bs")) opts->bs = parse_size(val);
+		else if (!strcmp(argv[i], "iodepth")) opts->iodepth = strtoul(val, NULL, 0);
+		else if (!strcmp(argv[i], "size")) opts->size = parse_size(val);
+		else if (!strcmp(argv[i], "ops")) opts->ops = strtoul(val, NULL, 0);
+		else return -1;
+	}
+
+	if (!strcmp(opts->mode, "read")) {}
+	else if (!strcmp(opts->mode, "write")) opts->writing = 1;
+	else if (!strcmp(opts->mode, "randread")) opts->random = 1;
+	else if (!strcmp(opts->mode, "randwrite")) opts->random = opts->writing = 1;
+	else return -1;
+
+	if (!opts->bs || opts->bs > FIO_MAX_BS || !opts->iodepth || opts->iodepth > FIO_MAX_JOBS) {
+		return -1;
+	}
+	return 0;
+}
+
+//make sure a regular file covers the whole test region before it's timed
+//returns the number of bytes available to test
+static uint32_t prepare_target(fio_options_t* opts, char* buf) {
+	int fd = open(opts->path, opts->writing ? O_RDWR | O_CREAT : O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+	int length = lseek(fd, 0, SEEK_END);
+	if (length < 0) {
+		length = 0;
+	}
+	if (opts->writing && (uint32_t)length < opts->size) {
+		memset(buf, 0, opts->bs);
+		while ((uint32_t)length < opts->size) {
+			if (write(fd, buf, opts->bs) <= 0) {
+				break;
+			}
+			length += opts->bs;
+		}
+	}
+	close(fd);
+	return (uint32_t)length < opts->size ? (uint32_t)length : opts->size;
+}
+
+static void job_result_path(char* out, size_t size, int job) {
+	snprintf(out, size, "/tmp/fio.%d", job);
+}
+
+//run one job's share of the I/O, and leave its per-request latencies in /tmp
+static int run_job(fio_options_t* opts, int job, uint32_t blocks, uint32_t ops, uint32_t rate, char* buf) {
+	int fd = open(opts->path, opts->writing ? O_RDWR : O_RDONLY);
+	if (fd < 0) {
+		return 1;
+	}
+	uint32_t* latencies = malloc(ops * sizeof(uint32_t));
+	if (!latencies) {
+		close(fd);
+		return 1;
+	}
+	for (uint32_t i = 0; i < opts->bs; i++) {
+		buf[i] = (char)(i + job);
+	}
+
+	//sequential jobs each sweep their own stripe of the region
+	uint32_t stripe = blocks / opts->iodepth;
+	uint32_t seed = 0x9E3779B9 * (job + 1);
+	uint32_t done = 0;
+	for (; done < ops; done++) {
+		uint32_t block;
+		if (opts->random) {
+			seed = seed * 1103515245 + 12345;
+			block = (seed >> 8) % blocks;
+		}
+		else {
+			block = (job * stripe) + (done % (stripe ? stripe : 1));
+		}
+
+		uint64_t start = rdtsc();
+		int ret = -1;
+		if (lseek(fd, block * opts->bs, SEEK_SET) >= 0) {
+			ret = opts->writing ? write(fd, buf, opts->bs) : read(fd, buf, opts->bs);
+		}
+		uint64_t end = rdtsc();
+		if (ret != (int)opts->bs) {
+			printf("fio: job %d: I/O error at block %u\n", job, block);
+			break;
+		}
+		latencies[done] = (uint32_t)((end - start) / rate);
+	}
+	close(fd);
+
+	char path[32];
+	job_result_path(path, sizeof(path), job);
+	int out = open(path, O_WRONLY | O_CREAT | O_TRUNC);
+	if (out >= 0) {
+		write(out, &done, sizeof(done));
+		write(out, latencies, done * sizeof(uint32_t));
+		close(out);
+	}
+	free(latencies);
+	return done == ops ? 0 : 1;
+}
+
+//append a job's latencies to @p all, returning how many were added
+static uint32_t collect_job(int job, uint32_t* all, uint32_t room) {
+	char path[32];
+	job_result_path(path, sizeof(path), job);
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+	uint32_t count = 0;
+	if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+		count = 0;
+	}
+	if (count > room) {
+		count = room;
+	}
+	int got = read(fd, all, count * sizeof(uint32_t));
+	close(fd);
+	return got > 0 ? got / sizeof(uint32_t) : 0;
+}
+
+static int compare_u32(const void* a, const void* b) {
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+//@p permille of 1000 is the max
+static uint32_t percentile(uint32_t* sorted, uint32_t count, uint32_t permille) {
+	uint32_t idx = (uint32_t)(((uint64_t)count * permille) / 1000);
+	return sorted[idx < count ? idx : count - 1];
+}
+
+static void usage(void) {
+	printf("Usage: fio <path> [rw=read|write|randread|randwrite] [bs=4096] [iodepth=1] [size=4M] [ops=N]\n");
+}
+
+int main(int argc, char** argv) {
+	fio_options_t opts;
+	if (parse_args(argc, argv, &opts)) {
+		usage();
+		return 1;
+	}
+
+	char* buf = malloc(opts.bs);
+	if (!buf) {
+		printf("fio: couldn't allocate a %u byte buffer\n", opts.bs);
+		return 1;
+	}
+	uint32_t region = prepare_target(&opts, buf);
+	uint32_t blocks = region / opts.bs;
+	if (blocks < opts.iodepth) {
+		printf("fio: %s: too small, or couldn't be opened\n", opts.path);
+		return 1;
+	}
+	//by default, move the whole region once
+	uint32_t total_ops = opts.ops ? opts.ops : blocks;
+	uint32_t job_ops = total_ops / opts.iodepth;
+	if (!job_ops) {
+		job_ops = 1;
+	}
+	uint32_t rate = tsc_per_us();
+
+	printf("fio: %s rw=%s bs=%u iodepth=%u size=%uk ops=%u\n",
+		   opts.path, opts.mode, opts.bs, opts.iodepth, region / 1024, job_ops * opts.iodepth);
+
+	uint32_t start = uptime();
+	int pids[FIO_MAX_JOBS];
+	for (uint32_t job = 1; job < opts.iodepth; job++) {
+		pids[job] = fork();
+		if (!pids[job]) {
+			_exit(run_job(&opts, job, blocks, job_ops, rate, buf));
+		}
+	}
+	int failed = run_job(&opts, 0, blocks, job_ops, rate, buf);
+	for (uint32_t job = 1; job < opts.iodepth; job++) {
+		int status = 0;
+		if (pids[job] > 0) {
+			waitpid(pids[job], &status, 0);
+		}
+		failed |= (pids[job] <= 0) || status;
+	}
+	uint32_t elapsed = uptime() - start;
+	if (!elapsed) {
+		elapsed = 1;
+	}
+
+	uint32_t room = job_ops * opts.iodepth;
+	uint32_t* all = malloc(room * sizeof(uint32_t));
+	uint32_t count = 0;
+	for (uint32_t job = 0; all && job < opts.iodepth; job++) {
+		count += collect_job(job, all + count, room - count);
+	}
+	if (!count) {
+		printf("fio: no requests completed\n");
+		return 1;
+	}
+	if (failed) {
+		printf("fio: some jobs failed, reporting %u completed requests\n", count);
+	}
+
+	qsort(all, count, sizeof(uint32_t), compare_u32);
+	uint64_t sum = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		sum += all[i];
+	}
+	uint64_t bytes = (uint64_t)count * opts.bs;
+	printf("fio: %u requests in %u ms, %u IOPS, %u KB/s\n",
+		   count, elapsed,
+		   (uint32_t)(((uint64_t)count * 1000) / elapsed),
+		   (uint32_t)((bytes * 1000) / 1024 / elapsed));
+	printf("fio: latency (us) min %u avg %u p50 %u p90 %u p99 %u p99.9 %u max %u\n",
+		   all[0], (uint32_t)(sum / count),
+		   percentile(all, count, 500), percentile(all, count, 900),
+		   percentile(all, count, 990), percentile(all, count, 999),
+		   all[count - 1]);
+
+	free(all);
+	free(buf);
+	return failed;
+}
@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <fcntl.h>
+#include <dirent.h>
 
 #include "lib/iberty/iberty.h"
 #include <stdio.h>
@@ -151,6 +153,37 @@ int query_exit(int argc, char** argv) {
 	return exit_code;
 }
 
+int ls(int argc, char** argv) {
+	char* path = "/";
+	if (argc > 1) {
+		path = argv[1];
+	}
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("ls: %s: No such file or directory\n", path);
+		return 1;
+	}
+
+	//each call returns as many entries as fit
+	char buf[2048];
+	int used;
+	while ((used = getdents(fd, (struct dirent*)buf, sizeof(buf))) > 0) {
+		for (int off = 0; off < used;) {
+			struct dirent* ent = (struct dirent*)(buf + off);
+			//each record ends with the entry's type
+			if (buf[off + ent->d_reclen - 1] == DT_DIR) {
+				printf("(dir)  %s/\n", ent->d_name);
+			}
+			else {
+				printf("(file) %s\n", ent->d_name);
+			}
+			off += ent->d_reclen;
+		}
+	}
+	close(fd);
+	return used < 0;
+}
+
 int spawn_xserv() {
 	return -1;
 	xserv_init();
@@ -177,6 +210,7 @@ int main(int argc, char** argv) {
 	register_command("exit", "quit shell", &quit);
 	register_command("startx", "initialize awm", &spawn_xserv);
 	register_command("?", "print exit code of last command", &query_exit);
+	register_command("ls", "list directory contents", &ls);
 	register_command("", "", &empty);
 
 	while (running) {
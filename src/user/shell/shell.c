@@ -9,10 +9,20 @@
 #include <user/shell/programs/rexle/rexle.h>
 #include <user/xserv/xserv.h>
 #include <kernel/kernel.h>
+#include <kernel/boot_timeline.h>
 #include <kernel/multitasking/tasks/task.h>
 #include <kernel/util/vfs/fs.h>
+#include <kernel/util/vfs/pagecache.h>
+#include <kernel/vmm/vm_area.h>
+#include <kernel/util/elf/elf_module.h>
+#include <kernel/util/bcache/bcache.h>
+#include <kernel/util/blkq/blkq.h>
+#include <kernel/util/fat/fat.h>
+#include <kernel/util/tmpfs/tmpfs.h>
 #include <kernel/drivers/kb/kb.h>
 #include <kernel/drivers/pci/pci_detect.h>
+#include <kernel/drivers/virtio/virtio_blk.h>
+#include <kernel/drivers/ahci/ahci.h>
 #include <kernel/drivers/pit/pit.h>
 #include <kernel/drivers/rtc/clock.h>
 #include <kernel/drivers/vga/vga.h>
@@ -353,19 +363,24 @@ void rexle_command() {
 }
 
 void ls_command() {
-	//list contents of current directory
-	int i = 0;
-	struct dirent* node = 0;
-	while ((node = readdir_fs(current_dir, i)) != 0) {
-		fs_node_t* fsnode = finddir_fs(current_dir, node->d_name);
-		if ((fsnode->flags & 0x7) == FS_DIRECTORY) {
-			printf("(dir)  %s/\n", node->d_name);
-		}
-		else {
-			printf("(file) %s\n", node->d_name);
+	//list contents of current directory, a buffer of entries at a time
+	uint8_t* buf = kmalloc(PAGE_SIZE);
+	uint32_t pos = 0;
+	uint32_t used;
+	while ((used = getdents_fs(current_dir, &pos, (struct dirent*)buf, PAGE_SIZE)) != 0) {
+		for (uint32_t off = 0; off < used;) {
+			struct dirent* node = (struct dirent*)(buf + off);
+			//each record ends with the entry's type
+			if (buf[off + node->d_reclen - 1] == DT_DIR) {
+				printf("(dir)  %s/\n", node->d_name);
+			}
+			else {
+				printf("(file) %s\n", node->d_name);
+			}
+			off += node->d_reclen;
 		}
-		i++;
 	}
+	kfree(buf);
 }
 
 void cat_command(int argc, char** argv) {
@@ -492,6 +507,27 @@ void execve_command(int argc, char** argv) {
 	waitpid(pid, &status, 0);
 }
 
+void insmod_command(int argc, char** argv) {
+	if (argc < 2) {
+		printf_err("Please specify the module to load.");
+		return;
+	}
+	//a bare name is looked for in the modules directory
+	if (strchr(argv[1], '/')) {
+		elf_module_load(argv[1]);
+	}
+	else {
+		elf_module_require(argv[1]);
+	}
+}
+
+void sync_command() {
+	int status = bcache_sync();
+	if (status) {
+		printf_err("Some blocks couldn't be written back (%d)", status);
+	}
+}
+
 void shell_init() {
 	printf("\n");
 	printf_info("Boostrap complete.");
@@ -524,6 +560,19 @@ void shell_init() {
 	add_new_command("hypervisor", "Run VM", hypervisor_command);
 	add_new_command("script", "Run a script", (void(*)())script_command);
 	add_new_command("run", "Execute a binary", (void(*)())execve_command);
+	add_new_command("sync", "Write cached disk blocks back to disk", sync_command);
+	add_new_command("bcache", "Print block cache statistics", bcache_print_stats);
+	add_new_command("blkq", "Print block request queue statistics", blkq_print_stats);
+	add_new_command("virtio", "Print virtio block device statistics", virtio_blk_print_stats);
+	add_new_command("ahci", "Print AHCI disk statistics", ahci_print_stats);
+	add_new_command("fatfrag", "Print FAT fragmentation report", fat_print_fragmentation);
+	add_new_command("mounts", "List mounted filesystems", fs_print_mounts);
+	add_new_command("pagecache", "Print page cache statistics", pagecache_print_stats);
+	add_new_command("tmpfs", "Print tmpfs usage", tmpfs_print_stats);
+	add_new_command("demand", "Print demand paging statistics", vm_area_print_stats);
+	add_new_command("insmod", "Load a kernel module", (void(*)())insmod_command);
+	add_new_command("lsmod", "List loaded kernel modules", elf_module_print);
+	add_new_command("boottime", "Print how long each boot stage took", boot_timeline_print);
 	add_new_command("", "", empty_command);
 
 	//register ourselves as the first responder